@@ -11,9 +11,6 @@
 #include "neuravr.h"
 #include "neuravr-private.h"
 
-// FIXME - We're using snprintf().
-#include <stdio.h>
-
 
 
 //
@@ -65,6 +62,8 @@ void ADC_HousekeepingPoll(void)
   uint8_t cidx, next_channel;
   uint8_t count;
 
+  SCOPE_RAISE(ADC);
+
   if ( (!ADC_idle) && (!ADC_IsADCBusy()) )
   {
     // A conversion just finished.
@@ -98,6 +97,8 @@ void ADC_HousekeepingPoll(void)
     else
       ADC_ReadFromChannel(next_channel);
   }
+
+  SCOPE_LOWER(ADC);
 }
 
 
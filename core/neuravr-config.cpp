@@ -0,0 +1,427 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - EEPROM configuration store.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// Configuration data lives in a RAM mirror. Reads come from the mirror.
+// Writes update the mirror and start a background write-back, which is
+// paced by the EEPROM-ready interrupt (each EEPROM byte takes about 3.3 ms
+// to program, so nothing ever waits on it).
+//
+// The EEPROM holds CONFIG_SLOT_COUNT record slots. Each write-back goes to
+// the slot after the previous one, spreading wear across all of them.
+// A record is [ sequence | data | checksum ]. The sequence number is
+// written last, so a record that was cut off by a reset either fails its
+// checksum or still looks older than the newest complete record.
+// Bytes that already hold the right value aren't rewritten.
+//
+// If the mirror changes while a record is being written, the record is
+// restarted from the beginning, so that every completed record is a
+// consistent snapshot. A steady stream of writes faster than a record takes
+// to write will keep postponing it.
+//
+// Loading reads only the sequence bytes to find the newest record, and
+// then checksums just that one (falling back to older ones if it's bad).
+
+
+
+//
+// Macros
+
+#define CONFIG_RECORD_BYTES (CONFIG_DATA_BYTES + 2)
+
+// Record layout.
+#define CONFIG_OFFSET_SEQ 0
+#define CONFIG_OFFSET_DATA 1
+#define CONFIG_OFFSET_CHECKSUM (CONFIG_DATA_BYTES + 1)
+
+// Write-back steps. Data bytes come first, then the checksum, then the
+// sequence number.
+#define CONFIG_STEP_CHECKSUM CONFIG_DATA_BYTES
+#define CONFIG_STEP_SEQ (CONFIG_DATA_BYTES + 1)
+#define CONFIG_STEP_COUNT (CONFIG_DATA_BYTES + 2)
+
+// Erased EEPROM reads as 0xff, so that sequence number is never used.
+#define CONFIG_SEQ_INVALID 0xff
+
+// Maximum number of unchanged bytes to skip per interrupt.
+#define CONFIG_SCAN_PER_IRQ 8
+
+
+
+//
+// Variables
+
+
+// RAM mirror of the configuration data.
+uint8_t CONFIG_mirror[CONFIG_DATA_BYTES];
+
+// Slot and sequence number of the newest record (or of the record being
+// written, during write-back).
+uint8_t CONFIG_slot = CONFIG_SLOT_COUNT - 1;
+uint8_t CONFIG_seq = CONFIG_SEQ_INVALID - 1;
+
+// Write-back state.
+volatile bool CONFIG_writing = false;
+volatile uint8_t CONFIG_write_step = 0;
+
+
+
+//
+// Functions
+
+
+// Private configuration functions.
+
+
+// This returns the checksum for a record with the specified sequence
+// number and the current mirror contents.
+
+uint8_t CONFIG_ComputeChecksum(uint8_t seq)
+{
+  uint8_t result;
+  uint8_t didx;
+
+  // Rotate-and-add, so that swapped bytes are caught.
+  result = 0xa5 ^ seq;
+  for (didx = 0; didx < CONFIG_DATA_BYTES; didx++)
+    result = ((result << 1) | (result >> 7)) + CONFIG_mirror[didx];
+
+  return result;
+}
+
+
+// This returns the sequence number that follows the specified one.
+
+uint8_t CONFIG_NextSeq(uint8_t seq)
+{
+  seq++;
+  if (CONFIG_SEQ_INVALID == seq)
+    seq++;
+
+  return seq;
+}
+
+
+// This returns the EEPROM address of the start of the specified slot.
+
+uint16_t CONFIG_SlotAddress(uint8_t slot)
+{
+  return CONFIG_EEPROM_BASE + ((uint16_t) slot) * CONFIG_RECORD_BYTES;
+}
+
+
+// This starts writing a new record into the next slot.
+// The caller is responsible for any needed locking.
+
+void CONFIG_StartRecord_ISR(void)
+{
+  CONFIG_slot++;
+  if (CONFIG_SLOT_COUNT <= CONFIG_slot)
+    CONFIG_slot = 0;
+
+  CONFIG_seq = CONFIG_NextSeq(CONFIG_seq);
+
+  CONFIG_write_step = 0;
+  CONFIG_writing = true;
+
+  CONFIG_SetReadyInterrupt_ISR(true);
+}
+
+
+// This advances the background write-back. It's called from the
+// EEPROM-ready interrupt.
+
+void CONFIG_HandleReady_ISR(void)
+{
+  uint16_t base_address, address;
+  uint8_t value;
+  uint8_t scan_count;
+  bool started;
+
+  base_address = CONFIG_SlotAddress(CONFIG_slot);
+  started = false;
+
+  for (scan_count = 0;
+    CONFIG_writing && (!started) && (scan_count < CONFIG_SCAN_PER_IRQ);
+    scan_count++)
+  {
+    if (CONFIG_STEP_COUNT <= CONFIG_write_step)
+    {
+      // Every byte has been programmed (the interrupt waits for the last
+      // one to finish).
+      CONFIG_writing = false;
+      CONFIG_SetReadyInterrupt_ISR(false);
+    }
+    else
+    {
+      if (CONFIG_STEP_SEQ == CONFIG_write_step)
+      {
+        address = base_address + CONFIG_OFFSET_SEQ;
+        value = CONFIG_seq;
+      }
+      else if (CONFIG_STEP_CHECKSUM == CONFIG_write_step)
+      {
+        address = base_address + CONFIG_OFFSET_CHECKSUM;
+        value = CONFIG_ComputeChecksum(CONFIG_seq);
+      }
+      else
+      {
+        address = base_address + CONFIG_OFFSET_DATA + CONFIG_write_step;
+        value = CONFIG_mirror[CONFIG_write_step];
+      }
+
+      CONFIG_write_step++;
+
+      if (value != CONFIG_ReadEEPROM_ISR(address))
+      {
+        CONFIG_WriteEEPROM_ISR(address, value);
+        started = true;
+      }
+    }
+  }
+}
+
+
+// This reads one byte from EEPROM, locking only for that byte.
+// The caller has to make sure no write is in progress, so that the read
+// doesn't spin with interrupts off.
+
+uint8_t CONFIG_ReadEEPROMLocked(uint16_t address)
+{
+  uint8_t result;
+
+#ifdef NEUREMU
+  // Suppress warning.
+  result = 0;
+#endif
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = CONFIG_ReadEEPROM_ISR(address);
+  }
+
+  return result;
+}
+
+
+// Public configuration functions.
+
+
+// Loads the newest valid record from EEPROM into the RAM mirror.
+// Returns false (and zeroes the mirror) if there wasn't one.
+// Interrupts stay enabled during the scan. Stopping write-back and waiting
+// for its last byte happen first, so no single read has to wait.
+
+bool CONFIG_Init(void)
+{
+  uint8_t seqs[CONFIG_SLOT_COUNT];
+  uint8_t sidx, best_slot;
+  uint8_t didx;
+  uint16_t address;
+  bool result;
+
+  result = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Abandon any write-back in progress.
+    CONFIG_SetReadyInterrupt_ISR(false);
+    CONFIG_writing = false;
+  }
+
+  // Let the byte that was being programmed finish (up to about 3.3 ms),
+  // with interrupts on.
+  while (CONFIG_IsEEPROMBusy())
+  {
+    // Busy-wait so as to not hammer the register.
+    _delay_loop_1(200);
+  }
+
+  for (sidx = 0; sidx < CONFIG_SLOT_COUNT; sidx++)
+    seqs[sidx] = CONFIG_ReadEEPROMLocked(
+      CONFIG_SlotAddress(sidx) + CONFIG_OFFSET_SEQ );
+
+  do
+  {
+    // Find the newest slot we haven't rejected yet.
+    // Sequence numbers wrap, so compare them as signed differences.
+    best_slot = CONFIG_SLOT_COUNT;
+    for (sidx = 0; sidx < CONFIG_SLOT_COUNT; sidx++)
+      if (CONFIG_SEQ_INVALID != seqs[sidx])
+        if ( (CONFIG_SLOT_COUNT == best_slot)
+          || (0 < (int8_t) (seqs[sidx] - seqs[best_slot])) )
+          best_slot = sidx;
+
+    if (CONFIG_SLOT_COUNT > best_slot)
+    {
+      address = CONFIG_SlotAddress(best_slot);
+
+      for (didx = 0; didx < CONFIG_DATA_BYTES; didx++)
+        CONFIG_mirror[didx] =
+          CONFIG_ReadEEPROMLocked(address + CONFIG_OFFSET_DATA + didx);
+
+      if ( CONFIG_ComputeChecksum(seqs[best_slot])
+        == CONFIG_ReadEEPROMLocked(address + CONFIG_OFFSET_CHECKSUM) )
+        result = true;
+      else
+        seqs[best_slot] = CONFIG_SEQ_INVALID;
+    }
+  }
+  while ( (!result) && (CONFIG_SLOT_COUNT > best_slot) );
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (result)
+    {
+      CONFIG_slot = best_slot;
+      CONFIG_seq = seqs[best_slot];
+    }
+    else
+    {
+      for (didx = 0; didx < CONFIG_DATA_BYTES; didx++)
+        CONFIG_mirror[didx] = 0;
+
+      CONFIG_slot = CONFIG_SLOT_COUNT - 1;
+      CONFIG_seq = CONFIG_SEQ_INVALID - 1;
+    }
+  }
+
+  return result;
+}
+
+
+// Copies configuration data out of the RAM mirror.
+// Returns false (copying nothing) if the range is out of bounds.
+
+bool CONFIG_Read(uint8_t offset, void *data, uint8_t length)
+{
+  uint8_t *dest;
+  uint8_t didx;
+  bool result;
+
+  result = false;
+
+  if ( (offset < CONFIG_DATA_BYTES)
+    && (length <= (CONFIG_DATA_BYTES - offset)) )
+  {
+    dest = (uint8_t *) data;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      for (didx = 0; didx < length; didx++)
+        dest[didx] = CONFIG_mirror[offset + didx];
+    }
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+// Returns one byte of configuration data, or 0 if out of bounds.
+
+uint8_t CONFIG_ReadByte(uint8_t offset)
+{
+  uint8_t result;
+
+  result = 0;
+
+  if (offset < CONFIG_DATA_BYTES)
+    result = CONFIG_mirror[offset];
+
+  return result;
+}
+
+
+// Copies data into the RAM mirror and schedules write-back if anything
+// changed.
+// Returns false (copying nothing) if the range is out of bounds.
+
+bool CONFIG_Write(uint8_t offset, const void *data, uint8_t length)
+{
+  const uint8_t *src;
+  uint8_t didx;
+  bool changed;
+  bool result;
+
+  result = false;
+
+  if ( (offset < CONFIG_DATA_BYTES)
+    && (length <= (CONFIG_DATA_BYTES - offset)) )
+  {
+    src = (const uint8_t *) data;
+    changed = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      for (didx = 0; didx < length; didx++)
+        if (CONFIG_mirror[offset + didx] != src[didx])
+        {
+          CONFIG_mirror[offset + didx] = src[didx];
+          changed = true;
+        }
+
+      if (changed)
+      {
+        if (CONFIG_writing)
+          CONFIG_write_step = 0;
+        else
+          CONFIG_StartRecord_ISR();
+      }
+    }
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+// Writes one byte of configuration data.
+// Returns false if out of bounds.
+
+bool CONFIG_WriteByte(uint8_t offset, uint8_t value)
+{
+  return CONFIG_Write(offset, &value, 1);
+}
+
+
+// Returns true if changes haven't been completely written to EEPROM yet.
+
+bool CONFIG_IsWritePending(void)
+{
+  return CONFIG_writing;
+}
+
+
+// Blocks until any pending write-back finishes.
+// Interrupts are still handled during this time.
+
+void CONFIG_WaitForWrite(void)
+{
+  while (CONFIG_writing)
+  {
+    // Busy-wait so as to not hammer the state variable.
+    _delay_loop_1(200);
+  }
+}
+
+
+
+//
+// This is the end of the file.
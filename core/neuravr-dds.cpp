@@ -0,0 +1,491 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - Direct digital synthesis functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// A 32-bit phase accumulator advances by a fixed step once per sample.
+// The top 8 bits index a 256-entry wavetable, and the next 8 bits
+// interpolate linearly between entries. Triangle, square, and sawtooth
+// waves are computed from the phase directly. The sine, triangle, and
+// sawtooth waves are zero at phase 0 and rising. The square wave is high
+// for the first half-cycle, so it starts high at phase 0.
+//
+// The sample is scaled by the amplitude (Q15), added to the offset
+// (unsigned 16-bit, 0x8000 is mid-scale), clamped, and written to the
+// output:
+// - PWM: the top 8 bits go to an 8-bit PWM compare register.
+// - IO8: the top 8 bits go to the 8-bit GPIO bank (parallel DAC).
+// - SPI: the top 12 bits go to an MCP4921-style DAC (buffered reference,
+// 1x gain), via a double-buffered transfer.
+//
+// Glitch-free updates:
+// - Frequency changes take effect at the next sample. The phase carries on
+// where it was, so the waveform has no discontinuity.
+// - Waveform, amplitude, and offset changes, and stopping, wait for the
+// end of the current cycle (phase wraparound), where the table waves are
+// at zero. If the frequency is zero, they take effect at the next sample.
+// - While stopped, changes take effect immediately.
+
+
+
+//
+// Private Macros
+
+// Reads one word of a flash-resident table.
+#if USE_FAR_FLASH_POINTERS
+#define DDS_READ_FLASH_WORD(X) pgm_read_word_far(X)
+#else
+#define DDS_READ_FLASH_WORD(X) pgm_read_word_near(X)
+#endif
+
+// MCP4921 command bits: channel A, buffered, 1x gain, active.
+#define DDS_SPI_DAC_COMMAND 0x70
+
+
+
+//
+// Private Constants
+
+// Sine table, full scale (Q15), one full cycle.
+const int16_t DDS_sine_table[DDS_TABLE_SIZE] PROGMEM =
+{
+       0,    804,   1608,   2410,   3212,   4011,   4808,   5602,
+    6393,   7179,   7962,   8739,   9512,  10278,  11039,  11793,
+   12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+   18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,
+   23170,  23731,  24279,  24811,  25329,  25832,  26319,  26790,
+   27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+   30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,
+   32137,  32285,  32412,  32521,  32609,  32678,  32728,  32757,
+   32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+   32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,
+   30273,  29956,  29621,  29268,  28898,  28510,  28105,  27683,
+   27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+   23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,
+   18204,  17530,  16846,  16151,  15446,  14732,  14010,  13279,
+   12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+    6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,
+       0,   -804,  -1608,  -2410,  -3212,  -4011,  -4808,  -5602,
+   -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793,
+  -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+  -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+  -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+  -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+  -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+  -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+  -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+  -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+  -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+  -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+  -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+  -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+  -12539, -11793, -11039, -10278,  -9512,  -8739,  -7962,  -7179,
+   -6393,  -5602,  -4808,  -4011,  -3212,  -2410,  -1608,   -804
+};
+
+
+
+//
+// Variables
+
+
+// Configuration.
+
+uint8_t dds_output_mode = DDS_OUTPUT_NONE;
+uint32_t dds_sample_hz = 0;
+spi_doublebuf_t dds_spi_dbuf;
+
+
+// Waveform state. The sample ISR owns the "active" settings; the
+// foreground writes the "next" settings and sets dds_next_ready.
+
+volatile bool dds_is_running = false;
+volatile bool dds_stop_pending = false;
+uint32_t dds_phase = 0;
+volatile uint32_t dds_step = 0;
+
+uint8_t dds_wave = DDS_WAVE_SINE;
+const int16_t *dds_table_P = DDS_sine_table;
+int16_t dds_amplitude = 0;
+uint16_t dds_offset = 0x8000;
+
+volatile bool dds_next_ready = false;
+uint8_t dds_next_wave = DDS_WAVE_SINE;
+const int16_t *dds_next_table_P = DDS_sine_table;
+int16_t dds_next_amplitude = 0;
+uint16_t dds_next_offset = 0x8000;
+
+
+
+//
+// Functions
+
+
+// Private DDS functions.
+
+
+// This computes floor(num * 2^32 / den), for num < den.
+// This is shift-and-subtract long division, one quotient bit per pass,
+// to avoid 64-bit math.
+
+static uint32_t DDS_FracDiv(uint32_t num, uint32_t den)
+{
+  uint32_t result;
+  uint8_t bidx;
+  bool carry;
+
+  result = 0;
+
+  for (bidx = 0; bidx < 32; bidx++)
+  {
+    carry = (0 != (num & 0x80000000ul));
+    num <<= 1;
+    result <<= 1;
+
+    if (carry || (num >= den))
+    {
+      num -= den;
+      result |= 1;
+    }
+  }
+
+  return result;
+}
+
+
+// This copies the next settings into the active settings.
+// The caller is responsible for any needed locking.
+
+static void DDS_LatchSettings_ISR(void)
+{
+  dds_wave = dds_next_wave;
+  dds_table_P = dds_next_table_P;
+  dds_amplitude = dds_next_amplitude;
+  dds_offset = dds_next_offset;
+
+  dds_next_ready = false;
+}
+
+
+// This writes one output value.
+
+static void DDS_WriteOutput_ISR(uint16_t value)
+{
+  uint8_t spidata[2];
+
+  if (DDS_OUTPUT_PWM == dds_output_mode)
+    DDS_WritePWM_ISR((uint8_t) (value >> 8));
+  else if (DDS_OUTPUT_IO8 == dds_output_mode)
+    IO8_WriteData((uint8_t) (value >> 8));
+  else if (DDS_OUTPUT_SPI == dds_output_mode)
+  {
+    spidata[0] = DDS_SPI_DAC_COMMAND | (uint8_t) (value >> 12);
+    spidata[1] = (uint8_t) (value >> 4);
+    SPI_WriteDoubleBuffer(dds_spi_dbuf, spidata);
+    SPI_TriggerDoubleBuffer_ISR(dds_spi_dbuf);
+  }
+}
+
+
+// This applies a settings change. If we're stopped, it happens now;
+// otherwise the sample ISR picks it up at the end of the cycle.
+// The caller is responsible for any needed locking.
+
+static void DDS_PostSettings_ISR(void)
+{
+  dds_next_ready = true;
+
+  if (!dds_is_running)
+  {
+    DDS_LatchSettings_ISR();
+    DDS_WriteOutput_ISR(dds_offset);
+  }
+}
+
+
+// Public DDS functions.
+
+
+// Configures the DDS engine's sample timer and output.
+
+void DDS_Init(uint32_t mcu_hz, uint32_t sample_hz, uint8_t output_mode)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    DDS_SetSampleInterrupt_ISR(false);
+
+    dds_is_running = false;
+    dds_stop_pending = false;
+    dds_phase = 0;
+    dds_step = 0;
+
+    dds_next_wave = DDS_WAVE_SINE;
+    dds_next_table_P = DDS_sine_table;
+    dds_next_amplitude = 0;
+    dds_next_offset = 0x8000;
+    DDS_LatchSettings_ISR();
+
+    dds_output_mode = output_mode;
+    dds_sample_hz = 0;
+    if (0 < sample_hz)
+      dds_sample_hz = DDS_InitTimers_ISR(mcu_hz, sample_hz,
+        (DDS_OUTPUT_PWM == output_mode));
+
+    if (DDS_OUTPUT_SPI == output_mode)
+      SPI_InitDoubleBuffer(dds_spi_dbuf, 2, NULL, 1);
+
+    DDS_WriteOutput_ISR(dds_offset);
+  }
+}
+
+
+// Selects the SPI DAC's chip select line.
+
+void DDS_SetSPIChipSelect(volatile uint8_t *cs_port, uint8_t cs_mask)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    SPI_InitDoubleBuffer(dds_spi_dbuf, 2, cs_port, cs_mask);
+  }
+}
+
+
+// Returns the actual sample rate, or 0 if the DDS engine is off.
+
+uint32_t DDS_QuerySampleRate(void)
+{
+  uint32_t result;
+
+#ifdef NEUREMU
+  // Suppress warning.
+  result = 0;
+#endif
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = dds_sample_hz;
+  }
+
+  return result;
+}
+
+
+// Converts a frequency to a phase step.
+
+uint32_t DDS_FrequencyToStep(uint32_t millihz)
+{
+  uint32_t result;
+  uint32_t denom;
+
+  result = 0;
+
+  denom = DDS_QuerySampleRate() * 1000ul;
+  if (0 < denom)
+  {
+    // Stay below the Nyquist limit.
+    if (millihz >= (denom >> 1))
+      millihz = (denom >> 1) - 1;
+
+    result = DDS_FracDiv(millihz, denom);
+  }
+
+  return result;
+}
+
+
+// Sets the output frequency.
+
+void DDS_SetFrequency(uint32_t millihz)
+{
+  DDS_SetPhaseStep(DDS_FrequencyToStep(millihz));
+}
+
+
+// Sets the phase step directly.
+
+void DDS_SetPhaseStep(uint32_t step)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    dds_step = step;
+  }
+}
+
+
+// Selects a built-in waveform.
+
+void DDS_SetWaveform(uint8_t wave)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (DDS_WAVE_TABLE > wave)
+    {
+      dds_next_wave = wave;
+      dds_next_table_P = DDS_sine_table;
+      DDS_PostSettings_ISR();
+    }
+  }
+}
+
+
+// Selects a user-supplied wavetable.
+
+void DDS_SetWaveTable(const int16_t *table_P)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    dds_next_wave = DDS_WAVE_TABLE;
+    dds_next_table_P = table_P;
+    DDS_PostSettings_ISR();
+  }
+}
+
+
+// Sets the amplitude.
+
+void DDS_SetAmplitude(int16_t amplitude)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    dds_next_amplitude = amplitude;
+    DDS_PostSettings_ISR();
+  }
+}
+
+
+// Sets the output level that the waveform is centred on.
+
+void DDS_SetOffset(uint16_t offset)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    dds_next_offset = offset;
+    DDS_PostSettings_ISR();
+  }
+}
+
+
+// Starts output at phase 0.
+
+void DDS_Start(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if ( (0 < dds_sample_hz) && (!dds_is_running) )
+    {
+      dds_phase = 0;
+      dds_stop_pending = false;
+      dds_is_running = true;
+      DDS_SetSampleInterrupt_ISR(true);
+    }
+  }
+}
+
+
+// Stops output at the end of the current cycle.
+
+void DDS_Stop(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (dds_is_running)
+      dds_stop_pending = true;
+  }
+}
+
+
+// Returns true if the DDS engine is producing output.
+
+bool DDS_IsRunning(void)
+{
+  return dds_is_running;
+}
+
+
+// This is the sample handler called from within the sample timer ISR.
+
+void DDS_HandleSample_ISR(void)
+{
+  uint32_t oldphase;
+  uint16_t phase16;
+  uint8_t tidx;
+  int16_t lower, upper;
+  int16_t sample;
+  int32_t value;
+
+  oldphase = dds_phase;
+  dds_phase += dds_step;
+
+  // At the end of a cycle (or every sample, if frequency is 0), pick up
+  // pending changes.
+  if ( (dds_phase <= oldphase) && (dds_next_ready || dds_stop_pending) )
+  {
+    if (dds_next_ready)
+      DDS_LatchSettings_ISR();
+
+    if (dds_stop_pending)
+    {
+      DDS_SetSampleInterrupt_ISR(false);
+      dds_stop_pending = false;
+      dds_is_running = false;
+      dds_phase = 0;
+    }
+  }
+
+  phase16 = (uint16_t) (dds_phase >> 16);
+
+  if (DDS_WAVE_TRIANGLE == dds_wave)
+  {
+    // Shift by a quarter cycle, fold, and rescale.
+    phase16 += 0x4000;
+    if (0x8000 & phase16)
+      phase16 = 0xffff - phase16;
+    sample = (int16_t) ((phase16 << 1) - 0x8000);
+  }
+  else if (DDS_WAVE_SQUARE == dds_wave)
+    sample = (0x8000 & phase16) ? -0x7fff : 0x7fff;
+  else if (DDS_WAVE_SAWTOOTH == dds_wave)
+    sample = (int16_t) phase16;
+  else
+  {
+    // Table lookup with linear interpolation. Entries are halved before
+    // subtracting so that the difference fits in 16 bits.
+    tidx = (uint8_t) (phase16 >> 8);
+    lower = (int16_t) DDS_READ_FLASH_WORD(dds_table_P + tidx);
+    tidx++;
+    upper = (int16_t) DDS_READ_FLASH_WORD(dds_table_P + tidx);
+
+    sample = lower + (int16_t)
+      ( ( ((int32_t) ((upper >> 1) - (lower >> 1)))
+        * (uint8_t) phase16 ) >> 7 );
+  }
+
+  if (!dds_is_running)
+    sample = 0;
+
+  value = ((int32_t) dds_offset) + FIXED_MulQ15(sample, dds_amplitude);
+  if (0 > value)
+    value = 0;
+  else if (0xffff < value)
+    value = 0xffff;
+
+  DDS_WriteOutput_ISR((uint16_t) value);
+}
+
+
+
+//
+// This is the end of the file.
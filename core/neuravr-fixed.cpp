@@ -0,0 +1,378 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - Fixed-point math functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// The AVR has an 8x8 hardware multiplier but no divider. avr-gcc handles
+// 16x16->32 multiplies with short library routines built on MUL, but
+// 32x32 multiplies, 64-bit intermediates, division, and floating point are
+// all much slower (hundreds to thousands of cycles). Everything here is
+// built out of 16x16 products, shifts, and adds.
+//
+// Division by a constant uses the Granlund-Montgomery method: for a
+// divisor d with l = ceil(log2(d)), and m = floor(2^16 * (2^l - d) / d) + 1,
+// (x / d) == (x + ((x * m) >> 16)) >> l for all 16-bit x. The sum has 17
+// bits, which is why it's done in 32 bits.
+//
+// Log2 finds the most significant bit, then looks up the fraction in a
+// 16-entry table and interpolates linearly between entries.
+
+
+
+//
+// Private Macros
+
+// Reads one byte of a flash-resident table.
+#if USE_FAR_FLASH_POINTERS
+#define FIXED_READ_FLASH_BYTE(X) pgm_read_byte_far(X)
+#else
+#define FIXED_READ_FLASH_BYTE(X) pgm_read_byte_near(X)
+#endif
+
+
+
+//
+// Private Constants
+
+// log2(1 + i/16) in Q8 format, for i = 0..15. The entry for i = 16 would
+// be 256.
+const uint8_t FIXED_log2_table[16] PROGMEM =
+{ 0, 22, 44, 63, 82, 100, 118, 134,
+  150, 165, 179, 193, 207, 220, 232, 244 };
+
+
+
+//
+// Functions
+
+
+// Private fixed-point functions.
+
+
+// This multiplies two signed 16-bit values into a 32-bit product.
+// avr-gcc would call __mulhisi3 for this; doing it inline saves the call.
+// This is the "muls16x16_32" sequence from Atmel's AVR201 app note. MULSU
+// only accepts r16..r23, hence the "a" constraints.
+
+static inline int32_t FIXED_MulS16x16(int16_t a, int16_t b)
+{
+  int32_t result;
+#ifdef NEUREMU
+  result = (int32_t) a * (int32_t) b;
+#else
+  uint8_t zero;
+
+  __asm (
+    "clr %[zero]\n\t"
+    "muls %B[a], %B[b]\n\t"
+    "movw %C[res], r0\n\t"
+    "mul %A[a], %A[b]\n\t"
+    "movw %A[res], r0\n\t"
+    "mulsu %B[a], %A[b]\n\t"
+    "sbc %D[res], %[zero]\n\t"
+    "add %B[res], r0\n\t"
+    "adc %C[res], r1\n\t"
+    "adc %D[res], %[zero]\n\t"
+    "mulsu %B[b], %A[a]\n\t"
+    "sbc %D[res], %[zero]\n\t"
+    "add %B[res], r0\n\t"
+    "adc %C[res], r1\n\t"
+    "adc %D[res], %[zero]\n\t"
+    "clr __zero_reg__\n\t"
+    : [res] "=&r" (result), [zero] "=&r" (zero)
+    : [a] "a" (a), [b] "a" (b)
+  );
+#endif
+
+  return result;
+}
+
+
+// Public fixed-point functions.
+
+
+// Saturating signed 16-bit addition.
+
+int16_t FIXED_AddSat16(int16_t a, int16_t b)
+{
+  int32_t result;
+
+  result = (int32_t) a + b;
+
+  if (0x7fff < result)
+    result = 0x7fff;
+  else if (-0x8000 > result)
+    result = -0x8000;
+
+  return (int16_t) result;
+}
+
+
+// Saturating signed 16-bit subtraction.
+
+int16_t FIXED_SubSat16(int16_t a, int16_t b)
+{
+  int32_t result;
+
+  result = (int32_t) a - b;
+
+  if (0x7fff < result)
+    result = 0x7fff;
+  else if (-0x8000 > result)
+    result = -0x8000;
+
+  return (int16_t) result;
+}
+
+
+// Saturating unsigned 16-bit addition.
+
+uint16_t FIXED_AddSatU16(uint16_t a, uint16_t b)
+{
+  uint16_t result;
+
+  result = a + b;
+
+  // Unsigned overflow wraps to something smaller than either operand.
+  if (result < a)
+    result = 0xffff;
+
+  return result;
+}
+
+
+// Saturating unsigned 16-bit subtraction.
+
+uint16_t FIXED_SubSatU16(uint16_t a, uint16_t b)
+{
+  uint16_t result;
+
+  result = 0;
+  if (a > b)
+    result = a - b;
+
+  return result;
+}
+
+
+// Saturating signed 32-bit addition.
+
+int32_t FIXED_AddSat32(int32_t a, int32_t b)
+{
+  uint32_t result;
+
+  // Do the math unsigned, so that overflow is well-defined.
+  result = (uint32_t) a + (uint32_t) b;
+
+  // Overflow happened if the operands have the same sign and the result
+  // has a different sign.
+  if ( 0 > (int32_t) ( ~((uint32_t) a ^ (uint32_t) b)
+    & ((uint32_t) a ^ result) ) )
+    result = (0 > a) ? 0x80000000ul : 0x7ffffffful;
+
+  return (int32_t) result;
+}
+
+
+// Saturating signed 32-bit subtraction.
+
+int32_t FIXED_SubSat32(int32_t a, int32_t b)
+{
+  uint32_t result;
+
+  result = (uint32_t) a - (uint32_t) b;
+
+  // Overflow happened if the operands have different signs and the result
+  // has a different sign from the first operand.
+  if ( 0 > (int32_t) ( ((uint32_t) a ^ (uint32_t) b)
+    & ((uint32_t) a ^ result) ) )
+    result = (0 > a) ? 0x80000000ul : 0x7ffffffful;
+
+  return (int32_t) result;
+}
+
+
+// Multiplies two Q15 values, rounding to nearest.
+
+int16_t FIXED_MulQ15(int16_t a, int16_t b)
+{
+  int32_t result;
+
+  result = (FIXED_MulS16x16(a, b) + 0x4000) >> 15;
+
+  // Only -1 * -1 can overflow.
+  if (0x7fff < result)
+    result = 0x7fff;
+
+  return (int16_t) result;
+}
+
+
+// Multiplies two Q16 values, truncating.
+// This is four 16x16 partial products rather than a 64-bit multiply.
+
+int32_t FIXED_MulQ16(int32_t a, int32_t b)
+{
+  int16_t ahi, bhi;
+  uint16_t alo, blo;
+  uint32_t result;
+
+  ahi = (int16_t) (a >> 16);
+  alo = (uint16_t) a;
+  bhi = (int16_t) (b >> 16);
+  blo = (uint16_t) b;
+
+  // Only the low half of the high product survives the shift.
+  result = (uint16_t) ((uint32_t) (uint16_t) ahi * (uint16_t) bhi);
+  result <<= 16;
+  result += (uint32_t) ((int32_t) ahi * (int32_t) blo);
+  result += (uint32_t) ((int32_t) bhi * (int32_t) alo);
+  result += ((uint32_t) alo * (uint32_t) blo) >> 16;
+
+  return (int32_t) result;
+}
+
+
+// Scales an unsigned value by a 16-bit fraction.
+
+uint16_t FIXED_ScaleU16(uint16_t value, uint16_t scale)
+{
+  return (uint16_t) ( ((uint32_t) value * (uint32_t) scale) >> 16 );
+}
+
+
+// Sets up a reciprocal for dividing by the specified divisor.
+// A divisor of 0 is treated as 1.
+
+void FIXED_MakeRecip16(fixed_recip16_t &recip, uint16_t divisor)
+{
+  uint8_t shift;
+  uint32_t span;
+
+  if (1 > divisor)
+    divisor = 1;
+
+  // shift = ceil(log2(divisor)).
+  shift = 0;
+  while ( ((uint32_t) 1 << shift) < divisor )
+    shift++;
+
+  // 2^16 * (2^shift - divisor) is less than 2^32, and the quotient fits
+  // in 16 bits.
+  span = ((uint32_t) 1 << shift) - divisor;
+  recip.mult = (uint16_t) ( ((span << 16) / divisor) + 1 );
+  recip.shift = shift;
+}
+
+
+// Divides by a precomputed reciprocal.
+
+uint16_t FIXED_DivRecip16(uint16_t value, const fixed_recip16_t &recip)
+{
+  uint32_t result;
+
+  result = ((uint32_t) value * (uint32_t) recip.mult) >> 16;
+  result = (result + value) >> recip.shift;
+
+  return (uint16_t) result;
+}
+
+
+// Returns floor(sqrt(value)).
+// This is the bitwise method; one result bit per iteration, no multiplies.
+
+uint16_t FIXED_SqrtU32(uint32_t value)
+{
+  uint32_t result;
+  uint32_t bit;
+
+  result = 0;
+
+  bit = (uint32_t) 1 << 30;
+  while (bit > value)
+    bit >>= 2;
+
+  while (0 != bit)
+  {
+    if (value >= (result + bit))
+    {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    }
+    else
+      result >>= 1;
+
+    bit >>= 2;
+  }
+
+  return (uint16_t) result;
+}
+
+
+// Returns log2(value) in Q8.8 format.
+
+uint16_t FIXED_Log2U32(uint32_t value)
+{
+  uint16_t result;
+  uint8_t exponent;
+  uint16_t mantissa;
+  uint8_t tidx;
+  uint8_t lower, upper;
+
+  result = 0;
+
+  if (0 != value)
+  {
+    // Normalize so that the most significant bit is bit 31.
+    // Skip whole bytes first; 32-bit shifts are slow.
+    exponent = 31;
+    while (0 == (value & 0xff000000ul))
+    {
+      value <<= 8;
+      exponent -= 8;
+    }
+    while (0 == (value & 0x80000000ul))
+    {
+      value <<= 1;
+      exponent--;
+    }
+
+    // The mantissa is 1.xxxx; the top four fraction bits pick a table
+    // entry and the next eleven interpolate.
+    mantissa = (uint16_t) (value >> 16);
+    tidx = (mantissa >> 11) & 0x0f;
+
+    lower = FIXED_READ_FLASH_BYTE(FIXED_log2_table + tidx);
+    if (15 > tidx)
+      upper = FIXED_READ_FLASH_BYTE(FIXED_log2_table + tidx + 1);
+    else
+      upper = 0;
+
+    // "upper" wraps for the last entry (256 - lower is still correct).
+    result = (uint8_t) (upper - lower);
+    result = ((result * (mantissa & 0x07ff)) + 0x0400) >> 11;
+    result += lower;
+
+    result += ((uint16_t) exponent) << 8;
+  }
+
+  return result;
+}
+
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,209 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - Flight recorder functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// The flight recorder is a ring of FLIGHT_RECORD_SLOTS timestamped event
+// records. Recording overwrites the oldest record; nothing is reported
+// until someone asks.
+//
+// The ring lives in the ".noinit" section, which the C runtime doesn't
+// clear at startup, so it survives watchdog, brown-out, and external
+// resets. The linker places ".noinit" below "_end", so the stack painter
+// in neuravr-mcu.cpp leaves it alone. A magic number and range checks
+// decide whether the contents are still valid; they're discarded after a
+// power-on reset regardless.
+//
+// Records are numbered with a 16-bit sequence counter, so that readers
+// can walk the ring while new records are being added and notice any that
+// were overwritten under them.
+
+
+
+//
+// Private Macros
+
+// Marks variables that shouldn't be cleared at startup.
+#ifdef NEUREMU
+#define FLIGHT_NOINIT
+#else
+#define FLIGHT_NOINIT __attribute__ ((section (".noinit")))
+#endif
+
+// Marks the recorder state as valid. This is "FL" in ASCII.
+#define FLIGHT_MAGIC 0x464c
+
+
+
+//
+// Variables
+
+// Recorder state. This persists across resets.
+uint16_t flight_magic FLIGHT_NOINIT;
+uint16_t flight_total FLIGHT_NOINIT;
+uint8_t flight_count FLIGHT_NOINIT;
+uint16_t flight_resets FLIGHT_NOINIT;
+flight_record_t flight_records[FLIGHT_RECORD_SLOTS] FLIGHT_NOINIT;
+
+// Reset cause for this run.
+uint8_t flight_reset_flags = 0;
+
+
+
+//
+// Functions
+
+
+// Private flight recorder functions.
+
+
+// This sets up the recorder after a reset, keeping old records if they're
+// still valid, and records the reset.
+// The caller is responsible for any needed locking.
+
+void FLIGHT_Init_ISR(uint8_t reset_flags)
+{
+  flight_reset_flags = reset_flags;
+
+  if ( (FLIGHT_MAGIC != flight_magic)
+    || (FLIGHT_RECORD_SLOTS < flight_count)
+    || (0 != (reset_flags & FLIGHT_RESET_POWERON)) )
+  {
+    flight_magic = FLIGHT_MAGIC;
+    flight_total = 0;
+    flight_count = 0;
+    flight_resets = 0;
+  }
+  else
+    flight_resets++;
+
+  FLIGHT_Record_ISR(FLIGHT_EV_RESET, reset_flags, flight_resets);
+}
+
+
+// Public flight recorder functions.
+
+
+// Adds a record to the ring.
+// The caller is responsible for any needed locking.
+
+void FLIGHT_Record_ISR(uint8_t event, uint8_t detail, uint16_t data)
+{
+  flight_record_t *thisrecord;
+
+  thisrecord = &(flight_records[flight_total & (FLIGHT_RECORD_SLOTS - 1)]);
+
+  thisrecord->timestamp = rtc_timestamp;
+  thisrecord->event = event;
+  thisrecord->detail = detail;
+  thisrecord->data = data;
+
+  flight_total++;
+  if (FLIGHT_RECORD_SLOTS > flight_count)
+    flight_count++;
+}
+
+
+// Adds a record to the ring, with locking.
+
+void FLIGHT_Record(uint8_t event, uint8_t detail, uint16_t data)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    FLIGHT_Record_ISR(event, detail, data);
+  }
+}
+
+
+// Discards all records. The reset count is kept.
+
+void FLIGHT_Clear(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    flight_count = 0;
+  }
+}
+
+
+// Returns the sequence numbers of the oldest record and of the next record
+// to be written.
+
+void FLIGHT_GetRange(uint16_t &first, uint16_t &end)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    end = flight_total;
+    first = end - flight_count;
+  }
+}
+
+
+// Copies the record with the specified sequence number.
+// Returns false if it's been overwritten or hasn't been written yet.
+
+bool FLIGHT_GetRecord(uint16_t sequence, flight_record_t &record)
+{
+  bool result;
+
+  result = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // "Age" is 0 for the newest record. Unwritten sequence numbers wrap
+    // around to large ages.
+    if ( ((uint16_t) (flight_total - sequence - 1)) < flight_count )
+    {
+      record = flight_records[sequence & (FLIGHT_RECORD_SLOTS - 1)];
+      result = true;
+    }
+  }
+
+  return result;
+}
+
+
+// Returns the reset cause flags for this run (FLIGHT_RESET_xx).
+
+uint8_t FLIGHT_GetResetFlags(void)
+{
+  return flight_reset_flags;
+}
+
+
+// Returns the number of resets the recorder has survived.
+
+uint16_t FLIGHT_GetResetCount(void)
+{
+  uint16_t result;
+
+#ifdef NEUREMU
+  // Suppress warning.
+  result = 0;
+#endif
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = flight_resets;
+  }
+
+  return result;
+}
+
+
+
+//
+// This is the end of the file.
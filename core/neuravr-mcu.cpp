@@ -13,12 +13,66 @@
 
 
 
+//
+// Macros
+
+// Value used to paint unused memory at startup.
+// Anything not 0x00 or 0xff is fine; this one is rarely seen in real data.
+#define STACK_CANARY 0xc5
+
+
+
 //
 // Private Global Variables
 
 // From the heap manager.
 extern char *__brkval;
 
+#ifndef NEUREMU
+// From the linker script. These are the end of static data and the top
+// of the stack.
+extern uint8_t _end;
+extern uint8_t __stack;
+#endif
+
+
+
+//
+// Startup Code
+
+#ifndef NEUREMU
+
+// This paints all memory between static data and the top of the stack with
+// a canary value, so that MCU_GetMinFreeMemory() can see how deep the
+// stack ever got.
+// This runs from .init1, before the stack pointer and zero register are set
+// up, so it has to be naked assembly that uses neither.
+// NOTE - This is linked in whenever anything else in this file is used.
+
+void MCU_PaintStack(void) __attribute__ ((naked, used, section (".init1")));
+
+void MCU_PaintStack(void)
+{
+  __asm volatile (
+    "    ldi r30, lo8(_end)      \n"
+    "    ldi r31, hi8(_end)      \n"
+    "    ldi r24, %0             \n"
+    "    ldi r25, hi8(__stack)   \n"
+    "    rjmp 2f                 \n"
+    "1:                          \n"
+    "    st Z+, r24              \n"
+    "2:                          \n"
+    "    cpi r30, lo8(__stack)   \n"
+    "    cpc r31, r25            \n"
+    "    brlo 1b                 \n"
+    "    breq 1b                 \n"
+    :
+    : "M" (STACK_CANARY)
+  );
+}
+
+#endif
+
 
 
 //
@@ -53,5 +107,39 @@ uint16_t MCU_GetFreeMemory(void)
 
 
 
+// This returns the smallest distance between the stack and the heap seen
+// since reset, by counting untouched canary bytes above the heap.
+// NOTE - A stack byte that happens to equal the canary at the deepest point
+// makes this read slightly high. Leave a little margin.
+
+uint16_t MCU_GetMinFreeMemory(void)
+{
+  uint16_t result;
+
+#ifdef NEUREMU
+  // Workstation emulation. Assume infinite memory.
+  result = 0xffff;
+
+#else
+  // AVR-native.
+  uint8_t *scanptr;
+
+  scanptr = (uint8_t *) __malloc_heap_start;
+  if (__brkval)
+    scanptr = (uint8_t *) __brkval;
+
+  result = 0;
+  while ( (scanptr <= &__stack) && (STACK_CANARY == *scanptr) )
+  {
+    result++;
+    scanptr++;
+  }
+#endif
+
+  return result;
+}
+
+
+
 //
 // This is the end of the file.
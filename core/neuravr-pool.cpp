@@ -0,0 +1,195 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - Fixed-block memory pool functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// Free blocks are kept on a singly-linked list, with the link stored in
+// the first bytes of each free block. Allocating pops the head of the
+// list and freeing pushes onto it, so both are a handful of instructions
+// regardless of pool size, and there's no per-block overhead.
+//
+// Frees are checked against the pool's storage and block boundaries, so
+// that a stray pointer doesn't corrupt the free list. Power-of-2 block
+// sizes only need a mask for the boundary check; other sizes need a
+// division. Blocks aren't checked for double-frees.
+
+
+
+//
+// Functions
+
+
+// Public memory pool functions.
+
+
+// Sets up a pool, threading all blocks onto the free list.
+
+void POOL_Init(pool_t &pool, void *storage, uint16_t block_size,
+  uint8_t block_count)
+{
+  uint8_t *thisblock;
+  uint8_t bidx;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    pool.block_bytes = POOL_BLOCK_BYTES(block_size);
+    pool.block_count = block_count;
+    pool.storage_start = (uint8_t *) storage;
+    pool.storage_end =
+      pool.storage_start + ((uint16_t) block_count) * pool.block_bytes;
+
+    // Link blocks in address order, so the first allocation is the first
+    // block.
+    pool.free_list = NULL;
+    thisblock = pool.storage_end;
+    for (bidx = 0; bidx < block_count; bidx++)
+    {
+      thisblock -= pool.block_bytes;
+      *((void **) thisblock) = pool.free_list;
+      pool.free_list = thisblock;
+    }
+
+    pool.in_use = 0;
+    pool.peak_in_use = 0;
+    pool.failures = 0;
+  }
+}
+
+
+// Takes a block from the pool.
+// The caller is responsible for any needed locking.
+
+void *POOL_Alloc_ISR(pool_t &pool)
+{
+  void *result;
+
+  result = pool.free_list;
+
+  if (NULL == result)
+  {
+    if (0xffff > pool.failures)
+      pool.failures++;
+  }
+  else
+  {
+    pool.free_list = *((void **) result);
+
+    pool.in_use++;
+    if (pool.in_use > pool.peak_in_use)
+      pool.peak_in_use = pool.in_use;
+  }
+
+  return result;
+}
+
+
+// Takes a block from the pool, with locking.
+
+void *POOL_Alloc(pool_t &pool)
+{
+  void *result;
+
+#ifdef NEUREMU
+  // Suppress warning.
+  result = NULL;
+#endif
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = POOL_Alloc_ISR(pool);
+  }
+
+  return result;
+}
+
+
+// Returns a block to the pool.
+// The caller is responsible for any needed locking.
+
+void POOL_Free_ISR(pool_t &pool, void *block)
+{
+  bool is_valid;
+  uint16_t offset;
+
+  is_valid = (((uint8_t *) block) >= pool.storage_start)
+    && (((uint8_t *) block) < pool.storage_end)
+    && (0 < pool.in_use);
+
+  // Reject pointers into the middle of a block.
+  if (is_valid)
+  {
+    offset = (uint16_t) (((uint8_t *) block) - pool.storage_start);
+    if (0 == (pool.block_bytes & (pool.block_bytes - 1)))
+      is_valid = (0 == (offset & (pool.block_bytes - 1)));
+    else
+      is_valid = (0 == (offset % pool.block_bytes));
+  }
+
+  if (!is_valid)
+  {
+    if (0xffff > pool.failures)
+      pool.failures++;
+  }
+  else
+  {
+    *((void **) block) = pool.free_list;
+    pool.free_list = block;
+
+    pool.in_use--;
+  }
+}
+
+
+// Returns a block to the pool, with locking.
+
+void POOL_Free(pool_t &pool, void *block)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    POOL_Free_ISR(pool, block);
+  }
+}
+
+
+// Copies usage statistics.
+
+void POOL_GetStats(pool_t &pool, uint8_t &in_use, uint8_t &peak_in_use,
+  uint16_t &failures)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    in_use = pool.in_use;
+    peak_in_use = pool.peak_in_use;
+    failures = pool.failures;
+  }
+}
+
+
+// Resets the peak usage and failure count.
+
+void POOL_ClearStats(pool_t &pool)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    pool.peak_in_use = pool.in_use;
+    pool.failures = 0;
+  }
+}
+
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,543 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - SPI functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// Transfers are described by spi_transfer_t descriptors owned by the
+// caller. Queueing a transfer stores a pointer to it, so the descriptor and
+// its buffers have to stay valid until the transfer is done.
+//
+// The SPI interrupt calls SPI_HandleByteDone_ISR() once per byte. This
+// stores the received byte and writes the next one, or finishes the
+// transfer and starts the next queued one. The foreground never waits on
+// individual bytes.
+//
+// Double-buffered transfers use two banks. The bank being transferred
+// belongs to the ISR side; the other belongs to the foreground. Triggering
+// swaps them, so received data is never read while it's being written and
+// transmit data is never changed while it's being sent.
+//
+// The hardware functions (SPI_Init(), the byte hooks, and the ISR) are the
+// same on every supported AVR; only the pins differ, and those come from
+// the SPI_PIN_xx macros in the architecture header. SS is driven as an
+// output (the default chip select). If it were an input and went low, the
+// hardware would drop out of master mode. Workstation emulation supplies
+// its own versions of these.
+//
+// Each byte costs one interrupt. At the fastest bit rates, the ISR takes
+// longer than the byte does, so there's little point in going above
+// about 2 Mbps.
+
+
+
+//
+// Macros
+
+// Byte to send when a transfer has no transmit buffer.
+#define SPI_FILL_BYTE 0x00
+
+#define SPI_QUEUE_MASK (SPI_QUEUE_SIZE - 1)
+
+#define SPI_OUTPUT_PINS (SPI_PIN_SS | SPI_PIN_MOSI | SPI_PIN_SCK)
+#define SPI_ALL_PINS (SPI_OUTPUT_PINS | SPI_PIN_MISO)
+
+// Slowest divisor the hardware offers.
+#define SPI_MAX_DIVISOR_BITS 6
+
+
+
+//
+// Variables
+
+
+// SPI variables.
+
+// Queue of pending transfers.
+spi_transfer_t * volatile SPI_queue[SPI_QUEUE_SIZE];
+volatile uint8_t SPI_queue_head = 0;
+volatile uint8_t SPI_queue_tail = 0;
+
+// Transfer in progress, and the next byte position within it.
+spi_transfer_t * volatile SPI_current = NULL;
+volatile uint8_t SPI_byte_idx = 0;
+
+#if !defined(NEUREMU) || defined(NEUREMU_REGS)
+// Actual bit rate set.
+uint32_t real_spi_rate = 0;
+#endif
+
+
+
+//
+// Functions
+
+
+// Private SPI functions.
+
+
+// This asserts or de-asserts a transfer's chip select.
+
+void SPI_SetChipSelect_ISR(spi_transfer_t *transfer, bool asserted)
+{
+  if (0 != transfer->cs_mask)
+  {
+    if (NULL == transfer->cs_port)
+      SPI_SetDefaultSelect_ISR(asserted);
+    else if (asserted)
+      *(transfer->cs_port) &= ~(transfer->cs_mask);
+    else
+      *(transfer->cs_port) |= transfer->cs_mask;
+  }
+}
+
+
+// This starts the next queued transfer, if there is one and if the bus is
+// idle.
+
+void SPI_StartNext_ISR(void)
+{
+  spi_transfer_t *transfer;
+
+  while ( (NULL == SPI_current) && (SPI_queue_head != SPI_queue_tail) )
+  {
+    transfer = SPI_queue[SPI_queue_tail];
+    SPI_queue_tail = (SPI_queue_tail + 1) & SPI_QUEUE_MASK;
+
+    if (0 == transfer->length)
+    {
+      // Nothing to send; finish it immediately.
+      transfer->state = SPI_XFER_DONE;
+      if (NULL != transfer->callback_ISR)
+        (*(transfer->callback_ISR))(transfer);
+    }
+    else
+    {
+      SPI_current = transfer;
+      SPI_byte_idx = 0;
+      transfer->state = SPI_XFER_ACTIVE;
+
+      SPI_SetChipSelect_ISR(transfer, true);
+
+      SPI_WriteByte_ISR( (NULL == transfer->tx_data) ? SPI_FILL_BYTE
+        : transfer->tx_data[0] );
+    }
+  }
+}
+
+
+// This discards all queued transfers and resets the queue.
+// The caller is responsible for any needed locking.
+
+void SPI_InitQueue_ISR(void)
+{
+  uint8_t qidx;
+
+  if (NULL != SPI_current)
+  {
+    SPI_SetChipSelect_ISR(SPI_current, false);
+    SPI_current->state = SPI_XFER_IDLE;
+    SPI_current = NULL;
+  }
+
+  for (qidx = SPI_queue_tail; qidx != SPI_queue_head;
+    qidx = (qidx + 1) & SPI_QUEUE_MASK)
+    SPI_queue[qidx]->state = SPI_XFER_IDLE;
+
+  SPI_queue_head = 0;
+  SPI_queue_tail = 0;
+  SPI_byte_idx = 0;
+}
+
+
+// This handles a completed byte. It's called from the SPI interrupt.
+
+void SPI_HandleByteDone_ISR(uint8_t recvbyte)
+{
+  spi_transfer_t *transfer;
+  uint8_t byte_idx;
+
+  transfer = SPI_current;
+
+  if (NULL != transfer)
+  {
+    byte_idx = SPI_byte_idx;
+
+    if (NULL != transfer->rx_data)
+      transfer->rx_data[byte_idx] = recvbyte;
+
+    byte_idx++;
+    SPI_byte_idx = byte_idx;
+
+    if (byte_idx < transfer->length)
+    {
+      SPI_WriteByte_ISR( (NULL == transfer->tx_data) ? SPI_FILL_BYTE
+        : transfer->tx_data[byte_idx] );
+    }
+    else
+    {
+      SPI_SetChipSelect_ISR(transfer, false);
+
+      SPI_current = NULL;
+      transfer->state = SPI_XFER_DONE;
+
+      if (NULL != transfer->callback_ISR)
+        (*(transfer->callback_ISR))(transfer);
+
+      SPI_StartNext_ISR();
+    }
+  }
+}
+
+
+// Public SPI functions.
+
+
+// Queues a transfer from within an ISR or other locked code.
+// Returns false if the queue is full or the transfer is already pending.
+
+bool SPI_QueueTransfer_ISR(spi_transfer_t &transfer)
+{
+  bool result;
+  uint8_t next_head;
+
+  result = false;
+
+  next_head = (SPI_queue_head + 1) & SPI_QUEUE_MASK;
+
+  if ( (next_head != SPI_queue_tail)
+    && (SPI_XFER_QUEUED != transfer.state)
+    && (SPI_XFER_ACTIVE != transfer.state) )
+  {
+    transfer.state = SPI_XFER_QUEUED;
+    SPI_queue[SPI_queue_head] = &transfer;
+    SPI_queue_head = next_head;
+
+    SPI_StartNext_ISR();
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+// Queues a transfer.
+// Returns false if the queue is full or the transfer is already pending.
+
+bool SPI_QueueTransfer(spi_transfer_t &transfer)
+{
+  bool result;
+
+  result = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = SPI_QueueTransfer_ISR(transfer);
+  }
+
+  return result;
+}
+
+
+// Returns true if the specified transfer has finished.
+
+bool SPI_IsTransferDone(spi_transfer_t &transfer)
+{
+  return (SPI_XFER_DONE == transfer.state);
+}
+
+
+// Blocks until the specified transfer finishes.
+// Interrupts are still handled during this time.
+
+void SPI_WaitForTransfer(spi_transfer_t &transfer)
+{
+  while ( (SPI_XFER_QUEUED == transfer.state)
+    || (SPI_XFER_ACTIVE == transfer.state) )
+  {
+    // Busy-wait so as to not hammer the state variable.
+    _delay_loop_1(20);
+  }
+}
+
+
+// Returns true if a transfer is in progress or queued.
+
+bool SPI_IsBusy(void)
+{
+  return (NULL != SPI_current) || (SPI_queue_head != SPI_queue_tail);
+}
+
+
+// Double-buffered transfer functions.
+
+
+// Sets up a double-buffered transfer of "length" bytes (at most
+// SPI_DBUF_BYTES). Chip select works as for single transfers.
+
+void SPI_InitDoubleBuffer(spi_doublebuf_t &dbuf, uint8_t length,
+  volatile uint8_t *cs_port, uint8_t cs_mask)
+{
+  uint8_t bidx, cidx;
+
+  if (SPI_DBUF_BYTES < length)
+    length = SPI_DBUF_BYTES;
+
+  for (bidx = 0; bidx < 2; bidx++)
+  {
+    dbuf.banks[bidx].tx_data = dbuf.tx_data[bidx];
+    dbuf.banks[bidx].rx_data = dbuf.rx_data[bidx];
+    dbuf.banks[bidx].length = length;
+    dbuf.banks[bidx].cs_port = cs_port;
+    dbuf.banks[bidx].cs_mask = cs_mask;
+    dbuf.banks[bidx].callback_ISR = NULL;
+    dbuf.banks[bidx].state = SPI_XFER_IDLE;
+
+    for (cidx = 0; cidx < SPI_DBUF_BYTES; cidx++)
+    {
+      dbuf.tx_data[bidx][cidx] = SPI_FILL_BYTE;
+      dbuf.rx_data[bidx][cidx] = 0;
+    }
+  }
+
+  dbuf.active = 0;
+  dbuf.tx_staged = false;
+  dbuf.rx_fresh = false;
+  dbuf.overruns = 0;
+}
+
+
+// Swaps banks and starts the next double-buffered transfer. This is meant
+// to be called from the RTC tick callback.
+// Returns false (and counts an overrun) if the previous transfer hasn't
+// finished yet.
+
+bool SPI_TriggerDoubleBuffer_ISR(spi_doublebuf_t &dbuf)
+{
+  bool result;
+  uint8_t old_bank, new_bank;
+  uint8_t cidx;
+
+  result = false;
+
+  old_bank = dbuf.active;
+  new_bank = old_bank ^ 1;
+
+  if ( (SPI_XFER_QUEUED == dbuf.banks[old_bank].state)
+    || (SPI_XFER_ACTIVE == dbuf.banks[old_bank].state) )
+  {
+    dbuf.overruns++;
+  }
+  else
+  {
+    // The bank we're handing back to the foreground has new data in it,
+    // if it was ever transferred.
+    if (SPI_XFER_DONE == dbuf.banks[old_bank].state)
+      dbuf.rx_fresh = true;
+
+    // If the foreground didn't stage new data, repeat what we last sent.
+    if (!dbuf.tx_staged)
+      for (cidx = 0; cidx < dbuf.banks[new_bank].length; cidx++)
+        dbuf.tx_data[new_bank][cidx] = dbuf.tx_data[old_bank][cidx];
+
+    dbuf.tx_staged = false;
+    dbuf.active = new_bank;
+
+    result = SPI_QueueTransfer_ISR(dbuf.banks[new_bank]);
+
+    if (!result)
+      dbuf.overruns++;
+  }
+
+  return result;
+}
+
+
+// Stages transmit data for the next double-buffered transfer.
+
+void SPI_WriteDoubleBuffer(spi_doublebuf_t &dbuf, const uint8_t *data)
+{
+  uint8_t bank;
+  uint8_t cidx;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    bank = dbuf.active ^ 1;
+
+    for (cidx = 0; cidx < dbuf.banks[bank].length; cidx++)
+      dbuf.tx_data[bank][cidx] = data[cidx];
+
+    dbuf.tx_staged = true;
+  }
+}
+
+
+// Copies out the most recently received double-buffered data.
+// Returns true if there was new data since the last call.
+
+bool SPI_ReadDoubleBuffer(spi_doublebuf_t &dbuf, uint8_t *data)
+{
+  bool result;
+  uint8_t bank;
+  uint8_t cidx;
+
+  result = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (dbuf.rx_fresh)
+    {
+      bank = dbuf.active ^ 1;
+
+      for (cidx = 0; cidx < dbuf.banks[bank].length; cidx++)
+        data[cidx] = dbuf.rx_data[bank][cidx];
+
+      dbuf.rx_fresh = false;
+      result = true;
+    }
+  }
+
+  return result;
+}
+
+
+
+// Hardware SPI functions.
+
+#if !defined(NEUREMU) || defined(NEUREMU_REGS)
+
+
+// Configures the SPI port as a master with the specified bit rate and mode
+// (0..3). A bit rate of 0 turns it off. Any queued transfers are discarded.
+// The bit rate is rounded down to the nearest of mcu_hz / 2..128. Rates
+// below mcu_hz / 128 are clamped up to mcu_hz / 128, so the port runs
+// _faster_ than requested; SPI_QueryBitRate() reports what was set.
+
+void SPI_Init(uint32_t mcu_hz, uint32_t bit_rate, uint8_t spi_mode)
+{
+  uint8_t divisor_bits;
+  uint32_t scratch;
+  uint8_t spcr_value, spsr_value;
+
+  if (0 == bit_rate)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      // Turn off the SPI module and its interrupt.
+      SPCR = 0x00;
+
+      SPI_InitQueue_ISR();
+
+      // If we'd claimed the pins, return them to high-Z inputs.
+      // Otherwise leave them alone (they may be scope pins).
+      if (0 != real_spi_rate)
+      {
+        SPI_DDR &= ~SPI_ALL_PINS;
+        SPI_PORT &= ~SPI_ALL_PINS;
+      }
+    }
+
+    real_spi_rate = 0;
+
+    IO8_ReserveSPIPins(false);
+  }
+  else
+  {
+    // Clamp slow requests to the slowest rate the hardware can do.
+    scratch = mcu_hz >> (SPI_MAX_DIVISOR_BITS + 1);
+    if (bit_rate < scratch)
+      bit_rate = scratch;
+
+    // Find the smallest divisor (2..128) that doesn't exceed the bit rate.
+    // Divisor bits are log2(divisor) - 1, from 0 to 6.
+    divisor_bits = 0;
+    scratch = mcu_hz >> 1;
+    while ( (SPI_MAX_DIVISOR_BITS > divisor_bits) && (scratch > bit_rate) )
+    {
+      divisor_bits++;
+      scratch >>= 1;
+    }
+    real_spi_rate = scratch;
+
+    // SPR1:0 selects /4, /16, /64, or /128. The double-speed flag halves
+    // the first three, giving /2, /8, and /32.
+    spsr_value = ( (divisor_bits & 1)
+      || (SPI_MAX_DIVISOR_BITS == divisor_bits) ) ? 0 : (1 << SPI2X);
+    spcr_value = (1 << SPIE) | (1 << SPE) | (1 << MSTR)
+      | ((spi_mode & 0x03) << CPHA)
+      | ((divisor_bits >> 1) & 0x03);
+
+    IO8_ReserveSPIPins(true);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      SPCR = 0x00;
+
+      SPI_InitQueue_ISR();
+
+      // SS idles high. MISO is an input without a pull-up.
+      SPI_PORT = (SPI_PORT & ~SPI_ALL_PINS) | SPI_PIN_SS;
+      SPI_DDR = (SPI_DDR & ~SPI_ALL_PINS) | SPI_OUTPUT_PINS;
+
+      SPSR = spsr_value;
+      SPCR = spcr_value;
+    }
+  }
+}
+
+
+// Returns the actual bit rate set, or 0 if SPI is off.
+
+uint32_t SPI_QueryBitRate(void)
+{
+  return real_spi_rate;
+}
+
+
+// This starts sending a byte.
+// The caller is responsible for any needed locking.
+
+void SPI_WriteByte_ISR(uint8_t sendbyte)
+{
+  SPDR = sendbyte;
+}
+
+
+// This drives the default chip select (SS) pin. It's active-low.
+// The caller is responsible for any needed locking.
+
+void SPI_SetDefaultSelect_ISR(bool asserted)
+{
+  if (asserted)
+    SPI_PORT &= ~SPI_PIN_SS;
+  else
+    SPI_PORT |= SPI_PIN_SS;
+}
+
+
+// Transfer-complete interrupt service routine.
+
+ISR(SPI_STC_vect, ISR_BLOCK)
+{
+  // SPIF is cleared by hardware when this interrupt is taken.
+  SPI_HandleByteDone_ISR(SPDR);
+}
+
+#endif
+
+
+//
+// This is the end of the file.
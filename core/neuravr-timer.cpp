@@ -13,6 +13,45 @@
 
 
 
+//
+// Notes
+
+// RTC disciplining:
+// Each sync edge is timestamped as (tick count, timer count). The phase
+// error is how far past the nearest pulse-grid boundary the RTC was when
+// the edge arrived, in MCU clocks. Tick length is trimmed in 1/4096ths of
+// an MCU clock; the integer part goes into OCRnA, and the fraction is
+// dithered by carrying out of a 16-bit accumulator each tick.
+//
+// The loop is a PI controller on the phase error. With the error scaled
+// to "trim that would cancel it over one pulse period", proportional gain
+// 1/2 and integral gain 1/16 give a critically damped response that
+// settles in about 20 pulses. Edges that are more than one tick off are
+// ignored as glitches; several in a row mean we've lost lock (or the
+// timestamp was reset), and the loop starts over.
+
+
+
+//
+// Private Macros
+
+// Tick-length trim resolution and limits.
+#define TIMER_SYNC_FRAC_BITS 12
+// Trim is limited to 1/64 of a tick (about 1.5%).
+#define TIMER_SYNC_TRIM_LIMIT_SHIFT 6
+
+// Loop gains, as right shifts.
+#define TIMER_SYNC_KP_SHIFT 1
+#define TIMER_SYNC_KI_SHIFT 4
+
+// Consecutive outliers before we give up and start over.
+#define TIMER_SYNC_MAX_OUTLIERS 3
+
+// Lock threshold, as a right shift of the tick length.
+#define TIMER_SYNC_LOCK_SHIFT 4
+
+
+
 //
 // Variables
 
@@ -23,6 +62,29 @@ volatile uint32_t rtc_timestamp;
 void (*rtc_usercallback)(void) = NULL;
 
 
+// RTC disciplining variables.
+
+volatile bool rtc_sync_active = false;
+
+// Set by Timer_Init(), and by the sync loop.
+uint16_t rtc_sync_base_clocks = 0;
+uint16_t rtc_sync_whole_clocks = 0;
+uint16_t rtc_sync_frac_clocks = 0;
+uint16_t rtc_sync_dither = 0;
+
+// Sync loop state.
+volatile uint8_t rtc_sync_state = TIMER_SYNC_OFF;
+uint16_t rtc_sync_ticks_per_pulse = 1;
+int32_t rtc_sync_integral = 0;
+int32_t rtc_sync_trim = 0;
+int32_t rtc_sync_phase = 0;
+uint8_t rtc_sync_outlier_run = 0;
+bool rtc_sync_locked = false;
+uint32_t rtc_sync_edges = 0;
+uint32_t rtc_sync_outliers = 0;
+uint16_t rtc_sync_steps = 0;
+
+
 
 //
 // Functions
@@ -88,5 +150,290 @@ void Timer_RegisterCallback(void (*callback)(void))
 
 
 
+// RTC disciplining functions.
+
+
+// This converts a phase error (MCU clocks) into the tick-length trim that
+// would cancel it over one pulse period.
+// The error can be up to half a pulse period, so this is done as quotient
+// and remainder to keep the intermediate values within 32 bits.
+
+static int32_t Timer_SyncErrorToTrim_ISR(int32_t error)
+{
+  int32_t result;
+  int32_t ticks;
+
+  ticks = rtc_sync_ticks_per_pulse;
+
+  result = (error / ticks) * ((int32_t) 1 << TIMER_SYNC_FRAC_BITS);
+  result += ((error % ticks) * ((int32_t) 1 << TIMER_SYNC_FRAC_BITS))
+    / ticks;
+
+  return result;
+}
+
+
+
+// This clamps a trim value to the allowed range.
+
+static int32_t Timer_ClampSyncTrim_ISR(int32_t trim)
+{
+  int32_t limit;
+
+  limit = ((int32_t) rtc_sync_base_clocks)
+    << (TIMER_SYNC_FRAC_BITS - TIMER_SYNC_TRIM_LIMIT_SHIFT);
+
+  if (trim > limit)
+    trim = limit;
+  else if (trim < -limit)
+    trim = -limit;
+
+  return trim;
+}
+
+
+
+// This applies the current trim to the tick length.
+
+static void Timer_ApplySyncTrim_ISR(void)
+{
+  // Arithmetic shifts floor negative values, so whole + frac still adds
+  // up to base + trim. The fraction is scaled to fill 16 bits.
+  rtc_sync_whole_clocks =
+    rtc_sync_base_clocks + (int16_t) (rtc_sync_trim >> TIMER_SYNC_FRAC_BITS);
+  rtc_sync_frac_clocks =
+    ((uint16_t) rtc_sync_trim) << (16 - TIMER_SYNC_FRAC_BITS);
+
+  // Once the tick length has been touched, the RTC ISR has to keep
+  // rewriting it; Timer_Init() turns that off again.
+  if (0 != rtc_sync_trim)
+    rtc_sync_active = true;
+}
+
+
+
+// This steps the timestamp forward so that a sync edge lands as close as
+// possible to a pulse-grid boundary. If the edge came late in its tick,
+// the next tick becomes the boundary. Returns the remaining phase error.
+
+static int32_t Timer_StepSyncPhase_ISR(uint16_t tickphase, uint16_t count)
+{
+  int32_t result;
+  uint16_t target;
+
+  result = count;
+  target = 0;
+  if (count > (rtc_sync_base_clocks >> 1))
+  {
+    result -= rtc_sync_base_clocks;
+    target = rtc_sync_ticks_per_pulse - 1;
+  }
+
+  if (tickphase <= target)
+    rtc_timestamp += target - tickphase;
+  else
+    rtc_timestamp += (rtc_sync_ticks_per_pulse - tickphase) + target;
+
+  if (0xffff > rtc_sync_steps)
+    rtc_sync_steps++;
+
+  return result;
+}
+
+
+
+// This resets the RTC disciplining loop. It should be called by
+// Timer_Init(), with the nominal tick length in MCU clocks (OCRnA + 1).
+// The caller is responsible for any needed locking.
+
+void Timer_InitSync_ISR(uint16_t clocks_per_tick)
+{
+  Timer_SetSyncCapture_ISR(false, true);
+
+  rtc_sync_state = TIMER_SYNC_OFF;
+  rtc_sync_base_clocks = clocks_per_tick;
+  rtc_sync_integral = 0;
+  rtc_sync_trim = 0;
+  rtc_sync_phase = 0;
+  rtc_sync_outlier_run = 0;
+  rtc_sync_locked = false;
+  rtc_sync_edges = 0;
+  rtc_sync_outliers = 0;
+  rtc_sync_steps = 0;
+
+  rtc_sync_dither = 0;
+  Timer_ApplySyncTrim_ISR();
+  rtc_sync_active = false;
+}
+
+
+
+// This returns the length of the next tick in MCU clocks, dithering the
+// fractional part of the trim. The RTC ISR calls this after each tick
+// while rtc_sync_active is set, and writes OCRnA accordingly.
+
+uint16_t Timer_GetSyncPeriod_ISR(void)
+{
+  uint16_t result;
+  uint16_t olddither;
+
+  result = rtc_sync_whole_clocks;
+
+  olddither = rtc_sync_dither;
+  rtc_sync_dither += rtc_sync_frac_clocks;
+  if (rtc_sync_dither < olddither)
+    result++;
+
+  return result;
+}
+
+
+
+// This is the sync edge handler called from within the input capture ISR.
+// The timestamp is the RTC tick count at the edge, and the count is the
+// captured timer value (MCU clocks since that tick began).
+
+void Timer_HandleSyncEdge_ISR(uint32_t timestamp, uint16_t count)
+{
+  uint16_t tickphase;
+  int32_t error;
+  int32_t span;
+  int32_t offset;
+
+  if (TIMER_SYNC_OFF != rtc_sync_state)
+  {
+    if (0xfffffffful > rtc_sync_edges)
+      rtc_sync_edges++;
+
+    // Find where this edge fell relative to the pulse grid, wrapped to
+    // within half a pulse period.
+    tickphase = (uint16_t) (timestamp % rtc_sync_ticks_per_pulse);
+    span = ((int32_t) rtc_sync_ticks_per_pulse) * rtc_sync_base_clocks;
+    error = ((int32_t) tickphase) * rtc_sync_base_clocks + count;
+    if (error > (span >> 1))
+      error -= span;
+
+    if (TIMER_SYNC_ACQUIRE == rtc_sync_state)
+    {
+      // First edge. Move onto the grid; what's left is sub-tick phase.
+      error = Timer_StepSyncPhase_ISR(tickphase, count);
+      rtc_sync_state = TIMER_SYNC_FREQUENCY;
+    }
+    else if (TIMER_SYNC_FREQUENCY == rtc_sync_state)
+    {
+      // Second edge. The change in phase over one pulse period gives the
+      // frequency error; start the integrator there.
+      rtc_sync_integral =
+        Timer_ClampSyncTrim_ISR( rtc_sync_trim
+          + Timer_SyncErrorToTrim_ISR(error - rtc_sync_phase) );
+      rtc_sync_trim = rtc_sync_integral;
+      Timer_ApplySyncTrim_ISR();
+
+      error = Timer_StepSyncPhase_ISR(tickphase, count);
+      rtc_sync_outlier_run = 0;
+      rtc_sync_state = TIMER_SYNC_TRACK;
+    }
+    else if ( (error > (int32_t) rtc_sync_base_clocks)
+      || (error < -((int32_t) rtc_sync_base_clocks)) )
+    {
+      // More than a tick off. This is a glitch, unless it keeps happening.
+      if (0xfffffffful > rtc_sync_outliers)
+        rtc_sync_outliers++;
+      rtc_sync_outlier_run++;
+
+      if (TIMER_SYNC_MAX_OUTLIERS <= rtc_sync_outlier_run)
+      {
+        // Start over, keeping the frequency trim we have.
+        error = Timer_StepSyncPhase_ISR(tickphase, count);
+        rtc_sync_state = TIMER_SYNC_FREQUENCY;
+      }
+      else
+        // Ignore this edge.
+        error = rtc_sync_phase;
+    }
+    else
+    {
+      // Tracking. PI update, with rounding.
+      rtc_sync_outlier_run = 0;
+
+      offset = Timer_SyncErrorToTrim_ISR(error);
+      rtc_sync_integral = Timer_ClampSyncTrim_ISR( rtc_sync_integral
+        + ((offset + (1 << (TIMER_SYNC_KI_SHIFT - 1)))
+          >> TIMER_SYNC_KI_SHIFT) );
+      rtc_sync_trim = Timer_ClampSyncTrim_ISR( rtc_sync_integral
+        + ((offset + (1 << (TIMER_SYNC_KP_SHIFT - 1)))
+          >> TIMER_SYNC_KP_SHIFT) );
+      Timer_ApplySyncTrim_ISR();
+    }
+
+    rtc_sync_phase = error;
+    rtc_sync_locked = (TIMER_SYNC_TRACK == rtc_sync_state)
+      && (0 == rtc_sync_outlier_run)
+      && (error <= (rtc_sync_base_clocks >> TIMER_SYNC_LOCK_SHIFT))
+      && (error >= -(rtc_sync_base_clocks >> TIMER_SYNC_LOCK_SHIFT));
+  }
+}
+
+
+
+// Starts disciplining the RTC to an external sync pulse.
+
+void Timer_EnableSync(uint16_t ticks_per_pulse, bool rising_edge)
+{
+  if (1 > ticks_per_pulse)
+    ticks_per_pulse = 1;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Do nothing if the RTC isn't running.
+    if (0 < rtc_sync_base_clocks)
+    {
+      rtc_sync_ticks_per_pulse = ticks_per_pulse;
+      rtc_sync_phase = 0;
+      rtc_sync_outlier_run = 0;
+      rtc_sync_locked = false;
+      rtc_sync_state = TIMER_SYNC_ACQUIRE;
+      rtc_sync_active = true;
+
+      Timer_SetSyncCapture_ISR(true, rising_edge);
+    }
+  }
+}
+
+
+
+// Stops disciplining the RTC. The last frequency trim is kept (holdover);
+// Timer_Init() clears it.
+
+void Timer_DisableSync(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    Timer_SetSyncCapture_ISR(false, true);
+    rtc_sync_state = TIMER_SYNC_OFF;
+    rtc_sync_locked = false;
+  }
+}
+
+
+
+// Copies the RTC disciplining loop's state.
+
+void Timer_GetSyncStatus(timer_sync_status_t &status)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    status.state = rtc_sync_state;
+    status.locked = rtc_sync_locked;
+    status.phase_error = rtc_sync_phase;
+    status.trim = rtc_sync_trim;
+    status.edges = rtc_sync_edges;
+    status.outliers = rtc_sync_outliers;
+    status.steps = rtc_sync_steps;
+  }
+}
+
+
+
 //
 // This is the end of the file.
@@ -0,0 +1,310 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Common core - TWI (I2C) functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// Transactions are described by twi_transaction_t descriptors owned by the
+// caller. Queueing a transaction stores a pointer to it, so the descriptor
+// and its buffers have to stay valid until the transaction is finished.
+//
+// Each transaction writes zero or more bytes and then reads zero or more
+// bytes from one device. If it does both, a repeated start separates the
+// write and the read (the usual "set register pointer, then read" form).
+//
+// The TWI interrupt calls TWI_HandleStatus_ISR() with the hardware status
+// code after every bus event. That walks the current transaction through
+// start, address, data, and stop, and starts the next queued transaction
+// when one finishes. The foreground never waits on the bus.
+
+
+
+//
+// Macros
+
+#define TWI_QUEUE_MASK (TWI_QUEUE_SIZE - 1)
+
+
+
+//
+// Variables
+
+
+// TWI variables.
+
+// Queue of pending transactions.
+twi_transaction_t * volatile TWI_queue[TWI_QUEUE_SIZE];
+volatile uint8_t TWI_queue_head = 0;
+volatile uint8_t TWI_queue_tail = 0;
+
+// Transaction in progress, which phase it's in, and the next byte
+// position within that phase.
+twi_transaction_t * volatile TWI_current = NULL;
+volatile bool TWI_reading = false;
+volatile uint8_t TWI_byte_idx = 0;
+
+
+
+//
+// Functions
+
+
+// Private TWI functions.
+
+
+// This pops the next queued transaction and makes it current.
+// Returns false if there wasn't one.
+
+bool TWI_PopNext_ISR(void)
+{
+  bool result;
+
+  result = false;
+
+  if (TWI_queue_head != TWI_queue_tail)
+  {
+    TWI_current = TWI_queue[TWI_queue_tail];
+    TWI_queue_tail = (TWI_queue_tail + 1) & TWI_QUEUE_MASK;
+
+    TWI_current->state = TWI_XFER_ACTIVE;
+    // Zero-length transactions write nothing, which is a probe.
+    TWI_reading = (0 == TWI_current->write_length)
+      && (0 < TWI_current->read_length);
+    TWI_byte_idx = 0;
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+// This finishes the current transaction with the specified state, and
+// either releases the bus or starts the next transaction.
+
+void TWI_Finish_ISR(uint8_t new_state)
+{
+  twi_transaction_t *transaction;
+
+  transaction = TWI_current;
+  TWI_current = NULL;
+
+  if (NULL != transaction)
+  {
+    transaction->state = new_state;
+
+    if (NULL != transaction->callback_ISR)
+      (*(transaction->callback_ISR))(transaction);
+  }
+
+  // The callback may have queued another transaction.
+  TWI_SendStop_ISR(TWI_PopNext_ISR());
+}
+
+
+// This discards all queued transactions and resets the queue.
+// The caller is responsible for any needed locking.
+
+void TWI_InitQueue_ISR(void)
+{
+  uint8_t qidx;
+
+  if (NULL != TWI_current)
+  {
+    TWI_current->state = TWI_XFER_IDLE;
+    TWI_current = NULL;
+  }
+
+  for (qidx = TWI_queue_tail; qidx != TWI_queue_head;
+    qidx = (qidx + 1) & TWI_QUEUE_MASK)
+    TWI_queue[qidx]->state = TWI_XFER_IDLE;
+
+  TWI_queue_head = 0;
+  TWI_queue_tail = 0;
+  TWI_reading = false;
+  TWI_byte_idx = 0;
+}
+
+
+// This advances the current transaction after a bus event.
+// It's called from the TWI interrupt with the masked status code.
+
+void TWI_HandleStatus_ISR(uint8_t status)
+{
+  twi_transaction_t *transaction;
+
+  transaction = TWI_current;
+
+  if (NULL == transaction)
+  {
+    // Nothing in progress. Release the bus.
+    TWI_SendStop_ISR(false);
+  }
+  else
+  {
+    switch (status)
+    {
+      case TWI_STATUS_START:
+      case TWI_STATUS_RESTART:
+        // Send the device address and the read/write flag.
+        TWI_byte_idx = 0;
+        TWI_SendByte_ISR( (transaction->address << 1)
+          | (TWI_reading ? 1 : 0) );
+        break;
+
+      case TWI_STATUS_WADDR_ACK:
+      case TWI_STATUS_WDATA_ACK:
+        if (TWI_byte_idx < transaction->write_length)
+        {
+          TWI_SendByte_ISR(transaction->write_data[TWI_byte_idx]);
+          TWI_byte_idx++;
+        }
+        else if (0 < transaction->read_length)
+        {
+          // Switch to reading with a repeated start.
+          TWI_reading = true;
+          TWI_SendStart_ISR();
+        }
+        else
+          TWI_Finish_ISR(TWI_XFER_DONE);
+        break;
+
+      case TWI_STATUS_RADDR_ACK:
+        if (0 == transaction->read_length)
+          TWI_Finish_ISR(TWI_XFER_DONE);
+        else
+          // NACK the last byte, to tell the device we're done.
+          TWI_ReceiveByte_ISR(1 < transaction->read_length);
+        break;
+
+      case TWI_STATUS_RDATA_ACK:
+        transaction->read_data[TWI_byte_idx] = TWI_ReadByte_ISR();
+        TWI_byte_idx++;
+        TWI_ReceiveByte_ISR((TWI_byte_idx + 1) < transaction->read_length);
+        break;
+
+      case TWI_STATUS_RDATA_NACK:
+        transaction->read_data[TWI_byte_idx] = TWI_ReadByte_ISR();
+        TWI_byte_idx++;
+        TWI_Finish_ISR(TWI_XFER_DONE);
+        break;
+
+      case TWI_STATUS_WADDR_NACK:
+      case TWI_STATUS_WDATA_NACK:
+      case TWI_STATUS_RADDR_NACK:
+        TWI_Finish_ISR(TWI_XFER_NACK);
+        break;
+
+      default:
+        // Arbitration lost, bus error, or something we don't expect.
+        TWI_Finish_ISR(TWI_XFER_BUSERR);
+        break;
+    }
+  }
+}
+
+
+// Public TWI functions.
+
+
+// Queues a transaction from within an ISR or other locked code.
+// Returns false if the queue is full or the transaction is already pending.
+
+bool TWI_QueueTransaction_ISR(twi_transaction_t &transaction)
+{
+  bool result;
+  uint8_t next_head;
+
+  result = false;
+
+  next_head = (TWI_queue_head + 1) & TWI_QUEUE_MASK;
+
+  if ( (next_head != TWI_queue_tail)
+    && (TWI_XFER_QUEUED != transaction.state)
+    && (TWI_XFER_ACTIVE != transaction.state) )
+  {
+    transaction.state = TWI_XFER_QUEUED;
+    TWI_queue[TWI_queue_head] = &transaction;
+    TWI_queue_head = next_head;
+
+    // If the bus is idle, start this one.
+    if (NULL == TWI_current)
+      if (TWI_PopNext_ISR())
+        TWI_SendStart_ISR();
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+// Queues a transaction.
+// Returns false if the queue is full or the transaction is already pending.
+
+bool TWI_QueueTransaction(twi_transaction_t &transaction)
+{
+  bool result;
+
+  result = false;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = TWI_QueueTransaction_ISR(transaction);
+  }
+
+  return result;
+}
+
+
+// Returns true if the specified transaction has finished (successfully
+// or not).
+
+bool TWI_IsTransactionDone(twi_transaction_t &transaction)
+{
+  uint8_t state;
+
+  state = transaction.state;
+
+  return (TWI_XFER_DONE == state) || (TWI_XFER_NACK == state)
+    || (TWI_XFER_BUSERR == state);
+}
+
+
+// Blocks until the specified transaction finishes.
+// Interrupts are still handled during this time.
+
+void TWI_WaitForTransaction(twi_transaction_t &transaction)
+{
+  while ( (TWI_XFER_QUEUED == transaction.state)
+    || (TWI_XFER_ACTIVE == transaction.state) )
+  {
+    // Busy-wait so as to not hammer the state variable.
+    _delay_loop_1(200);
+  }
+}
+
+
+// Returns true if a transaction is in progress or queued.
+
+bool TWI_IsBusy(void)
+{
+  return (NULL != TWI_current) || (TWI_queue_head != TWI_queue_tail);
+}
+
+
+
+//
+// This is the end of the file.
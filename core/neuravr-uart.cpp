@@ -11,9 +11,6 @@
 #include "neuravr.h"
 #include "neuravr-private.h"
 
-// FIXME - We're using snprintf().
-#include <stdio.h>
-
 
 
 //
@@ -24,6 +21,18 @@
 
 
 
+//
+// Types
+
+// A received line and its completion timestamp (for latency measurement).
+typedef struct
+{
+  char text[UART_LINE_SIZE];
+  uint32_t timestamp;
+} uart_line_t;
+
+
+
 //
 // Variables
 
@@ -31,9 +40,10 @@
 // UART variables.
 
 // Receive buffer. This is line-oriented and null-terminated.
-char UART_recvlines[UART_LINE_COUNT * UART_LINE_SIZE];
-int rowcount, oldestrow, newestrow;
-int recvcharptr;
+// The receive interrupt fills the ring's write slot and publishes it at
+// end-of-line; the polling loop reads and releases completed lines.
+NeurAVR_Ring<uart_line_t, UART_LINE_COUNT> UART_recvlines;
+uint8_t recvcharptr;
 
 // User-supplied transmit buffer. This is a null-terminated string.
 char *UART_transbuf;
@@ -43,6 +53,10 @@ bool trans_is_flash;
 // Behavior flags.
 bool uart_filter_empty_lines;
 
+// User-supplied receive hook. If set, this gets characters instead of the
+// line buffer.
+void (*uart_recv_hook)(char recvchar) = NULL;
+
 // Scratch string for printing.
 char scratchstr[INT_SCRATCH_CHARS];
 
@@ -61,19 +75,33 @@ char scratchstr[INT_SCRATCH_CHARS];
 char *UART_GetNextLine(void)
 {
   char *result;
+  uart_line_t *thisline;
 
   result = NULL;
 
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-  {
-    if (0 < rowcount)
-    {
-      // This is equivalent to &UART_recvlines[oldestrow * UART_LINE_SIZE].
-      result = UART_recvlines + (oldestrow << UART_LINE_BITS);
-    }
+  // Don't release the line for now - the entry has to remain valid.
+  thisline = UART_recvlines.GetReadSlot();
+  if (NULL != thisline)
+    result = thisline->text;
 
-    // Don't adjust row counts for now - the entry has to remain valid.
-  }
+  return result;
+}
+
+
+
+// Returns the RTC timestamp of when the line returned by UART_GetNextLine()
+// was completed.
+
+uint32_t UART_GetLineTimestamp(void)
+{
+  uint32_t result;
+  uart_line_t *thisline;
+
+  result = 0;
+
+  thisline = UART_recvlines.GetReadSlot();
+  if (NULL != thisline)
+    result = thisline->timestamp;
 
   return result;
 }
@@ -85,16 +113,10 @@ char *UART_GetNextLine(void)
 
 void UART_DoneWithLine(void)
 {
-  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-  {
-    // Get rid of the oldest line. We don't actually care if the user
-    // asked for a pointer to it or not.
-    if (0 < rowcount)
-    {
-      oldestrow = (oldestrow + 1) & (UART_LINE_COUNT - 1);
-      rowcount--;
-    }
-  }
+  // Get rid of the oldest line. We don't actually care if the user
+  // asked for a pointer to it or not.
+  if (!UART_recvlines.IsEmpty())
+    UART_recvlines.Release();
 }
 
 
@@ -189,14 +211,9 @@ bool UART_IsSendInProgress(void)
 
 void UART_InitBuffers_ISR(void)
 {
-  // Initialize all received rows to null-terminated empty strings.
-  for (rowcount = 0; rowcount < UART_LINE_COUNT; rowcount++)
-    UART_recvlines[rowcount << UART_LINE_BITS] = 0;
-
-  // Initialize tracking variables.
-  rowcount = 0;
-  oldestrow = 0;
-  newestrow = 0;
+  // Discard received lines, and start an empty line in the write slot.
+  UART_recvlines.Reset();
+  UART_recvlines.GetWriteSlot()->text[0] = 0;
   recvcharptr = 0;
 
   // Initialize transmit buffer.
@@ -215,9 +232,18 @@ void UART_InitBuffers_ISR(void)
 void UART_HandleRecvChar_ISR(char recvchar)
 {
   static bool saw_cr = false;
+  uart_line_t *thisline;
+
+  // We always have an incomplete line in the write slot; see below.
+  thisline = UART_recvlines.GetWriteSlot();
 
   // Process this character.
-  if (saw_cr && ('\n' == recvchar))
+  if (NULL != uart_recv_hook)
+  {
+    // The hook does its own end-of-line handling.
+    (*uart_recv_hook)(recvchar);
+  }
+  else if (saw_cr && ('\n' == recvchar))
   {
     // Do nothing else.
     // Ignore the "LF" in "CRLF" even if filtering is off.
@@ -241,21 +267,24 @@ void UART_HandleRecvChar_ISR(char recvchar)
       // Terminate this line.
       if (recvcharptr >= UART_LINE_SIZE)
         recvcharptr = UART_LINE_SIZE - 1;
-      UART_recvlines[(newestrow << UART_LINE_BITS) + recvcharptr] = 0;
-
-      // Advance to the next line. If we're full, stay on this line.
-      // NOTE - "rowcount" is the number of _completed_ lines. We always
-      // have one _incomplete_ line we're working on, so the true cap is
-      // UART_LINE_COUNT - 1, not UART_LINE_COUNT.
-      if (rowcount < (UART_LINE_COUNT - 1))
+      thisline->text[recvcharptr] = 0;
+      thisline->timestamp = Timer_Query_ISR();
+
+      // Publish this line. If we're full, stay on this line.
+      // NOTE - We always have one _incomplete_ line we're working on, in
+      // the ring's write slot, so the true cap is UART_LINE_COUNT - 1
+      // completed lines, not UART_LINE_COUNT.
+      if (1 < UART_recvlines.GetFree())
       {
-        newestrow = (newestrow + 1) & (UART_LINE_COUNT - 1);
-        rowcount++;
+        UART_recvlines.Publish();
+        thisline = UART_recvlines.GetWriteSlot();
       }
+      else
+        FLIGHT_Record_ISR(FLIGHT_EV_UART_DROP, FLIGHT_UART_LINE_LOST, 0);
 
       // New line or the same line, terminate it and initialize our
       // character pointer.
-      UART_recvlines[newestrow << UART_LINE_BITS] = 0;
+      thisline->text[0] = 0;
       recvcharptr = 0;
     }
   }
@@ -267,10 +296,16 @@ void UART_HandleRecvChar_ISR(char recvchar)
     // Let the application do that. It might _want_ them.
     if (recvcharptr < UART_LINE_SIZE)
     {
-      UART_recvlines[(newestrow << UART_LINE_BITS) + recvcharptr] = recvchar;
+      thisline->text[recvcharptr] = recvchar;
       recvcharptr++;
       // Don't terminate this string. We do that on end-of-line.
     }
+    else if (UART_LINE_SIZE == recvcharptr)
+    {
+      // Only record the first character dropped from each line.
+      FLIGHT_Record_ISR(FLIGHT_EV_UART_DROP, FLIGHT_UART_LINE_TRUNCATED, 0);
+      recvcharptr++;
+    }
   }
 
   // Update our CRLF tracking.
@@ -339,6 +374,19 @@ void UART_SetLineFiltering(bool new_state)
 
 
 
+// Specifies a user-defined function to call from the receive interrupt
+// with each received character, instead of buffering lines.
+
+void UART_RegisterRecvHook(void (*hook_ISR)(char recvchar))
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart_recv_hook = hook_ISR;
+  }
+}
+
+
+
 // Formatted printing functions.
 
 // Single-character output.
@@ -356,18 +404,18 @@ void UART_PrintChar(char value)
 
 
 // Formatted integers.
-// FIXME - These use snprintf(), which is slow and uses malloc().
-// Live with it, because writing my own is error-prone.
+// These use the fast-printing routines rather than snprintf(), which is
+// slow and pulls in malloc().
 
 void UART_PrintUInt(uint32_t value)
 {
+  uint8_t digits;
+
   // Make sure we aren't still using the scratch string.
   UART_WaitForSendDone();
 
-  // This always null-terminates, since we have extra space.
-  // It's supposed to no matter what, but extra space helps.
-  // NOTE - Need the explicit cast for compiling the emulated version.
-  snprintf(scratchstr, INT_SCRATCH_CHARS, "%lu", (unsigned long) value);
+  digits = UTIL_WriteDec(scratchstr, value);
+  scratchstr[digits] = 0;
 
   UART_QueueSend(scratchstr);
 }
@@ -375,13 +423,20 @@ void UART_PrintUInt(uint32_t value)
 
 void UART_PrintSInt(int32_t value)
 {
+  uint8_t digits;
+
   // Make sure we aren't still using the scratch string.
   UART_WaitForSendDone();
 
-  // This always null-terminates, since we have extra space.
-  // It's supposed to no matter what, but extra space helps.
-  // NOTE - Need the explicit cast for compiling the emulated version.
-  snprintf(scratchstr, INT_SCRATCH_CHARS, "%ld", (long) value);
+  // NOTE - Negate as unsigned, so that INT32_MIN comes out right.
+  if (0 > value)
+  {
+    scratchstr[0] = '-';
+    digits = 1 + UTIL_WriteDec(scratchstr + 1, 0ul - ((uint32_t) value));
+  }
+  else
+    digits = UTIL_WriteDec(scratchstr, value);
+  scratchstr[digits] = 0;
 
   UART_QueueSend(scratchstr);
 }
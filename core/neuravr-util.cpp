@@ -20,6 +20,11 @@ const char hexdigits[16] =
 { '0', '1', '2', '3', '4', '5', '6', '7',
   '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
 
+// Powers of ten for decimal printing, largest first.
+const uint32_t decpowers[9] =
+{ 1000000000ul, 100000000ul, 10000000ul, 1000000ul, 100000ul,
+  10000ul, 1000ul, 100ul, 10ul };
+
 
 
 //
@@ -45,6 +50,45 @@ void UTIL_WriteHex(char *buffer, uint32_t data, uint8_t digits)
 }
 
 
+// This renders an integer as decimal digits into a string.
+// Each digit is found by repeated subtraction, which is at most nine
+// 32-bit subtractions; that's far cheaper than a 32-bit division on the
+// AVR.
+
+uint8_t UTIL_WriteDec(char *buffer, uint32_t data)
+{
+  uint8_t pidx, bidx;
+  char thisdigit;
+  uint32_t thispower;
+
+  bidx = 0;
+
+  for (pidx = 0; pidx < 9; pidx++)
+  {
+    thispower = decpowers[pidx];
+    thisdigit = '0';
+    while (data >= thispower)
+    {
+      data -= thispower;
+      thisdigit++;
+    }
+
+    // Skip leading zeroes.
+    if ( (0 < bidx) || ('0' != thisdigit) )
+    {
+      buffer[bidx] = thisdigit;
+      bidx++;
+    }
+  }
+
+  // The ones digit is always printed.
+  buffer[bidx] = '0' + (char) data;
+  bidx++;
+
+  return bidx;
+}
+
+
 
 //
 // This is the end of the file.
@@ -14,8 +14,13 @@
 
 #ifdef NEUREMU
 
+#ifdef NEUREMU_REGS
+// Register-level emulation library. This runs the real backend.
+#include "neur-emuregs.h"
+#else
 // Emulation library.
 #include "neur-emu.h"
+#endif
 
 #else
 
@@ -44,6 +49,272 @@
 #endif
 
 
+// Lock-free ring buffer template.
+#include "neuravr-ring.h"
+
+
+//
+// Macros
+
+
+// Scope pin instrumentation.
+// Build the library (and application) with -DNEURAVR_SCOPE_PINS=1 to drive
+// spare pins high while the RTC ISR, the UART ISRs, ADC sequencing, and
+// app framework tick handlers are running, for viewing on a logic analyzer.
+// Pin assignments are in the architecture-specific header. Each edge is a
+// single SBI/CBI instruction (2 cycles). Emulation builds ignore this.
+// A signal with a mask of 0 has no pin; its macros compile to nothing.
+// NOTE - Nested RTC interrupts end the outer RTC pulse early.
+
+#ifndef NEURAVR_SCOPE_PINS
+#define NEURAVR_SCOPE_PINS 0
+#endif
+
+#if NEURAVR_SCOPE_PINS && !defined(NEUREMU)
+#define SCOPE_INIT(X) do { if (0 != (SCOPE_MASK_ ## X)) \
+  SCOPE_DDR_ ## X |= SCOPE_MASK_ ## X; } while (0)
+#define SCOPE_RAISE(X) do { if (0 != (SCOPE_MASK_ ## X)) \
+  SCOPE_PORT_ ## X |= SCOPE_MASK_ ## X; } while (0)
+#define SCOPE_LOWER(X) do { if (0 != (SCOPE_MASK_ ## X)) \
+  SCOPE_PORT_ ## X &= ~(SCOPE_MASK_ ## X); } while (0)
+#else
+#define SCOPE_INIT(X) do {} while (0)
+#define SCOPE_RAISE(X) do {} while (0)
+#define SCOPE_LOWER(X) do {} while (0)
+#endif
+
+
+// SPI transfer states.
+
+#define SPI_XFER_IDLE 0
+#define SPI_XFER_QUEUED 1
+#define SPI_XFER_ACTIVE 2
+#define SPI_XFER_DONE 3
+
+
+// TWI transaction states.
+// NACK means the device didn't acknowledge its address or a written byte.
+// BUSERR means arbitration was lost or the bus misbehaved.
+
+#define TWI_XFER_IDLE 0
+#define TWI_XFER_QUEUED 1
+#define TWI_XFER_ACTIVE 2
+#define TWI_XFER_DONE 3
+#define TWI_XFER_NACK 4
+#define TWI_XFER_BUSERR 5
+
+
+// RTC sync states (see Timer_EnableSync()).
+// The first edge steps the tick count onto the pulse grid, the second
+// measures the frequency error (and steps again), and after that the
+// compare value is trimmed continuously.
+
+#define TIMER_SYNC_OFF 0
+#define TIMER_SYNC_ACQUIRE 1
+#define TIMER_SYNC_FREQUENCY 2
+#define TIMER_SYNC_TRACK 3
+
+
+// DDS output modes (see DDS_Init()).
+
+#define DDS_OUTPUT_NONE 0
+#define DDS_OUTPUT_PWM 1
+#define DDS_OUTPUT_IO8 2
+#define DDS_OUTPUT_SPI 3
+
+
+// DDS waveforms.
+// Wavetables have DDS_TABLE_SIZE entries covering one full cycle.
+
+#define DDS_WAVE_SINE 0
+#define DDS_WAVE_TRIANGLE 1
+#define DDS_WAVE_SQUARE 2
+#define DDS_WAVE_SAWTOOTH 3
+#define DDS_WAVE_TABLE 4
+
+#define DDS_TABLE_SIZE 256
+
+
+// Flight recorder event types (see FLIGHT_Record()).
+// "Detail" and "data" depend on the event:
+// RESET: reset flags, and the number of resets the recorder survived.
+// COMMAND: first character of the command, and the other two (high byte
+//   first).
+// REPORT_DROP: report tag letter, and the low 16 bits of the drop count.
+// TICK_OVERRUN: 0, and the low 16 bits of the skipped tick count.
+// UART_DROP: FLIGHT_UART_xx, and 0.
+// ADC_OVERRUN: report tag letter, and the low 16 bits of the overrun count.
+// Event types from FLIGHT_EV_USER up are for applications.
+
+#define FLIGHT_EV_RESET 1
+#define FLIGHT_EV_COMMAND 2
+#define FLIGHT_EV_REPORT_DROP 3
+#define FLIGHT_EV_TICK_OVERRUN 4
+#define FLIGHT_EV_UART_DROP 5
+#define FLIGHT_EV_ADC_OVERRUN 6
+#define FLIGHT_EV_USER 0x80
+
+
+// UART drop reasons.
+
+#define FLIGHT_UART_LINE_LOST 0
+#define FLIGHT_UART_LINE_TRUNCATED 1
+#define FLIGHT_UART_COMMAND_LOST 2
+
+
+// Reset cause flags. These match MCUSR's bits on all supported chips.
+// NOTE - Bootloaders often clear these before the application starts.
+
+#define FLIGHT_RESET_POWERON 0x01
+#define FLIGHT_RESET_EXTERNAL 0x02
+#define FLIGHT_RESET_BROWNOUT 0x04
+#define FLIGHT_RESET_WATCHDOG 0x08
+#define FLIGHT_RESET_JTAG 0x10
+
+
+// Memory pool sizing.
+// Blocks are padded to a multiple of the pointer size, since free blocks
+// hold the free list link. POOL_STORAGE() declares suitably sized and
+// aligned storage for "count" blocks of "size" bytes.
+
+#define POOL_BLOCK_BYTES(size) \
+  ( ((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1) )
+#define POOL_STORAGE(name, size, count) \
+  void *name[ (POOL_BLOCK_BYTES(size) / sizeof(void *)) * (count) ]
+
+
+// Fixed-point constants.
+// Q15 values are int16_t with 15 fractional bits, covering [-1, 1).
+// Q16 values are int32_t with 16 fractional bits.
+// These use floating-point math, so only use them on compile-time
+// constants (where the compiler folds them).
+
+#define FIXED_Q15(X) ((int16_t) ((X) * 32768.0 + (((X) < 0) ? -0.5 : 0.5)))
+#define FIXED_Q16(X) ((int32_t) ((X) * 65536.0 + (((X) < 0) ? -0.5 : 0.5)))
+
+
+
+//
+// Typedefs
+
+// NOTE - This header may be included more than once (neurapp-oo.h includes
+// it too). Prototypes and macros don't mind that, but typedefs do.
+
+#ifndef NEURAVR_TYPEDEFS
+#define NEURAVR_TYPEDEFS
+
+
+// SPI transfer descriptor.
+// Data is sent from tx_data and received into rx_data; either may be NULL
+// (sending zeroes or discarding input). If cs_mask is nonzero, the chip
+// select line is held low for the transfer: cs_mask bits on cs_port, or
+// the SS pin if cs_port is NULL. The callback (if any) is called from the
+// SPI interrupt when the transfer finishes.
+
+typedef struct spi_transfer_s
+{
+  uint8_t *tx_data;
+  uint8_t *rx_data;
+  uint8_t length;
+  volatile uint8_t *cs_port;
+  uint8_t cs_mask;
+  void (*callback_ISR)(struct spi_transfer_s *transfer);
+  volatile uint8_t state;
+} spi_transfer_t;
+
+
+// Double-buffered SPI transfer.
+// Set this up with SPI_InitDoubleBuffer() rather than touching it directly.
+
+typedef struct
+{
+  spi_transfer_t banks[2];
+  uint8_t tx_data[2][SPI_DBUF_BYTES];
+  uint8_t rx_data[2][SPI_DBUF_BYTES];
+  volatile uint8_t active;
+  volatile bool tx_staged;
+  volatile bool rx_fresh;
+  volatile uint16_t overruns;
+} spi_doublebuf_t;
+
+
+// TWI (I2C) transaction descriptor.
+// This writes write_length bytes to the 7-bit address, then reads
+// read_length bytes from it (with a repeated start in between if both are
+// nonzero). If both are zero, this just checks whether the address is
+// acknowledged. The callback (if any) is called from the TWI interrupt
+// when the transaction finishes, successfully or not.
+
+typedef struct twi_transaction_s
+{
+  uint8_t address;
+  uint8_t *write_data;
+  uint8_t write_length;
+  uint8_t *read_data;
+  uint8_t read_length;
+  void (*callback_ISR)(struct twi_transaction_s *transaction);
+  volatile uint8_t state;
+} twi_transaction_t;
+
+
+// RTC sync status snapshot (see Timer_GetSyncStatus()).
+// Phase error is in MCU clocks at the most recent sync edge; positive
+// means the RTC is ahead of the reference. Trim is the adjustment to the
+// tick length, in 1/4096ths of an MCU clock.
+
+typedef struct
+{
+  uint8_t state;
+  bool locked;
+  int32_t phase_error;
+  int32_t trim;
+  uint32_t edges;
+  uint32_t outliers;
+  uint16_t steps;
+} timer_sync_status_t;
+
+
+// Flight recorder entry.
+// The timestamp is in RTC ticks; the RTC restarts from 0 after a reset.
+
+typedef struct
+{
+  uint32_t timestamp;
+  uint8_t event;
+  uint8_t detail;
+  uint16_t data;
+} flight_record_t;
+
+
+// Fixed-block memory pool.
+// Set this up with POOL_Init() rather than touching it directly.
+
+typedef struct
+{
+  void *free_list;
+  uint8_t *storage_start;
+  uint8_t *storage_end;
+  uint16_t block_bytes;
+  uint8_t block_count;
+  uint8_t in_use;
+  uint8_t peak_in_use;
+  uint16_t failures;
+} pool_t;
+
+
+// Precomputed reciprocal for fast unsigned 16-bit division by a constant.
+// Set this up with FIXED_MakeRecip16() rather than touching it directly.
+
+typedef struct
+{
+  uint16_t mult;
+  uint8_t shift;
+} fixed_recip16_t;
+
+
+#endif
+
+
 //
 // Functions
 
@@ -70,6 +341,24 @@ uint32_t Timer_Query(void);
 // locked code. This avoids an ATOMIC_BLOCK call.
 uint32_t Timer_Query_ISR(void);
 
+// Starts disciplining the RTC to an external sync pulse, connected to the
+// RTC timer's input capture pin (328p: B0, Uno Dig8; 2560: L1, Mega Dig48;
+// 32u4: D4, Leonardo Dig4). The pulse period must be a whole number of
+// RTC ticks. Edges are then kept on tick boundaries whose timestamps are
+// multiples of ticks_per_pulse, so boards sharing a sync line agree on
+// their tick counts. The pulse period has to be under 2^31 MCU clocks
+// (about two minutes at 16 MHz).
+// NOTE - Acquiring lock steps the timestamp forward by up to one pulse
+// period (twice). Call this after Timer_Init().
+void Timer_EnableSync(uint16_t ticks_per_pulse, bool rising_edge);
+
+// Stops disciplining the RTC. The last frequency trim is kept (holdover);
+// Timer_Init() clears it.
+void Timer_DisableSync(void);
+
+// Copies the RTC disciplining loop's state.
+void Timer_GetSyncStatus(timer_sync_status_t &status);
+
 // Specifies a user-defined function to call during timer interrupts.
 // _All_ interrupts, not just timer interrupts, are disabled while this
 // runs, so it has to return very quickly.
@@ -168,6 +457,10 @@ uint32_t UART_QueryBaud(void);
 // complete line has been received yet.
 char *UART_GetNextLine(void);
 
+// Returns the RTC timestamp of when the line returned by UART_GetNextLine()
+// was completed (when its end-of-line character arrived).
+uint32_t UART_GetLineTimestamp(void);
+
 // Tells the UART manager that we're done with the line we requested a
 // pointer to.
 void UART_DoneWithLine(void);
@@ -192,6 +485,234 @@ bool UART_IsSendInProgress(void);
 // This saves buffer space but feels less interactive to users.
 void UART_SetLineFiltering(bool new_state);
 
+// Specifies a user-defined function to call from the receive interrupt
+// with each received character, instead of buffering lines. End-of-line
+// characters are passed through too. NULL restores line buffering.
+// UART_GetNextLine() returns nothing new while a hook is registered.
+// _All_ interrupts are disabled while this runs, so it has to return very
+// quickly.
+void UART_RegisterRecvHook(void (*hook_ISR)(char recvchar));
+
+
+// SPI functions.
+// This is an interrupt-driven master. The 328p's SPI pins overlap GP5..GP7,
+// which are unavailable while SPI is on. The 2560's don't overlap.
+
+// Configures the SPI port as a master with the specified bit rate (rounded
+// down to mcu_hz / 2..128) and mode (0..3). A bit rate of 0 turns it off.
+// Any queued transfers are discarded.
+// Rates below mcu_hz / 128 are clamped _up_ to mcu_hz / 128. Check
+// SPI_QueryBitRate() if the device has a maximum clock.
+void SPI_Init(uint32_t mcu_hz, uint32_t bit_rate, uint8_t spi_mode);
+
+// Returns the actual bit rate set, or 0 if SPI is off.
+uint32_t SPI_QueryBitRate(void);
+
+// Queues a transfer. The descriptor and its buffers must stay valid until
+// the transfer is done.
+// Returns false if the queue is full or the transfer is already pending.
+bool SPI_QueueTransfer(spi_transfer_t &transfer);
+
+// Queues a transfer from within an ISR or other locked code.
+// This avoids an ATOMIC_BLOCK call.
+bool SPI_QueueTransfer_ISR(spi_transfer_t &transfer);
+
+// Returns true if the specified transfer has finished.
+bool SPI_IsTransferDone(spi_transfer_t &transfer);
+
+// Blocks until the specified transfer finishes.
+// Interrupts are still handled during this time.
+void SPI_WaitForTransfer(spi_transfer_t &transfer);
+
+// Returns true if a transfer is in progress or queued.
+bool SPI_IsBusy(void);
+
+// Sets up a double-buffered transfer of "length" bytes (at most
+// SPI_DBUF_BYTES). Chip select works as for single transfers.
+void SPI_InitDoubleBuffer(spi_doublebuf_t &dbuf, uint8_t length,
+  volatile uint8_t *cs_port, uint8_t cs_mask);
+
+// Swaps banks and starts the next double-buffered transfer. This is meant
+// to be called from the RTC tick callback, to service external converters
+// at a fixed rate.
+// Returns false (and counts an overrun) if the previous transfer hasn't
+// finished yet.
+bool SPI_TriggerDoubleBuffer_ISR(spi_doublebuf_t &dbuf);
+
+// Stages transmit data for the next double-buffered transfer. If nothing
+// is staged, the previous data is sent again.
+void SPI_WriteDoubleBuffer(spi_doublebuf_t &dbuf, const uint8_t *data);
+
+// Copies out the most recently received double-buffered data.
+// Returns true if there was new data since the last call.
+bool SPI_ReadDoubleBuffer(spi_doublebuf_t &dbuf, uint8_t *data);
+
+
+// TWI (I2C) functions.
+// This is an interrupt-driven master. The 328p's TWI pins are shared with
+// ADC4 and ADC5, which are unavailable while TWI is on.
+
+// Configures the TWI port as a master with the specified bit rate (rounded
+// down to what the hardware can do; usually 100000 or 400000). A bit rate
+// of 0 turns it off. Any queued transactions are discarded.
+void TWI_Init(uint32_t mcu_hz, uint32_t bit_rate);
+
+// Returns the actual bit rate set, or 0 if TWI is off.
+uint32_t TWI_QueryBitRate(void);
+
+// Queues a transaction. The descriptor and its buffers must stay valid
+// until the transaction is finished.
+// Returns false if the queue is full or the transaction is already pending.
+bool TWI_QueueTransaction(twi_transaction_t &transaction);
+
+// Queues a transaction from within an ISR or other locked code.
+// This avoids an ATOMIC_BLOCK call.
+bool TWI_QueueTransaction_ISR(twi_transaction_t &transaction);
+
+// Returns true if the specified transaction has finished (successfully
+// or not). Check its state to see which.
+bool TWI_IsTransactionDone(twi_transaction_t &transaction);
+
+// Blocks until the specified transaction finishes.
+// Interrupts are still handled during this time.
+void TWI_WaitForTransaction(twi_transaction_t &transaction);
+
+// Returns true if a transaction is in progress or queued.
+bool TWI_IsBusy(void);
+
+
+// EEPROM configuration store functions.
+// This keeps CONFIG_DATA_BYTES of application settings in a RAM mirror,
+// and writes changes back to EEPROM in the background. Records are
+// checksummed and rotated among CONFIG_SLOT_COUNT slots for wear leveling.
+
+// Loads the newest valid record from EEPROM into the RAM mirror. This is
+// fast enough to call during state initialization.
+// Returns false (and zeroes the mirror) if there wasn't one.
+bool CONFIG_Init(void);
+
+// Copies configuration data out of the RAM mirror.
+// Returns false (copying nothing) if the range is out of bounds.
+bool CONFIG_Read(uint8_t offset, void *data, uint8_t length);
+
+// Returns one byte of configuration data, or 0 if out of bounds.
+uint8_t CONFIG_ReadByte(uint8_t offset);
+
+// Copies data into the RAM mirror. If anything changed, a new record is
+// written to EEPROM in the background. This doesn't block.
+// Returns false (copying nothing) if the range is out of bounds.
+bool CONFIG_Write(uint8_t offset, const void *data, uint8_t length);
+
+// Writes one byte of configuration data.
+// Returns false if out of bounds.
+bool CONFIG_WriteByte(uint8_t offset, uint8_t value);
+
+// Returns true if changes haven't been completely written to EEPROM yet.
+bool CONFIG_IsWritePending(void);
+
+// Blocks until any pending write-back finishes. This takes about 3.3 ms
+// per changed byte.
+// Interrupts are still handled during this time.
+void CONFIG_WaitForWrite(void);
+
+
+// Direct digital synthesis functions.
+// This plays a waveform at a fixed sample rate from its own timer
+// interrupt, with no host involvement. The sample timer and PWM output
+// are 328p: Timer 0 and Timer 2 (OC2B, D3, Uno Dig3); 2560: Timer 4 and
+// Timer 3 (OC3A, E3, Mega Dig5); 32u4: Timer 3 and Timer 0 (OC0B, D0,
+// Leonardo Dig3, shared with TWI). PWM runs at MCU clock / 256.
+// Frequency changes are phase-continuous. Other changes (and stopping)
+// wait for the end of the current cycle, where waves are at zero.
+
+// Configures the sample timer and output. Call this after Timer_Init()
+// (which unhooks all timers). For SPI output, call SPI_Init() first; the
+// DAC's chip select is the SS pin unless DDS_SetSPIChipSelect() says
+// otherwise. For IO8 output, the whole GPIO bank has to be outputs.
+// A sample rate of 0 turns the DDS engine off.
+// Output starts stopped, at mid-scale, with a zero-amplitude sine wave.
+void DDS_Init(uint32_t mcu_hz, uint32_t sample_hz, uint8_t output_mode);
+
+// Selects the SPI DAC's chip select line, as for SPI transfers.
+void DDS_SetSPIChipSelect(volatile uint8_t *cs_port, uint8_t cs_mask);
+
+// Returns the actual sample rate, or 0 if the DDS engine is off.
+uint32_t DDS_QuerySampleRate(void);
+
+// Converts a frequency (in mHz) to a phase step. Frequencies are limited
+// to below half the sample rate.
+uint32_t DDS_FrequencyToStep(uint32_t millihz);
+
+// Sets the output frequency, in mHz.
+void DDS_SetFrequency(uint32_t millihz);
+
+// Sets the phase step directly (2^32 is one cycle per sample).
+void DDS_SetPhaseStep(uint32_t step);
+
+// Selects a built-in waveform (DDS_WAVE_SINE .. DDS_WAVE_SAWTOOTH).
+void DDS_SetWaveform(uint8_t wave);
+
+// Selects a user-supplied wavetable. This is DDS_TABLE_SIZE Q15 values in
+// program memory, and has to stay there.
+void DDS_SetWaveTable(const int16_t *table_P);
+
+// Sets the amplitude (Q15; 0x7fff is full scale).
+void DDS_SetAmplitude(int16_t amplitude);
+
+// Sets the output level that the waveform is centred on (0x8000 is
+// mid-scale). Output is clamped to the range 0..0xffff.
+void DDS_SetOffset(uint16_t offset);
+
+// Starts output at phase 0.
+void DDS_Start(void);
+
+// Stops output at the end of the current cycle. Output then holds the
+// offset level.
+void DDS_Stop(void);
+
+// Returns true if the DDS engine is producing output.
+bool DDS_IsRunning(void);
+
+
+// Fixed-point math functions.
+// These avoid floating-point math and 32-bit division, which are far too
+// slow for tick handlers. Multiplies use the hardware multiplier.
+// Shifts of negative values round towards negative infinity.
+
+// Saturating addition and subtraction. Results are clamped to the type's
+// range instead of wrapping.
+int16_t FIXED_AddSat16(int16_t a, int16_t b);
+int16_t FIXED_SubSat16(int16_t a, int16_t b);
+uint16_t FIXED_AddSatU16(uint16_t a, uint16_t b);
+uint16_t FIXED_SubSatU16(uint16_t a, uint16_t b);
+int32_t FIXED_AddSat32(int32_t a, int32_t b);
+int32_t FIXED_SubSat32(int32_t a, int32_t b);
+
+// Multiplies two Q15 values, rounding to nearest. -1 * -1 saturates to
+// the largest positive value.
+int16_t FIXED_MulQ15(int16_t a, int16_t b);
+
+// Multiplies two Q16 values, truncating. Results that don't fit wrap.
+int32_t FIXED_MulQ16(int32_t a, int32_t b);
+
+// Scales an unsigned value by a 16-bit fraction: (value * scale) / 65536.
+uint16_t FIXED_ScaleU16(uint16_t value, uint16_t scale);
+
+// Sets up a reciprocal for dividing by the specified divisor (nonzero).
+// This does one 32-bit division, so do it during initialization.
+void FIXED_MakeRecip16(fixed_recip16_t &recip, uint16_t divisor);
+
+// Divides by a precomputed reciprocal. The result is exactly
+// (value / divisor) for all inputs.
+uint16_t FIXED_DivRecip16(uint16_t value, const fixed_recip16_t &recip);
+
+// Returns floor(sqrt(value)).
+uint16_t FIXED_SqrtU32(uint32_t value);
+
+// Returns log2(value) in Q8.8 format (integer part in the high byte).
+// The error is at most about 1/256. log2(0) returns 0.
+uint16_t FIXED_Log2U32(uint32_t value);
+
 
 // Formatted printing functions.
 
@@ -208,8 +729,73 @@ void UART_PrintHex8(uint8_t value);
 
 // Debugging functions.
 
+// This returns the distance between the top of the stack and the heap.
 uint16_t MCU_GetFreeMemory(void);
 
+// This returns the smallest distance between the stack and the heap seen
+// since reset, including nested interrupts. Memory is painted at startup
+// and scanned when this is called, so this takes a while (a few cycles per
+// free byte).
+uint16_t MCU_GetMinFreeMemory(void);
+
+
+// Flight recorder functions.
+// This keeps the last FLIGHT_RECORD_SLOTS framework events in a ring that
+// survives non-power-on resets. MCU_Init() starts it and records the
+// reset. Recording an event takes a few dozen cycles.
+
+// Adds a record. The _ISR version needs interrupts to be off.
+void FLIGHT_Record(uint8_t event, uint8_t detail, uint16_t data);
+void FLIGHT_Record_ISR(uint8_t event, uint8_t detail, uint16_t data);
+
+// Discards all records.
+void FLIGHT_Clear(void);
+
+// Gets the sequence numbers of the oldest record and of the next record
+// to be written. Records are read oldest-first by sequence number; these
+// are 16-bit and wrap.
+void FLIGHT_GetRange(uint16_t &first, uint16_t &end);
+
+// Copies one record. Returns false if it was overwritten (or is from the
+// future).
+bool FLIGHT_GetRecord(uint16_t sequence, flight_record_t &record);
+
+// Returns the reset cause flags for this run (FLIGHT_RESET_xx).
+uint8_t FLIGHT_GetResetFlags(void);
+
+// Returns the number of resets the current records have survived.
+uint16_t FLIGHT_GetResetCount(void);
+
+// Memory pool functions.
+// These hand out fixed-size blocks from caller-supplied storage, for
+// records that get passed around by pointer. Allocating and freeing take
+// constant time, and never touch the heap.
+
+// Sets up a pool of "block_count" blocks of at least "block_size" bytes,
+// in storage declared with POOL_STORAGE() (using the same size and count).
+void POOL_Init(pool_t &pool, void *storage, uint16_t block_size,
+  uint8_t block_count);
+
+// Returns a block, or NULL if the pool is empty. Contents are undefined.
+// The _ISR version needs interrupts to be off.
+void *POOL_Alloc(pool_t &pool);
+void *POOL_Alloc_ISR(pool_t &pool);
+
+// Returns a block to its pool. Pointers that didn't come from this pool
+// (including NULL) are ignored and counted as failures.
+// The _ISR version needs interrupts to be off.
+void POOL_Free(pool_t &pool, void *block);
+void POOL_Free_ISR(pool_t &pool, void *block);
+
+// Gets the number of blocks in use, the most that have been in use at
+// once, and the number of failed allocations and bad frees (this stops
+// at 0xffff rather than wrapping).
+void POOL_GetStats(pool_t &pool, uint8_t &in_use, uint8_t &peak_in_use,
+  uint16_t &failures);
+
+// Resets the peak usage and failure count.
+void POOL_ClearStats(pool_t &pool);
+
 
 // Utility functions not tied to a particular module.
 
@@ -218,6 +804,11 @@ uint16_t MCU_GetFreeMemory(void);
 // This renders an integer as hexidecimal digits into a string.
 void UTIL_WriteHex(char *buffer, uint32_t data, uint8_t digits);
 
+// This renders an integer as decimal digits into a string, without
+// leading zeroes or a terminator. Returns the number of digits (1-10).
+// This uses subtraction, not 32-bit division.
+uint8_t UTIL_WriteDec(char *buffer, uint32_t data);
+
 
 //
 // This is the end of the file.
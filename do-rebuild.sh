@@ -16,6 +16,11 @@
 # compiled on a development workstation, with STDIN/STDOUT pretending to be
 # the USB serial link.
 #
+# - Register-level emulation libraries (libneurXXX-mYYYY-regs.a). These run
+# the real architecture-specific code against emulated peripheral registers,
+# with a deterministic virtual clock. Only the ATmega328P and ATmega2560 are
+# modelled.
+#
 # FIXME: Arduino stubs NYI.
 # The old way was to compile everything at the same time as the user's
 # project using the IDE. A better way would be to compile as a library, and
@@ -33,6 +38,7 @@ EMUCFLAGS="-I`pwd`/include -O2 -Wall -std=c++11 -pthread -DNEUREMU -c"
 read -d '' ARCHLIST <<-"Endofblock"
 	m328p
 	m2560
+	m32u4
 Endofblock
 
 # Auxiliary library folders.
@@ -43,6 +49,13 @@ Endofblock
 # Compatibility shim library folders.
 read -d '' SHIMLIST <<-"Endofblock"
 	emulation
+	emulation-regs
+Endofblock
+
+# Architectures with register-level emulation.
+read -d '' REGSARCHLIST <<-"Endofblock"
+	m328p
+	m2560
 Endofblock
 
 
@@ -199,6 +212,55 @@ done
 
 
 
+#
+# Build register-level emulated core firmware libraries.
+# These include the architecture-specific code, since that's what's being
+# tested.
+
+# Banner.
+echo "== Register-level emulated core firmware libraries."
+
+for ARCHDIR in $REGSARCHLIST
+do
+  # Banner.
+  echo "-- $ARCHDIR"
+
+  ARCHDEF=`cat ${ARCHDIR}/ARCHDEF`
+
+  # Rebuild the register model, core, and architecture-specific routines.
+
+  for SRCDIR in emulation-regs core ${ARCHDIR}
+  do
+    cd ${TOPDIR}/${SRCDIR}
+
+    rm -f *.o
+    for CFILE in *.cpp
+    do
+      OFILE=`echo $CFILE|sed -e "s/cpp/o/"`
+
+# FIXME - Diagnostics.
+echo ".. ${SRCDIR}/${CFILE}"
+
+      # NOTE - Use g++, not gcc, for the emulated version.
+      g++ -D${ARCHDEF} $EMUCFLAGS -DNEUREMU_REGS -o $OFILE $CFILE
+    done
+  done
+
+  # Assemble the library.
+
+  cd ${TOPDIR}
+
+  ar -rs lib/libneur-${ARCHDIR}-regs.a \
+    emulation-regs/*.o core/*.o ${ARCHDIR}/*.o
+
+  # Clean up.
+  rm -f emulation-regs/*.o
+  rm -f core/*.o
+  rm -f ${ARCHDIR}/*.o
+done
+
+
+
 #
 # Build auxiliary libraries for each of the architectures.
 # Source might not change, but compiler output may.
@@ -302,6 +364,55 @@ done
 
 
 
+#
+# Build register-level emulated auxiliary libraries.
+
+# Banner.
+echo "== Register-level emulated auxiliary libraries."
+
+for AUXDIR in $AUXLIST
+do
+  # Banner.
+  echo "-- $AUXDIR"
+
+  AUXNAME=`cat ${AUXDIR}/LIBNAME`
+
+  for ARCHDIR in $REGSARCHLIST
+  do
+    # Banner.
+    echo ".. $ARCHDIR"
+
+    ARCHDEF=`cat ${ARCHDIR}/ARCHDEF`
+
+    # Compile the files.
+
+    THISDIR=${TOPDIR}/${AUXDIR}
+    cd ${THISDIR}
+    rm -f *.o
+
+    for CFILE in *.cpp
+    do
+      OFILE=`echo $CFILE|sed -e "s/cpp/o/"`
+
+# FIXME - Diagnostics.
+echo ".. ${THISDIR}/${CFILE}"
+
+      g++ -D${ARCHDEF} $EMUCFLAGS -DNEUREMU_REGS -o $OFILE $CFILE
+    done
+
+    # Assemble the library.
+
+    cd ${TOPDIR}
+
+    ar -rs lib/lib${AUXNAME}-${ARCHDIR}-regs.a ${THISDIR}/*.o
+
+    # Clean up.
+    rm -f ${THISDIR}/*.o
+  done
+done
+
+
+
 #
 # Ending banner.
 
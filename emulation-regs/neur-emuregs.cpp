@@ -0,0 +1,1707 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Register-level peripheral emulation for running the real backends on a
+// workstation.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+
+
+
+//
+// Notes
+
+// Peripheral models are simplified where the backends don't care:
+//
+// - GPIO: PINx is computed from DDRx, PORTx, pull-ups, and externally
+// driven levels. Peripherals don't override pin directions.
+// - Timers: normal, CTC, and fast PWM modes. Phase-correct modes count
+// single-slope with the same TOP. OCRnx updates take effect immediately.
+// Output compare pins aren't driven. Input capture works on the ICPn
+// pins, without the noise canceller's delay.
+// - USART: 8n1 frames only. Two-byte receive FIFO with overrun detection.
+// - ADC: single conversions and free-running mode. Inputs are raw codes
+// set by the harness; the reference selection is ignored.
+// - SPI: master mode only. MISO comes from a harness-supplied responder,
+// or loops back from MOSI.
+// - TWI: master mode only. The bus has a 256-byte EEPROM at address 0x50
+// with a one-byte word address, like the one in the emulation library.
+// Every other address is NACKed.
+// - EEPROM: starts erased. The EEMPE/EEPE four-cycle window is checked.
+
+
+
+//
+// Private Macros
+
+// Cost of a register access (LDS/STS), in cycles.
+#define EMUREG_ACCESS_CYCLES 2
+
+// Cost of interrupt entry and of RETI, in cycles.
+#define EMUREG_ISR_ENTRY_CYCLES 4
+#define EMUREG_ISR_EXIT_CYCLES 4
+
+// Longest time step taken with interrupts enabled, in cycles.
+#define EMUREG_MAX_STEP_CYCLES 32
+
+// How often to look at stdin for console input, in cycles.
+#define EMUREG_CONSOLE_POLL_CYCLES 16000
+
+// Bus address of the emulated TWI EEPROM.
+#define EMUREG_TWI_DEVICE 0x50
+
+// Largest vector number used by either device.
+#define EMUREG_VECTOR_COUNT 57
+
+// Register addresses for the peripheral tables.
+// These mirror the definitions in neur-emuregs.h.
+#define EMUREG_ADDR_SREG 0x5f
+#define EMUREG_ADDR_MCUCR 0x55
+#define EMUREG_ADDR_MCUSR 0x54
+#define EMUREG_ADDR_EECR 0x3f
+#define EMUREG_ADDR_EEDR 0x40
+#define EMUREG_ADDR_EEARL 0x41
+#define EMUREG_ADDR_SPCR 0x4c
+#define EMUREG_ADDR_SPSR 0x4d
+#define EMUREG_ADDR_SPDR 0x4e
+#define EMUREG_ADDR_ADCL 0x78
+#define EMUREG_ADDR_ADCH 0x79
+#define EMUREG_ADDR_ADCSRA 0x7a
+#define EMUREG_ADDR_ADCSRB 0x7b
+#define EMUREG_ADDR_ADMUX 0x7c
+#define EMUREG_ADDR_TWBR 0xb8
+#define EMUREG_ADDR_TWSR 0xb9
+#define EMUREG_ADDR_TWDR 0xbb
+#define EMUREG_ADDR_TWCR 0xbc
+
+// Shorthand for a raw register value.
+#define EMUREG_RAW(X) (emureg_file[X].value)
+
+// Interrupt source table entries.
+// Flag-style sources are set by the peripheral and cleared on dispatch.
+#define EMUREG_SRC_FLAG(V, FREG, FBIT, EREG, EBIT) \
+  { V, FREG, (1 << (FBIT)), false, EREG, (1 << (EBIT)), true }
+// Level-style sources stay pending until the firmware clears the cause.
+#define EMUREG_SRC_LEVEL(V, FREG, FBIT, EREG, EBIT) \
+  { V, FREG, (1 << (FBIT)), false, EREG, (1 << (EBIT)), false }
+// Timer sources, given the TIFRn and TIMSKn addresses.
+#define EMUREG_SRC_TIMER(V, TIFR, TIMSK, BIT) \
+  EMUREG_SRC_FLAG(V, TIFR, BIT, TIMSK, BIT)
+
+// Timer TIFRn bits.
+#define EMUREG_TIFR_TOV 0x01
+#define EMUREG_TIFR_OCFA 0x02
+#define EMUREG_TIFR_OCFB 0x04
+#define EMUREG_TIFR_OCFC 0x08
+#define EMUREG_TIFR_ICF 0x20
+
+
+
+//
+// Private Types
+
+// Interrupt source.
+struct emureg_source_t
+{
+  uint8_t vector;
+  uint16_t flag_addr;
+  uint8_t flag_mask;
+  // The EEPROM-ready "flag" is EEPE being clear.
+  bool flag_inverted;
+  uint16_t enable_addr;
+  uint8_t enable_mask;
+  bool clear_on_dispatch;
+};
+
+
+// GPIO port.
+// DDRx and PORTx follow PINx.
+struct emureg_port_t
+{
+  char id;
+  uint16_t pin_addr;
+  uint8_t driven_mask;
+  uint8_t driven_levels;
+};
+
+
+// Timer/counter.
+// Unused register addresses are 0.
+struct emureg_timer_t
+{
+  bool is_wide;
+  bool is_timer2;
+  uint16_t tccra_addr;
+  uint16_t tccrb_addr;
+  uint16_t tcnt_addr;
+  uint16_t ocra_addr;
+  uint16_t ocrb_addr;
+  uint16_t ocrc_addr;
+  uint16_t icr_addr;
+  uint16_t tifr_addr;
+  char icp_port;
+  uint8_t icp_mask;
+
+  uint16_t prescale_count;
+  bool icp_level;
+};
+
+
+// USART.
+struct emureg_uart_t
+{
+  uint16_t csra_addr;
+  uint16_t csrb_addr;
+  uint16_t brrl_addr;
+  uint16_t brrh_addr;
+  uint16_t udr_addr;
+
+  uint8_t rx_fifo[2];
+  uint8_t rx_count;
+  uint64_t rx_next_time;
+
+  uint8_t tx_shift;
+  bool tx_shifting;
+  uint8_t tx_buffer;
+  bool tx_buffered;
+  uint64_t tx_done_time;
+
+  std::deque<uint8_t> *host_in;
+  std::string *host_out;
+};
+
+
+// Register hooks.
+// Read hooks return the value the firmware sees.
+typedef uint8_t (*emureg_readhook_t)(uint16_t address);
+typedef void (*emureg_writehook_t)(uint16_t address, uint8_t value);
+
+
+
+//
+// Private Prototypes
+
+// Interrupt vectors. Any that the backend doesn't define are NULL.
+#define EMUREG_DECLARE_VECTOR(N) \
+extern "C" void __vector_ ## N(void) __attribute__ ((weak));
+
+EMUREG_DECLARE_VECTOR(7) EMUREG_DECLARE_VECTOR(8)
+EMUREG_DECLARE_VECTOR(9) EMUREG_DECLARE_VECTOR(10)
+EMUREG_DECLARE_VECTOR(11) EMUREG_DECLARE_VECTOR(12)
+EMUREG_DECLARE_VECTOR(13) EMUREG_DECLARE_VECTOR(14)
+EMUREG_DECLARE_VECTOR(15) EMUREG_DECLARE_VECTOR(16)
+EMUREG_DECLARE_VECTOR(17) EMUREG_DECLARE_VECTOR(18)
+EMUREG_DECLARE_VECTOR(19) EMUREG_DECLARE_VECTOR(20)
+EMUREG_DECLARE_VECTOR(21) EMUREG_DECLARE_VECTOR(22)
+EMUREG_DECLARE_VECTOR(23) EMUREG_DECLARE_VECTOR(24)
+EMUREG_DECLARE_VECTOR(25) EMUREG_DECLARE_VECTOR(26)
+EMUREG_DECLARE_VECTOR(27) EMUREG_DECLARE_VECTOR(29)
+EMUREG_DECLARE_VECTOR(30) EMUREG_DECLARE_VECTOR(31)
+EMUREG_DECLARE_VECTOR(32) EMUREG_DECLARE_VECTOR(33)
+EMUREG_DECLARE_VECTOR(34) EMUREG_DECLARE_VECTOR(35)
+EMUREG_DECLARE_VECTOR(36) EMUREG_DECLARE_VECTOR(37)
+EMUREG_DECLARE_VECTOR(38) EMUREG_DECLARE_VECTOR(39)
+EMUREG_DECLARE_VECTOR(41) EMUREG_DECLARE_VECTOR(42)
+EMUREG_DECLARE_VECTOR(43) EMUREG_DECLARE_VECTOR(44)
+EMUREG_DECLARE_VECTOR(45) EMUREG_DECLARE_VECTOR(46)
+EMUREG_DECLARE_VECTOR(47) EMUREG_DECLARE_VECTOR(48)
+EMUREG_DECLARE_VECTOR(49) EMUREG_DECLARE_VECTOR(50)
+
+// This has to run before C++ static constructors, since global handler
+// objects may touch registers when they're built.
+static void EMUREG_PowerOnReset(void) __attribute__ ((constructor (101)));
+
+
+
+//
+// Private Constants
+
+#ifdef __AVR_ATmega328P__
+
+// EEPROM size in bytes.
+#define EMUREG_EEPROM_SIZE 1024
+
+// Number of single-ended ADC inputs.
+#define EMUREG_ADC_INPUTS 8
+
+// Interrupt sources, in priority order.
+const emureg_source_t emureg_sources[] =
+{
+  EMUREG_SRC_TIMER(7, 0x37, 0x70, 1),
+  EMUREG_SRC_TIMER(8, 0x37, 0x70, 2),
+  EMUREG_SRC_TIMER(9, 0x37, 0x70, 0),
+  EMUREG_SRC_TIMER(10, 0x36, 0x6f, 5),
+  EMUREG_SRC_TIMER(11, 0x36, 0x6f, 1),
+  EMUREG_SRC_TIMER(12, 0x36, 0x6f, 2),
+  EMUREG_SRC_TIMER(13, 0x36, 0x6f, 0),
+  EMUREG_SRC_TIMER(14, 0x35, 0x6e, 1),
+  EMUREG_SRC_TIMER(15, 0x35, 0x6e, 2),
+  EMUREG_SRC_TIMER(16, 0x35, 0x6e, 0),
+  EMUREG_SRC_FLAG(17, 0x4d, SPIF, 0x4c, SPIE),
+  EMUREG_SRC_LEVEL(18, 0xc0, RXC0, 0xc1, RXCIE0),
+  EMUREG_SRC_LEVEL(19, 0xc0, UDRE0, 0xc1, UDRIE0),
+  EMUREG_SRC_FLAG(20, 0xc0, TXC0, 0xc1, TXCIE0),
+  EMUREG_SRC_FLAG(21, 0x7a, ADIF, 0x7a, ADIE),
+  { 22, 0x3f, (1 << EEPE), true, 0x3f, (1 << EERIE), false },
+  EMUREG_SRC_LEVEL(24, 0xbc, TWINT, 0xbc, TWIE)
+};
+
+// Vector handlers, indexed by vector number.
+void (* const emureg_vectors[EMUREG_VECTOR_COUNT])(void) =
+{
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  __vector_7, __vector_8, __vector_9, __vector_10, __vector_11,
+  __vector_12, __vector_13, __vector_14, __vector_15, __vector_16,
+  __vector_17, __vector_18, __vector_19, __vector_20, __vector_21,
+  __vector_22, NULL, __vector_24
+};
+
+// GPIO ports.
+#define EMUREG_PORT_COUNT 3
+const emureg_port_t emureg_port_defaults[EMUREG_PORT_COUNT] =
+{
+  { 'B', 0x23, 0, 0 },
+  { 'C', 0x26, 0, 0 },
+  { 'D', 0x29, 0, 0 }
+};
+
+// Timers.
+#define EMUREG_TIMER_COUNT 3
+const emureg_timer_t emureg_timer_defaults[EMUREG_TIMER_COUNT] =
+{
+  { false, false, 0x44, 0x45, 0x46, 0x47, 0x48, 0, 0, 0x35, 0, 0, 0, false },
+  { true, false, 0x80, 0x81, 0x84, 0x88, 0x8a, 0, 0x86, 0x36,
+    'B', 0x01, 0, false },
+  { false, true, 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0, 0, 0x37, 0, 0, 0, false }
+};
+
+// USART register addresses.
+const uint16_t emureg_uart_addrs[EMUREG_UART_COUNT][5] =
+{
+  { 0xc0, 0xc1, 0xc4, 0xc5, 0xc6 }
+};
+
+#endif
+
+
+#ifdef __AVR_ATmega2560__
+
+// EEPROM size in bytes.
+#define EMUREG_EEPROM_SIZE 4096
+
+// Number of single-ended ADC inputs.
+#define EMUREG_ADC_INPUTS 16
+
+// Interrupt sources, in priority order.
+const emureg_source_t emureg_sources[] =
+{
+  EMUREG_SRC_TIMER(13, 0x37, 0x70, 1),
+  EMUREG_SRC_TIMER(14, 0x37, 0x70, 2),
+  EMUREG_SRC_TIMER(15, 0x37, 0x70, 0),
+  EMUREG_SRC_TIMER(16, 0x36, 0x6f, 5),
+  EMUREG_SRC_TIMER(17, 0x36, 0x6f, 1),
+  EMUREG_SRC_TIMER(18, 0x36, 0x6f, 2),
+  EMUREG_SRC_TIMER(19, 0x36, 0x6f, 3),
+  EMUREG_SRC_TIMER(20, 0x36, 0x6f, 0),
+  EMUREG_SRC_TIMER(21, 0x35, 0x6e, 1),
+  EMUREG_SRC_TIMER(22, 0x35, 0x6e, 2),
+  EMUREG_SRC_TIMER(23, 0x35, 0x6e, 0),
+  EMUREG_SRC_FLAG(24, 0x4d, SPIF, 0x4c, SPIE),
+  EMUREG_SRC_LEVEL(25, 0xc0, RXC0, 0xc1, RXCIE0),
+  EMUREG_SRC_LEVEL(26, 0xc0, UDRE0, 0xc1, UDRIE0),
+  EMUREG_SRC_FLAG(27, 0xc0, TXC0, 0xc1, TXCIE0),
+  EMUREG_SRC_FLAG(29, 0x7a, ADIF, 0x7a, ADIE),
+  { 30, 0x3f, (1 << EEPE), true, 0x3f, (1 << EERIE), false },
+  EMUREG_SRC_TIMER(31, 0x38, 0x71, 5),
+  EMUREG_SRC_TIMER(32, 0x38, 0x71, 1),
+  EMUREG_SRC_TIMER(33, 0x38, 0x71, 2),
+  EMUREG_SRC_TIMER(34, 0x38, 0x71, 3),
+  EMUREG_SRC_TIMER(35, 0x38, 0x71, 0),
+  EMUREG_SRC_LEVEL(36, 0xc8, RXC1, 0xc9, RXCIE1),
+  EMUREG_SRC_LEVEL(37, 0xc8, UDRE1, 0xc9, UDRIE1),
+  EMUREG_SRC_FLAG(38, 0xc8, TXC1, 0xc9, TXCIE1),
+  EMUREG_SRC_LEVEL(39, 0xbc, TWINT, 0xbc, TWIE),
+  EMUREG_SRC_TIMER(41, 0x39, 0x72, 5),
+  EMUREG_SRC_TIMER(42, 0x39, 0x72, 1),
+  EMUREG_SRC_TIMER(43, 0x39, 0x72, 2),
+  EMUREG_SRC_TIMER(44, 0x39, 0x72, 3),
+  EMUREG_SRC_TIMER(45, 0x39, 0x72, 0),
+  EMUREG_SRC_TIMER(46, 0x3a, 0x73, 5),
+  EMUREG_SRC_TIMER(47, 0x3a, 0x73, 1),
+  EMUREG_SRC_TIMER(48, 0x3a, 0x73, 2),
+  EMUREG_SRC_TIMER(49, 0x3a, 0x73, 3),
+  EMUREG_SRC_TIMER(50, 0x3a, 0x73, 0)
+};
+
+// Vector handlers, indexed by vector number.
+void (* const emureg_vectors[EMUREG_VECTOR_COUNT])(void) =
+{
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, __vector_13, __vector_14,
+  __vector_15, __vector_16, __vector_17, __vector_18, __vector_19,
+  __vector_20, __vector_21, __vector_22, __vector_23, __vector_24,
+  __vector_25, __vector_26, __vector_27, NULL, __vector_29,
+  __vector_30, __vector_31, __vector_32, __vector_33, __vector_34,
+  __vector_35, __vector_36, __vector_37, __vector_38, __vector_39,
+  NULL, __vector_41, __vector_42, __vector_43, __vector_44,
+  __vector_45, __vector_46, __vector_47, __vector_48, __vector_49,
+  __vector_50
+};
+
+// GPIO ports.
+#define EMUREG_PORT_COUNT 11
+const emureg_port_t emureg_port_defaults[EMUREG_PORT_COUNT] =
+{
+  { 'A', 0x20, 0, 0 },
+  { 'B', 0x23, 0, 0 },
+  { 'C', 0x26, 0, 0 },
+  { 'D', 0x29, 0, 0 },
+  { 'E', 0x2c, 0, 0 },
+  { 'F', 0x2f, 0, 0 },
+  { 'G', 0x32, 0, 0 },
+  { 'H', 0x100, 0, 0 },
+  { 'J', 0x103, 0, 0 },
+  { 'K', 0x106, 0, 0 },
+  { 'L', 0x109, 0, 0 }
+};
+
+// Timers.
+#define EMUREG_TIMER_COUNT 6
+const emureg_timer_t emureg_timer_defaults[EMUREG_TIMER_COUNT] =
+{
+  { false, false, 0x44, 0x45, 0x46, 0x47, 0x48, 0, 0, 0x35, 0, 0, 0, false },
+  { true, false, 0x80, 0x81, 0x84, 0x88, 0x8a, 0x8c, 0x86, 0x36,
+    'D', 0x10, 0, false },
+  { false, true, 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0, 0, 0x37, 0, 0, 0, false },
+  { true, false, 0x90, 0x91, 0x94, 0x98, 0x9a, 0x9c, 0x96, 0x38,
+    'E', 0x80, 0, false },
+  { true, false, 0xa0, 0xa1, 0xa4, 0xa8, 0xaa, 0xac, 0xa6, 0x39,
+    'L', 0x01, 0, false },
+  { true, false, 0x120, 0x121, 0x124, 0x128, 0x12a, 0x12c, 0x126, 0x3a,
+    'L', 0x02, 0, false }
+};
+
+// USART register addresses.
+const uint16_t emureg_uart_addrs[EMUREG_UART_COUNT][5] =
+{
+  { 0xc0, 0xc1, 0xc4, 0xc5, 0xc6 },
+  { 0xc8, 0xc9, 0xcc, 0xcd, 0xce }
+};
+
+#endif
+
+
+#define EMUREG_SOURCE_COUNT \
+  ( sizeof(emureg_sources) / sizeof(emureg_source_t) )
+
+// The USART that stands in for the USB serial link.
+#if defined(UART_USE_ALTERNATE) && UART_USE_ALTERNATE
+#define EMUREG_CONSOLE_UART 1
+#else
+#define EMUREG_CONSOLE_UART 0
+#endif
+
+// ADC clock prescaler, indexed by ADPS2:0.
+const uint8_t emureg_adc_prescale[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+
+// Timer clock prescalers, indexed by CSn2:0. 0 means stopped (or an
+// external clock, which isn't modelled).
+const uint16_t emureg_timer_prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+const uint16_t emureg_timer2_prescale[8] =
+  { 0, 1, 8, 32, 64, 128, 256, 1024 };
+
+// 16-bit timer TOP values for fixed-TOP modes, indexed by WGMn3:0.
+// 0 means TOP is OCRnA or ICRn instead.
+const uint16_t emureg_timer16_top[16] =
+{
+  0xffff, 0x00ff, 0x01ff, 0x03ff, 0, 0x00ff, 0x01ff, 0x03ff,
+  0, 0, 0, 0, 0, 0xffff, 0, 0
+};
+
+
+
+//
+// Global Variables
+
+// The register file.
+EMUREG_Reg8 emureg_file[EMUREG_FILE_SIZE];
+
+
+
+//
+// Private Global Variables
+
+
+// Emulator state.
+
+uint32_t emureg_mcu_hz = EMUREG_DEFAULT_MCU_HZ;
+uint64_t emureg_cycles = 0;
+uint32_t emureg_vector_counts[EMUREG_VECTOR_COUNT];
+
+emureg_readhook_t emureg_readhooks[EMUREG_FILE_SIZE];
+emureg_writehook_t emureg_writehooks[EMUREG_FILE_SIZE];
+
+
+// Peripheral state.
+
+emureg_port_t emureg_ports[EMUREG_PORT_COUNT];
+emureg_timer_t emureg_timers[EMUREG_TIMER_COUNT];
+emureg_uart_t emureg_uarts[EMUREG_UART_COUNT];
+
+std::deque<uint8_t> emureg_uart_in[EMUREG_UART_COUNT];
+std::string emureg_uart_out[EMUREG_UART_COUNT];
+
+bool emureg_console = true;
+bool emureg_console_eof = false;
+uint64_t emureg_console_next_poll = 0;
+
+uint16_t emureg_adc_inputs[EMUREG_ADC_INPUTS];
+bool emureg_adc_busy = false;
+bool emureg_adc_first = true;
+uint64_t emureg_adc_done_time = 0;
+
+uint8_t (*emureg_spi_responder)(uint8_t mosi_byte) = NULL;
+bool emureg_spi_busy = false;
+bool emureg_spi_flag_seen = false;
+uint8_t emureg_spi_sent = 0;
+uint64_t emureg_spi_done_time = 0;
+
+bool emureg_twi_busy = false;
+bool emureg_twi_bus_held = false;
+uint8_t emureg_twi_status = 0xf8;
+uint64_t emureg_twi_done_time = 0;
+bool emureg_twi_selected = false;
+bool emureg_twi_want_pointer = false;
+uint8_t emureg_twi_pointer = 0;
+uint8_t emureg_twi_memory[256];
+
+uint8_t emureg_eeprom[EMUREG_EEPROM_SIZE];
+uint64_t emureg_eeprom_done_time = 0;
+uint64_t emureg_eeprom_mpe_time = 0;
+
+
+
+//
+// Functions
+
+
+// Private emulator functions.
+
+
+// This returns the port record for a port ID, or NULL.
+
+static emureg_port_t *EMUREG_FindPort(char port_id)
+{
+  emureg_port_t *result;
+  uint8_t pidx;
+
+  result = NULL;
+
+  for (pidx = 0; (NULL == result) && (pidx < EMUREG_PORT_COUNT); pidx++)
+    if (port_id == emureg_ports[pidx].id)
+      result = &(emureg_ports[pidx]);
+
+  return result;
+}
+
+
+
+// This computes pin levels from the port registers and outside drivers.
+// Undriven inputs read high if their pull-up is on, and low otherwise.
+
+static uint8_t EMUREG_ComputePins(emureg_port_t &port)
+{
+  uint8_t ddr, data, inputs;
+
+  ddr = EMUREG_RAW(port.pin_addr + 1);
+  data = EMUREG_RAW(port.pin_addr + 2);
+
+  inputs = port.driven_mask & port.driven_levels;
+  if (0 == (EMUREG_RAW(EMUREG_ADDR_MCUCR) & (1 << PUD)))
+    inputs |= ~port.driven_mask & data;
+
+  return (ddr & data) | (~ddr & inputs);
+}
+
+
+
+// This looks for edges on input capture pins.
+
+static void EMUREG_CheckCapture(void)
+{
+  uint8_t tidx;
+  emureg_timer_t *timer;
+  emureg_port_t *port;
+  bool level, want_rising;
+
+  for (tidx = 0; tidx < EMUREG_TIMER_COUNT; tidx++)
+  {
+    timer = &(emureg_timers[tidx]);
+    port = EMUREG_FindPort(timer->icp_port);
+
+    if (NULL != port)
+    {
+      level = ( 0 != (EMUREG_ComputePins(*port) & timer->icp_mask) );
+      want_rising = ( 0 != (EMUREG_RAW(timer->tccrb_addr) & (1 << 6)) );
+
+      if ( (level != timer->icp_level) && (level == want_rising) )
+      {
+        EMUREG_RAW(timer->icr_addr) = EMUREG_RAW(timer->tcnt_addr);
+        EMUREG_RAW(timer->icr_addr + 1) = EMUREG_RAW(timer->tcnt_addr + 1);
+        EMUREG_RAW(timer->tifr_addr) |= EMUREG_TIFR_ICF;
+      }
+
+      timer->icp_level = level;
+    }
+  }
+}
+
+
+
+// This reads a timer register, which may be one or two bytes.
+
+static uint16_t EMUREG_GetTimerReg(emureg_timer_t &timer, uint16_t address)
+{
+  uint16_t result;
+
+  result = EMUREG_RAW(address);
+  if (timer.is_wide)
+    result |= ((uint16_t) EMUREG_RAW(address + 1)) << 8;
+
+  return result;
+}
+
+
+
+// This advances one timer by the specified number of CPU cycles.
+// Counting is done in jumps from one event (compare match or wrap) to the
+// next, so long idle stretches are cheap.
+
+static void EMUREG_UpdateTimer(emureg_timer_t &timer, uint32_t cycles)
+{
+  uint8_t tccrb, wgm;
+  uint16_t divisor;
+  uint32_t total, ticks, step;
+  uint32_t count, top, limit, ocra, ocrb, ocrc;
+  bool is_ctc;
+  uint8_t tifr;
+
+  tccrb = EMUREG_RAW(timer.tccrb_addr);
+  divisor = timer.is_timer2
+    ? emureg_timer2_prescale[tccrb & 0x07]
+    : emureg_timer_prescale[tccrb & 0x07];
+
+  if (0 < divisor)
+  {
+    total = timer.prescale_count + cycles;
+    ticks = total / divisor;
+    timer.prescale_count = total % divisor;
+
+    // Figure out TOP.
+    ocra = EMUREG_GetTimerReg(timer, timer.ocra_addr);
+    ocrb = EMUREG_GetTimerReg(timer, timer.ocrb_addr);
+    ocrc = timer.ocrc_addr
+      ? EMUREG_GetTimerReg(timer, timer.ocrc_addr) : 0x10000ul;
+
+    if (timer.is_wide)
+    {
+      wgm = (EMUREG_RAW(timer.tccra_addr) & 0x03) | ((tccrb >> 1) & 0x0c);
+      top = emureg_timer16_top[wgm];
+      if (0 == top)
+        top = ( (4 == wgm) || (9 == wgm) || (11 == wgm) || (15 == wgm) )
+          ? ocra : EMUREG_GetTimerReg(timer, timer.icr_addr);
+      is_ctc = ( (4 == wgm) || (12 == wgm) );
+      limit = 0xffff;
+    }
+    else
+    {
+      wgm = (EMUREG_RAW(timer.tccra_addr) & 0x03) | ((tccrb >> 1) & 0x04);
+      top = ( (2 == wgm) || (5 == wgm) || (7 == wgm) ) ? ocra : 0xff;
+      is_ctc = (2 == wgm);
+      limit = 0xff;
+    }
+
+    count = EMUREG_GetTimerReg(timer, timer.tcnt_addr);
+    tifr = EMUREG_RAW(timer.tifr_addr);
+
+    while (0 < ticks)
+    {
+      // If TOP was moved below the count, it runs all the way around.
+      if (count > top)
+        top = limit;
+
+      step = top - count + 1;
+      if ( (ocra > count) && ((ocra - count) < step) )
+        step = ocra - count;
+      if ( (ocrb > count) && ((ocrb - count) < step) )
+        step = ocrb - count;
+      if ( (ocrc > count) && ((ocrc - count) < step) )
+        step = ocrc - count;
+      if (step > ticks)
+        step = ticks;
+
+      count += step;
+      ticks -= step;
+
+      if (count > top)
+      {
+        count = 0;
+        // CTC modes only overflow when TOP is MAX.
+        if ( (!is_ctc) || (limit == top) )
+          tifr |= EMUREG_TIFR_TOV;
+      }
+
+      if (count == ocra)
+        tifr |= EMUREG_TIFR_OCFA;
+      if (count == ocrb)
+        tifr |= EMUREG_TIFR_OCFB;
+      if (count == ocrc)
+        tifr |= EMUREG_TIFR_OCFC;
+    }
+
+    EMUREG_RAW(timer.tcnt_addr) = (uint8_t) count;
+    if (timer.is_wide)
+      EMUREG_RAW(timer.tcnt_addr + 1) = (uint8_t) (count >> 8);
+    EMUREG_RAW(timer.tifr_addr) = tifr;
+  }
+}
+
+
+
+// This returns the length of one USART frame in cycles.
+
+static uint32_t EMUREG_GetFrameCycles(emureg_uart_t &uart)
+{
+  uint32_t result;
+
+  result = EMUREG_RAW(uart.brrl_addr);
+  result |= ((uint32_t) (EMUREG_RAW(uart.brrh_addr) & 0x0f)) << 8;
+  result++;
+
+  // 16 samples per bit, or 8 in double-speed mode. 10 bits per frame.
+  result *= (EMUREG_RAW(uart.csra_addr) & (1 << U2X0)) ? 80 : 160;
+
+  return result;
+}
+
+
+
+// This hands a transmitted byte to the host.
+
+static void EMUREG_EmitUARTByte(uint8_t uart_idx, uint8_t thischar)
+{
+  if ( emureg_console && (EMUREG_CONSOLE_UART == uart_idx) )
+  {
+    putchar(thischar);
+    if ('\n' == thischar)
+      fflush(stdout);
+  }
+  else
+    emureg_uart_out[uart_idx] += (char) thischar;
+}
+
+
+
+// This advances one USART to the present.
+
+static void EMUREG_UpdateUART(uint8_t uart_idx)
+{
+  emureg_uart_t *uart;
+  uint8_t csrb;
+
+  uart = &(emureg_uarts[uart_idx]);
+  csrb = EMUREG_RAW(uart->csrb_addr);
+
+  // Transmitter.
+  while ( uart->tx_shifting && (emureg_cycles >= uart->tx_done_time) )
+  {
+    EMUREG_EmitUARTByte(uart_idx, uart->tx_shift);
+
+    if (uart->tx_buffered)
+    {
+      uart->tx_shift = uart->tx_buffer;
+      uart->tx_buffered = false;
+      uart->tx_done_time += EMUREG_GetFrameCycles(*uart);
+      EMUREG_RAW(uart->csra_addr) |= (1 << UDRE0);
+    }
+    else
+    {
+      uart->tx_shifting = false;
+      EMUREG_RAW(uart->csra_addr) |= (1 << TXC0);
+    }
+  }
+
+  // Receiver. Bytes arrive one frame apart; anything that doesn't fit
+  // in the FIFO is lost.
+  while ( (0 != (csrb & (1 << RXEN0))) && (!uart->host_in->empty())
+    && (emureg_cycles >= uart->rx_next_time) )
+  {
+    if (2 > uart->rx_count)
+    {
+      uart->rx_fifo[uart->rx_count] = uart->host_in->front();
+      uart->rx_count++;
+      EMUREG_RAW(uart->csra_addr) |= (1 << RXC0);
+    }
+    else
+      EMUREG_RAW(uart->csra_addr) |= (1 << DOR0);
+
+    uart->host_in->pop_front();
+    uart->rx_next_time += EMUREG_GetFrameCycles(*uart);
+  }
+}
+
+
+
+// This looks at stdin for console input, without blocking.
+
+static void EMUREG_PollConsole(void)
+{
+  struct pollfd pollinfo;
+  char buffer[64];
+  ssize_t bytecount;
+  ssize_t bidx;
+  emureg_uart_t *uart;
+
+  pollinfo.fd = 0;
+  pollinfo.events = POLLIN;
+  pollinfo.revents = 0;
+
+  uart = &(emureg_uarts[EMUREG_CONSOLE_UART]);
+
+  if ( uart->host_in->empty() && (0 < poll(&pollinfo, 1, 0)) )
+  {
+    bytecount = read(0, buffer, sizeof(buffer));
+
+    if (0 < bytecount)
+    {
+      uart->rx_next_time = emureg_cycles + EMUREG_GetFrameCycles(*uart);
+      for (bidx = 0; bidx < bytecount; bidx++)
+        uart->host_in->push_back(buffer[bidx]);
+    }
+    else
+      emureg_console_eof = true;
+  }
+}
+
+
+
+// This finishes an ADC conversion.
+
+static void EMUREG_FinishADC(void)
+{
+  uint8_t channel;
+  uint16_t value;
+
+  channel = EMUREG_RAW(EMUREG_ADDR_ADMUX) & 0x1f;
+#ifdef __AVR_ATmega2560__
+  if (EMUREG_RAW(EMUREG_ADDR_ADCSRB) & (1 << MUX5))
+    channel |= 0x20;
+  // MUX5 selects the upper bank of single-ended inputs.
+  if (0x20 == (channel & 0x38))
+    channel = (channel & 0x07) | 0x08;
+#endif
+
+  value = 0;
+  if (channel < EMUREG_ADC_INPUTS)
+    value = emureg_adc_inputs[channel] & 0x03ff;
+
+  if (EMUREG_RAW(EMUREG_ADDR_ADMUX) & (1 << ADLAR))
+    value <<= 6;
+
+  EMUREG_RAW(EMUREG_ADDR_ADCL) = (uint8_t) value;
+  EMUREG_RAW(EMUREG_ADDR_ADCH) = (uint8_t) (value >> 8);
+
+  EMUREG_RAW(EMUREG_ADDR_ADCSRA) |= (1 << ADIF);
+  emureg_adc_busy = false;
+}
+
+
+
+// This starts an ADC conversion.
+
+static void EMUREG_StartADC(void)
+{
+  uint8_t adcsra;
+
+  adcsra = EMUREG_RAW(EMUREG_ADDR_ADCSRA);
+
+  emureg_adc_busy = true;
+  emureg_adc_done_time = emureg_cycles
+    + (emureg_adc_first ? 25 : 13) * emureg_adc_prescale[adcsra & 0x07];
+  emureg_adc_first = false;
+
+  EMUREG_RAW(EMUREG_ADDR_ADCSRA) |= (1 << ADSC);
+}
+
+
+
+// This advances the ADC to the present.
+
+static void EMUREG_UpdateADC(void)
+{
+  if ( emureg_adc_busy && (emureg_cycles >= emureg_adc_done_time) )
+  {
+    EMUREG_FinishADC();
+
+    // Free-running mode starts the next conversion right away.
+    if ( (EMUREG_RAW(EMUREG_ADDR_ADCSRA) & (1 << ADATE))
+      && (0 == (EMUREG_RAW(EMUREG_ADDR_ADCSRB) & 0x07)) )
+      EMUREG_StartADC();
+    else
+      EMUREG_RAW(EMUREG_ADDR_ADCSRA) &= ~(1 << ADSC);
+  }
+}
+
+
+
+// This returns the length of one SCL period in cycles.
+
+static uint32_t EMUREG_GetTWIBitCycles(void)
+{
+  uint32_t result;
+
+  result = EMUREG_RAW(EMUREG_ADDR_TWBR);
+  result <<= 1 + ((EMUREG_RAW(EMUREG_ADDR_TWSR) & 0x03) << 1);
+  result += 16;
+
+  return result;
+}
+
+
+
+// This advances everything to the present.
+
+static void EMUREG_UpdatePeripherals(uint32_t cycles)
+{
+  uint8_t idx;
+
+  for (idx = 0; idx < EMUREG_TIMER_COUNT; idx++)
+    EMUREG_UpdateTimer(emureg_timers[idx], cycles);
+
+  for (idx = 0; idx < EMUREG_UART_COUNT; idx++)
+    EMUREG_UpdateUART(idx);
+
+  if ( emureg_console && (!emureg_console_eof)
+    && (emureg_cycles >= emureg_console_next_poll) )
+  {
+    emureg_console_next_poll = emureg_cycles + EMUREG_CONSOLE_POLL_CYCLES;
+    EMUREG_PollConsole();
+  }
+
+  EMUREG_UpdateADC();
+
+  if ( emureg_spi_busy && (emureg_cycles >= emureg_spi_done_time) )
+  {
+    emureg_spi_busy = false;
+    EMUREG_RAW(EMUREG_ADDR_SPDR) = (NULL == emureg_spi_responder)
+      ? emureg_spi_sent : (*emureg_spi_responder)(emureg_spi_sent);
+    EMUREG_RAW(EMUREG_ADDR_SPSR) |= (1 << SPIF);
+    emureg_spi_flag_seen = false;
+  }
+
+  if ( emureg_twi_busy && (emureg_cycles >= emureg_twi_done_time) )
+  {
+    emureg_twi_busy = false;
+    EMUREG_RAW(EMUREG_ADDR_TWSR) =
+      emureg_twi_status | (EMUREG_RAW(EMUREG_ADDR_TWSR) & 0x03);
+    EMUREG_RAW(EMUREG_ADDR_TWCR) |= (1 << TWINT);
+  }
+
+  if ( emureg_cycles >= emureg_eeprom_done_time )
+    EMUREG_RAW(EMUREG_ADDR_EECR) &= ~(1 << EEPE);
+  if ( emureg_cycles >= emureg_eeprom_mpe_time )
+    EMUREG_RAW(EMUREG_ADDR_EECR) &= ~(1 << EEMPE);
+}
+
+
+
+// This calls handlers for pending interrupts, highest priority first,
+// until nothing enabled is pending or a handler leaves interrupts off.
+// Sources with no handler are ignored; on hardware they'd reset the chip.
+
+static void EMUREG_Dispatch(void)
+{
+  uint8_t sidx;
+  const emureg_source_t *source;
+  const emureg_source_t *found;
+  bool pending;
+
+  do
+  {
+    found = NULL;
+
+    for (sidx = 0; (NULL == found) && (sidx < EMUREG_SOURCE_COUNT); sidx++)
+    {
+      source = &(emureg_sources[sidx]);
+
+      pending = ( 0 != (EMUREG_RAW(source->flag_addr) & source->flag_mask) );
+      if (source->flag_inverted)
+        pending = !pending;
+
+      if ( pending
+        && (0 != (EMUREG_RAW(source->enable_addr) & source->enable_mask))
+        && (NULL != emureg_vectors[source->vector]) )
+        found = source;
+    }
+
+    if (NULL != found)
+    {
+      if (found->clear_on_dispatch)
+        EMUREG_RAW(found->flag_addr) &= ~(found->flag_mask);
+
+      emureg_vector_counts[found->vector]++;
+
+      EMUREG_RAW(EMUREG_ADDR_SREG) &= ~(1 << SREG_I);
+      emureg_cycles += EMUREG_ISR_ENTRY_CYCLES;
+      EMUREG_UpdatePeripherals(EMUREG_ISR_ENTRY_CYCLES);
+
+      (*(emureg_vectors[found->vector]))();
+
+      emureg_cycles += EMUREG_ISR_EXIT_CYCLES;
+      EMUREG_UpdatePeripherals(EMUREG_ISR_EXIT_CYCLES);
+      EMUREG_RAW(EMUREG_ADDR_SREG) |= (1 << SREG_I);
+    }
+  }
+  while (NULL != found);
+}
+
+
+// Register hooks.
+
+
+// GPIO.
+
+static uint8_t EMUREG_ReadPin(uint16_t address)
+{
+  uint8_t result;
+  uint8_t pidx;
+
+  result = 0;
+
+  for (pidx = 0; pidx < EMUREG_PORT_COUNT; pidx++)
+    if (address == emureg_ports[pidx].pin_addr)
+      result = EMUREG_ComputePins(emureg_ports[pidx]);
+
+  EMUREG_RAW(address) = result;
+
+  return result;
+}
+
+
+// Writing ones to PINx toggles PORTx.
+static void EMUREG_WritePin(uint16_t address, uint8_t value)
+{
+  EMUREG_RAW(address + 2) ^= value;
+  EMUREG_CheckCapture();
+}
+
+
+static void EMUREG_WritePort(uint16_t address, uint8_t value)
+{
+  EMUREG_RAW(address) = value;
+  EMUREG_CheckCapture();
+}
+
+
+
+// Timers.
+
+// Flags are cleared by writing ones.
+static void EMUREG_WriteTimerFlags(uint16_t address, uint8_t value)
+{
+  EMUREG_RAW(address) &= ~value;
+}
+
+
+
+// USARTs.
+
+static emureg_uart_t *EMUREG_FindUART(uint16_t address)
+{
+  emureg_uart_t *result;
+  uint8_t uidx;
+
+  result = NULL;
+
+  for (uidx = 0; uidx < EMUREG_UART_COUNT; uidx++)
+    if ( (address >= emureg_uarts[uidx].csra_addr)
+      && (address <= emureg_uarts[uidx].udr_addr) )
+      result = &(emureg_uarts[uidx]);
+
+  return result;
+}
+
+
+// TXC is cleared by writing one. U2X and MPCM are writable.
+static void EMUREG_WriteUARTStatus(uint16_t address, uint8_t value)
+{
+  uint8_t scratch;
+
+  scratch = EMUREG_RAW(address) & 0xbc;
+  if (value & (1 << TXC0))
+    scratch &= ~(1 << TXC0);
+  scratch |= value & 0x03;
+
+  EMUREG_RAW(address) = scratch;
+}
+
+
+static void EMUREG_WriteUARTControl(uint16_t address, uint8_t value)
+{
+  emureg_uart_t *uart;
+
+  uart = EMUREG_FindUART(address);
+
+  // Reception starts a frame after the receiver is turned on.
+  if ( (0 == (EMUREG_RAW(address) & (1 << RXEN0)))
+    && (0 != (value & (1 << RXEN0))) )
+    uart->rx_next_time = emureg_cycles + EMUREG_GetFrameCycles(*uart);
+
+  EMUREG_RAW(address) = value;
+}
+
+
+static uint8_t EMUREG_ReadUARTData(uint16_t address)
+{
+  emureg_uart_t *uart;
+  uint8_t result;
+
+  uart = EMUREG_FindUART(address);
+
+  result = uart->rx_fifo[0];
+
+  if (0 < uart->rx_count)
+  {
+    uart->rx_fifo[0] = uart->rx_fifo[1];
+    uart->rx_count--;
+  }
+
+  if (0 == uart->rx_count)
+    EMUREG_RAW(uart->csra_addr) &= ~( (1 << RXC0) | (1 << DOR0) );
+
+  return result;
+}
+
+
+static void EMUREG_WriteUARTData(uint16_t address, uint8_t value)
+{
+  emureg_uart_t *uart;
+
+  uart = EMUREG_FindUART(address);
+
+  if (0 != (EMUREG_RAW(uart->csrb_addr) & (1 << TXEN0)))
+  {
+    if (!uart->tx_shifting)
+    {
+      uart->tx_shift = value;
+      uart->tx_shifting = true;
+      uart->tx_done_time = emureg_cycles + EMUREG_GetFrameCycles(*uart);
+    }
+    else if (!uart->tx_buffered)
+    {
+      uart->tx_buffer = value;
+      uart->tx_buffered = true;
+      EMUREG_RAW(uart->csra_addr) &= ~(1 << UDRE0);
+    }
+    // Otherwise the write is ignored, as on hardware.
+  }
+}
+
+
+
+// ADC.
+
+// ADIF is cleared by writing one. ADSC can't be cleared by the firmware.
+static void EMUREG_WriteADCControl(uint16_t address, uint8_t value)
+{
+  uint8_t scratch;
+
+  scratch = value & ~( (1 << ADIF) | (1 << ADSC) );
+  if (0 == (value & (1 << ADIF)))
+    scratch |= EMUREG_RAW(address) & (1 << ADIF);
+  if (emureg_adc_busy)
+    scratch |= (1 << ADSC);
+
+  EMUREG_RAW(address) = scratch;
+
+  if (0 == (value & (1 << ADEN)))
+  {
+    // Turning the ADC off aborts conversions. The next one is long.
+    emureg_adc_busy = false;
+    emureg_adc_first = true;
+    EMUREG_RAW(address) &= ~(1 << ADSC);
+  }
+  else if ( (0 != (value & (1 << ADSC))) && (!emureg_adc_busy) )
+    EMUREG_StartADC();
+}
+
+
+
+// SPI.
+
+// Reading SPSR with SPIF set, then touching SPDR, clears SPIF.
+static uint8_t EMUREG_ReadSPIStatus(uint16_t address)
+{
+  if (EMUREG_RAW(address) & (1 << SPIF))
+    emureg_spi_flag_seen = true;
+
+  return EMUREG_RAW(address);
+}
+
+
+static void EMUREG_WriteSPIStatus(uint16_t address, uint8_t value)
+{
+  EMUREG_RAW(address) =
+    (EMUREG_RAW(address) & ~(1 << SPI2X)) | (value & (1 << SPI2X));
+}
+
+
+static void EMUREG_ClearSPIFlagIfSeen(void)
+{
+  if (emureg_spi_flag_seen)
+    EMUREG_RAW(EMUREG_ADDR_SPSR) &= ~( (1 << SPIF) | (1 << WCOL) );
+  emureg_spi_flag_seen = false;
+}
+
+
+static uint8_t EMUREG_ReadSPIData(uint16_t address)
+{
+  EMUREG_ClearSPIFlagIfSeen();
+
+  return EMUREG_RAW(address);
+}
+
+
+static void EMUREG_WriteSPIData(uint16_t address, uint8_t value)
+{
+  uint8_t spcr;
+  uint32_t divisor;
+
+  EMUREG_ClearSPIFlagIfSeen();
+
+  spcr = EMUREG_RAW(EMUREG_ADDR_SPCR);
+
+  if ( (0 != (spcr & (1 << SPE))) && (0 != (spcr & (1 << MSTR))) )
+  {
+    if (emureg_spi_busy)
+      EMUREG_RAW(EMUREG_ADDR_SPSR) |= (1 << WCOL);
+    else
+    {
+      // SPR1:0 selects /4, /16, /64, /128. SPI2X halves it.
+      divisor = (3 == (spcr & 0x03)) ? 128 : (4 << ((spcr & 0x03) << 1));
+      if (EMUREG_RAW(EMUREG_ADDR_SPSR) & (1 << SPI2X))
+        divisor >>= 1;
+
+      emureg_spi_sent = value;
+      emureg_spi_busy = true;
+      emureg_spi_done_time = emureg_cycles + 8 * divisor;
+    }
+  }
+}
+
+
+
+// TWI.
+
+static void EMUREG_WriteTWIControl(uint16_t address, uint8_t value)
+{
+  uint8_t scratch;
+  uint32_t bit_cycles;
+
+  // TWINT is cleared by writing one; TWWC is read-only.
+  scratch = value & ~( (1 << TWINT) | (1 << TWWC) );
+  if (0 == (value & (1 << TWINT)))
+    scratch |= EMUREG_RAW(address) & (1 << TWINT);
+  EMUREG_RAW(address) = scratch;
+
+  bit_cycles = EMUREG_GetTWIBitCycles();
+
+  if (0 == (value & (1 << TWEN)))
+  {
+    // Turning TWI off abandons everything.
+    emureg_twi_busy = false;
+    emureg_twi_bus_held = false;
+    emureg_twi_status = 0xf8;
+  }
+  else if (0 != (value & (1 << TWINT)))
+  {
+    if (value & (1 << TWSTO))
+    {
+      // Stop happens right away; the hardware clears TWSTO.
+      emureg_twi_bus_held = false;
+      emureg_twi_status = 0xf8;
+      EMUREG_RAW(address) &= ~(1 << TWSTO);
+    }
+
+    if (value & (1 << TWSTA))
+    {
+      // Start or repeated start.
+      emureg_twi_status = emureg_twi_bus_held ? 0x10 : 0x08;
+      emureg_twi_bus_held = true;
+      emureg_twi_busy = true;
+      emureg_twi_done_time = emureg_cycles + bit_cycles;
+    }
+    else if ( emureg_twi_bus_held
+      && ( (0x08 == emureg_twi_status) || (0x10 == emureg_twi_status) ) )
+    {
+      // Address byte. Only the EEPROM answers.
+      scratch = EMUREG_RAW(EMUREG_ADDR_TWDR);
+      emureg_twi_selected = ( EMUREG_TWI_DEVICE == (scratch >> 1) );
+      emureg_twi_want_pointer = true;
+      if (scratch & 0x01)
+        emureg_twi_status = emureg_twi_selected ? 0x40 : 0x48;
+      else
+        emureg_twi_status = emureg_twi_selected ? 0x18 : 0x20;
+      emureg_twi_busy = true;
+      emureg_twi_done_time = emureg_cycles + 9 * bit_cycles;
+    }
+    else if ( emureg_twi_bus_held && emureg_twi_selected
+      && ( (0x18 == emureg_twi_status) || (0x28 == emureg_twi_status) ) )
+    {
+      // Write data. The first byte is the word address.
+      scratch = EMUREG_RAW(EMUREG_ADDR_TWDR);
+      if (emureg_twi_want_pointer)
+        emureg_twi_pointer = scratch;
+      else
+      {
+        emureg_twi_memory[emureg_twi_pointer] = scratch;
+        emureg_twi_pointer++;
+      }
+      emureg_twi_want_pointer = false;
+      emureg_twi_status = 0x28;
+      emureg_twi_busy = true;
+      emureg_twi_done_time = emureg_cycles + 9 * bit_cycles;
+    }
+    else if ( emureg_twi_bus_held && emureg_twi_selected
+      && ( (0x40 == emureg_twi_status) || (0x50 == emureg_twi_status) ) )
+    {
+      // Read data. TWEA decides whether we ACK it.
+      EMUREG_RAW(EMUREG_ADDR_TWDR) = emureg_twi_memory[emureg_twi_pointer];
+      emureg_twi_pointer++;
+      emureg_twi_status = (value & (1 << TWEA)) ? 0x50 : 0x58;
+      emureg_twi_busy = true;
+      emureg_twi_done_time = emureg_cycles + 9 * bit_cycles;
+    }
+    else if (emureg_twi_bus_held)
+    {
+      // Data after a NACK. Nobody answers this.
+      EMUREG_RAW(EMUREG_ADDR_TWDR) = 0xff;
+      emureg_twi_busy = true;
+      emureg_twi_done_time = emureg_cycles + 9 * bit_cycles;
+    }
+  }
+}
+
+
+// Only the prescaler bits are writable.
+static void EMUREG_WriteTWIStatus(uint16_t address, uint8_t value)
+{
+  EMUREG_RAW(address) = (EMUREG_RAW(address) & 0xf8) | (value & 0x03);
+}
+
+
+
+// EEPROM.
+
+static void EMUREG_WriteEEPROMControl(uint16_t address, uint8_t value)
+{
+  uint16_t eeaddr;
+  bool was_armed;
+
+  eeaddr = EMUREG_RAW(EMUREG_ADDR_EEARL);
+  eeaddr |= ((uint16_t) EMUREG_RAW(EMUREG_ADDR_EEARL + 1)) << 8;
+  eeaddr &= EMUREG_EEPROM_SIZE - 1;
+
+  was_armed = ( 0 != (EMUREG_RAW(address) & (1 << EEMPE)) );
+
+  // EEPE and EEMPE can only be set here; the hardware clears them.
+  EMUREG_RAW(address) = (EMUREG_RAW(address) & ((1 << EEPE) | (1 << EEMPE)))
+    | (value & 0x38);
+
+  if (value & (1 << EEMPE))
+  {
+    EMUREG_RAW(address) |= (1 << EEMPE);
+    emureg_eeprom_mpe_time = emureg_cycles + 4;
+  }
+
+  if (0 == (EMUREG_RAW(address) & (1 << EEPE)))
+  {
+    if (value & (1 << EERE))
+      EMUREG_RAW(EMUREG_ADDR_EEDR) = emureg_eeprom[eeaddr];
+    else if ( (value & (1 << EEPE)) && was_armed )
+    {
+      // Erase-and-write takes 3.4 ms.
+      emureg_eeprom[eeaddr] = EMUREG_RAW(EMUREG_ADDR_EEDR);
+      EMUREG_RAW(address) |= (1 << EEPE);
+      EMUREG_RAW(address) &= ~(1 << EEMPE);
+      emureg_eeprom_done_time = emureg_cycles
+        + (emureg_mcu_hz / 10000ul) * 34ul;
+    }
+  }
+}
+
+
+// Setup.
+
+
+// This puts the register file and the peripherals in their power-on
+// state, and installs the register hooks.
+
+static void EMUREG_PowerOnReset(void)
+{
+  uint16_t ridx;
+  uint8_t idx;
+  emureg_uart_t *uart;
+
+  for (ridx = 0; ridx < EMUREG_FILE_SIZE; ridx++)
+  {
+    EMUREG_RAW(ridx) = 0;
+    emureg_readhooks[ridx] = NULL;
+    emureg_writehooks[ridx] = NULL;
+  }
+
+  for (idx = 0; idx < EMUREG_VECTOR_COUNT; idx++)
+    emureg_vector_counts[idx] = 0;
+
+  for (idx = 0; idx < EMUREG_PORT_COUNT; idx++)
+  {
+    emureg_ports[idx] = emureg_port_defaults[idx];
+    emureg_readhooks[emureg_ports[idx].pin_addr] = &EMUREG_ReadPin;
+    emureg_writehooks[emureg_ports[idx].pin_addr] = &EMUREG_WritePin;
+    emureg_writehooks[emureg_ports[idx].pin_addr + 1] = &EMUREG_WritePort;
+    emureg_writehooks[emureg_ports[idx].pin_addr + 2] = &EMUREG_WritePort;
+  }
+
+  for (idx = 0; idx < EMUREG_TIMER_COUNT; idx++)
+  {
+    emureg_timers[idx] = emureg_timer_defaults[idx];
+    emureg_writehooks[emureg_timers[idx].tifr_addr] =
+      &EMUREG_WriteTimerFlags;
+  }
+
+  for (idx = 0; idx < EMUREG_UART_COUNT; idx++)
+  {
+    uart = &(emureg_uarts[idx]);
+
+    uart->csra_addr = emureg_uart_addrs[idx][0];
+    uart->csrb_addr = emureg_uart_addrs[idx][1];
+    uart->brrl_addr = emureg_uart_addrs[idx][2];
+    uart->brrh_addr = emureg_uart_addrs[idx][3];
+    uart->udr_addr = emureg_uart_addrs[idx][4];
+
+    uart->rx_count = 0;
+    uart->rx_next_time = 0;
+    uart->tx_shifting = false;
+    uart->tx_buffered = false;
+    uart->host_in = &(emureg_uart_in[idx]);
+    uart->host_out = &(emureg_uart_out[idx]);
+
+    EMUREG_RAW(uart->csra_addr) = (1 << UDRE0);
+    EMUREG_RAW(uart->csra_addr + 2) = (1 << UCSZ01) | (1 << UCSZ00);
+
+    emureg_writehooks[uart->csra_addr] = &EMUREG_WriteUARTStatus;
+    emureg_writehooks[uart->csrb_addr] = &EMUREG_WriteUARTControl;
+    emureg_readhooks[uart->udr_addr] = &EMUREG_ReadUARTData;
+    emureg_writehooks[uart->udr_addr] = &EMUREG_WriteUARTData;
+  }
+
+  emureg_writehooks[EMUREG_ADDR_ADCSRA] = &EMUREG_WriteADCControl;
+
+  emureg_readhooks[EMUREG_ADDR_SPSR] = &EMUREG_ReadSPIStatus;
+  emureg_writehooks[EMUREG_ADDR_SPSR] = &EMUREG_WriteSPIStatus;
+  emureg_readhooks[EMUREG_ADDR_SPDR] = &EMUREG_ReadSPIData;
+  emureg_writehooks[EMUREG_ADDR_SPDR] = &EMUREG_WriteSPIData;
+
+  EMUREG_RAW(EMUREG_ADDR_TWSR) = 0xf8;
+  EMUREG_RAW(EMUREG_ADDR_TWDR) = 0xff;
+  emureg_writehooks[EMUREG_ADDR_TWCR] = &EMUREG_WriteTWIControl;
+  emureg_writehooks[EMUREG_ADDR_TWSR] = &EMUREG_WriteTWIStatus;
+
+  memset(emureg_eeprom, 0xff, sizeof(emureg_eeprom));
+  memset(emureg_twi_memory, 0xff, sizeof(emureg_twi_memory));
+  emureg_writehooks[EMUREG_ADDR_EECR] = &EMUREG_WriteEEPROMControl;
+
+  // This is a power-on reset.
+  EMUREG_RAW(EMUREG_ADDR_MCUSR) = (1 << PORF);
+}
+
+
+// Public register access functions.
+
+
+// Reads a register.
+
+uint8_t EMUREG_Read8(uint16_t address)
+{
+  uint8_t result;
+
+  EMUREG_Advance(EMUREG_ACCESS_CYCLES);
+
+  if (NULL != emureg_readhooks[address])
+    result = (*(emureg_readhooks[address]))(address);
+  else
+    result = EMUREG_RAW(address);
+
+  return result;
+}
+
+
+
+// Writes a register.
+
+void EMUREG_Write8(uint16_t address, uint8_t value)
+{
+  EMUREG_Advance(EMUREG_ACCESS_CYCLES);
+
+  if (NULL != emureg_writehooks[address])
+    (*(emureg_writehooks[address]))(address, value);
+  else
+    EMUREG_RAW(address) = value;
+}
+
+
+
+// Does a read-modify-write of a register, as a single access.
+// The new value is ((old & and_mask) | or_mask) ^ xor_mask.
+
+void EMUREG_Modify8(uint16_t address, uint8_t and_mask, uint8_t or_mask,
+  uint8_t xor_mask)
+{
+  uint8_t value;
+
+  EMUREG_Advance(EMUREG_ACCESS_CYCLES);
+
+  if (NULL != emureg_readhooks[address])
+    value = (*(emureg_readhooks[address]))(address);
+  else
+    value = EMUREG_RAW(address);
+
+  value = ((value & and_mask) | or_mask) ^ xor_mask;
+
+  // Flag registers only see the bits being set (as with SBI).
+  if (&EMUREG_WriteTimerFlags == emureg_writehooks[address])
+    value = or_mask;
+
+  if (NULL != emureg_writehooks[address])
+    (*(emureg_writehooks[address]))(address, value);
+  else
+    EMUREG_RAW(address) = value;
+}
+
+
+
+// Sets or clears the global interrupt flag.
+
+void EMUREG_SetInterrupts(bool enabled)
+{
+  if (enabled)
+  {
+    EMUREG_RAW(EMUREG_ADDR_SREG) |= (1 << SREG_I);
+    EMUREG_Advance(1);
+  }
+  else
+  {
+    EMUREG_RAW(EMUREG_ADDR_SREG) &= ~(1 << SREG_I);
+    EMUREG_Advance(1);
+  }
+}
+
+
+
+// Advances virtual time, dispatching pending interrupts if they're enabled.
+// With interrupts on, long delays are taken in short steps, so that
+// handlers run about when they would on hardware.
+
+void EMUREG_Advance(uint32_t cycles)
+{
+  uint32_t step;
+
+  do
+  {
+    step = cycles;
+    if ( (EMUREG_RAW(EMUREG_ADDR_SREG) & (1 << SREG_I))
+      && (EMUREG_MAX_STEP_CYCLES < step) )
+      step = EMUREG_MAX_STEP_CYCLES;
+
+    emureg_cycles += step;
+    cycles -= step;
+    EMUREG_UpdatePeripherals(step);
+
+    if (EMUREG_RAW(EMUREG_ADDR_SREG) & (1 << SREG_I))
+      EMUREG_Dispatch();
+  }
+  while (0 < cycles);
+}
+
+
+// Public emulator control functions.
+
+
+// Sets the emulated clock rate.
+
+void EMUREG_SetMCUClock(uint32_t mcu_hz)
+{
+  emureg_mcu_hz = mcu_hz;
+}
+
+
+
+// Returns the number of virtual clock cycles since startup.
+
+uint64_t EMUREG_GetCycles(void)
+{
+  return emureg_cycles;
+}
+
+
+
+// Returns the number of times a vector has been dispatched.
+
+uint32_t EMUREG_GetVectorCount(uint8_t vector)
+{
+  uint32_t result;
+
+  result = 0;
+  if (vector < EMUREG_VECTOR_COUNT)
+    result = emureg_vector_counts[vector];
+
+  return result;
+}
+
+
+
+// Drives input pins from outside.
+
+void EMUREG_DrivePins(char port_id, uint8_t mask, uint8_t levels)
+{
+  emureg_port_t *port;
+
+  port = EMUREG_FindPort(port_id);
+
+  if (NULL != port)
+  {
+    port->driven_mask |= mask;
+    port->driven_levels = (port->driven_levels & ~mask) | (levels & mask);
+    EMUREG_CheckCapture();
+  }
+}
+
+
+
+// Stops driving input pins from outside.
+
+void EMUREG_ReleasePins(char port_id, uint8_t mask)
+{
+  emureg_port_t *port;
+
+  port = EMUREG_FindPort(port_id);
+
+  if (NULL != port)
+  {
+    port->driven_mask &= ~mask;
+    EMUREG_CheckCapture();
+  }
+}
+
+
+
+// Returns pin levels as seen from outside.
+
+uint8_t EMUREG_GetPinLevels(char port_id)
+{
+  uint8_t result;
+  emureg_port_t *port;
+
+  result = 0;
+
+  port = EMUREG_FindPort(port_id);
+  if (NULL != port)
+    result = EMUREG_ComputePins(*port);
+
+  return result;
+}
+
+
+
+// Sets the value an ADC input reads as.
+
+void EMUREG_SetADCInput(uint8_t channel, uint16_t value)
+{
+  if (channel < EMUREG_ADC_INPUTS)
+    emureg_adc_inputs[channel] = value;
+}
+
+
+
+// Queues bytes for a USART to receive.
+
+void EMUREG_FeedUART(uint8_t uart_idx, const char *data, size_t length)
+{
+  emureg_uart_t *uart;
+  size_t bidx;
+
+  if (uart_idx < EMUREG_UART_COUNT)
+  {
+    uart = &(emureg_uarts[uart_idx]);
+
+    if ( uart->host_in->empty() && (uart->rx_next_time < emureg_cycles) )
+      uart->rx_next_time = emureg_cycles + EMUREG_GetFrameCycles(*uart);
+
+    for (bidx = 0; bidx < length; bidx++)
+      uart->host_in->push_back(data[bidx]);
+  }
+}
+
+
+
+// Copies out bytes that a USART transmitted.
+
+size_t EMUREG_ReadUART(uint8_t uart_idx, char *buffer, size_t size)
+{
+  size_t result;
+
+  result = 0;
+
+  if (uart_idx < EMUREG_UART_COUNT)
+  {
+    result = emureg_uart_out[uart_idx].copy(buffer, size);
+    emureg_uart_out[uart_idx].erase(0, result);
+  }
+
+  return result;
+}
+
+
+
+// Connects the primary USART to stdin/stdout, or disconnects it.
+
+void EMUREG_SetConsole(bool enabled)
+{
+  emureg_console = enabled;
+}
+
+
+
+// Sets the SPI MISO source.
+
+void EMUREG_SetSPIResponder(uint8_t (*responder)(uint8_t mosi_byte))
+{
+  emureg_spi_responder = responder;
+}
+
+
+
+//
+// This is the end of the file.
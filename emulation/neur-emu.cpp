@@ -11,6 +11,8 @@
 #include "neuravr.h"
 #include "neuravr-private.h"
 
+#include <stdio.h>
+
 #include <iostream>
 #include <string>
 #include <list>
@@ -99,6 +101,65 @@ std::thread uart_writer;
 std::thread uart_feeder;
 
 
+// SPI variables.
+
+volatile uint32_t real_spi_rate = 0;
+
+// Loopback state. Sending a byte from within the byte-done handler is
+// deferred, so that long transfers don't recurse.
+bool spi_in_handler = false;
+bool spi_byte_pending = false;
+uint8_t spi_pending_byte = 0;
+
+
+// TWI variables.
+
+volatile uint32_t real_twi_rate = 0;
+
+// Stand-in device: a 256-byte EEPROM at address 0x50 with a one-byte word
+// address. Nothing else on the bus acknowledges.
+#define TWI_EMU_EEPROM_ADDR 0x50
+uint8_t twi_eeprom[256];
+uint8_t twi_eeprom_ptr = 0;
+
+// Bus state.
+bool twi_bus_started = false;
+bool twi_addr_phase = false;
+bool twi_dev_selected = false;
+bool twi_word_phase = false;
+uint8_t twi_data = 0;
+
+// Status reporting is deferred the same way as SPI bytes are.
+bool twi_in_handler = false;
+bool twi_status_pending = false;
+uint8_t twi_pending_status = 0;
+
+
+// EEPROM variables.
+
+// The emulated EEPROM is backed by a file, so that configuration data
+// persists between runs. NEUREMU_EEPROM overrides the file name.
+#define EMU_EEPROM_BYTES 4096
+#define EMU_EEPROM_DEFAULT_FILE "neuremu-eeprom.bin"
+uint8_t emu_eeprom[EMU_EEPROM_BYTES];
+bool emu_eeprom_loaded = false;
+FILE *emu_eeprom_file = NULL;
+
+// The ready interrupt is delivered in a loop, like SPI bytes.
+bool eeprom_irq_enabled = false;
+bool eeprom_in_handler = false;
+
+
+// DDS variables.
+
+// Samples are delivered from the RTC ISR, paced by virtual clocks rather
+// than wall-clock time. The PWM value is just stored.
+bool dds_irq_enabled = false;
+uint64_t dds_clocks_per_sample = 1;
+uint64_t dds_next_sample_clock = 0;
+uint8_t dds_pwm_value = 0x80;
+
+
 
 //
 // Utility Functions
@@ -226,11 +287,17 @@ int ATOMIC_ReleaseCli(int desired_state)
 void MCU_Init(void)
 {
   // Global variables already have reasonable values.
-  // Nothing to do!
 
 #if TATTLE_ATOMIC
   tid_lut.insert(std::make_pair(std::this_thread::get_id(), "main"));
 #endif
+
+  // Starting the emulator is a power-on reset as far as the flight
+  // recorder is concerned.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    FLIGHT_Init_ISR(FLIGHT_RESET_POWERON);
+  }
 }
 
 
@@ -253,7 +320,18 @@ void Timer_ISR(void)
 #endif
 
     // Update emulator state.
-    clocks_elapsed += clocks_per_tick;
+    // A disciplined RTC has its own idea of how long a tick is.
+    if (rtc_sync_active)
+      clocks_elapsed += Timer_GetSyncPeriod_ISR();
+    else
+      clocks_elapsed += clocks_per_tick;
+
+    // Deliver any DDS samples that are due.
+    while ( dds_irq_enabled && (clocks_elapsed >= dds_next_sample_clock) )
+    {
+      dds_next_sample_clock += dds_clocks_per_sample;
+      DDS_HandleSample_ISR();
+    }
 
     // Update neuravr state.
     rtc_timestamp++;
@@ -316,6 +394,11 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
   {
     timer_active = new_timer_active;
     clocks_per_tick = new_clocks_per_tick;
+
+    // Reset RTC disciplining. This needs the tick length.
+    if (0xffff < new_clocks_per_tick)
+      new_clocks_per_tick = 0xffff;
+    Timer_InitSync_ISR((uint16_t) new_clocks_per_tick);
   }
 
 
@@ -332,6 +415,16 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
 
 
 
+// RTC sync capture hook.
+// There's no sync input in emulation, so this does nothing.
+
+void Timer_SetSyncCapture_ISR(bool enabled, bool rising_edge)
+{
+  // Nothing to do.
+}
+
+
+
 //
 // GPIO Functions
 
@@ -382,6 +475,15 @@ uint8_t IO8_ReadData(void)
 }
 
 
+// Private GPIO functions.
+
+// This tells the GPIO bank to leave the SPI pins alone (or to reclaim them).
+void IO8_ReserveSPIPins(bool reserved)
+{
+  // Nothing to do.
+}
+
+
 // 16-bit Digital GPIO functions.
 
 // Configures input and output GPIO lines. 1 = output, 0 = input.
@@ -730,5 +832,350 @@ void UART_EnableTransmit_ISR(void)
 
 
 
+//
+// SPI Functions
+
+
+// Configures the SPI port as a master.
+// The emulated port is a loopback (MISO tied to MOSI) that completes each
+// byte immediately.
+
+void SPI_Init(uint32_t mcu_hz, uint32_t bit_rate, uint8_t spi_mode)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    real_spi_rate = bit_rate;
+    SPI_InitQueue_ISR();
+  }
+}
+
+
+// Returns the actual bit rate set, or 0 if SPI is off.
+
+uint32_t SPI_QueryBitRate(void)
+{
+  return real_spi_rate;
+}
+
+
+// This "sends" a byte, echoing it back to the byte-done handler.
+// The caller is responsible for any needed locking.
+
+void SPI_WriteByte_ISR(uint8_t sendbyte)
+{
+  spi_pending_byte = sendbyte;
+  spi_byte_pending = true;
+
+  if (!spi_in_handler)
+  {
+    spi_in_handler = true;
+
+    while (spi_byte_pending)
+    {
+      spi_byte_pending = false;
+      SPI_HandleByteDone_ISR(spi_pending_byte);
+    }
+
+    spi_in_handler = false;
+  }
+}
+
+
+// This drives the default chip select pin.
+// The caller is responsible for any needed locking.
+
+void SPI_SetDefaultSelect_ISR(bool asserted)
+{
+  // Nothing to do.
+}
+
+
+
+//
+// TWI Functions
+
+
+// Configures the TWI port as a master.
+// The emulated bus completes each operation immediately, and has one
+// device on it (a small EEPROM at address 0x50).
+
+void TWI_Init(uint32_t mcu_hz, uint32_t bit_rate)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    real_twi_rate = bit_rate;
+    TWI_InitQueue_ISR();
+
+    twi_bus_started = false;
+    twi_addr_phase = false;
+    twi_dev_selected = false;
+  }
+}
+
+
+// Returns the actual bit rate set, or 0 if TWI is off.
+
+uint32_t TWI_QueryBitRate(void)
+{
+  return real_twi_rate;
+}
+
+
+// This reports a bus event to the state machine, as the TWI interrupt
+// would.
+
+void TWI_EmuPostStatus(uint8_t status)
+{
+  twi_pending_status = status;
+  twi_status_pending = true;
+
+  if (!twi_in_handler)
+  {
+    twi_in_handler = true;
+
+    while (twi_status_pending)
+    {
+      twi_status_pending = false;
+      TWI_HandleStatus_ISR(twi_pending_status);
+    }
+
+    twi_in_handler = false;
+  }
+}
+
+
+// Hardware hooks for the state machine.
+// The caller is responsible for any needed locking.
+
+void TWI_SendStart_ISR(void)
+{
+  bool was_started;
+
+  was_started = twi_bus_started;
+
+  twi_bus_started = true;
+  twi_addr_phase = true;
+  twi_dev_selected = false;
+
+  TWI_EmuPostStatus(was_started ? TWI_STATUS_RESTART : TWI_STATUS_START);
+}
+
+
+void TWI_SendStop_ISR(bool start_next)
+{
+  twi_bus_started = false;
+  twi_addr_phase = false;
+  twi_dev_selected = false;
+
+  if (start_next)
+    TWI_SendStart_ISR();
+}
+
+
+void TWI_SendByte_ISR(uint8_t sendbyte)
+{
+  bool is_read;
+
+  if (twi_addr_phase)
+  {
+    twi_addr_phase = false;
+
+    is_read = (0 != (sendbyte & 1));
+    twi_dev_selected = ( TWI_EMU_EEPROM_ADDR == (sendbyte >> 1) );
+    // The first byte written after addressing sets the word address.
+    twi_word_phase = !is_read;
+
+    if (is_read)
+      TWI_EmuPostStatus( twi_dev_selected
+        ? TWI_STATUS_RADDR_ACK : TWI_STATUS_RADDR_NACK );
+    else
+      TWI_EmuPostStatus( twi_dev_selected
+        ? TWI_STATUS_WADDR_ACK : TWI_STATUS_WADDR_NACK );
+  }
+  else
+  {
+    if (twi_word_phase)
+      twi_eeprom_ptr = sendbyte;
+    else
+    {
+      twi_eeprom[twi_eeprom_ptr] = sendbyte;
+      twi_eeprom_ptr++;
+    }
+
+    twi_word_phase = false;
+
+    TWI_EmuPostStatus(TWI_STATUS_WDATA_ACK);
+  }
+}
+
+
+void TWI_ReceiveByte_ISR(bool send_ack)
+{
+  twi_data = twi_eeprom[twi_eeprom_ptr];
+  twi_eeprom_ptr++;
+
+  TWI_EmuPostStatus(send_ack ? TWI_STATUS_RDATA_ACK : TWI_STATUS_RDATA_NACK);
+}
+
+
+uint8_t TWI_ReadByte_ISR(void)
+{
+  return twi_data;
+}
+
+
+
+//
+// EEPROM Functions
+
+
+// This loads the emulated EEPROM from its backing file the first time it's
+// accessed, creating the file (blank) if there isn't one.
+
+void EMU_LoadEEPROM(void)
+{
+  const char *fname;
+  size_t bidx;
+
+  if (!emu_eeprom_loaded)
+  {
+    emu_eeprom_loaded = true;
+
+    // Blank EEPROM reads as 0xff.
+    for (bidx = 0; bidx < EMU_EEPROM_BYTES; bidx++)
+      emu_eeprom[bidx] = 0xff;
+
+    fname = getenv("NEUREMU_EEPROM");
+    if (NULL == fname)
+      fname = EMU_EEPROM_DEFAULT_FILE;
+
+    emu_eeprom_file = fopen(fname, "r+b");
+    if (NULL != emu_eeprom_file)
+    {
+      // A short file just leaves the rest blank.
+      bidx = fread(emu_eeprom, 1, EMU_EEPROM_BYTES, emu_eeprom_file);
+    }
+    else
+    {
+      emu_eeprom_file = fopen(fname, "w+b");
+      if (NULL != emu_eeprom_file)
+      {
+        fwrite(emu_eeprom, 1, EMU_EEPROM_BYTES, emu_eeprom_file);
+        fflush(emu_eeprom_file);
+      }
+      else
+        std::cerr << "### Can't open \"" << fname
+          << "\"; EEPROM won't persist.\n";
+    }
+  }
+}
+
+
+// Reads one byte from the emulated EEPROM.
+// The caller is responsible for any needed locking.
+
+uint8_t CONFIG_ReadEEPROM_ISR(uint16_t address)
+{
+  EMU_LoadEEPROM();
+
+  return emu_eeprom[address % EMU_EEPROM_BYTES];
+}
+
+
+// Writes one byte to the emulated EEPROM and its backing file.
+// This completes immediately.
+// The caller is responsible for any needed locking.
+
+void CONFIG_WriteEEPROM_ISR(uint16_t address, uint8_t value)
+{
+  EMU_LoadEEPROM();
+
+  address %= EMU_EEPROM_BYTES;
+  emu_eeprom[address] = value;
+
+  if (NULL != emu_eeprom_file)
+  {
+    fseek(emu_eeprom_file, address, SEEK_SET);
+    fputc(value, emu_eeprom_file);
+    fflush(emu_eeprom_file);
+  }
+}
+
+
+// Returns true if an emulated EEPROM write is still in progress.
+// Writes complete immediately, so this is never the case.
+
+bool CONFIG_IsEEPROMBusy(void)
+{
+  return false;
+}
+
+
+// Turns the emulated EEPROM-ready interrupt on or off.
+// Since writes complete immediately, the handler is called until it turns
+// the interrupt back off.
+// The caller is responsible for any needed locking.
+
+void CONFIG_SetReadyInterrupt_ISR(bool enabled)
+{
+  eeprom_irq_enabled = enabled;
+
+  if (!eeprom_in_handler)
+  {
+    eeprom_in_handler = true;
+
+    while (eeprom_irq_enabled)
+      CONFIG_HandleReady_ISR();
+
+    eeprom_in_handler = false;
+  }
+}
+
+
+
+//
+// DDS Functions
+
+
+// Sets up the emulated sample timer. There's no PWM hardware; the value
+// written is just stored. Returns the actual sample rate.
+// The caller is responsible for any needed locking.
+
+uint32_t DDS_InitTimers_ISR(uint32_t mcu_hz, uint32_t sample_hz,
+  bool use_pwm)
+{
+  dds_irq_enabled = false;
+  dds_pwm_value = 0x80;
+
+  dds_clocks_per_sample = mcu_hz / sample_hz;
+  if (1 > dds_clocks_per_sample)
+    dds_clocks_per_sample = 1;
+
+  return (uint32_t) (mcu_hz / dds_clocks_per_sample);
+}
+
+
+// Turns the emulated sample interrupt on or off.
+// The caller is responsible for any needed locking.
+
+void DDS_SetSampleInterrupt_ISR(bool enabled)
+{
+  if (enabled && (!dds_irq_enabled))
+    dds_next_sample_clock = clocks_elapsed + dds_clocks_per_sample;
+
+  dds_irq_enabled = enabled;
+}
+
+
+// Stores a PWM output value.
+// The caller is responsible for any needed locking.
+
+void DDS_WritePWM_ISR(uint8_t value)
+{
+  dds_pwm_value = value;
+}
+
+
+
 //
 // This is the end of the file.
@@ -26,6 +26,8 @@
 #define PGM_P const char *
 #define pgm_read_byte_near(X) (*(X))
 #define pgm_read_byte_far(X) (*(X))
+#define pgm_read_word_near(X) (*(X))
+#define pgm_read_word_far(X) (*(X))
 
 // Various _P functions revert to their normal versions.
 #define strncpy_P strncpy
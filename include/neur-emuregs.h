@@ -0,0 +1,776 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Compatibility header for register-level emulation on a workstation.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+// This header can be included more than once, but classes and inline
+// functions may only be defined once.
+#ifndef NEUREMU_REGS_DEFS
+#define NEUREMU_REGS_DEFS
+
+
+//
+// Includes
+
+#include <string.h>
+#include <stdio.h>
+
+
+
+//
+// Notes
+
+// This stands in for avr-libc when building with -DNEUREMU -DNEUREMU_REGS.
+// Instead of replacing the architecture-specific code (as "neur-emu.h"
+// does), it lets the real m328p or m2560 backend run on the workstation
+// against an emulated register file.
+//
+// Registers are proxy objects at their real data-space addresses. Reads
+// and writes go through per-address hooks that model the peripherals
+// (GPIO, ADC, USART, timers, SPI, TWI, EEPROM). Every access costs two
+// virtual clock cycles, as LDS/STS would; compound assignments cost two
+// cycles total, as SBI/CBI would.
+//
+// Virtual time only moves when the firmware touches a register, enters
+// or leaves an atomic block, or calls a _delay_loop function. Pending
+// interrupts are dispatched in vector priority order whenever time moves
+// with interrupts enabled. There are no threads; runs are deterministic.
+//
+// Taking the address of a register gives a pointer to its raw value.
+// Accesses through that pointer skip the hooks and cost no time. This is
+// fine for PORTx (chip selects); don't do it for anything with side
+// effects.
+//
+// Interrupt vectors are named "__vector_N", as in avr-libc. Handlers that
+// the backend doesn't define are weak references, and are ignored.
+
+
+
+//
+// Macros - emulator configuration
+
+// Size of the emulated data-space register region.
+#define EMUREG_FILE_SIZE 0x200
+
+// Default emulated clock rate. This only affects the EEPROM write time.
+#define EMUREG_DEFAULT_MCU_HZ 16000000ul
+
+// Number of USARTs modelled.
+#ifdef __AVR_ATmega2560__
+#define EMUREG_UART_COUNT 2
+#else
+#define EMUREG_UART_COUNT 1
+#endif
+
+
+
+//
+// Classes - emulated registers
+
+
+// 8-bit register. These live in emureg_file[]; the address is the index.
+
+class EMUREG_Reg8
+{
+public:
+  uint8_t value;
+
+  inline operator uint8_t();
+  inline EMUREG_Reg8 &operator=(uint8_t newval);
+  inline EMUREG_Reg8 &operator=(EMUREG_Reg8 &other);
+  inline EMUREG_Reg8 &operator|=(uint8_t mask);
+  inline EMUREG_Reg8 &operator&=(uint8_t mask);
+  inline EMUREG_Reg8 &operator^=(uint8_t mask);
+
+  // This is what "&PORTB" gives; see the notes.
+  volatile uint8_t *operator&() { return &value; }
+};
+
+
+// 16-bit register pair. This is a temporary that forwards to the byte
+// registers, reading low first and writing high first.
+
+class EMUREG_Reg16
+{
+protected:
+  uint16_t address;
+
+public:
+  EMUREG_Reg16(uint16_t newaddr) { address = newaddr; }
+
+  inline operator uint16_t();
+  inline EMUREG_Reg16 &operator=(uint16_t newval);
+};
+
+
+
+//
+// Global Variables
+
+// The register file.
+extern EMUREG_Reg8 emureg_file[EMUREG_FILE_SIZE];
+
+
+
+//
+// Functions - register access
+
+// These advance virtual time and call peripheral hooks.
+uint8_t EMUREG_Read8(uint16_t address);
+void EMUREG_Write8(uint16_t address, uint8_t value);
+void EMUREG_Modify8(uint16_t address, uint8_t and_mask, uint8_t or_mask,
+  uint8_t xor_mask);
+
+// This sets or clears the global interrupt flag, dispatching anything that
+// was pending if interrupts are now enabled.
+void EMUREG_SetInterrupts(bool enabled);
+
+// This advances virtual time by the specified number of cycles.
+void EMUREG_Advance(uint32_t cycles);
+
+
+
+//
+// Functions - register classes
+
+EMUREG_Reg8::operator uint8_t()
+{
+  return EMUREG_Read8(this - emureg_file);
+}
+
+EMUREG_Reg8 &EMUREG_Reg8::operator=(uint8_t newval)
+{
+  EMUREG_Write8(this - emureg_file, newval);
+  return *this;
+}
+
+EMUREG_Reg8 &EMUREG_Reg8::operator=(EMUREG_Reg8 &other)
+{
+  EMUREG_Write8(this - emureg_file, (uint8_t) other);
+  return *this;
+}
+
+EMUREG_Reg8 &EMUREG_Reg8::operator|=(uint8_t mask)
+{
+  EMUREG_Modify8(this - emureg_file, 0xff, mask, 0);
+  return *this;
+}
+
+EMUREG_Reg8 &EMUREG_Reg8::operator&=(uint8_t mask)
+{
+  EMUREG_Modify8(this - emureg_file, mask, 0, 0);
+  return *this;
+}
+
+EMUREG_Reg8 &EMUREG_Reg8::operator^=(uint8_t mask)
+{
+  EMUREG_Modify8(this - emureg_file, 0xff, 0, mask);
+  return *this;
+}
+
+EMUREG_Reg16::operator uint16_t()
+{
+  uint16_t result;
+
+  result = EMUREG_Read8(address);
+  result |= ((uint16_t) EMUREG_Read8(address + 1)) << 8;
+
+  return result;
+}
+
+EMUREG_Reg16 &EMUREG_Reg16::operator=(uint16_t newval)
+{
+  EMUREG_Write8(address + 1, (uint8_t) (newval >> 8));
+  EMUREG_Write8(address, (uint8_t) newval);
+  return *this;
+}
+
+
+
+//
+// Functions - emulator control
+
+// These are for test harnesses. Port IDs are letters ('A'..'L').
+
+// Sets the emulated clock rate.
+void EMUREG_SetMCUClock(uint32_t mcu_hz);
+
+// Returns the number of virtual clock cycles since startup.
+uint64_t EMUREG_GetCycles(void);
+
+// Returns the number of times the specified vector has been dispatched.
+uint32_t EMUREG_GetVectorCount(uint8_t vector);
+
+// Drives input pins from outside, or stops driving them.
+void EMUREG_DrivePins(char port_id, uint8_t mask, uint8_t levels);
+void EMUREG_ReleasePins(char port_id, uint8_t mask);
+
+// Returns pin levels as seen from outside.
+uint8_t EMUREG_GetPinLevels(char port_id);
+
+// Sets the 10-bit value that the ADC reads from the specified channel.
+void EMUREG_SetADCInput(uint8_t channel, uint16_t value);
+
+// Queues bytes for a USART to receive, one frame time apart.
+void EMUREG_FeedUART(uint8_t uart_idx, const char *data, size_t length);
+
+// Copies out and discards up to "size" bytes that a USART transmitted.
+// Returns the number of bytes copied.
+size_t EMUREG_ReadUART(uint8_t uart_idx, char *buffer, size_t size);
+
+// Connects the primary USART to stdin/stdout (the default), or not.
+void EMUREG_SetConsole(bool enabled);
+
+// Sets the function that supplies MISO bytes for SPI transfers.
+// NULL (the default) loops MOSI back to MISO.
+void EMUREG_SetSPIResponder(uint8_t (*responder)(uint8_t mosi_byte));
+
+
+
+//
+// Macros - avr/io.h
+
+#define EMUREG_SFR8(X) (emureg_file[X])
+#define EMUREG_SFR16(X) (EMUREG_Reg16(X))
+
+
+// Registers common to the ATmega328P and ATmega2560.
+
+#define PINB EMUREG_SFR8(0x23)
+#define DDRB EMUREG_SFR8(0x24)
+#define PORTB EMUREG_SFR8(0x25)
+#define PINC EMUREG_SFR8(0x26)
+#define DDRC EMUREG_SFR8(0x27)
+#define PORTC EMUREG_SFR8(0x28)
+#define PIND EMUREG_SFR8(0x29)
+#define DDRD EMUREG_SFR8(0x2a)
+#define PORTD EMUREG_SFR8(0x2b)
+
+#define TIFR0 EMUREG_SFR8(0x35)
+#define TIFR1 EMUREG_SFR8(0x36)
+#define TIFR2 EMUREG_SFR8(0x37)
+#define GPIOR0 EMUREG_SFR8(0x3e)
+#define EECR EMUREG_SFR8(0x3f)
+#define EEDR EMUREG_SFR8(0x40)
+#define EEAR EMUREG_SFR16(0x41)
+#define EEARL EMUREG_SFR8(0x41)
+#define EEARH EMUREG_SFR8(0x42)
+#define TCCR0A EMUREG_SFR8(0x44)
+#define TCCR0B EMUREG_SFR8(0x45)
+#define TCNT0 EMUREG_SFR8(0x46)
+#define OCR0A EMUREG_SFR8(0x47)
+#define OCR0B EMUREG_SFR8(0x48)
+#define GPIOR1 EMUREG_SFR8(0x4a)
+#define GPIOR2 EMUREG_SFR8(0x4b)
+#define SPCR EMUREG_SFR8(0x4c)
+#define SPSR EMUREG_SFR8(0x4d)
+#define SPDR EMUREG_SFR8(0x4e)
+#define MCUSR EMUREG_SFR8(0x54)
+#define MCUCR EMUREG_SFR8(0x55)
+#define SREG EMUREG_SFR8(0x5f)
+
+#define WDTCSR EMUREG_SFR8(0x60)
+#define TIMSK0 EMUREG_SFR8(0x6e)
+#define TIMSK1 EMUREG_SFR8(0x6f)
+#define TIMSK2 EMUREG_SFR8(0x70)
+#define ADC EMUREG_SFR16(0x78)
+#define ADCL EMUREG_SFR8(0x78)
+#define ADCH EMUREG_SFR8(0x79)
+#define ADCSRA EMUREG_SFR8(0x7a)
+#define ADCSRB EMUREG_SFR8(0x7b)
+#define ADMUX EMUREG_SFR8(0x7c)
+#define DIDR0 EMUREG_SFR8(0x7e)
+#define DIDR1 EMUREG_SFR8(0x7f)
+
+#define TCCR1A EMUREG_SFR8(0x80)
+#define TCCR1B EMUREG_SFR8(0x81)
+#define TCCR1C EMUREG_SFR8(0x82)
+#define TCNT1 EMUREG_SFR16(0x84)
+#define TCNT1L EMUREG_SFR8(0x84)
+#define TCNT1H EMUREG_SFR8(0x85)
+#define ICR1 EMUREG_SFR16(0x86)
+#define ICR1L EMUREG_SFR8(0x86)
+#define ICR1H EMUREG_SFR8(0x87)
+#define OCR1A EMUREG_SFR16(0x88)
+#define OCR1AL EMUREG_SFR8(0x88)
+#define OCR1AH EMUREG_SFR8(0x89)
+#define OCR1B EMUREG_SFR16(0x8a)
+#define OCR1BL EMUREG_SFR8(0x8a)
+#define OCR1BH EMUREG_SFR8(0x8b)
+
+#define TCCR2A EMUREG_SFR8(0xb0)
+#define TCCR2B EMUREG_SFR8(0xb1)
+#define TCNT2 EMUREG_SFR8(0xb2)
+#define OCR2A EMUREG_SFR8(0xb3)
+#define OCR2B EMUREG_SFR8(0xb4)
+#define TWBR EMUREG_SFR8(0xb8)
+#define TWSR EMUREG_SFR8(0xb9)
+#define TWAR EMUREG_SFR8(0xba)
+#define TWDR EMUREG_SFR8(0xbb)
+#define TWCR EMUREG_SFR8(0xbc)
+
+#define UCSR0A EMUREG_SFR8(0xc0)
+#define UCSR0B EMUREG_SFR8(0xc1)
+#define UCSR0C EMUREG_SFR8(0xc2)
+#define UBRR0 EMUREG_SFR16(0xc4)
+#define UBRR0L EMUREG_SFR8(0xc4)
+#define UBRR0H EMUREG_SFR8(0xc5)
+#define UDR0 EMUREG_SFR8(0xc6)
+
+
+// Registers that only the ATmega2560 has.
+
+#ifdef __AVR_ATmega2560__
+
+#define PINA EMUREG_SFR8(0x20)
+#define DDRA EMUREG_SFR8(0x21)
+#define PORTA EMUREG_SFR8(0x22)
+#define PINE EMUREG_SFR8(0x2c)
+#define DDRE EMUREG_SFR8(0x2d)
+#define PORTE EMUREG_SFR8(0x2e)
+#define PINF EMUREG_SFR8(0x2f)
+#define DDRF EMUREG_SFR8(0x30)
+#define PORTF EMUREG_SFR8(0x31)
+#define PING EMUREG_SFR8(0x32)
+#define DDRG EMUREG_SFR8(0x33)
+#define PORTG EMUREG_SFR8(0x34)
+#define PINH EMUREG_SFR8(0x100)
+#define DDRH EMUREG_SFR8(0x101)
+#define PORTH EMUREG_SFR8(0x102)
+#define PINJ EMUREG_SFR8(0x103)
+#define DDRJ EMUREG_SFR8(0x104)
+#define PORTJ EMUREG_SFR8(0x105)
+#define PINK EMUREG_SFR8(0x106)
+#define DDRK EMUREG_SFR8(0x107)
+#define PORTK EMUREG_SFR8(0x108)
+#define PINL EMUREG_SFR8(0x109)
+#define DDRL EMUREG_SFR8(0x10a)
+#define PORTL EMUREG_SFR8(0x10b)
+
+#define TIFR3 EMUREG_SFR8(0x38)
+#define TIFR4 EMUREG_SFR8(0x39)
+#define TIFR5 EMUREG_SFR8(0x3a)
+#define TIMSK3 EMUREG_SFR8(0x71)
+#define TIMSK4 EMUREG_SFR8(0x72)
+#define TIMSK5 EMUREG_SFR8(0x73)
+#define DIDR2 EMUREG_SFR8(0x7d)
+
+#define OCR1C EMUREG_SFR16(0x8c)
+#define OCR1CL EMUREG_SFR8(0x8c)
+#define OCR1CH EMUREG_SFR8(0x8d)
+
+#define TCCR3A EMUREG_SFR8(0x90)
+#define TCCR3B EMUREG_SFR8(0x91)
+#define TCCR3C EMUREG_SFR8(0x92)
+#define TCNT3 EMUREG_SFR16(0x94)
+#define TCNT3L EMUREG_SFR8(0x94)
+#define TCNT3H EMUREG_SFR8(0x95)
+#define ICR3 EMUREG_SFR16(0x96)
+#define ICR3L EMUREG_SFR8(0x96)
+#define ICR3H EMUREG_SFR8(0x97)
+#define OCR3A EMUREG_SFR16(0x98)
+#define OCR3AL EMUREG_SFR8(0x98)
+#define OCR3AH EMUREG_SFR8(0x99)
+#define OCR3B EMUREG_SFR16(0x9a)
+#define OCR3BL EMUREG_SFR8(0x9a)
+#define OCR3BH EMUREG_SFR8(0x9b)
+#define OCR3C EMUREG_SFR16(0x9c)
+#define OCR3CL EMUREG_SFR8(0x9c)
+#define OCR3CH EMUREG_SFR8(0x9d)
+
+#define TCCR4A EMUREG_SFR8(0xa0)
+#define TCCR4B EMUREG_SFR8(0xa1)
+#define TCCR4C EMUREG_SFR8(0xa2)
+#define TCNT4 EMUREG_SFR16(0xa4)
+#define TCNT4L EMUREG_SFR8(0xa4)
+#define TCNT4H EMUREG_SFR8(0xa5)
+#define ICR4 EMUREG_SFR16(0xa6)
+#define ICR4L EMUREG_SFR8(0xa6)
+#define ICR4H EMUREG_SFR8(0xa7)
+#define OCR4A EMUREG_SFR16(0xa8)
+#define OCR4AL EMUREG_SFR8(0xa8)
+#define OCR4AH EMUREG_SFR8(0xa9)
+#define OCR4B EMUREG_SFR16(0xaa)
+#define OCR4BL EMUREG_SFR8(0xaa)
+#define OCR4BH EMUREG_SFR8(0xab)
+#define OCR4C EMUREG_SFR16(0xac)
+#define OCR4CL EMUREG_SFR8(0xac)
+#define OCR4CH EMUREG_SFR8(0xad)
+
+#define UCSR1A EMUREG_SFR8(0xc8)
+#define UCSR1B EMUREG_SFR8(0xc9)
+#define UCSR1C EMUREG_SFR8(0xca)
+#define UBRR1 EMUREG_SFR16(0xcc)
+#define UBRR1L EMUREG_SFR8(0xcc)
+#define UBRR1H EMUREG_SFR8(0xcd)
+#define UDR1 EMUREG_SFR8(0xce)
+
+#define TCCR5A EMUREG_SFR8(0x120)
+#define TCCR5B EMUREG_SFR8(0x121)
+#define TCCR5C EMUREG_SFR8(0x122)
+#define TCNT5 EMUREG_SFR16(0x124)
+#define TCNT5L EMUREG_SFR8(0x124)
+#define TCNT5H EMUREG_SFR8(0x125)
+#define ICR5 EMUREG_SFR16(0x126)
+#define ICR5L EMUREG_SFR8(0x126)
+#define ICR5H EMUREG_SFR8(0x127)
+#define OCR5A EMUREG_SFR16(0x128)
+#define OCR5AL EMUREG_SFR8(0x128)
+#define OCR5AH EMUREG_SFR8(0x129)
+#define OCR5B EMUREG_SFR16(0x12a)
+#define OCR5BL EMUREG_SFR8(0x12a)
+#define OCR5BH EMUREG_SFR8(0x12b)
+#define OCR5C EMUREG_SFR16(0x12c)
+#define OCR5CL EMUREG_SFR8(0x12c)
+#define OCR5CH EMUREG_SFR8(0x12d)
+
+#endif
+
+
+// Register bits.
+
+#define SREG_I 7
+
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define JTRF 4
+
+#define PUD 4
+#define IVSEL 1
+#define IVCE 0
+
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+
+#define EEPM1 5
+#define EEPM0 4
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+
+#define SPIE 7
+#define SPE 6
+#define DORD 5
+#define MSTR 4
+#define CPOL 3
+#define CPHA 2
+#define SPR1 1
+#define SPR0 0
+#define SPIF 7
+#define WCOL 6
+#define SPI2X 0
+
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWWC 3
+#define TWEN 2
+#define TWIE 0
+#define TWPS1 1
+#define TWPS0 0
+
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX4 4
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ACME 6
+#define MUX5 3
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+#define MPCM0 0
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ02 2
+#define UCSZ01 2
+#define UCSZ00 1
+
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define FE1 4
+#define DOR1 3
+#define UPE1 2
+#define U2X1 1
+#define MPCM1 0
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define UCSZ12 2
+#define UCSZ11 2
+#define UCSZ10 1
+
+// 8-bit timers (0 and 2).
+
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define OCIE0B 2
+#define OCIE0A 1
+#define TOIE0 0
+#define OCF0B 2
+#define OCF0A 1
+#define TOV0 0
+
+#define COM2A1 7
+#define COM2A0 6
+#define COM2B1 5
+#define COM2B0 4
+#define WGM21 1
+#define WGM20 0
+#define WGM22 3
+#define CS22 2
+#define CS21 1
+#define CS20 0
+#define OCIE2B 2
+#define OCIE2A 1
+#define TOIE2 0
+#define OCF2B 2
+#define OCF2A 1
+#define TOV2 0
+
+// 16-bit timers (1, and 3..5 on the 2560).
+// Channel C bits only exist on the 2560.
+
+#define EMUREG_TIMER16_BITS(N) \
+  COM ## N ## A1 = 7, COM ## N ## A0 = 6, COM ## N ## B1 = 5, \
+  COM ## N ## B0 = 4, COM ## N ## C1 = 3, COM ## N ## C0 = 2, \
+  WGM ## N ## 1 = 1, WGM ## N ## 0 = 0, \
+  ICNC ## N = 7, ICES ## N = 6, WGM ## N ## 3 = 4, WGM ## N ## 2 = 3, \
+  CS ## N ## 2 = 2, CS ## N ## 1 = 1, CS ## N ## 0 = 0, \
+  ICIE ## N = 5, OCIE ## N ## C = 3, OCIE ## N ## B = 2, \
+  OCIE ## N ## A = 1, TOIE ## N = 0, \
+  ICF ## N = 5, OCF ## N ## C = 3, OCF ## N ## B = 2, OCF ## N ## A = 1, \
+  TOV ## N = 0
+
+enum emureg_timer16_bits_t
+{
+  EMUREG_TIMER16_BITS(1),
+  EMUREG_TIMER16_BITS(3),
+  EMUREG_TIMER16_BITS(4),
+  EMUREG_TIMER16_BITS(5)
+};
+
+
+
+//
+// Macros - avr/pgmspace.h
+
+// Nothing special about "program memory" in emulation.
+#define PSTR(X) (X)
+#define PROGMEM /* Do nothing. */
+
+// Program memory pointers and pointer access.
+#define PGM_P const char *
+#define pgm_read_byte_near(X) (*(X))
+#define pgm_read_byte_far(X) (*(X))
+#define pgm_read_word_near(X) (*(X))
+#define pgm_read_word_far(X) (*(X))
+
+// Various _P functions revert to their normal versions.
+#define strncpy_P strncpy
+#define snprintf_P snprintf
+
+
+
+//
+// Macros - avr/interrupt.h
+
+// Vector numbers match avr-libc's, so that dispatch priority is the same.
+
+#ifdef __AVR_ATmega328P__
+#define TIMER2_COMPA_vect __vector_7
+#define TIMER2_COMPB_vect __vector_8
+#define TIMER2_OVF_vect __vector_9
+#define TIMER1_CAPT_vect __vector_10
+#define TIMER1_COMPA_vect __vector_11
+#define TIMER1_COMPB_vect __vector_12
+#define TIMER1_OVF_vect __vector_13
+#define TIMER0_COMPA_vect __vector_14
+#define TIMER0_COMPB_vect __vector_15
+#define TIMER0_OVF_vect __vector_16
+#define SPI_STC_vect __vector_17
+#define USART_RX_vect __vector_18
+#define USART_UDRE_vect __vector_19
+#define USART_TX_vect __vector_20
+#define ADC_vect __vector_21
+#define EE_READY_vect __vector_22
+#define TWI_vect __vector_24
+#endif
+
+#ifdef __AVR_ATmega2560__
+#define TIMER2_COMPA_vect __vector_13
+#define TIMER2_COMPB_vect __vector_14
+#define TIMER2_OVF_vect __vector_15
+#define TIMER1_CAPT_vect __vector_16
+#define TIMER1_COMPA_vect __vector_17
+#define TIMER1_COMPB_vect __vector_18
+#define TIMER1_COMPC_vect __vector_19
+#define TIMER1_OVF_vect __vector_20
+#define TIMER0_COMPA_vect __vector_21
+#define TIMER0_COMPB_vect __vector_22
+#define TIMER0_OVF_vect __vector_23
+#define SPI_STC_vect __vector_24
+#define USART0_RX_vect __vector_25
+#define USART0_UDRE_vect __vector_26
+#define USART0_TX_vect __vector_27
+#define ADC_vect __vector_29
+#define EE_READY_vect __vector_30
+#define TIMER3_CAPT_vect __vector_31
+#define TIMER3_COMPA_vect __vector_32
+#define TIMER3_COMPB_vect __vector_33
+#define TIMER3_COMPC_vect __vector_34
+#define TIMER3_OVF_vect __vector_35
+#define USART1_RX_vect __vector_36
+#define USART1_UDRE_vect __vector_37
+#define USART1_TX_vect __vector_38
+#define TWI_vect __vector_39
+#define TIMER4_CAPT_vect __vector_41
+#define TIMER4_COMPA_vect __vector_42
+#define TIMER4_COMPB_vect __vector_43
+#define TIMER4_COMPC_vect __vector_44
+#define TIMER4_OVF_vect __vector_45
+#define TIMER5_CAPT_vect __vector_46
+#define TIMER5_COMPA_vect __vector_47
+#define TIMER5_COMPB_vect __vector_48
+#define TIMER5_COMPC_vect __vector_49
+#define TIMER5_OVF_vect __vector_50
+#endif
+
+// Handlers are plain functions. Attributes are ignored; an ISR always
+// starts with interrupts disabled, and may re-enable them itself.
+#define ISR_BLOCK
+#define ISR_NOBLOCK
+#define ISR(vector, ...) \
+extern "C" void vector(void); \
+extern "C" void vector(void)
+
+#define sei() EMUREG_SetInterrupts(true)
+#define cli() EMUREG_SetInterrupts(false)
+
+
+
+//
+// Macros - util/atomic.h
+
+// These are the same tricks that avr-libc uses: a one-pass for() loop,
+// with a cleanup function that restores interrupt state however the block
+// is left.
+
+#define ATOMIC_RESTORESTATE \
+uint8_t EMUREG_sreg_save __attribute__ ((__cleanup__(EMUREG_RestoreSREG))) \
+  = emureg_file[0x5f].value
+#define ATOMIC_FORCEON \
+uint8_t EMUREG_sreg_save __attribute__ ((__cleanup__(EMUREG_ForceOn))) = 0
+
+#define ATOMIC_BLOCK(type) \
+for ( type, EMUREG_todo = EMUREG_CliRetVal(); \
+  EMUREG_todo; EMUREG_todo = 0 )
+
+#define NONATOMIC_RESTORESTATE ATOMIC_RESTORESTATE
+#define NONATOMIC_FORCEOFF \
+uint8_t EMUREG_sreg_save __attribute__ ((__cleanup__(EMUREG_ForceOff))) = 0
+
+#define NONATOMIC_BLOCK(type) \
+for ( type, EMUREG_todo = EMUREG_SeiRetVal(); \
+  EMUREG_todo; EMUREG_todo = 0 )
+
+
+
+//
+// Functions - util/atomic.h
+
+static inline uint8_t EMUREG_CliRetVal(void)
+{
+  EMUREG_SetInterrupts(false);
+  return 1;
+}
+
+static inline uint8_t EMUREG_SeiRetVal(void)
+{
+  EMUREG_SetInterrupts(true);
+  return 1;
+}
+
+static inline void EMUREG_RestoreSREG(const uint8_t *sreg_save)
+{
+  EMUREG_SetInterrupts( 0 != (*sreg_save & (1 << SREG_I)) );
+}
+
+static inline void EMUREG_ForceOn(const uint8_t *sreg_save)
+{
+  EMUREG_SetInterrupts(true);
+}
+
+static inline void EMUREG_ForceOff(const uint8_t *sreg_save)
+{
+  EMUREG_SetInterrupts(false);
+}
+
+
+
+//
+// Functions - util/delay_basic.h
+
+// Three cycles per iteration; 0 means 256.
+static inline void _delay_loop_1(uint8_t count)
+{
+  EMUREG_Advance( 3 * ((0 == count) ? 256ul : count) );
+}
+
+// Four cycles per iteration; 0 means 65536.
+static inline void _delay_loop_2(uint16_t count)
+{
+  EMUREG_Advance( 4 * ((0 == count) ? 65536ul : count) );
+}
+
+
+#endif
+
+
+//
+// This is the end of the file.
@@ -19,10 +19,17 @@
 #define UART_USE_ALTERNATE 0
 
 // Sizes should be powers of 2, so we can do modulo math by masking.
-// The 2560 has 8k of SRAM. This uses 1k.
+// The 2560 has 8k of SRAM. This uses 1056 bytes (each line also holds a
+// 4-byte timestamp).
+// These can be overridden at build time. The count has to be at least 2.
+// Apps that parse input with a receive hook can use the minimum.
+#ifndef UART_LINE_COUNT
 #define UART_LINE_COUNT 8
+#endif
 // Each line can have 2^bits characters.
+#ifndef UART_LINE_BITS
 #define UART_LINE_BITS 7
+#endif
 #define UART_LINE_SIZE (1 << UART_LINE_BITS)
 
 // This switch identifies whether to use _near or _far pointers for
@@ -33,5 +40,70 @@
 #define USE_FAR_FLASH_POINTERS 1
 
 
+// SPI-related macros.
+
+// Queue size should be a power of 2, so we can do modulo math by masking.
+#define SPI_QUEUE_SIZE 16
+// Maximum length of double-buffered transfers.
+#define SPI_DBUF_BYTES 8
+
+// The SPI pins are B0 (SS), B1 (SCK), B2 (MOSI), and B3 (MISO).
+// These are Mega pins 53, 52, 51, and 50. None of them are GPIO lines.
+#define SPI_PORT PORTB
+#define SPI_DDR DDRB
+#define SPI_PIN_SS (1 << 0)
+#define SPI_PIN_MOSI (1 << 2)
+#define SPI_PIN_MISO (1 << 3)
+#define SPI_PIN_SCK (1 << 1)
+
+
+// TWI-related macros.
+
+// Queue size should be a power of 2, so we can do modulo math by masking.
+#define TWI_QUEUE_SIZE 8
+
+
+// Configuration store macros.
+
+// The 2560 has 4k of EEPROM. This uses 2k.
+// Records are CONFIG_DATA_BYTES + 2 bytes long.
+#define CONFIG_EEPROM_BASE 0
+#define CONFIG_DATA_BYTES 64
+#define CONFIG_SLOT_COUNT 32
+
+
+// Flight recorder macros.
+
+// Slot count must be a power of 2, and no more than 128. Each slot is
+// 8 bytes, so this uses 512 bytes.
+#define FLIGHT_RECORD_BITS 6
+#define FLIGHT_RECORD_SLOTS (1 << FLIGHT_RECORD_BITS)
+
+
+// Scope pin assignments (see NEURAVR_SCOPE_PINS).
+// These must be in the low I/O space so that SBI/CBI can reach them.
+// These are A0..A4 (Mega pins 22..26), which nothing else uses.
+
+#define SCOPE_PORT_RTC PORTA
+#define SCOPE_DDR_RTC DDRA
+#define SCOPE_MASK_RTC (1 << 0)
+
+#define SCOPE_PORT_UART PORTA
+#define SCOPE_DDR_UART DDRA
+#define SCOPE_MASK_UART (1 << 1)
+
+#define SCOPE_PORT_ADC PORTA
+#define SCOPE_DDR_ADC DDRA
+#define SCOPE_MASK_ADC (1 << 2)
+
+#define SCOPE_PORT_APP PORTA
+#define SCOPE_DDR_APP DDRA
+#define SCOPE_MASK_APP (1 << 3)
+
+#define SCOPE_PORT_POLL PORTA
+#define SCOPE_DDR_POLL DDRA
+#define SCOPE_MASK_POLL (1 << 4)
+
+
 //
 // This is the end of the file.
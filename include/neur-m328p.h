@@ -16,10 +16,17 @@
 // UART-related macros.
 
 // Sizes should be powers of 2, so we can do modulo math by masking.
-// The 328P has 2k of SRAM. This uses 0.5k.
+// The 328P has 2k of SRAM. This uses 544 bytes (each line also holds a
+// 4-byte timestamp).
+// These can be overridden at build time. The count has to be at least 2.
+// Apps that parse input with a receive hook can use the minimum.
+#ifndef UART_LINE_COUNT
 #define UART_LINE_COUNT 8
+#endif
 // Each line can have 2^bits characters.
+#ifndef UART_LINE_BITS
 #define UART_LINE_BITS 6
+#endif
 #define UART_LINE_SIZE (1 << UART_LINE_BITS)
 
 // This switch identifies whether to use _near or _far pointers for
@@ -29,5 +36,77 @@
 #define USE_FAR_FLASH_POINTERS 0
 
 
+// SPI-related macros.
+
+// Queue size should be a power of 2, so we can do modulo math by masking.
+#define SPI_QUEUE_SIZE 8
+// Maximum length of double-buffered transfers.
+#define SPI_DBUF_BYTES 4
+
+// The SPI pins are B2 (SS), B3 (MOSI), B4 (MISO), and B5 (SCK).
+// B2..B4 are also GP5..GP7, so those GPIO lines are given up while SPI is
+// on. B5 is also the APP scope pin; SPI overrides it.
+#define SPI_PORT PORTB
+#define SPI_DDR DDRB
+#define SPI_PIN_SS (1 << 2)
+#define SPI_PIN_MOSI (1 << 3)
+#define SPI_PIN_MISO (1 << 4)
+#define SPI_PIN_SCK (1 << 5)
+
+
+// TWI-related macros.
+
+// Queue size should be a power of 2, so we can do modulo math by masking.
+#define TWI_QUEUE_SIZE 8
+
+
+// Configuration store macros.
+
+// The 328p has 1k of EEPROM. This uses 544 bytes.
+// Records are CONFIG_DATA_BYTES + 2 bytes long.
+#define CONFIG_EEPROM_BASE 0
+#define CONFIG_DATA_BYTES 32
+#define CONFIG_SLOT_COUNT 16
+
+
+// Flight recorder macros.
+
+// Slot count must be a power of 2, and no more than 128. Each slot is
+// 8 bytes, so this uses 128 bytes.
+#define FLIGHT_RECORD_BITS 4
+#define FLIGHT_RECORD_SLOTS (1 << FLIGHT_RECORD_BITS)
+
+
+// Scope pin assignments (see NEURAVR_SCOPE_PINS).
+// These must be in the low I/O space so that SBI/CBI can reach them.
+// D2..D4 and B5 (the Uno's LED) are the only pins not already spoken for.
+// There's no fifth spare pin, so high-priority polling isn't shown. Its
+// mask is 0, which turns its scope macros into no-ops (the port is just a
+// placeholder).
+// NOTE - B5 is also SCK. While SPI is on, the APP pulses don't appear.
+// NOTE - D3 is also the DDS PWM output (OC2B). Don't use PWM DDS output
+// with scope pins turned on.
+
+#define SCOPE_PORT_RTC PORTD
+#define SCOPE_DDR_RTC DDRD
+#define SCOPE_MASK_RTC (1 << 2)
+
+#define SCOPE_PORT_UART PORTD
+#define SCOPE_DDR_UART DDRD
+#define SCOPE_MASK_UART (1 << 3)
+
+#define SCOPE_PORT_ADC PORTD
+#define SCOPE_DDR_ADC DDRD
+#define SCOPE_MASK_ADC (1 << 4)
+
+#define SCOPE_PORT_APP PORTB
+#define SCOPE_DDR_APP DDRB
+#define SCOPE_MASK_APP (1 << 5)
+
+#define SCOPE_PORT_POLL PORTD
+#define SCOPE_DDR_POLL DDRD
+#define SCOPE_MASK_POLL 0
+
+
 //
 // This is the end of the file.
@@ -0,0 +1,153 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - ADC streaming.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+// NOTE - Include "neurapp-oo.h" before including this.
+
+
+//
+// Notes
+
+// This samples a user-selected set of ADC channels every N ticks, buffers
+// timestamped scans, and streams them as compact hex report lines.
+//
+// Report formats (all numbers are hexadecimal):
+//
+// "A ssss tttttttt vvvv vvvv ..."  One scan. "s" is the scan sequence
+//                                  number, "t" is the timestamp of the
+//                                  start of the scan, and "v" are samples
+//                                  in ascending channel order.
+// "AX dddddddd"                    Scans were dropped since the last
+//                                  report (total dropped so far).
+// "AQ ..."                         Status report (see "ASQ").
+//
+// Sequence numbers increment for dropped scans too, so the host can see
+// exactly where gaps are.
+//
+// Throughput limits (16 MHz clock, /128 ADC prescaler):
+//
+// - Conversions take about 1700 clocks, and the sequencer only advances
+// once per poll (once per tick). Channels x scan rate can't exceed the tick
+// rate, and can't usefully exceed about 8k samples/sec.
+//
+// - A scan line is (17 + 5 x channels) characters. At 10 bits per
+// character, scans/sec can't exceed (baud / 10) / (17 + 5 x channels).
+// At 115200 baud that's about 520 scans/sec for 1 channel, 245 for 6
+// channels, and 200 for 8 channels. At 500000 baud, it's about 2270,
+// 1060, and 880 scans/sec respectively, which is close to the ADC limit.
+//
+// The scan buffer absorbs bursts (polling loop stalls); sustained rates
+// above these limits show up as "AX" drop reports.
+
+
+//
+// Macros
+
+// Scan buffer depth. This must be a power of 2 and no more than 128.
+// Each slot costs (7 + 2 x ADC_CHANNEL_COUNT) bytes.
+#ifdef __AVR_ATmega2560__
+#define NEURAPP_ADCSTREAM_SCAN_BITS 5
+#else
+#define NEURAPP_ADCSTREAM_SCAN_BITS 3
+#endif
+#define NEURAPP_ADCSTREAM_SCAN_SLOTS (1 << NEURAPP_ADCSTREAM_SCAN_BITS)
+
+// Default sampling period, in ticks.
+#define NEURAPP_ADCSTREAM_DEFAULT_PERIOD 10
+
+// Opcodes for this handler's commands.
+#define NEURAPP_ADCSTREAM_OP_MASK 1
+#define NEURAPP_ADCSTREAM_OP_RATE 2
+#define NEURAPP_ADCSTREAM_OP_RUN 3
+#define NEURAPP_ADCSTREAM_OP_QUERY 4
+
+
+
+//
+// Typedefs
+
+// One buffered scan.
+typedef struct
+{
+  uint32_t timestamp;
+  uint16_t sequence;
+  uint8_t count;
+  uint16_t data[ADC_CHANNEL_COUNT];
+} neurapp_adcstream_scan_t;
+
+
+
+//
+// Global Variables
+
+// Command list for this handler.
+// This lives in program memory; use it as the "cmdlist_P" entry in the
+// event handler table, e.g. { &handler, NULL, neurapp_adcstream_cmds }.
+extern const neurapp_cmd_list_row_P_t neurapp_adcstream_cmds[];
+
+
+
+//
+// Classes
+
+
+// ADC streaming event handler.
+// This calls ADC_Init() during InitHardware(), and calls
+// ADC_HousekeepingPoll() from its tick handler, so the application doesn't
+// have to do either.
+
+class NeurAppEvent_ADCStream : public NeurAppEvent_Base
+{
+protected:
+  // Configuration.
+  uint8_t channel_mask;
+  uint16_t period_ticks;
+  volatile bool is_running;
+
+  // Sampling state. Only the tick handler touches this while running.
+  uint16_t ticks_left;
+  bool scan_pending;
+  uint32_t scan_timestamp;
+  uint16_t next_sequence;
+
+  // Scan buffer. The tick handler writes, the polling loop reads.
+  NeurAVR_Ring<neurapp_adcstream_scan_t, NEURAPP_ADCSTREAM_SCAN_SLOTS> scans;
+
+  // Statistics.
+  volatile uint32_t scans_total;
+  volatile uint32_t scans_dropped;
+  volatile uint32_t scans_overrun;
+
+  // Report state, copied in SaveReportState_Fast().
+  uint8_t saved_mark;
+  uint32_t saved_dropped;
+  uint32_t saved_overrun;
+  uint32_t saved_total;
+  uint32_t reported_dropped;
+  bool status_wanted;
+
+  // This copies completed samples into the next free scan slot.
+  void StoreScan_ISR(void);
+
+public:
+  NeurAppEvent_ADCStream(void);
+  // Default destructor is fine.
+
+  virtual PGM_P GetHelpScreen(void);
+
+  virtual void InitHardware(void);
+  virtual void InitState(void);
+
+  virtual void HandleTick_ISR(void);
+
+  virtual void HandleCommand(uint8_t opcode, uint16_t arg1, uint16_t arg2);
+
+  virtual void SaveReportState_Fast(void);
+  virtual bool MakeReportString(neurapp_report_buf_t &buffer);
+};
+
+
+//
+// This is the end of the file.
@@ -14,6 +14,9 @@
 extern volatile uint32_t rtc_timestamp;
 extern void (*rtc_usercallback)(void);
 
+// Set while the RTC ISR should be calling Timer_GetSyncPeriod_ISR().
+extern volatile bool rtc_sync_active;
+
 
 // No shared GPIO variables.
 
@@ -21,6 +24,10 @@ extern void (*rtc_usercallback)(void);
 
 // No shared UART variables.
 
+// No shared SPI variables.
+
+// No shared TWI variables.
+
 
 
 //
@@ -29,12 +36,35 @@ extern void (*rtc_usercallback)(void);
 
 // Real-time clock functions.
 
-// No additional RTC functions.
+// This resets the RTC disciplining loop. It should be called by
+// Timer_Init(), with the nominal tick length in MCU clocks (OCRnA + 1).
+// The caller is responsible for any needed locking.
+void Timer_InitSync_ISR(uint16_t clocks_per_tick);
+
+// This returns the length of the next tick in MCU clocks, dithering the
+// fractional part of the trim. The RTC ISR calls this after each tick
+// while rtc_sync_active is set, and writes OCRnA accordingly.
+uint16_t Timer_GetSyncPeriod_ISR(void);
+
+// This is the sync edge handler called from within the input capture ISR.
+// The timestamp is the RTC tick count at the edge, and the count is the
+// captured timer value (MCU clocks since that tick began).
+void Timer_HandleSyncEdge_ISR(uint32_t timestamp, uint16_t count);
+
+// This is a hardware hook that turns the input capture interrupt on or off
+// and selects the capture edge. The caller is responsible for any needed
+// locking.
+void Timer_SetSyncCapture_ISR(bool enabled, bool rising_edge);
 
 
 // GPIO functions.
 
-// No additional GPIO functions.
+// This tells the GPIO bank to leave the SPI pins alone (or to reclaim them).
+void IO8_ReserveSPIPins(bool reserved);
+
+// This tells the GPIO banks to leave the RTC sync capture pin alone (or to
+// reclaim it). Timer_SetSyncCapture_ISR() calls this.
+void IO_ReserveSyncPin(bool reserved);
 
 
 // ADC functions.
@@ -70,6 +100,95 @@ bool UART_GetNextSendChar_ISR(char &sendchar);
 void UART_EnableTransmit_ISR(void);
 
 
+// SPI functions.
+
+// This discards all queued transfers and resets the queue. It should be
+// called by SPI_Init(). The caller is responsible for any needed locking.
+void SPI_InitQueue_ISR(void);
+
+// This is the byte-complete handler called from within the SPI ISR.
+void SPI_HandleByteDone_ISR(uint8_t recvbyte);
+
+// These are hardware hooks called from within the SPI handlers.
+// The caller is responsible for any needed locking.
+void SPI_WriteByte_ISR(uint8_t sendbyte);
+void SPI_SetDefaultSelect_ISR(bool asserted);
+
+
+// TWI functions.
+
+// Master-mode status codes (TWSR with the prescaler bits masked off).
+#define TWI_STATUS_START 0x08
+#define TWI_STATUS_RESTART 0x10
+#define TWI_STATUS_WADDR_ACK 0x18
+#define TWI_STATUS_WADDR_NACK 0x20
+#define TWI_STATUS_WDATA_ACK 0x28
+#define TWI_STATUS_WDATA_NACK 0x30
+#define TWI_STATUS_ARB_LOST 0x38
+#define TWI_STATUS_RADDR_ACK 0x40
+#define TWI_STATUS_RADDR_NACK 0x48
+#define TWI_STATUS_RDATA_ACK 0x50
+#define TWI_STATUS_RDATA_NACK 0x58
+#define TWI_STATUS_BUS_ERROR 0x00
+
+// This discards all queued transactions and resets the queue. It should be
+// called by TWI_Init(). The caller is responsible for any needed locking.
+void TWI_InitQueue_ISR(void);
+
+// This is the state machine handler called from within the TWI ISR.
+void TWI_HandleStatus_ISR(uint8_t status);
+
+// These are hardware hooks called from within the TWI handlers.
+// Each of them except TWI_ReadByte_ISR() and TWI_SendStop_ISR(false)
+// results in another TWI interrupt.
+// The caller is responsible for any needed locking.
+void TWI_SendStart_ISR(void);
+void TWI_SendStop_ISR(bool start_next);
+void TWI_SendByte_ISR(uint8_t sendbyte);
+void TWI_ReceiveByte_ISR(bool send_ack);
+uint8_t TWI_ReadByte_ISR(void);
+
+
+// EEPROM configuration store functions.
+
+// This is the write-back handler called from within the EEPROM-ready ISR.
+void CONFIG_HandleReady_ISR(void);
+
+// These are hardware hooks called from within the configuration store.
+// Reading waits for any EEPROM write in progress to finish. Writing
+// starts an erase-and-write of one byte and returns immediately.
+// The caller is responsible for any needed locking.
+uint8_t CONFIG_ReadEEPROM_ISR(uint16_t address);
+void CONFIG_WriteEEPROM_ISR(uint16_t address, uint8_t value);
+void CONFIG_SetReadyInterrupt_ISR(bool enabled);
+// This returns true if an EEPROM write is still in progress. It's safe to
+// call without locking.
+bool CONFIG_IsEEPROMBusy(void);
+
+
+// Direct digital synthesis functions.
+
+// This is the sample handler called from within the sample timer ISR.
+void DDS_HandleSample_ISR(void);
+
+// These are hardware hooks called by the DDS engine.
+// The caller is responsible for any needed locking.
+// This configures the sample timer (with its interrupt off) and, if
+// asked, the PWM output. Returns the actual sample rate.
+uint32_t DDS_InitTimers_ISR(uint32_t mcu_hz, uint32_t sample_hz,
+  bool use_pwm);
+void DDS_SetSampleInterrupt_ISR(bool enabled);
+void DDS_WritePWM_ISR(uint8_t value);
+
+
+// Flight recorder functions.
+
+// This is called by MCU_Init() with the reset cause flags. It keeps the
+// old records if they survived the reset, and records the reset.
+// The caller is responsible for any needed locking.
+void FLIGHT_Init_ISR(uint8_t reset_flags);
+
+
 // FIXME - ADC functions go here.
 
 
@@ -0,0 +1,236 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// Single-producer single-consumer ring buffer template.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+// NOTE - This gets included multiple times along with neuravr.h, so the
+// whole thing is guarded.
+
+#ifndef NEURAVR_RING_DEFS
+#define NEURAVR_RING_DEFS
+
+
+//
+// Includes
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+
+//
+// Notes
+
+// NeurAVR_Ring<T, SIZE> holds up to SIZE records of type T. SIZE has to be
+// a power of 2 no larger than 128.
+//
+// One context (usually an ISR) produces and one context consumes. Neither
+// side needs a lock:
+// - The head and tail are free-running 8-bit counters, so reading or
+// writing either one is a single atomic access on the AVR. Indices come
+// from masking them, and the difference is the record count, so all SIZE
+// slots are usable.
+// - The producer only writes the head, after filling the slot. The
+// consumer only writes the tail, after it's done with the slot. A barrier
+// keeps the compiler from moving slot accesses past either write.
+//
+// Slots can be filled and consumed in place (GetWriteSlot()/Publish(),
+// GetReadSlot()/Release()), which avoids copying large records, or copied
+// with Push()/Pop() and PushBatch()/PopBatch().
+//
+// Reset() touches both counters, so the caller has to make sure neither
+// side is running (usually with an ATOMIC_BLOCK).
+
+
+
+//
+// Macros
+
+// Compiler barrier. The emulated ISRs run on another thread, so that
+// needs a real fence.
+#ifdef NEUREMU
+#define NEURAVR_RING_BARRIER() __sync_synchronize()
+#else
+#define NEURAVR_RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+
+
+//
+// Classes
+
+
+template <typename T, uint8_t SIZE> class NeurAVR_Ring
+{
+protected:
+  // This fails to compile if SIZE isn't a power of 2 between 1 and 128.
+  typedef char size_check_t
+    [ ( (0 < SIZE) && (128 >= SIZE) && (0 == (SIZE & (SIZE - 1))) )
+      ? 1 : -1 ];
+
+  T slots[SIZE];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+
+public:
+  NeurAVR_Ring(void) { head = 0; tail = 0; }
+
+  // Discards all records.
+  // The caller is responsible for any needed locking.
+  void Reset(void) { head = 0; tail = 0; }
+
+  // Status. These are safe to call from either side, but are only
+  // snapshots from the other side's point of view.
+  uint8_t GetCount(void) { return (uint8_t) (head - tail); }
+  uint8_t GetFree(void) { return (uint8_t) (SIZE - GetCount()); }
+  bool IsEmpty(void) { return head == tail; }
+  bool IsFull(void) { return SIZE == GetCount(); }
+  static uint8_t GetSize(void) { return SIZE; }
+
+
+  // Producer side.
+
+  // Returns a pointer to the next free slot, or NULL if the ring is full.
+  // The slot isn't visible to the consumer until Publish() is called, so
+  // it can be filled (or abandoned) at leisure.
+  T *GetWriteSlot(void)
+  {
+    T *result;
+
+    result = NULL;
+    if (!IsFull())
+      result = &(slots[head & (SIZE - 1)]);
+
+    return result;
+  }
+
+  // Hands the slot from GetWriteSlot() to the consumer.
+  void Publish(void)
+  {
+    NEURAVR_RING_BARRIER();
+    head = head + 1;
+  }
+
+  // Copies a record in. Returns false if the ring was full.
+  bool Push(const T &record)
+  {
+    bool result;
+
+    result = false;
+    if (!IsFull())
+    {
+      slots[head & (SIZE - 1)] = record;
+      Publish();
+      result = true;
+    }
+
+    return result;
+  }
+
+  // Copies up to "count" records in, publishing them all at once.
+  // Returns the number of records copied.
+  uint8_t PushBatch(const T *records, uint8_t count)
+  {
+    uint8_t result;
+    uint8_t thishead;
+
+    if (count > GetFree())
+      count = GetFree();
+
+    thishead = head;
+    for (result = 0; result < count; result++)
+    {
+      slots[thishead & (SIZE - 1)] = records[result];
+      thishead++;
+    }
+
+    NEURAVR_RING_BARRIER();
+    head = thishead;
+
+    return result;
+  }
+
+  // Returns the head counter. Consumers can save this, and later use
+  // HasReachedMark() to read only records published before the save.
+  uint8_t GetMark(void) { return head; }
+
+
+  // Consumer side.
+
+  // Returns a pointer to the oldest record, or NULL if the ring is empty.
+  // The slot stays valid until Release() is called.
+  T *GetReadSlot(void)
+  {
+    T *result;
+
+    result = NULL;
+    if (!IsEmpty())
+    {
+      NEURAVR_RING_BARRIER();
+      result = &(slots[tail & (SIZE - 1)]);
+    }
+
+    return result;
+  }
+
+  // Hands the slot from GetReadSlot() back to the producer.
+  void Release(void)
+  {
+    NEURAVR_RING_BARRIER();
+    tail = tail + 1;
+  }
+
+  // Copies the oldest record out. Returns false if the ring was empty.
+  bool Pop(T &record)
+  {
+    bool result;
+
+    result = false;
+    if (!IsEmpty())
+    {
+      NEURAVR_RING_BARRIER();
+      record = slots[tail & (SIZE - 1)];
+      Release();
+      result = true;
+    }
+
+    return result;
+  }
+
+  // Copies up to "count" records out, releasing them all at once.
+  // Returns the number of records copied.
+  uint8_t PopBatch(T *records, uint8_t count)
+  {
+    uint8_t result;
+    uint8_t thistail;
+
+    if (count > GetCount())
+      count = GetCount();
+
+    NEURAVR_RING_BARRIER();
+
+    thistail = tail;
+    for (result = 0; result < count; result++)
+    {
+      records[result] = slots[thistail & (SIZE - 1)];
+      thistail++;
+    }
+
+    NEURAVR_RING_BARRIER();
+    tail = thistail;
+
+    return result;
+  }
+
+  // Returns true if every record published before GetMark() returned
+  // "mark" has been released.
+  bool HasReachedMark(uint8_t mark) { return tail == mark; }
+};
+
+
+#endif
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,141 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega2560 - Direct digital synthesis functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+//
+// Notes
+
+// We're using Timer 4 (16-bit) for the sample clock, in CTC mode.
+// PWM output uses Timer 3 (16-bit) in 8-bit fast PWM mode with a /1
+// prescaler, on OC3A (E3, Mega Dig5).
+
+
+
+//
+// Functions
+
+
+// DDS timer initialization hook.
+// This configures the sample timer (with its interrupt off) and, if
+// requested, the PWM output. Returns the actual sample rate.
+// The caller is responsible for any needed locking.
+
+uint32_t DDS_InitTimers_ISR(uint32_t mcu_hz, uint32_t sample_hz,
+  bool use_pwm)
+{
+  uint32_t result;
+  uint32_t clocks_per_sample;
+  uint8_t clock_select;
+  uint8_t prescale_shift;
+  // Timer 4's prescaler steps are /1, /8, /64, /256, and /1024.
+  const uint8_t prescale_shifts[5] = { 0, 3, 6, 8, 10 };
+
+  // Sample timer.
+
+  TIMSK4 = 0;
+  TCCR4A = 0;
+  TCCR4B = (1 << WGM42);
+
+  // Pick the smallest prescaler that gives a count that fits in 16 bits.
+  // For CTC mode, f = cpuclk / (prescale * (1 + OCRnA)).
+  clock_select = 0;
+  do
+  {
+    prescale_shift = prescale_shifts[clock_select];
+    clock_select++;
+    clocks_per_sample = (mcu_hz >> prescale_shift) / sample_hz;
+  }
+  while ( (0x10000 < clocks_per_sample) && (5 > clock_select) );
+
+  if (1 > clocks_per_sample)
+    clocks_per_sample = 1;
+  if (0x10000 < clocks_per_sample)
+    clocks_per_sample = 0x10000;
+
+  result = mcu_hz / (clocks_per_sample << prescale_shift);
+
+  // NOTE - For 16-bit registers, write high first.
+  OCR4AH = (uint8_t) ((clocks_per_sample - 1) >> 8);
+  OCR4AL = (uint8_t) (clocks_per_sample - 1);
+  TCNT4H = 0;
+  TCNT4L = 0;
+  TCCR4B = (1 << WGM42) | clock_select;
+
+  // PWM output.
+
+  TCCR3A = 0;
+  TCCR3B = (1 << WGM32);
+
+  if (use_pwm)
+  {
+    // OC3A is E3.
+    DDRE |= (1 << 3);
+
+    OCR3AH = 0;
+    OCR3AL = 0x80;
+    TCNT3H = 0;
+    TCNT3L = 0;
+
+    // 8-bit fast PWM (mode 5), non-inverting output on OC3A, /1 prescaler.
+    TCCR3A = (1 << COM3A1) | (1 << WGM30);
+    TCCR3B = (1 << WGM32) | (1 << CS30);
+  }
+
+  return result;
+}
+
+
+
+// DDS sample interrupt hook.
+// The caller is responsible for any needed locking.
+
+void DDS_SetSampleInterrupt_ISR(bool enabled)
+{
+  if (enabled)
+  {
+    // Clear any stale match and start the sample period from scratch.
+    TCNT4H = 0;
+    TCNT4L = 0;
+    TIFR4 = (1 << OCF4A);
+    TIMSK4 |= (1 << OCIE4A);
+  }
+  else
+    TIMSK4 &= ~(1 << OCIE4A);
+}
+
+
+
+// DDS PWM output hook.
+// The caller is responsible for any needed locking.
+
+void DDS_WritePWM_ISR(uint8_t value)
+{
+  // NOTE - The high byte goes through a shared temporary register, so
+  // write it every time.
+  OCR3AH = 0;
+  OCR3AL = value;
+}
+
+
+
+// DDS sample clock interrupt service routine.
+
+ISR(TIMER4_COMPA_vect, ISR_BLOCK)
+{
+  DDS_HandleSample_ISR();
+}
+
+
+
+//
+// This is the end of the file.
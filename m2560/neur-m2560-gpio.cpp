@@ -20,6 +20,7 @@
 
 // The 8-bit digital bank uses H3..H6 for GP0..GP3, and B4..B7 for GP4..GP7.
 // The 16-bit bank uses L0..L7 for GP8..GP15 and C0..C7 for GP16..GP23.
+// While the RTC is being disciplined, L1 (GP9) is the sync capture input.
 
 
 
@@ -28,11 +29,18 @@
 
 
 // Pin use masks for ports that are only partly mapped to I/Os.
-// We want unmapped bits to stay high-Z inputs, period.
+// Unmapped bits are left alone. They stay high-Z inputs unless something
+// else (the SPI module, on B0..B3) has claimed them.
+// NOTE - Other bits on these ports may be changed from within ISRs, so
+// updates are locked read-modify-write operations.
 
 #define GPMASK_PORTH (0x0f << 3)
 #define GPMASK_PORTB 0xf0
 
+// L1 (GP9) is ICP5, the RTC sync capture input. It's dropped from the
+// port L mask while sync capture is on.
+#define SYNCMASK_PORTL 0x02
+
 
 
 //
@@ -58,6 +66,9 @@ uint8_t data_c = 0x00;
 uint8_t lastval_8 = 0x00;
 uint16_t lastval_16 = 0x00;
 
+// Port L pins currently available to the GPIO bank.
+uint8_t gpmask_portl = 0xff;
+
 
 
 //
@@ -77,8 +88,11 @@ void IO8_SelectOutputs(uint8_t output_mask)
   dirmask_porth &= GPMASK_PORTH;
   dirmask_portb &= GPMASK_PORTB;
 
-  DDRH = dirmask_porth;
-  DDRB = dirmask_portb;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    DDRH = (DDRH & ~GPMASK_PORTH) | dirmask_porth;
+    DDRB = (DDRB & ~GPMASK_PORTB) | dirmask_portb;
+  }
 }
 
 
@@ -107,8 +121,11 @@ void IO8_WriteData(uint8_t output_data)
   data_b |= scratch_b;
 
 
-  PORTH = data_h;
-  PORTB = data_b;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTH = (PORTH & ~GPMASK_PORTH) | data_h;
+    PORTB = (PORTB & ~GPMASK_PORTB) | data_b;
+  }
 }
 
 
@@ -148,8 +165,11 @@ void IO8_SetPullups(uint8_t pullup_mask)
   data_b |= scratch_b;
 
 
-  PORTH = data_h;
-  PORTB = data_b;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTH = (PORTH & ~GPMASK_PORTH) | data_h;
+    PORTB = (PORTB & ~GPMASK_PORTB) | data_b;
+  }
 }
 
 
@@ -182,6 +202,37 @@ uint8_t IO8_ReadData(void)
 
 
 
+// Private GPIO functions.
+
+// This tells the GPIO bank to leave the SPI pins alone (or to reclaim them).
+// The SPI pins (B0..B3) aren't mapped to GPIO lines, so there's nothing to
+// do.
+
+void IO8_ReserveSPIPins(bool reserved)
+{
+  // Nothing to do.
+}
+
+
+// This tells the GPIO banks to leave the RTC sync capture pin alone (or to
+// reclaim it). GP9 is unavailable while sync capture is on.
+
+void IO_ReserveSyncPin(bool reserved)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (reserved)
+      gpmask_portl = 0xff & ~SYNCMASK_PORTL;
+    else
+      gpmask_portl = 0xff;
+
+    dirmask_portl &= gpmask_portl;
+    data_l &= gpmask_portl;
+  }
+}
+
+
+
 // 16-bit Digital GPIO functions.
 
 // Configures input and output GPIO lines. 1 = output, 0 = input.
@@ -197,7 +248,12 @@ void IO16_SelectOutputs(uint16_t output_mask)
   dirmask_portl = (uint8_t) scratch_l;
   dirmask_portc = (uint8_t) scratch_c;
 
-  DDRL = dirmask_portl;
+  dirmask_portl &= gpmask_portl;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    DDRL = (DDRL & ~gpmask_portl) | dirmask_portl;
+  }
   DDRC = dirmask_portc;
 }
 
@@ -231,7 +287,10 @@ void IO16_WriteData(uint16_t output_data)
   data_c |= byte_c;
 
 
-  PORTL = data_l;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTL = (PORTL & ~gpmask_portl) | data_l;
+  }
   PORTC = data_c;
 }
 
@@ -259,9 +318,10 @@ void IO16_SetPullups(uint16_t pullup_mask)
   byte_l = (uint8_t) word_l;
   byte_c = (uint8_t) word_c;
 
-  // Keep bits that are _not_ outputs.
+  // Keep bits that are _not_ outputs, but that are still mapped to GPIOs.
 
   byte_l &= ~dirmask_portl;
+  byte_l &= gpmask_portl;
   byte_c &= ~dirmask_portc;
 
   // Combine this with output state.
@@ -273,7 +333,10 @@ void IO16_SetPullups(uint16_t pullup_mask)
   data_c |= byte_c;
 
 
-  PORTL = data_l;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTL = (PORTL & ~gpmask_portl) | data_l;
+  }
   PORTC = data_c;
 }
 
@@ -288,9 +351,10 @@ uint16_t IO16_ReadData(void)
   byte_l = PINL;
   byte_c = PINC;
 
-  // Keep bits that are _not_ outputs.
+  // Keep bits that are _not_ outputs, but that are still mapped to GPIOs.
 
   byte_l &= ~dirmask_portl;
+  byte_l &= gpmask_portl;
   byte_c &= ~dirmask_portc;
 
   // Map port bits to data bits.
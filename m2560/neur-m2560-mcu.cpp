@@ -32,11 +32,21 @@
 
 void MCU_Init(void)
 {
+  uint8_t reset_flags;
+
   // Make very sure interrupts are off during initialization, and turned
   // on afterwards.
   // This is more robust than cli() alone.
   ATOMIC_BLOCK(ATOMIC_FORCEON)
   {
+    // Note why we reset, and clear the flags for next time.
+    // The watchdog stays on after a watchdog reset, so turn it off before
+    // it fires again. This is a timed sequence; WDRF has to be clear first.
+    reset_flags = MCUSR;
+    MCUSR = 0;
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = 0;
+
     // Initialize I/O pins.
     // Pull-ups enabled globally, all pins high-Z inputs locally.
 
@@ -72,6 +82,13 @@ void MCU_Init(void)
     PORTK = 0x00;
     PORTL = 0x00;
 
+    // Scope pins, if enabled, are outputs driven low.
+    SCOPE_INIT(RTC);
+    SCOPE_INIT(UART);
+    SCOPE_INIT(ADC);
+    SCOPE_INIT(APP);
+    SCOPE_INIT(POLL);
+
 
     // Initialize peripherals.
 
@@ -84,8 +101,17 @@ void MCU_Init(void)
     // Disable the UART.
     UART_Init(0, 0);
 
+    // Disable SPI.
+    SPI_Init(0, 0, 0);
+
+    // Disable TWI.
+    TWI_Init(0, 0);
+
     // Disable the ADC.
     // FIXME - ADC NYI.
+
+    // Start the flight recorder. This records the reset.
+    FLIGHT_Init_ISR(reset_flags);
   }
 
   // ATOMIC_FORCEON means interrupts are enabled by this point.
@@ -18,6 +18,9 @@
 // The ATmega2560 has six timers: Timers 0 and 2 (8-bit) and Timers 1, 3, 4,
 // and 5 (16-bit). Timers 0 and 2 are not identical.
 // We're using Timer 5 for the RTC.
+// The RTC can be disciplined to a sync pulse on ICP5 (L1, Mega Dig48).
+// L1 is also GPIO line GP9; the GPIO bank leaves it alone while sync
+// capture is on.
 
 
 
@@ -97,8 +100,10 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
     // underflow while doing this calculation.
     if (0 < clocks_per_tick)
       clocks_per_tick--;
-    if (0xffff < clocks_per_tick)
-      clocks_per_tick = 0xffff;
+    // The disciplining loop needs the tick length (OCRnA + 1) to fit in
+    // 16 bits, so stop one short of the counter's range.
+    if (0xfffe < clocks_per_tick)
+      clocks_per_tick = 0xfffe;
 
     // Configure Timer 5.
     // NOTE - For 16-bit registers, write high first, read low first.
@@ -120,6 +125,12 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
     TCCR5B = 0b01001;
     TIMSK5 = (1 << OCIE5A);
   }
+
+  // Reset RTC disciplining. This needs the tick length.
+  if (0 < rtc_hz)
+    Timer_InitSync_ISR((uint16_t) (clocks_per_tick + 1));
+  else
+    Timer_InitSync_ISR(0);
 }
 
 
@@ -130,15 +141,89 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
 
 ISR(TIMER5_COMPA_vect, ISR_BLOCK)
 {
+  uint16_t period;
+
+  SCOPE_RAISE(RTC);
+
   // This may overflow for very fast or very long running clocks.
   // That's tolerable.
   rtc_timestamp++;
 
+  // If the RTC is being disciplined, set the next tick's length.
+  // The counter has only just wrapped, so this is safely ahead of it.
+  // NOTE - For 16-bit registers, write high first.
+  if (rtc_sync_active)
+  {
+    period = Timer_GetSyncPeriod_ISR() - 1;
+    OCR5AH = (uint8_t) (period >> 8);
+    OCR5AL = (uint8_t) period;
+  }
+
   // This really, really has to return quickly.
   // Not just within one RTC tick - it has to return before _any_ other
   // interrupt-driven event would happen _twice_.
   if (NULL != rtc_usercallback)
     (*rtc_usercallback)();
+
+  SCOPE_LOWER(RTC);
+}
+
+
+
+// RTC sync capture hook.
+// This turns the input capture interrupt on or off and selects the
+// capture edge. The caller is responsible for any needed locking.
+
+void Timer_SetSyncCapture_ISR(bool enabled, bool rising_edge)
+{
+  // Turn off the capture interrupt while changing settings.
+  TIMSK5 &= ~(1 << ICIE5);
+
+  // Keep the GPIO bank off of the capture pin while we're using it.
+  IO_ReserveSyncPin(enabled);
+
+  if (enabled)
+  {
+    // ICP5 is L1. Make it an input, leaving the pull-up alone.
+    DDRL &= ~(1 << 1);
+
+    // The noise canceller adds a fixed 4-clock delay, which is the same on
+    // every board.
+    if (rising_edge)
+      TCCR5B |= (1 << ICNC5) | (1 << ICES5);
+    else
+      TCCR5B = (TCCR5B & ~(1 << ICES5)) | (1 << ICNC5);
+
+    // Changing the edge can set the capture flag. Clear it.
+    TIFR5 = (1 << ICF5);
+
+    TIMSK5 |= (1 << ICIE5);
+  }
+}
+
+
+
+// RTC sync input capture interrupt service routine.
+// This timestamps the sync edge and hands it to the disciplining loop.
+// NOTE - Capture has a higher priority than compare match, so if both are
+// pending, the capture is serviced first.
+
+ISR(TIMER5_CAPT_vect, ISR_BLOCK)
+{
+  uint16_t count;
+  uint32_t timestamp;
+
+  // NOTE - For 16-bit registers, read low first.
+  count = ICR5L;
+  count |= ((uint16_t) ICR5H) << 8;
+
+  // If a tick happened before the edge but hasn't been counted yet, the
+  // capture count is small and the compare flag is still set.
+  timestamp = rtc_timestamp;
+  if ( (TIFR5 & (1 << OCF5A)) && (count < (OCR5A >> 1)) )
+    timestamp++;
+
+  Timer_HandleSyncEdge_ISR(timestamp, count);
 }
 
 
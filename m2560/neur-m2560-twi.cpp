@@ -0,0 +1,178 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega2560 - TWI (I2C) functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// The ATmega2560 TWI pins are D1 (SDA) and D0 (SCL). These are Mega pins
+// 20 and 21. Nothing else uses them.
+// The internal pull-ups are enabled, but they're weak (20k-50k); use
+// external pull-ups for anything faster than 100 kbps.
+
+
+
+//
+// Macros
+
+#define TWI_PIN_SDA (1 << 1)
+#define TWI_PIN_SCL (1 << 0)
+#define TWI_PINS (TWI_PIN_SDA | TWI_PIN_SCL)
+
+// Control register values. Writing TWINT clears the interrupt flag, which
+// starts the requested bus operation.
+#define TWI_CR_IDLE ((1 << TWEN) | (1 << TWIE))
+#define TWI_CR_GO ((1 << TWINT) | TWI_CR_IDLE)
+#define TWI_CR_ACK (TWI_CR_GO | (1 << TWEA))
+#define TWI_CR_START (TWI_CR_GO | (1 << TWSTA))
+#define TWI_CR_STOP (TWI_CR_GO | (1 << TWSTO))
+// Stop followed by start.
+#define TWI_CR_STOPSTART (TWI_CR_STOP | (1 << TWSTA))
+
+// Status register prescaler bits.
+#define TWI_SR_PRESCALE_MASK 0x03
+
+
+
+//
+// Variables
+
+// Actual bit rate set.
+uint32_t real_twi_rate = 0;
+
+
+
+//
+// Functions
+
+
+// Configures the TWI port as a master with the specified bit rate (rounded
+// down to what the hardware can do). A bit rate of 0 turns it off.
+// Any queued transactions are discarded.
+
+void TWI_Init(uint32_t mcu_hz, uint32_t bit_rate)
+{
+  uint32_t twbr_value;
+  uint8_t prescale_bits;
+
+  if (0 == bit_rate)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      TWCR = 0x00;
+
+      TWI_InitQueue_ISR();
+
+      // If we'd claimed the pins, turn the pull-ups back off.
+      if (0 != real_twi_rate)
+        PORTD &= ~TWI_PINS;
+    }
+
+    real_twi_rate = 0;
+  }
+  else
+  {
+    // SCL = mcu_hz / (16 + 2 * TWBR * prescale). Prescale is 4^bits.
+    // Round TWBR up, so that we don't exceed the requested rate.
+    twbr_value = mcu_hz / bit_rate;
+    twbr_value = (16 < twbr_value) ? ((twbr_value - 15) >> 1) : 0;
+
+    prescale_bits = 0;
+    while ( (3 > prescale_bits) && (0xff < twbr_value) )
+    {
+      prescale_bits++;
+      twbr_value = (twbr_value + 3) >> 2;
+    }
+    if (0xff < twbr_value)
+      twbr_value = 0xff;
+
+    real_twi_rate = mcu_hz
+      / (16 + ((twbr_value << 1) << (prescale_bits << 1)));
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      TWCR = 0x00;
+
+      TWI_InitQueue_ISR();
+
+      // Inputs with pull-ups; the TWI module drives them when enabled.
+      DDRD &= ~TWI_PINS;
+      PORTD |= TWI_PINS;
+
+      TWSR = prescale_bits & TWI_SR_PRESCALE_MASK;
+      TWBR = (uint8_t) twbr_value;
+
+      TWCR = TWI_CR_IDLE;
+    }
+  }
+}
+
+
+
+// Returns the actual bit rate set, or 0 if TWI is off.
+
+uint32_t TWI_QueryBitRate(void)
+{
+  return real_twi_rate;
+}
+
+
+
+// Hardware hooks for the state machine.
+// The caller is responsible for any needed locking.
+
+void TWI_SendStart_ISR(void)
+{
+  TWCR = TWI_CR_START;
+}
+
+
+void TWI_SendStop_ISR(bool start_next)
+{
+  TWCR = start_next ? TWI_CR_STOPSTART : TWI_CR_STOP;
+}
+
+
+void TWI_SendByte_ISR(uint8_t sendbyte)
+{
+  TWDR = sendbyte;
+  TWCR = TWI_CR_GO;
+}
+
+
+void TWI_ReceiveByte_ISR(bool send_ack)
+{
+  TWCR = send_ack ? TWI_CR_ACK : TWI_CR_GO;
+}
+
+
+uint8_t TWI_ReadByte_ISR(void)
+{
+  return TWDR;
+}
+
+
+
+// TWI interrupt service routine.
+// TWINT stays set until the state machine writes TWCR.
+
+ISR(TWI_vect, ISR_BLOCK)
+{
+  TWI_HandleStatus_ISR(TWSR & ~TWI_SR_PRESCALE_MASK);
+}
+
+
+
+//
+// This is the end of the file.
@@ -176,9 +176,13 @@ ISR(UVECT_RX, ISR_BLOCK)
 {
   uint8_t thischar;
 
+  SCOPE_RAISE(UART);
+
   thischar = UREG_DR;
 
   UART_HandleRecvChar_ISR(thischar);
+
+  SCOPE_LOWER(UART);
 }
 
 
@@ -191,6 +195,8 @@ ISR(UVECT_UDRE, ISR_BLOCK)
 {
   char thischar;
 
+  SCOPE_RAISE(UART);
+
   thischar = 0;
 
   if (UART_GetNextSendChar_ISR(thischar))
@@ -204,6 +210,8 @@ ISR(UVECT_UDRE, ISR_BLOCK)
     // Keep TX enabled but disable the UDRE interrupt.
     UREG_CSRB = UART_CSRB_TXIDLE;
   }
+
+  SCOPE_LOWER(UART);
 }
 
 
@@ -0,0 +1,134 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega328P - Direct digital synthesis functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+//
+// Notes
+
+// We're using Timer 0 (8-bit) for the sample clock, in CTC mode.
+// PWM output uses Timer 2 (8-bit) in fast PWM mode with a /1 prescaler,
+// on OC2B (D3, Uno Dig3). OC2A (B3) is the SPI MOSI pin.
+// D3 is also the UART scope pin (see neur-m328p.h). With NEURAVR_SCOPE_PINS
+// turned on, UART interrupts pulse the PWM output, so don't use both.
+
+
+
+//
+// Functions
+
+
+// DDS timer initialization hook.
+// This configures the sample timer (with its interrupt off) and, if
+// requested, the PWM output. Returns the actual sample rate.
+// The caller is responsible for any needed locking.
+
+uint32_t DDS_InitTimers_ISR(uint32_t mcu_hz, uint32_t sample_hz,
+  bool use_pwm)
+{
+  uint32_t result;
+  uint32_t clocks_per_sample;
+  uint8_t clock_select;
+  uint8_t prescale_shift;
+  // Timer 0's prescaler steps are /1, /8, /64, /256, and /1024.
+  const uint8_t prescale_shifts[5] = { 0, 3, 6, 8, 10 };
+
+  // Sample timer.
+
+  TIMSK0 = 0;
+  TCCR0A = (1 << WGM01);
+  TCCR0B = 0;
+
+  // Pick the smallest prescaler that gives a count that fits in 8 bits.
+  // For CTC mode, f = cpuclk / (prescale * (1 + OCRnA)).
+  clock_select = 0;
+  do
+  {
+    prescale_shift = prescale_shifts[clock_select];
+    clock_select++;
+    clocks_per_sample = (mcu_hz >> prescale_shift) / sample_hz;
+  }
+  while ( (0x100 < clocks_per_sample) && (5 > clock_select) );
+
+  if (1 > clocks_per_sample)
+    clocks_per_sample = 1;
+  if (0x100 < clocks_per_sample)
+    clocks_per_sample = 0x100;
+
+  result = mcu_hz / (clocks_per_sample << prescale_shift);
+
+  OCR0A = (uint8_t) (clocks_per_sample - 1);
+  TCNT0 = 0;
+  TCCR0B = clock_select;
+
+  // PWM output.
+
+  TCCR2A = (1 << WGM21);
+  TCCR2B = 0;
+
+  if (use_pwm)
+  {
+    // OC2B is D3.
+    DDRD |= (1 << 3);
+
+    OCR2B = 0x80;
+    TCNT2 = 0;
+
+    // Fast PWM (mode 3), non-inverting output on OC2B, /1 prescaler.
+    TCCR2A = (1 << COM2B1) | (1 << WGM21) | (1 << WGM20);
+    TCCR2B = (1 << CS20);
+  }
+
+  return result;
+}
+
+
+
+// DDS sample interrupt hook.
+// The caller is responsible for any needed locking.
+
+void DDS_SetSampleInterrupt_ISR(bool enabled)
+{
+  if (enabled)
+  {
+    // Clear any stale match and start the sample period from scratch.
+    TCNT0 = 0;
+    TIFR0 = (1 << OCF0A);
+    TIMSK0 |= (1 << OCIE0A);
+  }
+  else
+    TIMSK0 &= ~(1 << OCIE0A);
+}
+
+
+
+// DDS PWM output hook.
+// The caller is responsible for any needed locking.
+
+void DDS_WritePWM_ISR(uint8_t value)
+{
+  OCR2B = value;
+}
+
+
+
+// DDS sample clock interrupt service routine.
+
+ISR(TIMER0_COMPA_vect, ISR_BLOCK)
+{
+  DDS_HandleSample_ISR();
+}
+
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,99 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega328P - EEPROM functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// Programming mode bits (EEPM1:0) are left at 0, for erase-and-write.
+// The EEPROM-ready interrupt fires continuously while it's enabled and no
+// write is in progress, so it has to be turned off when there's nothing
+// left to write.
+
+
+
+//
+// Functions
+
+
+// Reads one byte from EEPROM, waiting for any write in progress first.
+// The caller is responsible for any needed locking.
+
+uint8_t CONFIG_ReadEEPROM_ISR(uint16_t address)
+{
+  while (EECR & (1 << EEPE))
+    ;
+
+  EEAR = address;
+  EECR |= (1 << EERE);
+
+  return EEDR;
+}
+
+
+
+// Starts writing one byte to EEPROM. This returns immediately; the write
+// takes about 3.3 ms.
+// The caller is responsible for any needed locking.
+
+void CONFIG_WriteEEPROM_ISR(uint16_t address, uint8_t value)
+{
+  while (EECR & (1 << EEPE))
+    ;
+
+  EEAR = address;
+  EEDR = value;
+
+  // EEPE has to be set within four cycles of EEMPE. Each of these is an
+  // SBI instruction, and interrupts are off.
+  EECR |= (1 << EEMPE);
+  EECR |= (1 << EEPE);
+}
+
+
+
+// Returns true if an EEPROM write is still in progress.
+// This is a single register read, so it doesn't need locking.
+
+bool CONFIG_IsEEPROMBusy(void)
+{
+  return (0 != (EECR & (1 << EEPE)));
+}
+
+
+
+// Turns the EEPROM-ready interrupt on or off.
+// The caller is responsible for any needed locking.
+
+void CONFIG_SetReadyInterrupt_ISR(bool enabled)
+{
+  if (enabled)
+    EECR |= (1 << EERIE);
+  else
+    EECR &= ~(1 << EERIE);
+}
+
+
+
+// EEPROM-ready interrupt service routine.
+
+ISR(EE_READY_vect, ISR_BLOCK)
+{
+  CONFIG_HandleReady_ISR();
+}
+
+
+
+//
+// This is the end of the file.
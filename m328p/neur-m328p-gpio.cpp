@@ -20,6 +20,8 @@
 
 // The 8-bit digital bank uses D5..D7 for GP0..DP2 and B0..B4 for GP3..GP7.
 // The 16-bit bank is not mapped.
+// When SPI is enabled, B2..B4 (GP5..GP7) and B5 belong to it instead.
+// While the RTC is being disciplined, B0 (GP3) is the sync capture input.
 
 
 
@@ -28,11 +30,22 @@
 
 
 // Pin use masks for ports that are only partly mapped to I/Os.
-// We want unmapped bits to stay high-Z inputs, period.
+// Unmapped bits are left alone. They stay high-Z inputs unless something
+// else (the UART, scope pins) has claimed them.
+// NOTE - Other bits on these ports may be changed from within ISRs, so
+// updates are locked read-modify-write operations.
 
 #define GPMASK_PORTD 0xe0
 #define GPMASK_PORTB 0x1f
 
+// B2..B4 (GP5..GP7) double as SS, MOSI, and MISO. They're dropped from the
+// port B mask while the SPI module is using them.
+#define SPIMASK_PORTB 0x1c
+
+// B0 (GP3) is ICP1, the RTC sync capture input. It's dropped from the
+// port B mask while sync capture is on.
+#define SYNCMASK_PORTB 0x01
+
 
 
 //
@@ -45,6 +58,11 @@
 uint8_t dirmask_portd = 0x00;
 uint8_t dirmask_portb = 0x00;
 
+// Port B pins claimed by other modules, and the ones left for the GPIO
+// bank.
+uint8_t reserved_portb = 0x00;
+uint8_t gpmask_portb = GPMASK_PORTB;
+
 // Last values written to the various ports.
 // This is a combination of data for outputs and pullup state for inputs.
 uint8_t data_d = 0x00;
@@ -70,10 +88,13 @@ void IO8_SelectOutputs(uint8_t output_mask)
   dirmask_portb = (output_mask & 0xf8) >> 3;
 
   dirmask_portd &= GPMASK_PORTD;
-  dirmask_portb &= GPMASK_PORTB;
+  dirmask_portb &= gpmask_portb;
 
-  DDRD = dirmask_portd;
-  DDRB = dirmask_portb;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    DDRD = (DDRD & ~GPMASK_PORTD) | dirmask_portd;
+    DDRB = (DDRB & ~gpmask_portb) | dirmask_portb;
+  }
 }
 
 
@@ -102,8 +123,11 @@ void IO8_WriteData(uint8_t output_data)
   data_b |= scratch_b;
 
 
-  PORTD = data_d;
-  PORTB = data_b;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTD = (PORTD & ~GPMASK_PORTD) | data_d;
+    PORTB = (PORTB & ~gpmask_portb) | data_b;
+  }
 }
 
 
@@ -132,7 +156,7 @@ void IO8_SetPullups(uint8_t pullup_mask)
   scratch_d &= GPMASK_PORTD;
 
   scratch_b &= ~dirmask_portb;
-  scratch_b &= GPMASK_PORTB;
+  scratch_b &= gpmask_portb;
 
   // Combine this with output state.
 
@@ -143,8 +167,11 @@ void IO8_SetPullups(uint8_t pullup_mask)
   data_b |= scratch_b;
 
 
-  PORTD = data_d;
-  PORTB = data_b;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTD = (PORTD & ~GPMASK_PORTD) | data_d;
+    PORTB = (PORTB & ~gpmask_portb) | data_b;
+  }
 }
 
 
@@ -163,7 +190,7 @@ uint8_t IO8_ReadData(void)
   scratch_d &= GPMASK_PORTD;
 
   scratch_b &= ~dirmask_portb;
-  scratch_b &= GPMASK_PORTB;
+  scratch_b &= gpmask_portb;
 
   // Map port bits to data bits.
 
@@ -178,6 +205,47 @@ uint8_t IO8_ReadData(void)
 
 
 
+// Private GPIO functions.
+
+// This claims or releases port B pins on behalf of another module.
+// Claimed pins are dropped from the GPIO bank until they're released.
+
+static void IO8_ReservePortBPins(uint8_t pinmask, bool reserved)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (reserved)
+      reserved_portb |= pinmask;
+    else
+      reserved_portb &= ~pinmask;
+
+    gpmask_portb = GPMASK_PORTB & ~reserved_portb;
+
+    dirmask_portb &= gpmask_portb;
+    data_b &= gpmask_portb;
+  }
+}
+
+
+// This tells the GPIO bank to leave the SPI pins alone (or to reclaim them).
+// GP5..GP7 are unavailable while the SPI module has them.
+
+void IO8_ReserveSPIPins(bool reserved)
+{
+  IO8_ReservePortBPins(SPIMASK_PORTB, reserved);
+}
+
+
+// This tells the GPIO banks to leave the RTC sync capture pin alone (or to
+// reclaim it). GP3 is unavailable while sync capture is on.
+
+void IO_ReserveSyncPin(bool reserved)
+{
+  IO8_ReservePortBPins(SYNCMASK_PORTB, reserved);
+}
+
+
+
 // 16-bit Digital GPIO functions.
 
 // Configures input and output GPIO lines. 1 = output, 0 = input.
@@ -18,6 +18,9 @@
 // The ATmega328 has three timers: Timer 0 (8-bit), Timer 1 (16-bit),
 // and Timer 2 (8-bit).
 // We're using Timer 1 for the RTC.
+// The RTC can be disciplined to a sync pulse on ICP1 (B0, Uno Dig8).
+// B0 is also GPIO line GP3; the GPIO bank leaves it alone while sync
+// capture is on.
 
 
 
@@ -69,8 +72,10 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
     // Do boundary checking just to be safe.
     if (0 < clocks_per_tick)
       clocks_per_tick--;
-    if (0xffff < clocks_per_tick)
-      clocks_per_tick = 0xffff;
+    // The disciplining loop needs the tick length (OCRnA + 1) to fit in
+    // 16 bits, so stop one short of the counter's range.
+    if (0xfffe < clocks_per_tick)
+      clocks_per_tick = 0xfffe;
 
     // Configure Timer 1.
     // NOTE - For 16-bit registers, write high first, read low first.
@@ -90,6 +95,12 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
     TCCR1B = 0b01001;
     TIMSK1 = 0x02;
   }
+
+  // Reset RTC disciplining. This needs the tick length.
+  if (0 < rtc_hz)
+    Timer_InitSync_ISR((uint16_t) (clocks_per_tick + 1));
+  else
+    Timer_InitSync_ISR(0);
 }
 
 
@@ -100,15 +111,89 @@ void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
 
 ISR(TIMER1_COMPA_vect, ISR_BLOCK)
 {
+  uint16_t period;
+
+  SCOPE_RAISE(RTC);
+
   // This may overflow for very fast or very long running clocks.
   // That's tolerable.
   rtc_timestamp++;
 
+  // If the RTC is being disciplined, set the next tick's length.
+  // The counter has only just wrapped, so this is safely ahead of it.
+  // NOTE - For 16-bit registers, write high first.
+  if (rtc_sync_active)
+  {
+    period = Timer_GetSyncPeriod_ISR() - 1;
+    OCR1AH = (uint8_t) (period >> 8);
+    OCR1AL = (uint8_t) period;
+  }
+
   // This really, really has to return quickly.
   // Not just within one RTC tick - it has to return before _any_ other
   // interrupt-driven event would happen _twice_.
   if (NULL != rtc_usercallback)
     (*rtc_usercallback)();
+
+  SCOPE_LOWER(RTC);
+}
+
+
+
+// RTC sync capture hook.
+// This turns the input capture interrupt on or off and selects the
+// capture edge. The caller is responsible for any needed locking.
+
+void Timer_SetSyncCapture_ISR(bool enabled, bool rising_edge)
+{
+  // Turn off the capture interrupt while changing settings.
+  TIMSK1 &= ~(1 << ICIE1);
+
+  // Keep the GPIO bank off of the capture pin while we're using it.
+  IO_ReserveSyncPin(enabled);
+
+  if (enabled)
+  {
+    // ICP1 is B0. Make it an input, leaving the pull-up alone.
+    DDRB &= ~(1 << 0);
+
+    // The noise canceller adds a fixed 4-clock delay, which is the same on
+    // every board.
+    if (rising_edge)
+      TCCR1B |= (1 << ICNC1) | (1 << ICES1);
+    else
+      TCCR1B = (TCCR1B & ~(1 << ICES1)) | (1 << ICNC1);
+
+    // Changing the edge can set the capture flag. Clear it.
+    TIFR1 = (1 << ICF1);
+
+    TIMSK1 |= (1 << ICIE1);
+  }
+}
+
+
+
+// RTC sync input capture interrupt service routine.
+// This timestamps the sync edge and hands it to the disciplining loop.
+// NOTE - Capture has a higher priority than compare match, so if both are
+// pending, the capture is serviced first.
+
+ISR(TIMER1_CAPT_vect, ISR_BLOCK)
+{
+  uint16_t count;
+  uint32_t timestamp;
+
+  // NOTE - For 16-bit registers, read low first.
+  count = ICR1L;
+  count |= ((uint16_t) ICR1H) << 8;
+
+  // If a tick happened before the edge but hasn't been counted yet, the
+  // capture count is small and the compare flag is still set.
+  timestamp = rtc_timestamp;
+  if ( (TIFR1 & (1 << OCF1A)) && (count < (OCR1A >> 1)) )
+    timestamp++;
+
+  Timer_HandleSyncEdge_ISR(timestamp, count);
 }
 
 
@@ -149,9 +149,13 @@ ISR(USART_RX_vect, ISR_BLOCK)
 {
   uint8_t thischar;
 
+  SCOPE_RAISE(UART);
+
   thischar = UDR0;
 
   UART_HandleRecvChar_ISR(thischar);
+
+  SCOPE_LOWER(UART);
 }
 
 
@@ -165,6 +169,8 @@ ISR(USART_UDRE_vect, ISR_BLOCK)
 {
   char thischar;
 
+  SCOPE_RAISE(UART);
+
   thischar = 0;
 
   if (UART_GetNextSendChar_ISR(thischar))
@@ -178,6 +184,8 @@ ISR(USART_UDRE_vect, ISR_BLOCK)
     // Keep TX enabled but disable the UDRE interrupt.
     UCSR0B = UART_CSRB_TXIDLE;
   }
+
+  SCOPE_LOWER(UART);
 }
 
 
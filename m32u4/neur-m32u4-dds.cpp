@@ -0,0 +1,137 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega32U4 - Direct digital synthesis functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+//
+// Notes
+
+// We're using Timer 3 (16-bit) for the sample clock, in CTC mode.
+// PWM output uses Timer 0 (8-bit) in fast PWM mode with a /1 prescaler,
+// on OC0B (D0, Leonardo Dig3). This is also the TWI SCL pin, so PWM output
+// and TWI can't be used together.
+
+
+
+//
+// Functions
+
+
+// DDS timer initialization hook.
+// This configures the sample timer (with its interrupt off) and, if
+// requested, the PWM output. Returns the actual sample rate.
+// The caller is responsible for any needed locking.
+
+uint32_t DDS_InitTimers_ISR(uint32_t mcu_hz, uint32_t sample_hz,
+  bool use_pwm)
+{
+  uint32_t result;
+  uint32_t clocks_per_sample;
+  uint8_t clock_select;
+  uint8_t prescale_shift;
+  // Timer 3's prescaler steps are /1, /8, /64, /256, and /1024.
+  const uint8_t prescale_shifts[5] = { 0, 3, 6, 8, 10 };
+
+  // Sample timer.
+
+  TIMSK3 = 0;
+  TCCR3A = 0;
+  TCCR3B = (1 << WGM32);
+
+  // Pick the smallest prescaler that gives a count that fits in 16 bits.
+  // For CTC mode, f = cpuclk / (prescale * (1 + OCRnA)).
+  clock_select = 0;
+  do
+  {
+    prescale_shift = prescale_shifts[clock_select];
+    clock_select++;
+    clocks_per_sample = (mcu_hz >> prescale_shift) / sample_hz;
+  }
+  while ( (0x10000 < clocks_per_sample) && (5 > clock_select) );
+
+  if (1 > clocks_per_sample)
+    clocks_per_sample = 1;
+  if (0x10000 < clocks_per_sample)
+    clocks_per_sample = 0x10000;
+
+  result = mcu_hz / (clocks_per_sample << prescale_shift);
+
+  // NOTE - For 16-bit registers, write high first.
+  OCR3AH = (uint8_t) ((clocks_per_sample - 1) >> 8);
+  OCR3AL = (uint8_t) (clocks_per_sample - 1);
+  TCNT3H = 0;
+  TCNT3L = 0;
+  TCCR3B = (1 << WGM32) | clock_select;
+
+  // PWM output.
+
+  TCCR0A = (1 << WGM01);
+  TCCR0B = 0;
+
+  if (use_pwm)
+  {
+    // OC0B is D0.
+    DDRD |= (1 << 0);
+
+    OCR0B = 0x80;
+    TCNT0 = 0;
+
+    // Fast PWM (mode 3), non-inverting output on OC0B, /1 prescaler.
+    TCCR0A = (1 << COM0B1) | (1 << WGM01) | (1 << WGM00);
+    TCCR0B = (1 << CS00);
+  }
+
+  return result;
+}
+
+
+
+// DDS sample interrupt hook.
+// The caller is responsible for any needed locking.
+
+void DDS_SetSampleInterrupt_ISR(bool enabled)
+{
+  if (enabled)
+  {
+    // Clear any stale match and start the sample period from scratch.
+    TCNT3H = 0;
+    TCNT3L = 0;
+    TIFR3 = (1 << OCF3A);
+    TIMSK3 |= (1 << OCIE3A);
+  }
+  else
+    TIMSK3 &= ~(1 << OCIE3A);
+}
+
+
+
+// DDS PWM output hook.
+// The caller is responsible for any needed locking.
+
+void DDS_WritePWM_ISR(uint8_t value)
+{
+  OCR0B = value;
+}
+
+
+
+// DDS sample clock interrupt service routine.
+
+ISR(TIMER3_COMPA_vect, ISR_BLOCK)
+{
+  DDS_HandleSample_ISR();
+}
+
+
+
+//
+// This is the end of the file.
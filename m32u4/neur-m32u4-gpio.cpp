@@ -0,0 +1,289 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega32U4 - Digital GPIO functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// See "NOTES-pins" for pin mappings.
+
+// The 8-bit digital bank uses B4..B7 for GP0..GP3, C6..C7 for GP4..GP5,
+// and D6..D7 for GP6..GP7.
+// The 16-bit bank is not mapped.
+
+
+
+//
+// Macros
+
+
+// Pin use masks for ports that are only partly mapped to I/Os.
+// Unmapped bits are left alone. They stay high-Z inputs unless something
+// else (SPI, TWI, scope pins) has claimed them.
+// NOTE - Other bits on these ports may be changed from within ISRs, so
+// updates are locked read-modify-write operations.
+
+#define GPMASK_PORTB 0xf0
+#define GPMASK_PORTC 0xc0
+#define GPMASK_PORTD 0xc0
+
+
+
+//
+// Private Global Variables
+
+
+// Direction masks for the various ports.
+// Default to "all input", per MCU initialization.
+
+uint8_t dirmask_portb = 0x00;
+uint8_t dirmask_portc = 0x00;
+uint8_t dirmask_portd = 0x00;
+
+// Last values written to the various ports.
+// This is a combination of data for outputs and pullup state for inputs.
+uint8_t data_b = 0x00;
+uint8_t data_c = 0x00;
+uint8_t data_d = 0x00;
+
+// Last values written by the user.
+uint8_t lastval_8 = 0x00;
+
+
+
+//
+// Functions
+
+
+// 8-bit Digital GPIO functions.
+
+// Configures input and output GPIO lines. 1 = output, 0 = input.
+// NOTE - Pull-up state should be set immediately after this.
+
+void IO8_SelectOutputs(uint8_t output_mask)
+{
+  dirmask_portb = (output_mask & 0x0f) << 4;
+  dirmask_portc = (output_mask & 0x30) << 2;
+  dirmask_portd = output_mask & 0xc0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    DDRB = (DDRB & ~GPMASK_PORTB) | dirmask_portb;
+    DDRC = (DDRC & ~GPMASK_PORTC) | dirmask_portc;
+    DDRD = (DDRD & ~GPMASK_PORTD) | dirmask_portd;
+  }
+}
+
+
+// Asserts GPIO outputs. Only configured outputs are asserted.
+
+void IO8_WriteData(uint8_t output_data)
+{
+  uint8_t scratch_b, scratch_c, scratch_d;
+
+  lastval_8 = output_data;
+
+  scratch_b = (output_data & 0x0f) << 4;
+  scratch_c = (output_data & 0x30) << 2;
+  scratch_d = output_data & 0xc0;
+
+  // Keep bits that are outputs.
+
+  scratch_b &= dirmask_portb;
+  scratch_c &= dirmask_portc;
+  scratch_d &= dirmask_portd;
+
+  // Combine this with pull-up state.
+
+  data_b &= ~dirmask_portb;
+  data_b |= scratch_b;
+
+  data_c &= ~dirmask_portc;
+  data_c |= scratch_c;
+
+  data_d &= ~dirmask_portd;
+  data_d |= scratch_d;
+
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTB = (PORTB & ~GPMASK_PORTB) | data_b;
+    PORTC = (PORTC & ~GPMASK_PORTC) | data_c;
+    PORTD = (PORTD & ~GPMASK_PORTD) | data_d;
+  }
+}
+
+
+// Returns the last written value. This lets the user set/clear bits
+// without disturbing bits that are to remain the same.
+
+uint8_t IO8_GetOutputValue(void)
+{
+  return lastval_8;
+}
+
+
+// Enables pull-ups on selected GPIO lines. Only configured inputs have
+// pull-ups. 1 = pull-up, 0 = floating.
+
+void IO8_SetPullups(uint8_t pullup_mask)
+{
+  uint8_t scratch_b, scratch_c, scratch_d;
+
+  scratch_b = (pullup_mask & 0x0f) << 4;
+  scratch_c = (pullup_mask & 0x30) << 2;
+  scratch_d = pullup_mask & 0xc0;
+
+  // Keep bits that are _not_ outputs, but that are still mapped to GPIOs.
+
+  scratch_b &= ~dirmask_portb;
+  scratch_b &= GPMASK_PORTB;
+
+  scratch_c &= ~dirmask_portc;
+  scratch_c &= GPMASK_PORTC;
+
+  scratch_d &= ~dirmask_portd;
+  scratch_d &= GPMASK_PORTD;
+
+  // Combine this with output state.
+
+  data_b &= dirmask_portb;
+  data_b |= scratch_b;
+
+  data_c &= dirmask_portc;
+  data_c |= scratch_c;
+
+  data_d &= dirmask_portd;
+  data_d |= scratch_d;
+
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    PORTB = (PORTB & ~GPMASK_PORTB) | data_b;
+    PORTC = (PORTC & ~GPMASK_PORTC) | data_c;
+    PORTD = (PORTD & ~GPMASK_PORTD) | data_d;
+  }
+}
+
+
+// Reads from GPIO inputs. Pins configured as outputs read as 0.
+
+uint8_t IO8_ReadData(void)
+{
+  uint8_t scratch_b, scratch_c, scratch_d;
+
+  scratch_b = PINB;
+  scratch_c = PINC;
+  scratch_d = PIND;
+
+  // Keep bits that are _not_ outputs, but that are still mapped to GPIOs.
+
+  scratch_b &= ~dirmask_portb;
+  scratch_b &= GPMASK_PORTB;
+
+  scratch_c &= ~dirmask_portc;
+  scratch_c &= GPMASK_PORTC;
+
+  scratch_d &= ~dirmask_portd;
+  scratch_d &= GPMASK_PORTD;
+
+  // Map port bits to data bits.
+
+  scratch_b >>= 4;
+  scratch_b &= 0x0f;
+
+  scratch_c >>= 2;
+  scratch_c &= 0x30;
+
+  scratch_d &= 0xc0;
+
+  return scratch_b | scratch_c | scratch_d;
+}
+
+
+
+// Private GPIO functions.
+
+// This tells the GPIO bank to leave the SPI pins alone (or to reclaim them).
+// The SPI pins (B0..B3) aren't mapped to GPIO lines, so there's nothing to
+// do.
+
+void IO8_ReserveSPIPins(bool reserved)
+{
+  // Nothing to do.
+}
+
+
+// This tells the GPIO banks to leave the RTC sync capture pin alone (or to
+// reclaim it). The capture pin (D4) isn't mapped to a GPIO line, so there's
+// nothing to do.
+
+void IO_ReserveSyncPin(bool reserved)
+{
+  // Nothing to do.
+}
+
+
+
+// 16-bit Digital GPIO functions.
+
+// Configures input and output GPIO lines. 1 = output, 0 = input.
+// NOTE - Pull-up state should be set immediately after this.
+
+void IO16_SelectOutputs(uint16_t output_mask)
+{
+  // Not mapped; nothing to do.
+}
+
+
+// Asserts GPIO outputs. Only configured outputs are asserted.
+
+void IO16_WriteData(uint16_t output_data)
+{
+  // Not mapped; nothing to do.
+}
+
+
+// Returns the last written value. This lets the user set/clear bits
+// without disturbing bits that are to remain the same.
+
+uint16_t IO16_GetOutputValue(void)
+{
+  // Not mapped; nothing to do.
+  return 0;
+}
+
+
+// Enables pull-ups on selected GPIO lines. Only configured inputs have
+// pull-ups. 1 = pull-up, 0 = floating.
+
+void IO16_SetPullups(uint16_t pullup_mask)
+{
+  // Not mapped; nothing to do.
+}
+
+
+// Reads from GPIO inputs. Pins configured as outputs read as 0.
+
+uint16_t IO16_ReadData(void)
+{
+  // Not mapped; nothing to do.
+
+  return 0;
+}
+
+
+
+//
+// This is the end of the file.
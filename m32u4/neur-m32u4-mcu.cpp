@@ -0,0 +1,115 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega32U4 - MCU initialization functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+//
+// Notes
+
+// The ATmega32U4 has four timers: Timer 0 (8-bit), Timer 1 (16-bit),
+// Timer 3 (16-bit), and Timer 4 (10-bit high-speed).
+// We're using Timer 1 for the RTC.
+
+// The ATmega32U4 has one hardware UART (UART 1), but our primary "UART" is
+// the native USB CDC serial port. UART 1 isn't used.
+
+
+
+//
+// Functions
+
+
+// MCU initialization routine.
+// Initializes the MCU to a known-good state.
+
+void MCU_Init(void)
+{
+  uint8_t reset_flags;
+
+  // Make very sure interrupts are off during initialization, and turned
+  // on afterwards.
+  // This is more robust than cli() alone.
+  ATOMIC_BLOCK(ATOMIC_FORCEON)
+  {
+    // Note why we reset, and clear the flags for next time.
+    // The watchdog stays on after a watchdog reset, so turn it off before
+    // it fires again. This is a timed sequence; WDRF has to be clear first.
+    reset_flags = MCUSR;
+    MCUSR = 0;
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = 0;
+
+    // Initialize I/O pins.
+    // Pull-ups enabled globally, all pins high-Z inputs locally.
+
+    // Clear Pull-Up Disable, enabling pull-ups.
+    // Also set JTAG Disable, so that F4..F7 (ADC4..7) are usable even if
+    // the JTAG fuse is programmed. JTD has to be written twice within four
+    // cycles to take effect.
+    // We can ignore IVSEL and IVCE; they only change when a specific
+    // song and dance are performed.
+    MCUCR = (1 << JTD);
+    MCUCR = (1 << JTD);
+
+    // Set everything to high-Z input.
+
+    DDRB = 0x00;
+    DDRC = 0x00;
+    DDRD = 0x00;
+    DDRE = 0x00;
+    DDRF = 0x00;
+
+    PORTB = 0x00;
+    PORTC = 0x00;
+    PORTD = 0x00;
+    PORTE = 0x00;
+    PORTF = 0x00;
+
+    // Scope pins, if enabled, are outputs driven low.
+    SCOPE_INIT(RTC);
+    SCOPE_INIT(UART);
+    SCOPE_INIT(ADC);
+    SCOPE_INIT(APP);
+    SCOPE_INIT(POLL);
+
+
+    // Initialize peripherals.
+
+    // FIXME - Relying on mcu_hz not mattering if we're disabling a device.
+    // This may change!
+
+    // Disable all timers.
+    Timer_Init(0, 0);
+
+    // Disable the USB serial port.
+    // This also detaches from the bus, if a bootloader left us attached.
+    UART_Init(0, 0);
+
+    // Disable SPI.
+    SPI_Init(0, 0, 0);
+
+    // Disable TWI.
+    TWI_Init(0, 0);
+
+    // Disable the ADC.
+    // FIXME - ADC NYI.
+
+    // Start the flight recorder. This records the reset.
+    FLIGHT_Init_ISR(reset_flags);
+  }
+
+  // ATOMIC_FORCEON means interrupts are enabled by this point.
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,210 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega32U4 - Timer functions.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+//
+// Notes
+
+// The ATmega32U4 has four timers: Timer 0 (8-bit), Timer 1 (16-bit),
+// Timer 3 (16-bit), and Timer 4 (10-bit high-speed).
+// We're using Timer 1 for the RTC.
+// The RTC can be disciplined to a sync pulse on ICP1 (D4, Leonardo Dig4).
+// D4 isn't mapped to a GPIO line or a scope pin.
+
+
+
+//
+// Functions
+
+
+// RTC intialization routine.
+// Unhooks all timers and initializes the RTC timer.
+// An RTC rate of 0 disables the RTC.
+
+void Timer_Init(uint32_t mcu_hz, uint32_t rtc_hz)
+{
+  uint32_t clocks_per_tick;
+  uint32_t scratch;
+
+  // First, disable all timer interrupts.
+  TIMSK0 = 0;
+  TIMSK1 = 0;
+  TIMSK3 = 0;
+  TIMSK4 = 0;
+
+  // We can now alter timer settings without further locking.
+
+  // Set all timers to inactive, CTC mode.
+
+  TCCR0A = 0x02;
+  TCCR0B = 0x00;
+
+  TCCR1A = 0x00;
+  TCCR1B = 0b01000;
+  TCCR1C = 0x00; // Probably not needed, but writing 0 is still ok.
+
+  TCCR3A = 0x00;
+  TCCR3B = 0b01000;
+  TCCR3C = 0x00;
+
+  // Timer 4 has no CTC mode as such; it counts up to OCR4C. Clearing the
+  // clock select bits stops it.
+  TCCR4A = 0x00;
+  TCCR4B = 0x00;
+  TCCR4C = 0x00;
+  TCCR4D = 0x00;
+  TCCR4E = 0x00;
+
+  // Initialize the timestamp and reset the callback.
+  rtc_timestamp = 0;
+  rtc_usercallback = NULL;
+
+
+  // Initialize our timer if we've been given a nonzero rate.
+  if (0 < rtc_hz)
+  {
+    // Figure out what Timer 1's ceiling should be.
+    // NOTE - We're forcing a /1 divisor, which constrains range.
+    clocks_per_tick = mcu_hz / rtc_hz;
+    // For a /1 prescaler, f = cpuclk / (1 + OCRnA).
+    // So, OCRnA = (cpuclk / f) - 1.
+    // Do boundary checking just to be safe.
+    if (0 < clocks_per_tick)
+      clocks_per_tick--;
+    // The disciplining loop needs the tick length (OCRnA + 1) to fit in
+    // 16 bits, so stop one short of the counter's range.
+    if (0xfffe < clocks_per_tick)
+      clocks_per_tick = 0xfffe;
+
+    // Configure Timer 1.
+    // NOTE - For 16-bit registers, write high first, read low first.
+    // NOTE - Type coercion has to be done carefully here.
+    // Otherwise we can get truncation before we want it.
+
+    scratch = (clocks_per_tick >> 8) & 0xff;
+    OCR1AH = (uint8_t) scratch;
+    scratch = clocks_per_tick & 0xff;
+    OCR1AL = (uint8_t) scratch;
+
+    // Reset the counter value, to be safe.
+    TCNT1H = 0x00;
+    TCNT1L = 0x00;
+
+    // Enable the timer with a /1 divisor.
+    TCCR1B = 0b01001;
+    TIMSK1 = 0x02;
+  }
+
+  // Reset RTC disciplining. This needs the tick length.
+  if (0 < rtc_hz)
+    Timer_InitSync_ISR((uint16_t) (clocks_per_tick + 1));
+  else
+    Timer_InitSync_ISR(0);
+}
+
+
+
+// RTC Interrupt service routine.
+// This updates the RTC timestamp, and optionally calls a user-provided
+// function.
+
+ISR(TIMER1_COMPA_vect, ISR_BLOCK)
+{
+  uint16_t period;
+
+  SCOPE_RAISE(RTC);
+
+  // This may overflow for very fast or very long running clocks.
+  // That's tolerable.
+  rtc_timestamp++;
+
+  // If the RTC is being disciplined, set the next tick's length.
+  // The counter has only just wrapped, so this is safely ahead of it.
+  // NOTE - For 16-bit registers, write high first.
+  if (rtc_sync_active)
+  {
+    period = Timer_GetSyncPeriod_ISR() - 1;
+    OCR1AH = (uint8_t) (period >> 8);
+    OCR1AL = (uint8_t) period;
+  }
+
+  // This really, really has to return quickly.
+  // Not just within one RTC tick - it has to return before _any_ other
+  // interrupt-driven event would happen _twice_.
+  if (NULL != rtc_usercallback)
+    (*rtc_usercallback)();
+
+  SCOPE_LOWER(RTC);
+}
+
+
+
+// RTC sync capture hook.
+// This turns the input capture interrupt on or off and selects the
+// capture edge. The caller is responsible for any needed locking.
+
+void Timer_SetSyncCapture_ISR(bool enabled, bool rising_edge)
+{
+  // Turn off the capture interrupt while changing settings.
+  TIMSK1 &= ~(1 << ICIE1);
+
+  // Keep the GPIO bank off of the capture pin while we're using it.
+  IO_ReserveSyncPin(enabled);
+
+  if (enabled)
+  {
+    // ICP1 is D4. Make it an input, leaving the pull-up alone.
+    DDRD &= ~(1 << 4);
+
+    // The noise canceller adds a fixed 4-clock delay, which is the same on
+    // every board.
+    if (rising_edge)
+      TCCR1B |= (1 << ICNC1) | (1 << ICES1);
+    else
+      TCCR1B = (TCCR1B & ~(1 << ICES1)) | (1 << ICNC1);
+
+    // Changing the edge can set the capture flag. Clear it.
+    TIFR1 = (1 << ICF1);
+
+    TIMSK1 |= (1 << ICIE1);
+  }
+}
+
+
+
+// RTC sync input capture interrupt service routine.
+// This timestamps the sync edge and hands it to the disciplining loop.
+// NOTE - Capture has a higher priority than compare match, so if both are
+// pending, the capture is serviced first.
+
+ISR(TIMER1_CAPT_vect, ISR_BLOCK)
+{
+  uint16_t count;
+  uint32_t timestamp;
+
+  // NOTE - For 16-bit registers, read low first.
+  count = ICR1L;
+  count |= ((uint16_t) ICR1H) << 8;
+
+  // If a tick happened before the edge but hasn't been counted yet, the
+  // capture count is small and the compare flag is still set.
+  timestamp = rtc_timestamp;
+  if ( (TIFR1 & (1 << OCF1A)) && (count < (OCR1A >> 1)) )
+    timestamp++;
+
+  Timer_HandleSyncEdge_ISR(timestamp, count);
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,735 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega32U4 - UART functions (USB CDC serial port).
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+
+
+
+//
+// Notes
+
+// The primary "UART" on the 32U4 is the native USB port, enumerating as a
+// CDC ACM serial device. The host's baud rate setting is accepted and
+// reported, but has no effect; data moves at USB full-speed bulk rates.
+
+// Endpoints:
+// - EP0 is the control endpoint (64 bytes).
+// - EP2 is the CDC notification endpoint (interrupt IN). Nothing is ever
+// sent on it, but the ACM descriptors require it.
+// - EP3 is bulk OUT (host to device), 64 bytes, double-banked.
+// - EP4 is bulk IN (device to host), 64 bytes, double-banked.
+// With two banks, one packet can be in flight over the bus while the
+// other is being filled or drained by the ISR.
+
+// Received packets are fed a character at a time to
+// UART_HandleRecvChar_ISR(), exactly as the hardware UART ISR does. As with
+// a hardware UART, input is dropped if the line buffers are full; the host
+// doesn't get backpressure.
+
+// Transmission is driven by the bulk IN "bank free" interrupt, which pulls
+// up to 64 characters per packet from UART_GetNextSendChar_ISR(). A
+// transmission ending on a full packet is followed by a zero-length packet
+// so that the host sees the end of the transfer.
+// If the host hasn't configured the device or hasn't asserted DTR (no
+// terminal program has the port open), output is discarded rather than
+// left waiting; otherwise UART_QueueSend() would block forever.
+
+// Control requests are handled entirely within the USB ISR. The data and
+// status stages busy-wait, but they only take a frame or two and only
+// happen during enumeration and port setup.
+
+// The USB clock comes from the PLL, which needs an 8 MHz or 16 MHz system
+// clock (selected by mcu_hz).
+
+
+
+//
+// Macros
+
+
+// Endpoint assignments and sizes.
+
+#define USB_EP0_SIZE 64
+
+#define CDC_NOTIFY_EP 2
+#define CDC_NOTIFY_SIZE 16
+#define CDC_RX_EP 3
+#define CDC_TX_EP 4
+#define CDC_DATA_SIZE 64
+
+
+// Endpoint configuration register values.
+// UECFG0X: type in bits 7:6 (00 control, 10 bulk, 11 interrupt), and
+// direction in bit 0 (1 = IN).
+// UECFG1X: size in bits 6:4 (000 = 8 bytes .. 011 = 64 bytes), banks in
+// bits 3:2 (00 single, 01 double), and ALLOC in bit 1.
+
+#define UECFG0_CONTROL 0x00
+#define UECFG0_BULK_OUT 0x80
+#define UECFG0_BULK_IN 0x81
+#define UECFG0_INTERRUPT_IN 0xc1
+
+#define UECFG1_64_SINGLE 0x32
+#define UECFG1_64_DOUBLE 0x36
+#define UECFG1_16_SINGLE 0x12
+
+
+// PLL configuration. PINDIV divides the input clock by 2 for 16 MHz.
+#define PLLCSR_8MHZ (1 << PLLE)
+#define PLLCSR_16MHZ ((1 << PINDIV) | (1 << PLLE))
+
+
+// Standard requests.
+#define USB_REQ_GET_STATUS 0
+#define USB_REQ_CLEAR_FEATURE 1
+#define USB_REQ_SET_FEATURE 3
+#define USB_REQ_SET_ADDRESS 5
+#define USB_REQ_GET_DESCRIPTOR 6
+#define USB_REQ_GET_CONFIGURATION 8
+#define USB_REQ_SET_CONFIGURATION 9
+
+// CDC class requests.
+#define CDC_REQ_SET_LINE_CODING 0x20
+#define CDC_REQ_GET_LINE_CODING 0x21
+#define CDC_REQ_SET_CONTROL_LINE_STATE 0x22
+
+// Request types (bmRequestType).
+#define USB_RTYPE_DEVICE_OUT 0x00
+#define USB_RTYPE_DEVICE_IN 0x80
+#define USB_RTYPE_ENDPOINT_OUT 0x02
+#define USB_RTYPE_CLASS_OUT 0x21
+#define USB_RTYPE_CLASS_IN 0xa1
+
+// Descriptor types.
+#define USB_DESC_DEVICE 1
+#define USB_DESC_CONFIGURATION 2
+#define USB_DESC_STRING 3
+
+// Control line state bits.
+#define CDC_LINE_DTR 0x01
+
+// Line coding structure size.
+#define CDC_LINE_CODING_BYTES 7
+
+
+
+//
+// Descriptors
+
+// NOTE - These are stored in flash and sent a byte at a time.
+
+const uint8_t usb_desc_device[] PROGMEM =
+{
+  18,                   // bLength
+  USB_DESC_DEVICE,      // bDescriptorType
+  0x00, 0x02,           // bcdUSB (2.0)
+  2,                    // bDeviceClass (CDC)
+  0,                    // bDeviceSubClass
+  0,                    // bDeviceProtocol
+  USB_EP0_SIZE,         // bMaxPacketSize0
+  (USB_VENDOR_ID & 0xff), (USB_VENDOR_ID >> 8),
+  (USB_PRODUCT_ID & 0xff), (USB_PRODUCT_ID >> 8),
+  0x00, 0x01,           // bcdDevice (1.00)
+  1,                    // iManufacturer
+  2,                    // iProduct
+  0,                    // iSerialNumber
+  1                     // bNumConfigurations
+};
+
+#define USB_CONFIG_BYTES 67
+
+const uint8_t usb_desc_config[] PROGMEM =
+{
+  // Configuration.
+  9, USB_DESC_CONFIGURATION,
+  USB_CONFIG_BYTES, 0,  // wTotalLength
+  2,                    // bNumInterfaces
+  1,                    // bConfigurationValue
+  0,                    // iConfiguration
+  0x80,                 // bmAttributes (bus powered)
+  50,                   // bMaxPower (100 mA)
+
+  // Interface 0: CDC communication (ACM, AT commands).
+  9, 4, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+
+  // CDC header functional descriptor (CDC 1.10).
+  5, 0x24, 0x00, 0x10, 0x01,
+  // Call management: no call management, data interface 1.
+  5, 0x24, 0x01, 0x00, 1,
+  // ACM: supports line coding and break.
+  4, 0x24, 0x02, 0x06,
+  // Union: master interface 0, slave interface 1.
+  5, 0x24, 0x06, 0, 1,
+
+  // Notification endpoint (interrupt IN).
+  7, 5, 0x80 | CDC_NOTIFY_EP, 0x03, CDC_NOTIFY_SIZE, 0, 64,
+
+  // Interface 1: CDC data.
+  9, 4, 1, 0, 2, 0x0a, 0x00, 0x00, 0,
+
+  // Bulk OUT.
+  7, 5, CDC_RX_EP, 0x02, CDC_DATA_SIZE, 0, 0,
+  // Bulk IN.
+  7, 5, 0x80 | CDC_TX_EP, 0x02, CDC_DATA_SIZE, 0, 0
+};
+
+// String descriptors are UTF-16LE.
+
+const uint8_t usb_desc_string0[] PROGMEM =
+{
+  4, USB_DESC_STRING, 0x09, 0x04  // US English
+};
+
+const uint8_t usb_desc_string1[] PROGMEM =
+{
+  16, USB_DESC_STRING,
+  'A', 0, 'C', 0, 'C', 0, ' ', 0, 'L', 0, 'a', 0, 'b', 0
+};
+
+const uint8_t usb_desc_string2[] PROGMEM =
+{
+  16, USB_DESC_STRING,
+  'N', 0, 'e', 0, 'u', 0, 'r', 0, 'A', 0, 'V', 0, 'R', 0
+};
+
+
+
+//
+// Variables
+
+// Baud rate reported to the host (as if it were real).
+uint32_t real_baud_rate = 0;
+
+// Current configuration (0 until the host configures us).
+volatile uint8_t usb_configuration = 0;
+
+// Control line state (DTR, RTS) from the host.
+volatile uint8_t cdc_line_state = 0;
+
+// Line coding from the host: baud (32-bit LE), stop bits, parity, bits.
+uint8_t cdc_line_coding[CDC_LINE_CODING_BYTES] =
+  { 0x00, 0xe1, 0x00, 0x00, 0, 0, 8 };
+
+// Whether the last packet sent was full, needing a zero-length packet if
+// nothing follows it.
+bool usb_tx_need_zlp = false;
+
+
+
+//
+// Functions
+
+
+// Private USB functions.
+
+
+// Control endpoint handshaking. EP0 must be selected.
+
+void USB_WaitInReady_ISR(void)
+{
+  while (!(UEINTX & (1 << TXINI)))
+    ;
+}
+
+
+void USB_SendIn_ISR(void)
+{
+  UEINTX = ~(1 << TXINI);
+}
+
+
+void USB_WaitReceiveOut_ISR(void)
+{
+  while (!(UEINTX & (1 << RXOUTI)))
+    ;
+}
+
+
+void USB_AckOut_ISR(void)
+{
+  UEINTX = ~(1 << RXOUTI);
+}
+
+
+// This stalls the current control request.
+
+void USB_Stall_ISR(void)
+{
+  UECONX = (1 << STALLRQ) | (1 << EPEN);
+}
+
+
+// This sends a flash-stored descriptor in response to GET_DESCRIPTOR,
+// truncated to the host's requested length.
+
+void USB_SendDescriptor_ISR(const uint8_t *desc, uint16_t desc_len,
+  uint16_t req_len)
+{
+  uint8_t status;
+  uint8_t packet_len, bidx;
+  bool done;
+
+  if (desc_len > req_len)
+    desc_len = req_len;
+
+  done = false;
+
+  while (!done)
+  {
+    // Wait for the bank to free up, or for the host to end the data stage
+    // early (status stage OUT).
+    do
+    {
+      status = UEINTX;
+    }
+    while (!(status & ((1 << TXINI) | (1 << RXOUTI))));
+
+    if (status & (1 << RXOUTI))
+      done = true;
+    else
+    {
+      packet_len = (desc_len < USB_EP0_SIZE) ? desc_len : USB_EP0_SIZE;
+
+      for (bidx = 0; bidx < packet_len; bidx++)
+      {
+        UEDATX = pgm_read_byte_near(desc);
+        desc++;
+      }
+
+      desc_len -= packet_len;
+
+      USB_SendIn_ISR();
+
+      // A full last packet needs a zero-length packet after it.
+      if ( (0 == desc_len) && (USB_EP0_SIZE != packet_len) )
+        done = true;
+    }
+  }
+}
+
+
+// This sets up the CDC endpoints after SET_CONFIGURATION.
+// The caller is responsible for any needed locking.
+
+void USB_ConfigureEndpoints_ISR(void)
+{
+  UENUM = CDC_NOTIFY_EP;
+  UECONX = (1 << EPEN);
+  UECFG0X = UECFG0_INTERRUPT_IN;
+  UECFG1X = UECFG1_16_SINGLE;
+
+  UENUM = CDC_RX_EP;
+  UECONX = (1 << EPEN);
+  UECFG0X = UECFG0_BULK_OUT;
+  UECFG1X = UECFG1_64_DOUBLE;
+  UEIENX = (1 << RXOUTE);
+
+  UENUM = CDC_TX_EP;
+  UECONX = (1 << EPEN);
+  UECFG0X = UECFG0_BULK_IN;
+  UECFG1X = UECFG1_64_DOUBLE;
+  // TXINE is turned on when there's something to send.
+  UEIENX = 0;
+
+  // Reset the endpoint FIFOs and data toggles.
+  UERST = (1 << CDC_NOTIFY_EP) | (1 << CDC_RX_EP) | (1 << CDC_TX_EP);
+  UERST = 0;
+
+  usb_tx_need_zlp = false;
+}
+
+
+// This throws away anything queued for transmission. It's used when
+// nobody is listening on the host side.
+// The caller is responsible for any needed locking.
+
+void USB_DiscardSend_ISR(void)
+{
+  char thischar;
+
+  while (UART_GetNextSendChar_ISR(thischar))
+    ;
+}
+
+
+// This returns true if the host is configured and listening.
+
+bool USB_IsHostListening_ISR(void)
+{
+  return (0 != usb_configuration) && (cdc_line_state & CDC_LINE_DTR);
+}
+
+
+// This handles a SETUP packet on EP0. EP0 must be selected.
+
+void USB_HandleSetup_ISR(void)
+{
+  uint8_t request_type, request;
+  uint16_t value, index, length;
+  uint8_t bidx;
+  uint8_t scratch;
+
+  // NOTE - Read these one at a time; evaluation order within an expression
+  // isn't defined.
+  request_type = UEDATX;
+  request = UEDATX;
+  value = UEDATX;
+  scratch = UEDATX;
+  value |= ((uint16_t) scratch) << 8;
+  index = UEDATX;
+  scratch = UEDATX;
+  index |= ((uint16_t) scratch) << 8;
+  length = UEDATX;
+  scratch = UEDATX;
+  length |= ((uint16_t) scratch) << 8;
+
+  // Acknowledge the SETUP packet, and clear any stale flags.
+  UEINTX = ~((1 << RXSTPI) | (1 << RXOUTI) | (1 << TXINI));
+
+  if (USB_REQ_GET_DESCRIPTOR == request)
+  {
+    scratch = value >> 8;
+    value &= 0xff;
+
+    if (USB_DESC_DEVICE == scratch)
+      USB_SendDescriptor_ISR(usb_desc_device, sizeof(usb_desc_device),
+        length);
+    else if (USB_DESC_CONFIGURATION == scratch)
+      USB_SendDescriptor_ISR(usb_desc_config, sizeof(usb_desc_config),
+        length);
+    else if ( (USB_DESC_STRING == scratch) && (0 == value) )
+      USB_SendDescriptor_ISR(usb_desc_string0, sizeof(usb_desc_string0),
+        length);
+    else if ( (USB_DESC_STRING == scratch) && (1 == value) )
+      USB_SendDescriptor_ISR(usb_desc_string1, sizeof(usb_desc_string1),
+        length);
+    else if ( (USB_DESC_STRING == scratch) && (2 == value) )
+      USB_SendDescriptor_ISR(usb_desc_string2, sizeof(usb_desc_string2),
+        length);
+    else
+      USB_Stall_ISR();
+  }
+  else if (USB_REQ_SET_ADDRESS == request)
+  {
+    // The new address takes effect after the status stage.
+    USB_SendIn_ISR();
+    USB_WaitInReady_ISR();
+    UDADDR = (value & 0x7f) | (1 << ADDEN);
+  }
+  else if ( (USB_REQ_SET_CONFIGURATION == request)
+    && (USB_RTYPE_DEVICE_OUT == request_type) )
+  {
+    usb_configuration = value & 0xff;
+    cdc_line_state = 0;
+
+    USB_SendIn_ISR();
+
+    if (0 != usb_configuration)
+      USB_ConfigureEndpoints_ISR();
+  }
+  else if ( (USB_REQ_GET_CONFIGURATION == request)
+    && (USB_RTYPE_DEVICE_IN == request_type) )
+  {
+    USB_WaitInReady_ISR();
+    UEDATX = usb_configuration;
+    USB_SendIn_ISR();
+  }
+  else if (USB_REQ_GET_STATUS == request)
+  {
+    // Not self-powered, no remote wakeup, no halted endpoints.
+    USB_WaitInReady_ISR();
+    UEDATX = 0;
+    UEDATX = 0;
+    USB_SendIn_ISR();
+  }
+  else if ( ( (USB_REQ_CLEAR_FEATURE == request)
+      || (USB_REQ_SET_FEATURE == request) )
+    && (USB_RTYPE_ENDPOINT_OUT == request_type) && (0 == value) )
+  {
+    // ENDPOINT_HALT on one of the CDC endpoints.
+    scratch = index & 0x7f;
+    if ( (CDC_NOTIFY_EP <= scratch) && (CDC_TX_EP >= scratch) )
+    {
+      USB_SendIn_ISR();
+
+      UENUM = scratch;
+      if (USB_REQ_SET_FEATURE == request)
+        UECONX = (1 << STALLRQ) | (1 << EPEN);
+      else
+      {
+        UECONX = (1 << STALLRQC) | (1 << RSTDT) | (1 << EPEN);
+        UERST = (1 << scratch);
+        UERST = 0;
+      }
+      UENUM = 0;
+    }
+    else
+      USB_Stall_ISR();
+  }
+  else if ( (CDC_REQ_SET_LINE_CODING == request)
+    && (USB_RTYPE_CLASS_OUT == request_type) )
+  {
+    USB_WaitReceiveOut_ISR();
+    for (bidx = 0; bidx < CDC_LINE_CODING_BYTES; bidx++)
+      cdc_line_coding[bidx] = UEDATX;
+    USB_AckOut_ISR();
+    USB_SendIn_ISR();
+
+    real_baud_rate = cdc_line_coding[3];
+    real_baud_rate = (real_baud_rate << 8) | cdc_line_coding[2];
+    real_baud_rate = (real_baud_rate << 8) | cdc_line_coding[1];
+    real_baud_rate = (real_baud_rate << 8) | cdc_line_coding[0];
+  }
+  else if ( (CDC_REQ_GET_LINE_CODING == request)
+    && (USB_RTYPE_CLASS_IN == request_type) )
+  {
+    USB_WaitInReady_ISR();
+    for (bidx = 0; bidx < CDC_LINE_CODING_BYTES; bidx++)
+      UEDATX = cdc_line_coding[bidx];
+    USB_SendIn_ISR();
+  }
+  else if ( (CDC_REQ_SET_CONTROL_LINE_STATE == request)
+    && (USB_RTYPE_CLASS_OUT == request_type) )
+  {
+    cdc_line_state = value & 0xff;
+
+    USB_WaitInReady_ISR();
+    USB_SendIn_ISR();
+  }
+  else
+    USB_Stall_ISR();
+}
+
+
+// This drains one received packet into the UART line buffers.
+// The bulk OUT endpoint must be selected.
+
+void USB_HandleRecv_ISR(void)
+{
+  uint8_t count;
+
+  count = UEBCLX;
+
+  while (0 < count)
+  {
+    UART_HandleRecvChar_ISR(UEDATX);
+    count--;
+  }
+
+  // Release the bank. With double-banking, the other bank may already
+  // hold the next packet, in which case RXOUTI is set again immediately.
+  UEINTX &= ~((1 << RXOUTI) | (1 << FIFOCON));
+}
+
+
+// This fills and sends one packet from the transmit buffer, or turns off
+// the bank-free interrupt if there's nothing to send.
+// The bulk IN endpoint must be selected.
+
+void USB_HandleSend_ISR(void)
+{
+  uint8_t count;
+  char thischar;
+
+  if (!USB_IsHostListening_ISR())
+  {
+    USB_DiscardSend_ISR();
+    usb_tx_need_zlp = false;
+    UEIENX &= ~(1 << TXINE);
+  }
+  else
+  {
+    count = 0;
+    while ( (CDC_DATA_SIZE > count) && UART_GetNextSendChar_ISR(thischar) )
+    {
+      UEDATX = thischar;
+      count++;
+    }
+
+    if ( (0 < count) || usb_tx_need_zlp )
+    {
+      // Hand the bank to the hardware.
+      UEINTX &= ~((1 << TXINI) | (1 << FIFOCON));
+      usb_tx_need_zlp = (CDC_DATA_SIZE == count);
+    }
+    else
+    {
+      // Nothing more to send.
+      UEIENX &= ~(1 << TXINE);
+    }
+  }
+}
+
+
+// Public UART functions.
+
+
+// Configures the primary UART for the specified baud rate.
+// A baud rate of 0 turns it off.
+// On the 32U4 this attaches to or detaches from the USB bus. The baud rate
+// is only what's reported until the host sets its own.
+
+void UART_Init(uint32_t mcu_hz, uint32_t baud_rate)
+{
+  uint32_t scratch;
+  uint8_t bidx;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // Detach and turn off the USB controller and its clock.
+    UDIEN = 0;
+    UDCON = (1 << DETACH);
+    USBCON = (1 << FRZCLK);
+    PLLCSR = 0;
+    UHWCON = 0;
+
+    usb_configuration = 0;
+    cdc_line_state = 0;
+    usb_tx_need_zlp = false;
+
+    real_baud_rate = 0;
+
+    if (0 != baud_rate)
+    {
+      real_baud_rate = baud_rate;
+
+      scratch = baud_rate;
+      for (bidx = 0; bidx < 4; bidx++)
+      {
+        cdc_line_coding[bidx] = (uint8_t) (scratch & 0xff);
+        scratch >>= 8;
+      }
+
+      // Reinitialize buffers.
+      UART_InitBuffers_ISR();
+
+      // Enable the pad regulator and the controller, with the clock frozen.
+      UHWCON = (1 << UVREGE);
+      USBCON = (1 << USBE) | (1 << FRZCLK);
+
+      // Start the PLL and wait for lock (about 100 us).
+      PLLCSR = (8000000ul < mcu_hz) ? PLLCSR_16MHZ : PLLCSR_8MHZ;
+      while (!(PLLCSR & (1 << PLOCK)))
+        ;
+
+      // Unfreeze the clock, enable the VBUS pad, and attach at full speed.
+      USBCON = (1 << USBE) | (1 << OTGPADE);
+      UDCON = 0;
+
+      // The host resets the bus after it sees us attach.
+      UDIEN = (1 << EORSTE);
+    }
+  }
+}
+
+
+
+// Returns the actual baud rate set, or 0 if the UART is off.
+// For USB this is the rate the host asked for (or the one passed to
+// UART_Init()).
+
+uint32_t UART_QueryBaud(void)
+{
+  return real_baud_rate;
+}
+
+
+
+// This is a transmission-start hook called after a string is queued.
+// It re-enables need-character interrupts if they aren't aready enabled.
+// The caller is responsible for any needed locking.
+
+void UART_EnableTransmit_ISR(void)
+{
+  uint8_t saved_endpoint;
+
+  if (USB_IsHostListening_ISR())
+  {
+    // The USB ISRs expect endpoint selection to be preserved.
+    saved_endpoint = UENUM;
+
+    UENUM = CDC_TX_EP;
+    UEIENX |= (1 << TXINE);
+
+    UENUM = saved_endpoint;
+  }
+  else
+    USB_DiscardSend_ISR();
+}
+
+
+
+// General USB interrupt service routine.
+// We only care about bus reset, which puts us back in the default state.
+
+ISR(USB_GEN_vect, ISR_BLOCK)
+{
+  uint8_t int_flags;
+
+  SCOPE_RAISE(UART);
+
+  int_flags = UDINT;
+  // Writing 0 clears flags; writing 1 leaves them alone.
+  UDINT = ~int_flags;
+
+  if (int_flags & (1 << EORSTI))
+  {
+    UENUM = 0;
+    UECONX = (1 << EPEN);
+    UECFG0X = UECFG0_CONTROL;
+    UECFG1X = UECFG1_64_SINGLE;
+    UEIENX = (1 << RXSTPE);
+
+    usb_configuration = 0;
+    cdc_line_state = 0;
+  }
+
+  SCOPE_LOWER(UART);
+}
+
+
+
+// Endpoint interrupt service routine.
+// This handles control requests, received packets, and transmit-bank-free
+// events.
+
+ISR(USB_COM_vect, ISR_BLOCK)
+{
+  uint8_t saved_endpoint;
+
+  SCOPE_RAISE(UART);
+
+  saved_endpoint = UENUM;
+
+  UENUM = 0;
+  if (UEINTX & (1 << RXSTPI))
+    USB_HandleSetup_ISR();
+
+  if (0 != usb_configuration)
+  {
+    UENUM = CDC_RX_EP;
+    if (UEINTX & (1 << RXOUTI))
+      USB_HandleRecv_ISR();
+
+    UENUM = CDC_TX_EP;
+    if ( (UEIENX & (1 << TXINE)) && (UEINTX & (1 << TXINI)) )
+      USB_HandleSend_ISR();
+  }
+
+  UENUM = saved_endpoint;
+
+  SCOPE_LOWER(UART);
+}
+
+
+
+//
+// This is the end of the file.
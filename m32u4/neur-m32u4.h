@@ -0,0 +1,119 @@
+// Attention Circuits Control Laboratory - Atmel AVR firmware
+// ATmega32U4 - Header.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+// Macros
+
+// ADC-related macros.
+
+#define ADC_CHANNEL_COUNT 6
+
+
+// UART-related macros.
+// The primary "UART" on the 32U4 is the native USB CDC serial port.
+
+// Sizes should be powers of 2, so we can do modulo math by masking.
+// The 32U4 has 2.5k of SRAM. This uses 544 bytes (each line also holds a
+// 4-byte timestamp).
+// These can be overridden at build time. The count has to be at least 2.
+// Apps that parse input with a receive hook can use the minimum.
+#ifndef UART_LINE_COUNT
+#define UART_LINE_COUNT 8
+#endif
+// Each line can have 2^bits characters.
+#ifndef UART_LINE_BITS
+#define UART_LINE_BITS 6
+#endif
+#define UART_LINE_SIZE (1 << UART_LINE_BITS)
+
+// This switch identifies whether to use _near or _far pointers for
+// flash-stored variables.
+// Even for large flash memories, PROGMEM variables are placed in the lower
+// 64k first, so near pointers usually work.
+#define USE_FAR_FLASH_POINTERS 0
+
+
+// USB-related macros.
+
+// Vendor and product IDs reported to the host.
+// FIXME - These are the pid.codes test IDs. Use real ones for deployment.
+#define USB_VENDOR_ID 0x1209
+#define USB_PRODUCT_ID 0x0001
+
+
+// SPI-related macros.
+
+// Queue size should be a power of 2, so we can do modulo math by masking.
+#define SPI_QUEUE_SIZE 8
+// Maximum length of double-buffered transfers.
+#define SPI_DBUF_BYTES 4
+
+// The SPI pins are B0 (SS), B1 (SCK), B2 (MOSI), and B3 (MISO).
+// On the Leonardo, SCK/MOSI/MISO are only on the ICSP header, and SS drives
+// the RX LED. None of them are GPIO lines.
+#define SPI_PORT PORTB
+#define SPI_DDR DDRB
+#define SPI_PIN_SS (1 << 0)
+#define SPI_PIN_MOSI (1 << 2)
+#define SPI_PIN_MISO (1 << 3)
+#define SPI_PIN_SCK (1 << 1)
+
+
+// TWI-related macros.
+
+// Queue size should be a power of 2, so we can do modulo math by masking.
+#define TWI_QUEUE_SIZE 8
+
+
+// Configuration store macros.
+
+// The 32u4 has 1k of EEPROM. This uses 544 bytes.
+// Records are CONFIG_DATA_BYTES + 2 bytes long.
+#define CONFIG_EEPROM_BASE 0
+#define CONFIG_DATA_BYTES 32
+#define CONFIG_SLOT_COUNT 16
+
+
+// Flight recorder macros.
+
+// Slot count must be a power of 2, and no more than 128. Each slot is
+// 8 bytes, so this uses 128 bytes.
+#define FLIGHT_RECORD_BITS 4
+#define FLIGHT_RECORD_SLOTS (1 << FLIGHT_RECORD_BITS)
+
+
+// Scope pin assignments (see NEURAVR_SCOPE_PINS).
+// These must be in the low I/O space so that SBI/CBI can reach them.
+// The hardware UART isn't used, so its pins (D2, D3) are free. E6 is
+// Leonardo pin 7. D5 is the Leonardo's TX LED. E2 is the HWB pin, which
+// isn't on the Leonardo's headers; probe it at the chip.
+// NOTE - D4 (Leonardo pin 4) is ICP1, the RTC sync capture input, so it
+// isn't used here.
+
+#define SCOPE_PORT_RTC PORTD
+#define SCOPE_DDR_RTC DDRD
+#define SCOPE_MASK_RTC (1 << 2)
+
+#define SCOPE_PORT_UART PORTD
+#define SCOPE_DDR_UART DDRD
+#define SCOPE_MASK_UART (1 << 3)
+
+#define SCOPE_PORT_ADC PORTD
+#define SCOPE_DDR_ADC DDRD
+#define SCOPE_MASK_ADC (1 << 5)
+
+#define SCOPE_PORT_APP PORTE
+#define SCOPE_DDR_APP DDRE
+#define SCOPE_MASK_APP (1 << 6)
+
+#define SCOPE_PORT_POLL PORTE
+#define SCOPE_DDR_POLL DDRE
+#define SCOPE_MASK_POLL (1 << 2)
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,679 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - ADC triggered capture.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+//
+// Includes
+
+#include <neuravr.h>
+#include <neurapp-oo.h>
+#include <neurapp-adccapture.h>
+
+
+//
+//
+//
+// Private Constants
+
+// Help screen.
+const char neurapp_adccapture_help[] PROGMEM =
+  "ADC triggered capture commands:\r\n"
+  "\r\n"
+  "  ACM n     :  Select channels to sample (bit mask, decimal).\r\n"
+  "  ACR n     :  Sample every n ticks.\r\n"
+  "  ACW p n   :  Capture p scans before and n scans after the trigger.\r\n"
+  "  ACT c v   :  Trigger when channel c rises through level v.\r\n"
+  "  ACL c v   :  Trigger when channel c falls through level v.\r\n"
+  "  ACG b 1/0 :  Trigger on a rising/falling edge of GPIO bit b.\r\n"
+  "  ACN       :  No automatic trigger (forced triggers only).\r\n"
+  "  ACF       :  Force a trigger.\r\n"
+  "  ACS 1/0   :  Start/stop capturing.\r\n"
+  "  ACQ       :  Report capture status.\r\n"
+  "\r\n"
+  "Snippets are \"C (seq) (time) (mask) (pre) (scans) (src)\",\r\n"
+  "then \"CD (seq) (idx) (ch) (ch)...\" per scan, then \"CE (seq)\", in hex.\r\n"
+  ;
+
+
+
+//
+//
+// Public Global Variables
+
+const neurapp_cmd_list_row_P_t neurapp_adccapture_cmds[] PROGMEM =
+{
+  { { 'A', 'C', 'M' }, NEURAPP_ADCCAPTURE_OP_MASK, 1 },
+  { { 'A', 'C', 'R' }, NEURAPP_ADCCAPTURE_OP_RATE, 1 },
+  { { 'A', 'C', 'W' }, NEURAPP_ADCCAPTURE_OP_WINDOW, 2 },
+  { { 'A', 'C', 'T' }, NEURAPP_ADCCAPTURE_OP_TRIG_RISE, 2 },
+  { { 'A', 'C', 'L' }, NEURAPP_ADCCAPTURE_OP_TRIG_FALL, 2 },
+  { { 'A', 'C', 'G' }, NEURAPP_ADCCAPTURE_OP_TRIG_GPIO, 2 },
+  { { 'A', 'C', 'N' }, NEURAPP_ADCCAPTURE_OP_TRIG_OFF, 0 },
+  { { 'A', 'C', 'F' }, NEURAPP_ADCCAPTURE_OP_FORCE, 0 },
+  { { 'A', 'C', 'S' }, NEURAPP_ADCCAPTURE_OP_RUN, 1 },
+  { { 'A', 'C', 'Q' }, NEURAPP_ADCCAPTURE_OP_QUERY, 0 },
+  { { 0, 0, 0 }, 0, -1 }
+};
+
+
+
+//
+//
+// Classes
+
+
+//
+// ADC triggered capture event handler.
+
+
+// Constructor.
+
+NeurAppEvent_ADCCapture::NeurAppEvent_ADCCapture(void)
+{
+  channel_mask = 0x01;
+  period_ticks = NEURAPP_ADCCAPTURE_DEFAULT_PERIOD;
+  pre_scans = NEURAPP_ADCCAPTURE_DEFAULT_PRE;
+  post_scans = NEURAPP_ADCCAPTURE_DEFAULT_POST;
+
+  trig_mode = NEURAPP_ADCCAPTURE_TRIG_NONE;
+  trig_channel = 0;
+  trig_level = 0x8000;
+
+  InitState();
+}
+
+
+// Returns a help screen describing handler-specific commands.
+
+PGM_P NeurAppEvent_ADCCapture::GetHelpScreen(void)
+{
+  return neurapp_adccapture_help;
+}
+
+
+// This performs one-time hardware initialization.
+
+void NeurAppEvent_ADCCapture::InitHardware(void)
+{
+  ADC_Init();
+}
+
+
+// This performs internal state initialization. Multiple calls are ok.
+// Configuration is left alone; capture is stopped and both buffers are
+// discarded.
+
+void NeurAppEvent_ADCCapture::InitState(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    is_running = false;
+
+    ticks_left = 0;
+    scan_pending = false;
+    scan_discard = false;
+    scan_timestamp = 0;
+
+    active_buf = 0;
+    buf_ready[0] = false;
+    buf_ready[1] = false;
+    next_sequence = 0;
+
+    snippets_total = 0;
+    snippets_dropped = 0;
+    scans_overrun = 0;
+
+    saved_ready_buf = 0xff;
+    saved_total = 0;
+    saved_dropped = 0;
+    saved_overrun = 0;
+    reported_dropped = 0;
+    report_line = 0;
+    status_wanted = false;
+
+    ApplyConfig_ISR();
+  }
+}
+
+
+// This fits the requested window to the channel mask, and restarts
+// capture. The requested lengths themselves are left alone.
+
+void NeurAppEvent_ADCCapture::ApplyConfig_ISR(void)
+{
+  uint8_t count;
+  uint8_t bidx;
+  uint16_t capacity;
+
+  count = 0;
+  for (bidx = 0; bidx < ADC_CHANNEL_COUNT; bidx++)
+    if (channel_mask & (1 << bidx))
+      count++;
+
+  capacity = NEURAPP_ADCCAPTURE_BUF_SAMPLES;
+  if (1 < count)
+    capacity /= count;
+  if (255 < capacity)
+    capacity = 255;
+
+  eff_post_scans = post_scans;
+  if (1 > eff_post_scans)
+    eff_post_scans = 1;
+  if (capacity < eff_post_scans)
+    eff_post_scans = capacity;
+
+  eff_pre_scans = pre_scans;
+  if (capacity < (eff_pre_scans + eff_post_scans))
+    eff_pre_scans = capacity - eff_post_scans;
+
+  RestartCapture_ISR();
+}
+
+
+// This resets the active buffer to start a fresh pre-trigger window
+// with the current configuration.
+
+void NeurAppEvent_ADCCapture::RestartCapture_ISR(void)
+{
+  neurapp_adccapture_snippet_t *thissnip;
+  uint8_t bidx;
+
+  thissnip = &(snippets[active_buf]);
+
+  thissnip->channel_mask = channel_mask;
+  thissnip->pre_scans = eff_pre_scans;
+  thissnip->total_scans = eff_pre_scans + eff_post_scans;
+
+  thissnip->channel_count = 0;
+  trig_slot = 0xff;
+  for (bidx = 0; bidx < ADC_CHANNEL_COUNT; bidx++)
+    if (channel_mask & (1 << bidx))
+    {
+      if (bidx == trig_channel)
+        trig_slot = thissnip->channel_count;
+      thissnip->channel_count++;
+    }
+
+  write_scan = 0;
+  filled_scans = 0;
+  post_left = 0;
+  is_triggered = false;
+  trig_have_prev = false;
+  force_pending = false;
+
+  // A scan in flight was started with the old channel mask.
+  scan_discard = scan_pending;
+}
+
+
+// This checks the trigger condition against the newest scan.
+// Returns the trigger source character, or 0 if it didn't fire.
+// Edge history is updated whether or not a trigger can be accepted.
+
+char NeurAppEvent_ADCCapture::CheckTrigger_ISR(uint16_t *scan)
+{
+  char result;
+  uint16_t thissample;
+  bool thisgpio;
+
+  result = 0;
+
+  switch (trig_mode)
+  {
+    case NEURAPP_ADCCAPTURE_TRIG_RISE:
+    case NEURAPP_ADCCAPTURE_TRIG_FALL:
+      if (0xff != trig_slot)
+      {
+        thissample = scan[trig_slot];
+
+        if (trig_have_prev)
+        {
+          if (NEURAPP_ADCCAPTURE_TRIG_RISE == trig_mode)
+          {
+            if ( (trig_prev_sample < trig_level)
+              && (thissample >= trig_level) )
+              result = 'T';
+          }
+          else
+          {
+            if ( (trig_prev_sample > trig_level)
+              && (thissample <= trig_level) )
+              result = 'T';
+          }
+        }
+
+        trig_prev_sample = thissample;
+        trig_have_prev = true;
+      }
+      break;
+
+    case NEURAPP_ADCCAPTURE_TRIG_GPIO_RISE:
+    case NEURAPP_ADCCAPTURE_TRIG_GPIO_FALL:
+      thisgpio = (0 != (IO8_ReadData() & (1 << trig_channel)));
+
+      if (trig_have_prev && (thisgpio != trig_prev_gpio))
+        if (thisgpio == (NEURAPP_ADCCAPTURE_TRIG_GPIO_RISE == trig_mode))
+          result = 'G';
+
+      trig_prev_gpio = thisgpio;
+      trig_have_prev = true;
+      break;
+
+    default:
+      break;
+  }
+
+  // Forced triggers stay pending until they're accepted.
+  if (force_pending)
+    result = 'F';
+
+  return result;
+}
+
+
+// This hands a completed snippet to the polling loop.
+// If the polling loop still owns the other buffer, the snippet is dropped
+// and the active buffer is reused.
+
+void NeurAppEvent_ADCCapture::FreezeSnippet_ISR(void)
+{
+  neurapp_adccapture_snippet_t *thissnip;
+  uint8_t other_buf;
+
+  thissnip = &(snippets[active_buf]);
+
+  thissnip->start_scan = write_scan;
+  thissnip->sequence = next_sequence;
+  next_sequence++;
+  snippets_total++;
+
+  other_buf = active_buf ^ 1;
+
+  if (buf_ready[other_buf])
+  {
+    snippets_dropped++;
+    FLIGHT_Record(FLIGHT_EV_REPORT_DROP, 'C', (uint16_t) snippets_dropped);
+  }
+  else
+  {
+    buf_ready[active_buf] = true;
+    active_buf = other_buf;
+  }
+
+  RestartCapture_ISR();
+}
+
+
+// This copies completed samples into the active buffer and advances the
+// capture state.
+
+void NeurAppEvent_ADCCapture::StoreScan_ISR(void)
+{
+  neurapp_adccapture_snippet_t *thissnip;
+  uint16_t *thisscan;
+  uint16_t thisdata;
+  uint8_t thischan;
+  uint8_t sidx;
+  char source;
+
+  if (scan_discard || (!is_running))
+  {
+    // Consume the samples anyways, so the ADC is left clean.
+    while (ADC_ReadPendingSample(thisdata, thischan))
+      ;
+
+    scan_discard = false;
+  }
+  else
+  {
+    thissnip = &(snippets[active_buf]);
+    thisscan = thissnip->samples + (write_scan * thissnip->channel_count);
+
+    // Samples come out in ascending channel order; pack them.
+    sidx = 0;
+    while ( (sidx < thissnip->channel_count)
+      && ADC_ReadPendingSample(thisdata, thischan) )
+    {
+      thisscan[sidx] = thisdata;
+      sidx++;
+    }
+    for (; sidx < thissnip->channel_count; sidx++)
+      thisscan[sidx] = 0;
+
+    source = CheckTrigger_ISR(thisscan);
+
+    if (is_triggered)
+      post_left--;
+    else if ( (0 != source) && (filled_scans >= thissnip->pre_scans) )
+    {
+      // The trigger scan is the first post-trigger scan.
+      is_triggered = true;
+      post_left = thissnip->total_scans - thissnip->pre_scans - 1;
+      force_pending = false;
+
+      thissnip->trigger_time = scan_timestamp;
+      thissnip->source = source;
+    }
+
+    write_scan++;
+    if (write_scan >= thissnip->total_scans)
+      write_scan = 0;
+    if (filled_scans < thissnip->total_scans)
+      filled_scans++;
+
+    if (is_triggered && (0 == post_left))
+      FreezeSnippet_ISR();
+  }
+}
+
+
+// This is called from the timer ISR.
+// Total time is one ADC housekeeping poll plus, at most, one scan copy.
+
+void NeurAppEvent_ADCCapture::HandleTick_ISR(void)
+{
+  ADC_HousekeepingPoll();
+
+  if (scan_pending && ADC_IsDataReady())
+  {
+    // Clear this first; freezing a snippet checks it.
+    scan_pending = false;
+    StoreScan_ISR();
+  }
+
+  if (is_running)
+  {
+    if (0 < ticks_left)
+      ticks_left--;
+
+    if (0 == ticks_left)
+    {
+      ticks_left = period_ticks;
+
+      if (scan_pending)
+      {
+        // The previous scan hasn't finished; skip this one.
+        scans_overrun++;
+        FLIGHT_Record(FLIGHT_EV_ADC_OVERRUN, 'C', (uint16_t) scans_overrun);
+      }
+      else
+      {
+        scan_timestamp = Timer_Query_ISR();
+        scan_pending = true;
+        ADC_StartConversion(channel_mask);
+      }
+    }
+  }
+}
+
+
+// This is called to handle user commands.
+
+void NeurAppEvent_ADCCapture::HandleCommand(uint8_t opcode,
+  uint16_t arg1, uint16_t arg2)
+{
+  switch (opcode)
+  {
+    case NEURAPP_ADCCAPTURE_OP_MASK:
+      arg1 &= (1 << ADC_CHANNEL_COUNT) - 1;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        channel_mask = (uint8_t) arg1;
+        if (0 == channel_mask)
+          is_running = false;
+        ApplyConfig_ISR();
+      }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_RATE:
+      if (1 > arg1)
+        arg1 = 1;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        period_ticks = arg1;
+        ticks_left = 0;
+        RestartCapture_ISR();
+      }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_WINDOW:
+      // Clamp to 8 bits here; ApplyConfig_ISR() does the rest.
+      if (255 < arg1)
+        arg1 = 255;
+      if (255 < arg2)
+        arg2 = 255;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        pre_scans = (uint8_t) arg1;
+        post_scans = (uint8_t) arg2;
+        ApplyConfig_ISR();
+      }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_TRIG_RISE:
+    case NEURAPP_ADCCAPTURE_OP_TRIG_FALL:
+      if (ADC_CHANNEL_COUNT > arg1)
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+          trig_mode = (NEURAPP_ADCCAPTURE_OP_TRIG_RISE == opcode)
+            ? NEURAPP_ADCCAPTURE_TRIG_RISE : NEURAPP_ADCCAPTURE_TRIG_FALL;
+          trig_channel = (uint8_t) arg1;
+          trig_level = arg2;
+          RestartCapture_ISR();
+        }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_TRIG_GPIO:
+      if (8 > arg1)
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+          trig_mode = (0 != arg2)
+            ? NEURAPP_ADCCAPTURE_TRIG_GPIO_RISE
+            : NEURAPP_ADCCAPTURE_TRIG_GPIO_FALL;
+          trig_channel = (uint8_t) arg1;
+          RestartCapture_ISR();
+        }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_TRIG_OFF:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        trig_mode = NEURAPP_ADCCAPTURE_TRIG_NONE;
+        RestartCapture_ISR();
+      }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_FORCE:
+      // Single-byte write, so it's atomic.
+      force_pending = true;
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_RUN:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        is_running = (0 != arg1) && (0 != channel_mask);
+        ticks_left = 0;
+        RestartCapture_ISR();
+      }
+      break;
+
+    case NEURAPP_ADCCAPTURE_OP_QUERY:
+      status_wanted = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+// This is called from within an atomic lock prior to report generation.
+
+void NeurAppEvent_ADCCapture::SaveReportState_Fast(void)
+{
+  saved_ready_buf = 0xff;
+  if (buf_ready[0])
+    saved_ready_buf = 0;
+  else if (buf_ready[1])
+    saved_ready_buf = 1;
+
+  saved_total = snippets_total;
+  saved_dropped = snippets_dropped;
+  saved_overrun = scans_overrun;
+}
+
+
+// This is called from the polling loop to generate report text.
+// Priority is status, then drop notices, then snippet lines. Drop notices
+// wait until the snippet being reported is finished.
+// A snippet is reported one line per call: header, scans, end marker.
+
+bool NeurAppEvent_ADCCapture::MakeReportString(neurapp_report_buf_t &buffer)
+{
+  bool result;
+  uint8_t sidx;
+  uint8_t bidx;
+  uint8_t scanidx;
+  uint16_t slot;
+  neurapp_adccapture_snippet_t *thissnip;
+  uint16_t *thisscan;
+
+  result = false;
+
+  if (status_wanted)
+  {
+    status_wanted = false;
+
+    // "CQ r mm pp nn g cc llll tttttttt dddddddd oooooooo\r\n"
+    buffer[0] = 'C';
+    buffer[1] = 'Q';
+    buffer[2] = ' ';
+    buffer[3] = is_running ? '1' : '0';
+    buffer[4] = ' ';
+    UTIL_WriteHex(buffer + 5, channel_mask, 2);
+    buffer[7] = ' ';
+    UTIL_WriteHex(buffer + 8, eff_pre_scans, 2);
+    buffer[10] = ' ';
+    UTIL_WriteHex(buffer + 11, eff_post_scans, 2);
+    buffer[13] = ' ';
+    UTIL_WriteHex(buffer + 14, trig_mode, 1);
+    buffer[15] = ' ';
+    UTIL_WriteHex(buffer + 16, trig_channel, 2);
+    buffer[18] = ' ';
+    UTIL_WriteHex(buffer + 19, trig_level, 4);
+    buffer[23] = ' ';
+    UTIL_WriteHex(buffer + 24, saved_total, 8);
+    buffer[32] = ' ';
+    UTIL_WriteHex(buffer + 33, saved_dropped, 8);
+    buffer[41] = ' ';
+    UTIL_WriteHex(buffer + 42, saved_overrun, 8);
+    buffer[50] = '\r';
+    buffer[51] = '\n';
+    buffer[52] = 0;
+
+    result = true;
+  }
+  else if ( (saved_dropped != reported_dropped) && (0 == report_line) )
+  {
+    reported_dropped = saved_dropped;
+
+    // "CX dddddddd\r\n"
+    buffer[0] = 'C';
+    buffer[1] = 'X';
+    buffer[2] = ' ';
+    UTIL_WriteHex(buffer + 3, saved_dropped, 8);
+    buffer[11] = '\r';
+    buffer[12] = '\n';
+    buffer[13] = 0;
+
+    result = true;
+  }
+  else if (2 > saved_ready_buf)
+  {
+    // The polling loop owns this buffer until it clears the ready flag.
+    thissnip = &(snippets[saved_ready_buf]);
+
+    buffer[0] = 'C';
+
+    if (0 == report_line)
+    {
+      // "C ssss tttttttt mm pp nn k\r\n"
+      buffer[1] = ' ';
+      UTIL_WriteHex(buffer + 2, thissnip->sequence, 4);
+      buffer[6] = ' ';
+      UTIL_WriteHex(buffer + 7, thissnip->trigger_time, 8);
+      buffer[15] = ' ';
+      UTIL_WriteHex(buffer + 16, thissnip->channel_mask, 2);
+      buffer[18] = ' ';
+      UTIL_WriteHex(buffer + 19, thissnip->pre_scans, 2);
+      buffer[21] = ' ';
+      UTIL_WriteHex(buffer + 22, thissnip->total_scans, 2);
+      buffer[24] = ' ';
+      buffer[25] = thissnip->source;
+      buffer[26] = '\r';
+      buffer[27] = '\n';
+      buffer[28] = 0;
+
+      report_line++;
+    }
+    else if (report_line <= thissnip->total_scans)
+    {
+      // "CD ssss ii vvvv vvvv ...\r\n"
+      // Worst case is 10 + 5 * 8 = 50 characters.
+      scanidx = report_line - 1;
+
+      // Scans are stored circularly, oldest first at start_scan.
+      slot = thissnip->start_scan + scanidx;
+      if (slot >= thissnip->total_scans)
+        slot -= thissnip->total_scans;
+      thisscan = thissnip->samples + (slot * thissnip->channel_count);
+
+      buffer[1] = 'D';
+      buffer[2] = ' ';
+      UTIL_WriteHex(buffer + 3, thissnip->sequence, 4);
+      buffer[7] = ' ';
+      UTIL_WriteHex(buffer + 8, scanidx, 2);
+      bidx = 10;
+
+      for (sidx = 0; sidx < thissnip->channel_count; sidx++)
+      {
+        buffer[bidx] = ' ';
+        UTIL_WriteHex(buffer + bidx + 1, thisscan[sidx], 4);
+        bidx += 5;
+      }
+
+      buffer[bidx] = '\r';
+      buffer[bidx + 1] = '\n';
+      buffer[bidx + 2] = 0;
+
+      report_line++;
+    }
+    else
+    {
+      // "CE ssss\r\n"
+      buffer[1] = 'E';
+      buffer[2] = ' ';
+      UTIL_WriteHex(buffer + 3, thissnip->sequence, 4);
+      buffer[7] = '\r';
+      buffer[8] = '\n';
+      buffer[9] = 0;
+
+      // Release the buffer. This is a single-byte write, so it's atomic.
+      report_line = 0;
+      buf_ready[saved_ready_buf] = false;
+      saved_ready_buf = 0xff;
+    }
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,231 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - ADC triggered capture.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+// NOTE - Include "neurapp-oo.h" before including this.
+
+
+//
+// Notes
+
+// This samples a user-selected set of ADC channels every N ticks into a
+// circular pre-trigger window. When a trigger fires, it keeps sampling for
+// the post-trigger length and then freezes the window into a snippet, which
+// is reported asynchronously. Capture then re-arms by itself.
+//
+// Triggers:
+// - Threshold: one armed channel rises through (or falls through) a level.
+// Levels are in the ADC's 16-bit left-adjusted scale.
+// - GPIO edge: one IO8 input bit rises or falls (sampled once per scan).
+// - Command: "ACF" forces a trigger at the next scan. This works with any
+// trigger mode, including "ACN" (no automatic trigger).
+// A trigger is ignored until the pre-trigger window has filled, so every
+// snippet has its full pre-trigger length.
+//
+// Everything from sampling to freezing happens in the tick handler; the
+// polling loop only formats reports. There are two snippet buffers. While
+// one is being reported, capture continues into the other. If that one
+// fills too before the report is done, its snippet is dropped (and
+// counted) and capture re-arms in place.
+//
+// Window lengths are in scans. The trigger scan is the first post-trigger
+// scan. The whole window (pre + post) has to fit in one buffer:
+// NEURAPP_ADCCAPTURE_BUF_SAMPLES / (number of armed channels) scans, and
+// no more than 255. A window that doesn't fit is shortened, pre-trigger
+// scans first. The requested lengths are kept, so arming fewer channels
+// later gets them back. "ACQ" reports the window actually in use.
+//
+// Report formats (all numbers are hexadecimal):
+//
+// "C ssss tttttttt mm pp nn k"  Snippet header. "s" is the snippet
+//                               sequence number, "t" is the timestamp of
+//                               the trigger scan, "m" is the channel mask,
+//                               "p" is the pre-trigger scan count, "n" is
+//                               the total scan count, and "k" is the
+//                               trigger source (T, G, or F).
+// "CD ssss ii vvvv vvvv ..."    One scan. "i" is the scan index within the
+//                               snippet (the trigger scan is index "p"),
+//                               and "v" are samples in ascending channel
+//                               order.
+// "CE ssss"                     End of snippet.
+// "CX dddddddd"                 Snippets were dropped since the last
+//                               report (total dropped so far).
+// "CQ ..."                      Status report (see "ACQ").
+//
+// This handler runs the ADC sequencer itself (like the ADC streaming
+// handler); don't use both in the same application.
+
+
+//
+// Macros
+
+// Samples per snippet buffer. There are two buffers.
+// Each sample costs 2 bytes per buffer.
+#ifdef __AVR_ATmega2560__
+#define NEURAPP_ADCCAPTURE_BUF_SAMPLES 512
+#else
+#define NEURAPP_ADCCAPTURE_BUF_SAMPLES 96
+#endif
+
+// Default window and sampling period.
+#define NEURAPP_ADCCAPTURE_DEFAULT_PRE 16
+#define NEURAPP_ADCCAPTURE_DEFAULT_POST 16
+#define NEURAPP_ADCCAPTURE_DEFAULT_PERIOD 1
+
+// Trigger modes.
+#define NEURAPP_ADCCAPTURE_TRIG_NONE 0
+#define NEURAPP_ADCCAPTURE_TRIG_RISE 1
+#define NEURAPP_ADCCAPTURE_TRIG_FALL 2
+#define NEURAPP_ADCCAPTURE_TRIG_GPIO_RISE 3
+#define NEURAPP_ADCCAPTURE_TRIG_GPIO_FALL 4
+
+// Opcodes for this handler's commands.
+#define NEURAPP_ADCCAPTURE_OP_MASK 1
+#define NEURAPP_ADCCAPTURE_OP_RATE 2
+#define NEURAPP_ADCCAPTURE_OP_WINDOW 3
+#define NEURAPP_ADCCAPTURE_OP_TRIG_RISE 4
+#define NEURAPP_ADCCAPTURE_OP_TRIG_FALL 5
+#define NEURAPP_ADCCAPTURE_OP_TRIG_GPIO 6
+#define NEURAPP_ADCCAPTURE_OP_FORCE 7
+#define NEURAPP_ADCCAPTURE_OP_RUN 8
+#define NEURAPP_ADCCAPTURE_OP_QUERY 9
+#define NEURAPP_ADCCAPTURE_OP_TRIG_OFF 10
+
+
+
+//
+// Typedefs
+
+// One snippet buffer. Samples are stored scan by scan, as a circular
+// buffer of total_scans scans starting at start_scan.
+typedef struct
+{
+  uint16_t samples[NEURAPP_ADCCAPTURE_BUF_SAMPLES];
+  uint32_t trigger_time;
+  uint16_t sequence;
+  uint8_t channel_mask;
+  uint8_t channel_count;
+  uint8_t pre_scans;
+  uint8_t total_scans;
+  uint8_t start_scan;
+  char source;
+} neurapp_adccapture_snippet_t;
+
+
+
+//
+// Global Variables
+
+// Command list for this handler.
+// This lives in program memory; use it as the "cmdlist_P" entry in the
+// event handler table, e.g. { &handler, NULL, neurapp_adccapture_cmds }.
+extern const neurapp_cmd_list_row_P_t neurapp_adccapture_cmds[];
+
+
+
+//
+// Classes
+
+
+// ADC triggered capture event handler.
+// This calls ADC_Init() during InitHardware(), and calls
+// ADC_HousekeepingPoll() from its tick handler, so the application doesn't
+// have to do either. GPIO trigger inputs still have to be configured by
+// the application.
+
+class NeurAppEvent_ADCCapture : public NeurAppEvent_Base
+{
+protected:
+  // Configuration. The window lengths are as requested.
+  uint8_t channel_mask;
+  uint16_t period_ticks;
+  uint8_t pre_scans;
+  uint8_t post_scans;
+  uint8_t trig_mode;
+  uint8_t trig_channel;
+  uint16_t trig_level;
+  volatile bool is_running;
+
+  // Sampling state. Only the tick handler touches this while running.
+  uint16_t ticks_left;
+  bool scan_pending;
+  bool scan_discard;
+  uint32_t scan_timestamp;
+
+  // Window in use, fitted to the channel mask by ApplyConfig_ISR().
+  uint8_t eff_pre_scans;
+  uint8_t eff_post_scans;
+
+  // Capture state. Only the tick handler touches this while running.
+  uint8_t active_buf;
+  uint8_t write_scan;
+  uint8_t filled_scans;
+  uint8_t post_left;
+  bool is_triggered;
+  uint8_t trig_slot;
+  uint16_t trig_prev_sample;
+  bool trig_prev_gpio;
+  bool trig_have_prev;
+  volatile bool force_pending;
+  uint16_t next_sequence;
+
+  // Snippet buffers. The tick handler fills, the polling loop reports.
+  // A buffer belongs to the polling loop while its ready flag is set.
+  neurapp_adccapture_snippet_t snippets[2];
+  volatile bool buf_ready[2];
+
+  // Statistics.
+  volatile uint32_t snippets_total;
+  volatile uint32_t snippets_dropped;
+  volatile uint32_t scans_overrun;
+
+  // Report state, copied in SaveReportState_Fast().
+  uint8_t saved_ready_buf;
+  uint32_t saved_total;
+  uint32_t saved_dropped;
+  uint32_t saved_overrun;
+  uint32_t reported_dropped;
+  uint16_t report_line;
+  bool status_wanted;
+
+  // This fits the requested window to the channel mask, and restarts
+  // capture.
+  void ApplyConfig_ISR(void);
+
+  // This resets the active buffer to start a fresh pre-trigger window
+  // with the current configuration.
+  void RestartCapture_ISR(void);
+
+  // This checks the trigger condition against the newest scan.
+  // Returns the trigger source character, or 0 if it didn't fire.
+  char CheckTrigger_ISR(uint16_t *scan);
+
+  // This copies completed samples into the active buffer and advances the
+  // capture state.
+  void StoreScan_ISR(void);
+
+  // This hands a completed snippet to the polling loop.
+  void FreezeSnippet_ISR(void);
+
+public:
+  NeurAppEvent_ADCCapture(void);
+  // Default destructor is fine.
+
+  virtual PGM_P GetHelpScreen(void);
+
+  virtual void InitHardware(void);
+  virtual void InitState(void);
+
+  virtual void HandleTick_ISR(void);
+
+  virtual void HandleCommand(uint8_t opcode, uint16_t arg1, uint16_t arg2);
+
+  virtual void SaveReportState_Fast(void);
+  virtual bool MakeReportString(neurapp_report_buf_t &buffer);
+};
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,338 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - ADC streaming.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+//
+// Includes
+
+#include <neuravr.h>
+#include <neurapp-oo.h>
+#include <neurapp-adcstream.h>
+
+
+//
+//
+//
+// Private Constants
+
+// Help screen.
+const char neurapp_adcstream_help[] PROGMEM =
+  "ADC streaming commands:\r\n"
+  "\r\n"
+  "  ASM n  :  Select channels to sample (bit mask, decimal).\r\n"
+  "  ASR n  :  Sample every n ticks.\r\n"
+  "  ASS 1/0:  Start/stop streaming.\r\n"
+  "  ASQ    :  Report scan/drop/overrun totals.\r\n"
+  "\r\n"
+  "Reports are \"A (seq) (time) (ch) (ch)...\" in hex.\r\n"
+  ;
+
+
+
+//
+//
+// Public Global Variables
+
+const neurapp_cmd_list_row_P_t neurapp_adcstream_cmds[] PROGMEM =
+{
+  { { 'A', 'S', 'M' }, NEURAPP_ADCSTREAM_OP_MASK, 1 },
+  { { 'A', 'S', 'R' }, NEURAPP_ADCSTREAM_OP_RATE, 1 },
+  { { 'A', 'S', 'S' }, NEURAPP_ADCSTREAM_OP_RUN, 1 },
+  { { 'A', 'S', 'Q' }, NEURAPP_ADCSTREAM_OP_QUERY, 0 },
+  { { 0, 0, 0 }, 0, -1 }
+};
+
+
+
+//
+//
+// Classes
+
+
+//
+// ADC streaming event handler.
+
+
+// Constructor.
+
+NeurAppEvent_ADCStream::NeurAppEvent_ADCStream(void)
+{
+  channel_mask = 0x01;
+  period_ticks = NEURAPP_ADCSTREAM_DEFAULT_PERIOD;
+
+  InitState();
+}
+
+
+// Returns a help screen describing handler-specific commands.
+
+PGM_P NeurAppEvent_ADCStream::GetHelpScreen(void)
+{
+  return neurapp_adcstream_help;
+}
+
+
+// This performs one-time hardware initialization.
+
+void NeurAppEvent_ADCStream::InitHardware(void)
+{
+  ADC_Init();
+}
+
+
+// This performs internal state initialization. Multiple calls are ok.
+// Channel mask and rate are left alone; streaming is stopped.
+
+void NeurAppEvent_ADCStream::InitState(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    is_running = false;
+
+    ticks_left = 0;
+    scan_pending = false;
+    scan_timestamp = 0;
+    next_sequence = 0;
+
+    scans.Reset();
+
+    scans_total = 0;
+    scans_dropped = 0;
+    scans_overrun = 0;
+
+    saved_mark = 0;
+    saved_dropped = 0;
+    saved_overrun = 0;
+    saved_total = 0;
+    reported_dropped = 0;
+    status_wanted = false;
+  }
+}
+
+
+// This copies completed samples into the next free scan slot.
+// If the buffer is full, the scan is counted as dropped.
+
+void NeurAppEvent_ADCStream::StoreScan_ISR(void)
+{
+  uint16_t thisdata;
+  uint8_t thischan;
+  uint8_t sidx;
+  neurapp_adcstream_scan_t *thisscan;
+
+  thisscan = scans.GetWriteSlot();
+
+  if (NULL == thisscan)
+  {
+    // Full. Consume the samples anyways, so the ADC is left clean.
+    while (ADC_ReadPendingSample(thisdata, thischan))
+      ;
+
+    scans_dropped++;
+    FLIGHT_Record(FLIGHT_EV_REPORT_DROP, 'A', (uint16_t) scans_dropped);
+  }
+  else
+  {
+    thisscan->timestamp = scan_timestamp;
+    thisscan->sequence = next_sequence;
+
+    // Samples come out in ascending channel order; pack them.
+    sidx = 0;
+    while ( (sidx < ADC_CHANNEL_COUNT)
+      && ADC_ReadPendingSample(thisdata, thischan) )
+    {
+      thisscan->data[sidx] = thisdata;
+      sidx++;
+    }
+    thisscan->count = sidx;
+
+    // Publish the scan.
+    scans.Publish();
+  }
+
+  next_sequence++;
+  scans_total++;
+}
+
+
+// This is called from the timer ISR.
+// Total time is one ADC housekeeping poll plus, at most, one scan copy.
+
+void NeurAppEvent_ADCStream::HandleTick_ISR(void)
+{
+  ADC_HousekeepingPoll();
+
+  if (scan_pending && ADC_IsDataReady())
+  {
+    StoreScan_ISR();
+    scan_pending = false;
+  }
+
+  if (is_running)
+  {
+    if (0 < ticks_left)
+      ticks_left--;
+
+    if (0 == ticks_left)
+    {
+      ticks_left = period_ticks;
+
+      if (scan_pending)
+      {
+        // The previous scan hasn't finished; skip this one.
+        scans_overrun++;
+        FLIGHT_Record(FLIGHT_EV_ADC_OVERRUN, 'A', (uint16_t) scans_overrun);
+      }
+      else
+      {
+        scan_timestamp = Timer_Query_ISR();
+        scan_pending = true;
+        ADC_StartConversion(channel_mask);
+      }
+    }
+  }
+}
+
+
+// This is called to handle user commands.
+
+void NeurAppEvent_ADCStream::HandleCommand(uint8_t opcode,
+  uint16_t arg1, uint16_t arg2)
+{
+  switch (opcode)
+  {
+    case NEURAPP_ADCSTREAM_OP_MASK:
+      arg1 &= (1 << ADC_CHANNEL_COUNT) - 1;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        channel_mask = (uint8_t) arg1;
+        if (0 == channel_mask)
+          is_running = false;
+      }
+      break;
+
+    case NEURAPP_ADCSTREAM_OP_RATE:
+      if (1 > arg1)
+        arg1 = 1;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        period_ticks = arg1;
+        ticks_left = 0;
+      }
+      break;
+
+    case NEURAPP_ADCSTREAM_OP_RUN:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        is_running = (0 != arg1) && (0 != channel_mask);
+        ticks_left = 0;
+      }
+      break;
+
+    case NEURAPP_ADCSTREAM_OP_QUERY:
+      status_wanted = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+// This is called from within an atomic lock prior to report generation.
+
+void NeurAppEvent_ADCStream::SaveReportState_Fast(void)
+{
+  saved_mark = scans.GetMark();
+  saved_dropped = scans_dropped;
+  saved_overrun = scans_overrun;
+  saved_total = scans_total;
+}
+
+
+// This is called from the polling loop to generate report text.
+// Priority is status, then drop notices, then buffered scans.
+
+bool NeurAppEvent_ADCStream::MakeReportString(neurapp_report_buf_t &buffer)
+{
+  bool result;
+  uint8_t sidx;
+  uint8_t bidx;
+  neurapp_adcstream_scan_t *thisscan;
+
+  result = false;
+
+  if (status_wanted)
+  {
+    status_wanted = false;
+
+    // "AQ tttttttt dddddddd oooooooo\r\n"
+    buffer[0] = 'A';
+    buffer[1] = 'Q';
+    buffer[2] = ' ';
+    UTIL_WriteHex(buffer + 3, saved_total, 8);
+    buffer[11] = ' ';
+    UTIL_WriteHex(buffer + 12, saved_dropped, 8);
+    buffer[20] = ' ';
+    UTIL_WriteHex(buffer + 21, saved_overrun, 8);
+    buffer[29] = '\r';
+    buffer[30] = '\n';
+    buffer[31] = 0;
+
+    result = true;
+  }
+  else if (saved_dropped != reported_dropped)
+  {
+    reported_dropped = saved_dropped;
+
+    // "AX dddddddd\r\n"
+    buffer[0] = 'A';
+    buffer[1] = 'X';
+    buffer[2] = ' ';
+    UTIL_WriteHex(buffer + 3, saved_dropped, 8);
+    buffer[11] = '\r';
+    buffer[12] = '\n';
+    buffer[13] = 0;
+
+    result = true;
+  }
+  else if (!scans.HasReachedMark(saved_mark))
+  {
+    thisscan = scans.GetReadSlot();
+
+    // "A ssss tttttttt vvvv vvvv ...\r\n"
+    // Worst case is 17 + 5 * 8 = 57 characters.
+    buffer[0] = 'A';
+    buffer[1] = ' ';
+    UTIL_WriteHex(buffer + 2, thisscan->sequence, 4);
+    buffer[6] = ' ';
+    UTIL_WriteHex(buffer + 7, thisscan->timestamp, 8);
+    bidx = 15;
+
+    for (sidx = 0; sidx < thisscan->count; sidx++)
+    {
+      buffer[bidx] = ' ';
+      UTIL_WriteHex(buffer + bidx + 1, thisscan->data[sidx], 4);
+      bidx += 5;
+    }
+
+    buffer[bidx] = '\r';
+    buffer[bidx + 1] = '\n';
+    buffer[bidx + 2] = 0;
+
+    // Release the slot. This is a single-byte write, so it's atomic.
+    scans.Release();
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+//
+// This is the end of the file.
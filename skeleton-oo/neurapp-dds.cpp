@@ -0,0 +1,240 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - DDS waveform output.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+//
+// Includes
+
+#include <neuravr.h>
+#include <neurapp-oo.h>
+#include <neurapp-dds.h>
+
+
+//
+//
+//
+// Private Constants
+
+// Help screen.
+const char neurapp_dds_help[] PROGMEM =
+  "DDS waveform output commands:\r\n"
+  "\r\n"
+  "  DDF h m:  Set frequency to h Hz plus m mHz.\r\n"
+  "  DDA n  :  Set amplitude (0..32767 is 0..full scale).\r\n"
+  "  DDO n  :  Set offset (32768 is mid-scale).\r\n"
+  "  DDW n  :  Waveform (0 sine, 1 triangle, 2 square, 3 saw, 4 table).\r\n"
+  "  DDR 1/0:  Start/stop output (stops at the end of a cycle).\r\n"
+  "  DDQ    :  Report settings.\r\n"
+  "\r\n"
+  "Amplitude, offset, and waveform change at the end of a cycle.\r\n"
+  ;
+
+
+
+//
+//
+// Public Global Variables
+
+const neurapp_cmd_list_row_P_t neurapp_dds_cmds[] PROGMEM =
+{
+  { { 'D', 'D', 'F' }, NEURAPP_DDS_OP_FREQ, 2 },
+  { { 'D', 'D', 'A' }, NEURAPP_DDS_OP_AMPLITUDE, 1 },
+  { { 'D', 'D', 'O' }, NEURAPP_DDS_OP_OFFSET, 1 },
+  { { 'D', 'D', 'W' }, NEURAPP_DDS_OP_WAVE, 1 },
+  { { 'D', 'D', 'R' }, NEURAPP_DDS_OP_RUN, 1 },
+  { { 'D', 'D', 'Q' }, NEURAPP_DDS_OP_QUERY, 0 },
+  { { 0, 0, 0 }, 0, -1 }
+};
+
+
+
+//
+//
+// Classes
+
+
+//
+// DDS waveform output event handler.
+
+
+// Constructor.
+
+NeurAppEvent_DDS::NeurAppEvent_DDS(void)
+{
+  phase_step = 0;
+  wave = DDS_WAVE_SINE;
+  amplitude = 0;
+  offset = 0x8000;
+  table_P = NULL;
+  hardware_ready = false;
+
+  InitState();
+}
+
+
+// This supplies a wavetable for "DDW 4".
+
+void NeurAppEvent_DDS::SetWaveTable(const int16_t *new_table_P)
+{
+  table_P = new_table_P;
+
+  // Fall back to a sine wave if the table we were using went away.
+  if ( (DDS_WAVE_TABLE == wave) && (NULL == table_P) )
+    wave = DDS_WAVE_SINE;
+}
+
+
+// Returns a help screen describing handler-specific commands.
+
+PGM_P NeurAppEvent_DDS::GetHelpScreen(void)
+{
+  return neurapp_dds_help;
+}
+
+
+// This performs one-time hardware setup.
+// The DDS engine's timers would be reset by the application's Timer_Init()
+// call, which comes later, so setup waits for the first DDS command.
+
+void NeurAppEvent_DDS::InitHardware(void)
+{
+  hardware_ready = false;
+}
+
+
+// This initializes the DDS engine on first use.
+
+void NeurAppEvent_DDS::StartHardware(void)
+{
+  if (!hardware_ready)
+  {
+    DDS_Init(NEURAPP_DDS_MCU_HZ, NEURAPP_DDS_SAMPLE_HZ, NEURAPP_DDS_OUTPUT);
+    hardware_ready = true;
+
+    // DDS_Init() forgets our settings; reapply them.
+    InitState();
+  }
+}
+
+
+// This performs internal state initialization. Multiple calls are ok.
+// Settings are reapplied; output is stopped.
+
+void NeurAppEvent_DDS::InitState(void)
+{
+  DDS_Stop();
+
+  DDS_SetPhaseStep(phase_step);
+  if (DDS_WAVE_TABLE == wave)
+    DDS_SetWaveTable(table_P);
+  else
+    DDS_SetWaveform(wave);
+  DDS_SetAmplitude(amplitude);
+  DDS_SetOffset(offset);
+
+  status_wanted = false;
+}
+
+
+// This is called to handle user commands.
+
+void NeurAppEvent_DDS::HandleCommand(uint8_t opcode,
+  uint16_t arg1, uint16_t arg2)
+{
+  // Frequency conversion needs the sample rate, so do this first.
+  StartHardware();
+
+  switch (opcode)
+  {
+    case NEURAPP_DDS_OP_FREQ:
+      phase_step = DDS_FrequencyToStep( ((uint32_t) arg1) * 1000ul
+        + (uint32_t) arg2 );
+      DDS_SetPhaseStep(phase_step);
+      break;
+
+    case NEURAPP_DDS_OP_AMPLITUDE:
+      if (0x7fff < arg1)
+        arg1 = 0x7fff;
+      amplitude = (int16_t) arg1;
+      DDS_SetAmplitude(amplitude);
+      break;
+
+    case NEURAPP_DDS_OP_OFFSET:
+      offset = arg1;
+      DDS_SetOffset(offset);
+      break;
+
+    case NEURAPP_DDS_OP_WAVE:
+      if (DDS_WAVE_TABLE > arg1)
+      {
+        wave = (uint8_t) arg1;
+        DDS_SetWaveform(wave);
+      }
+      else if ( (DDS_WAVE_TABLE == arg1) && (NULL != table_P) )
+      {
+        wave = DDS_WAVE_TABLE;
+        DDS_SetWaveTable(table_P);
+      }
+      break;
+
+    case NEURAPP_DDS_OP_RUN:
+      if (0 != arg1)
+        DDS_Start();
+      else
+        DDS_Stop();
+      break;
+
+    case NEURAPP_DDS_OP_QUERY:
+      status_wanted = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+// This is called from the polling loop to generate report text.
+
+bool NeurAppEvent_DDS::MakeReportString(neurapp_report_buf_t &buffer)
+{
+  bool result;
+
+  result = false;
+
+  if (status_wanted)
+  {
+    status_wanted = false;
+
+    // "DQ r w ssssssss pppppppp aaaa oooo\r\n"
+    buffer[0] = 'D';
+    buffer[1] = 'Q';
+    buffer[2] = ' ';
+    buffer[3] = DDS_IsRunning() ? '1' : '0';
+    buffer[4] = ' ';
+    UTIL_WriteHex(buffer + 5, wave, 1);
+    buffer[6] = ' ';
+    UTIL_WriteHex(buffer + 7, DDS_QuerySampleRate(), 8);
+    buffer[15] = ' ';
+    UTIL_WriteHex(buffer + 16, phase_step, 8);
+    buffer[24] = ' ';
+    UTIL_WriteHex(buffer + 25, (uint16_t) amplitude, 4);
+    buffer[29] = ' ';
+    UTIL_WriteHex(buffer + 30, offset, 4);
+    buffer[34] = '\r';
+    buffer[35] = '\n';
+    buffer[36] = 0;
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,114 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - DDS waveform output.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+// NOTE - Include "neurapp-oo.h" before including this.
+
+
+//
+// Notes
+
+// This exposes the DDS engine (DDS_xx functions) as user commands. The
+// waveform is generated entirely by the sample timer interrupt; this
+// handler only changes settings and reports status.
+//
+// The MCU clock, sample rate, and output sink are compile-time settings
+// (see below). DDS_Init() is called when the first DDS command arrives,
+// not during InitHardware(). Applications call Timer_Init() after
+// DoInitialSetup(), and Timer_Init() resets every timer, including the
+// ones the DDS engine uses. Commands are only handled from DoPolling(),
+// which runs after all of the application's setup.
+//
+// Report format (all numbers are hexadecimal):
+//
+// "DQ r w ssssssss pppppppp aaaa oooo"  Status report (see "DDQ").
+//   "r" is 1 if running, "w" is the waveform, "s" is the sample rate,
+//   "p" is the phase step, "a" is the amplitude, "o" is the offset.
+
+
+//
+// Macros
+
+// Hardware configuration. Override these before including this header.
+#ifndef NEURAPP_DDS_MCU_HZ
+#define NEURAPP_DDS_MCU_HZ 16000000ul
+#endif
+#ifndef NEURAPP_DDS_SAMPLE_HZ
+#define NEURAPP_DDS_SAMPLE_HZ 10000
+#endif
+#ifndef NEURAPP_DDS_OUTPUT
+#define NEURAPP_DDS_OUTPUT DDS_OUTPUT_PWM
+#endif
+
+// Opcodes for this handler's commands.
+#define NEURAPP_DDS_OP_FREQ 1
+#define NEURAPP_DDS_OP_AMPLITUDE 2
+#define NEURAPP_DDS_OP_OFFSET 3
+#define NEURAPP_DDS_OP_WAVE 4
+#define NEURAPP_DDS_OP_RUN 5
+#define NEURAPP_DDS_OP_QUERY 6
+
+
+
+//
+// Global Variables
+
+// Command list for this handler.
+// This lives in program memory; use it as the "cmdlist_P" entry in the
+// event handler table, e.g. { &handler, NULL, neurapp_dds_cmds }.
+extern const neurapp_cmd_list_row_P_t neurapp_dds_cmds[];
+
+
+
+//
+// Classes
+
+
+// DDS waveform output event handler.
+// This calls DDS_Init() when the first DDS command arrives.
+
+class NeurAppEvent_DDS : public NeurAppEvent_Base
+{
+protected:
+  // Settings, as last requested. The DDS engine applies most of these at
+  // the end of the current cycle.
+  uint32_t phase_step;
+  uint8_t wave;
+  int16_t amplitude;
+  uint16_t offset;
+
+  // Optional user-supplied wavetable (in program memory).
+  const int16_t *table_P;
+
+  bool status_wanted;
+
+  // Whether DDS_Init() has been called yet.
+  bool hardware_ready;
+
+  // This initializes the DDS engine if that hasn't been done yet, and
+  // applies the current settings.
+  void StartHardware(void);
+
+public:
+  NeurAppEvent_DDS(void);
+  // Default destructor is fine.
+
+  // This supplies a wavetable for "DDW 4" (DDS_TABLE_SIZE Q15 values in
+  // program memory). NULL removes it.
+  void SetWaveTable(const int16_t *new_table_P);
+
+  virtual PGM_P GetHelpScreen(void);
+
+  virtual void InitHardware(void);
+  virtual void InitState(void);
+
+  virtual void HandleCommand(uint8_t opcode, uint16_t arg1, uint16_t arg2);
+
+  virtual bool MakeReportString(neurapp_report_buf_t &buffer);
+};
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,317 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - GPIO edge logging.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+
+//
+//
+// Includes
+
+#include <neuravr.h>
+#include <neurapp-oo.h>
+#include <neurapp-gpiolog.h>
+
+// We're using strncpy_P() for verbose reports.
+#include <string.h>
+
+
+//
+//
+//
+// Private Constants
+
+// Help screen.
+const char neurapp_gpiolog_help[] PROGMEM =
+  "GPIO edge logging commands:\r\n"
+  "\r\n"
+  "  GLM n  :  Select IO8 inputs to monitor (bit mask, decimal).\r\n"
+  "  GLW n  :  Select IO16 inputs to monitor (bit mask, decimal).\r\n"
+  "  GLS 1/0:  Start/stop logging.\r\n"
+  "  GLF 1/0:  Verbose/compact reports.\r\n"
+  "  GLQ    :  Report event/drop totals.\r\n"
+  "\r\n"
+  "Reports are \"G (time) (changed) (levels)\" in hex.\r\n"
+  ;
+
+
+
+//
+//
+// Public Global Variables
+
+const neurapp_cmd_list_row_P_t neurapp_gpiolog_cmds[] PROGMEM =
+{
+  { { 'G', 'L', 'M' }, NEURAPP_GPIOLOG_OP_MASK8, 1 },
+  { { 'G', 'L', 'W' }, NEURAPP_GPIOLOG_OP_MASK16, 1 },
+  { { 'G', 'L', 'S' }, NEURAPP_GPIOLOG_OP_RUN, 1 },
+  { { 'G', 'L', 'F' }, NEURAPP_GPIOLOG_OP_FORMAT, 1 },
+  { { 'G', 'L', 'Q' }, NEURAPP_GPIOLOG_OP_QUERY, 0 },
+  { { 0, 0, 0 }, 0, -1 }
+};
+
+
+
+//
+//
+// Classes
+
+
+//
+// GPIO edge logging event handler.
+
+
+// Constructor.
+
+NeurAppEvent_GPIOLog::NeurAppEvent_GPIOLog(void)
+{
+  mask8 = 0xff;
+  mask16 = 0xffff;
+  verbose = false;
+
+  InitState();
+}
+
+
+// Returns a help screen describing handler-specific commands.
+
+PGM_P NeurAppEvent_GPIOLog::GetHelpScreen(void)
+{
+  return neurapp_gpiolog_help;
+}
+
+
+// This performs internal state initialization. Multiple calls are ok.
+// Masks and format are left alone; logging is stopped.
+
+void NeurAppEvent_GPIOLog::InitState(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    is_running = false;
+
+    prev8 = 0;
+    prev16 = 0;
+
+    events.Reset();
+
+    events_total = 0;
+    events_dropped = 0;
+
+    saved_mark = 0;
+    saved_total = 0;
+    saved_dropped = 0;
+    reported_dropped = 0;
+    status_wanted = false;
+  }
+}
+
+
+// This takes a new baseline sample without reporting changes.
+// The caller is responsible for any needed locking.
+
+void NeurAppEvent_GPIOLog::ResampleInputs(void)
+{
+  prev8 = IO8_ReadData() & mask8;
+  prev16 = IO16_ReadData() & mask16;
+}
+
+
+// This is called from the timer ISR.
+// The no-change case is two port reads and a few bitwise operations.
+
+void NeurAppEvent_GPIOLog::HandleTick_ISR(void)
+{
+  uint8_t this8, changed8;
+  uint16_t this16, changed16;
+  neurapp_gpiolog_event_t *thisevent;
+
+  if (is_running)
+  {
+    this8 = IO8_ReadData() & mask8;
+    this16 = IO16_ReadData() & mask16;
+
+    changed8 = this8 ^ prev8;
+    changed16 = this16 ^ prev16;
+
+    if (changed8 || changed16)
+    {
+      prev8 = this8;
+      prev16 = this16;
+
+      thisevent = events.GetWriteSlot();
+
+      if (NULL == thisevent)
+      {
+        events_dropped++;
+        FLIGHT_Record(FLIGHT_EV_REPORT_DROP, 'G', (uint16_t) events_dropped);
+      }
+      else
+      {
+        thisevent->timestamp = Timer_Query_ISR();
+        thisevent->changed8 = changed8;
+        thisevent->level8 = this8;
+        thisevent->changed16 = changed16;
+        thisevent->level16 = this16;
+
+        // Publish the event.
+        events.Publish();
+      }
+
+      events_total++;
+    }
+  }
+}
+
+
+// This is called to handle user commands.
+
+void NeurAppEvent_GPIOLog::HandleCommand(uint8_t opcode,
+  uint16_t arg1, uint16_t arg2)
+{
+  switch (opcode)
+  {
+    case NEURAPP_GPIOLOG_OP_MASK8:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        mask8 = (uint8_t) (arg1 & 0xff);
+        ResampleInputs();
+      }
+      break;
+
+    case NEURAPP_GPIOLOG_OP_MASK16:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        mask16 = arg1;
+        ResampleInputs();
+      }
+      break;
+
+    case NEURAPP_GPIOLOG_OP_RUN:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        // Take a fresh baseline, so stale levels don't look like edges.
+        if ( (0 != arg1) && (!is_running) )
+          ResampleInputs();
+        is_running = (0 != arg1);
+      }
+      break;
+
+    case NEURAPP_GPIOLOG_OP_FORMAT:
+      verbose = (0 != arg1);
+      break;
+
+    case NEURAPP_GPIOLOG_OP_QUERY:
+      status_wanted = true;
+      break;
+
+    default:
+      break;
+  }
+}
+
+
+// This is called from within an atomic lock prior to report generation.
+
+void NeurAppEvent_GPIOLog::SaveReportState_Fast(void)
+{
+  saved_mark = events.GetMark();
+  saved_total = events_total;
+  saved_dropped = events_dropped;
+}
+
+
+// This is called from the polling loop to generate report text.
+// Priority is status, then drop notices, then buffered events.
+
+bool NeurAppEvent_GPIOLog::MakeReportString(neurapp_report_buf_t &buffer)
+{
+  bool result;
+  uint8_t bidx;
+  neurapp_gpiolog_event_t *thisevent;
+
+  result = false;
+
+  if (status_wanted)
+  {
+    status_wanted = false;
+
+    // "GQ tttttttt dddddddd\r\n"
+    buffer[0] = 'G';
+    buffer[1] = 'Q';
+    buffer[2] = ' ';
+    UTIL_WriteHex(buffer + 3, saved_total, 8);
+    buffer[11] = ' ';
+    UTIL_WriteHex(buffer + 12, saved_dropped, 8);
+    buffer[20] = '\r';
+    buffer[21] = '\n';
+    buffer[22] = 0;
+
+    result = true;
+  }
+  else if (saved_dropped != reported_dropped)
+  {
+    reported_dropped = saved_dropped;
+
+    // "GX dddddddd\r\n"
+    buffer[0] = 'G';
+    buffer[1] = 'X';
+    buffer[2] = ' ';
+    UTIL_WriteHex(buffer + 3, saved_dropped, 8);
+    buffer[11] = '\r';
+    buffer[12] = '\n';
+    buffer[13] = 0;
+
+    result = true;
+  }
+  else if (!events.HasReachedMark(saved_mark))
+  {
+    thisevent = events.GetReadSlot();
+
+    if (verbose)
+    {
+      // "Edge at tttttttt:  changed cccccc  levels llllll\r\n"
+      strncpy_P(buffer, PSTR("Edge at "), NEURAPP_REPORT_BUFFER_CHARS);
+      UTIL_WriteHex(buffer + 8, thisevent->timestamp, 8);
+      strncpy_P(buffer + 16, PSTR(":  changed "),
+        NEURAPP_REPORT_BUFFER_CHARS - 16);
+      bidx = 27;
+      UTIL_WriteHex(buffer + bidx, thisevent->changed16, 4);
+      UTIL_WriteHex(buffer + bidx + 4, thisevent->changed8, 2);
+      strncpy_P(buffer + bidx + 6, PSTR("  levels "),
+        NEURAPP_REPORT_BUFFER_CHARS - (bidx + 6));
+      bidx += 15;
+    }
+    else
+    {
+      // "G tttttttt cccccc llllll\r\n"
+      buffer[0] = 'G';
+      buffer[1] = ' ';
+      UTIL_WriteHex(buffer + 2, thisevent->timestamp, 8);
+      buffer[10] = ' ';
+      bidx = 11;
+      UTIL_WriteHex(buffer + bidx, thisevent->changed16, 4);
+      UTIL_WriteHex(buffer + bidx + 4, thisevent->changed8, 2);
+      buffer[bidx + 6] = ' ';
+      bidx += 7;
+    }
+
+    UTIL_WriteHex(buffer + bidx, thisevent->level16, 4);
+    UTIL_WriteHex(buffer + bidx + 4, thisevent->level8, 2);
+    buffer[bidx + 6] = '\r';
+    buffer[bidx + 7] = '\n';
+    buffer[bidx + 8] = 0;
+
+    // Release the slot. This is a single-byte write, so it's atomic.
+    events.Release();
+
+    result = true;
+  }
+
+  return result;
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,149 @@
+// Attention Circuits Control Laboratory - Object-oriented firmware framework
+// Ready-made event handler - GPIO edge logging.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+// NOTE - Include "neurapp-oo.h" before including this.
+
+
+//
+// Notes
+
+// This samples the IO8 and IO16 input banks every tick, compares them
+// against the previous sample, and queues an event for every tick where a
+// monitored input changed.
+//
+// Bits 0..7 of reported masks and levels are IO8, and bits 8..23 are IO16.
+// The 328p has no IO16 bank, so those bits always read as 0 there.
+//
+// Report formats (all numbers are hexadecimal):
+//
+// Compact:  "G tttttttt cccccc llllll"
+// Verbose:  "Edge at tttttttt:  changed cccccc  levels llllll"
+//   "t" is the tick the change was seen on, "c" is the mask of inputs that
+//   changed, and "l" is the new level of all monitored inputs.
+// "GX dddddddd"  Events were dropped (total dropped so far).
+// "GQ ..."       Status report (see "GLQ").
+//
+// Latency and rate limits:
+//
+// - Inputs are sampled once per tick, so an edge is timestamped between 0
+// and 1 tick late, plus ISR entry latency. Pulses shorter than one tick may
+// be missed, and several edges on one input within a tick look like one
+// (or no) change. The worst-case detection latency is one tick plus the
+// longest time interrupts are locked out.
+//
+// - Reports leave through the UART. A compact report is 26 characters;
+// at 10 bits per character that's about 440 events/sec at 115200 baud and
+// about 1900 events/sec at 500000 baud. Verbose reports are 50 characters,
+// halving those rates. Bursts up to the event buffer depth are absorbed;
+// beyond that, events are dropped and counted.
+//
+// - An event spends at most (buffer depth x report time) in the buffer
+// before being reported, plus however long the polling loop is stalled.
+
+
+//
+// Macros
+
+// Event buffer depth. This must be a power of 2 and no more than 128.
+// Each slot costs 10 bytes.
+#ifdef __AVR_ATmega2560__
+#define NEURAPP_GPIOLOG_EVENT_BITS 6
+#else
+#define NEURAPP_GPIOLOG_EVENT_BITS 4
+#endif
+#define NEURAPP_GPIOLOG_EVENT_SLOTS (1 << NEURAPP_GPIOLOG_EVENT_BITS)
+
+// Opcodes for this handler's commands.
+#define NEURAPP_GPIOLOG_OP_MASK8 1
+#define NEURAPP_GPIOLOG_OP_MASK16 2
+#define NEURAPP_GPIOLOG_OP_RUN 3
+#define NEURAPP_GPIOLOG_OP_FORMAT 4
+#define NEURAPP_GPIOLOG_OP_QUERY 5
+
+
+
+//
+// Typedefs
+
+// One buffered edge event.
+typedef struct
+{
+  uint32_t timestamp;
+  uint8_t changed8;
+  uint8_t level8;
+  uint16_t changed16;
+  uint16_t level16;
+} neurapp_gpiolog_event_t;
+
+
+
+//
+// Global Variables
+
+// Command list for this handler.
+// This lives in program memory; use it as the "cmdlist_P" entry in the
+// event handler table, e.g. { &handler, NULL, neurapp_gpiolog_cmds }.
+extern const neurapp_cmd_list_row_P_t neurapp_gpiolog_cmds[];
+
+
+
+//
+// Classes
+
+
+// GPIO edge logging event handler.
+// Pins still have to be configured as inputs (IO8_SelectOutputs() etc.);
+// this handler only reads them.
+
+class NeurAppEvent_GPIOLog : public NeurAppEvent_Base
+{
+protected:
+  // Configuration.
+  uint8_t mask8;
+  uint16_t mask16;
+  volatile bool is_running;
+  bool verbose;
+
+  // Previous sample.
+  uint8_t prev8;
+  uint16_t prev16;
+
+  // Event buffer. The tick handler writes, the polling loop reads.
+  NeurAVR_Ring<neurapp_gpiolog_event_t, NEURAPP_GPIOLOG_EVENT_SLOTS> events;
+
+  // Statistics.
+  volatile uint32_t events_total;
+  volatile uint32_t events_dropped;
+
+  // Report state, copied in SaveReportState_Fast().
+  uint8_t saved_mark;
+  uint32_t saved_total;
+  uint32_t saved_dropped;
+  uint32_t reported_dropped;
+  bool status_wanted;
+
+  // This takes a new baseline sample without reporting changes.
+  void ResampleInputs(void);
+
+public:
+  NeurAppEvent_GPIOLog(void);
+  // Default destructor is fine.
+
+  virtual PGM_P GetHelpScreen(void);
+
+  virtual void InitState(void);
+
+  virtual void HandleTick_ISR(void);
+
+  virtual void HandleCommand(uint8_t opcode, uint16_t arg1, uint16_t arg2);
+
+  virtual void SaveReportState_Fast(void);
+  virtual bool MakeReportString(neurapp_report_buf_t &buffer);
+};
+
+
+//
+// This is the end of the file.
@@ -26,13 +26,17 @@
 // Private Constants
 
 // Built-in commands.
-neurapp_cmdname_t cmd_help  = { 'H', 'L', 'P' };
-neurapp_cmdname_t cmd_ident = { 'I', 'D', 'Q' };
-neurapp_cmdname_t cmd_reset = { 'I', 'N', 'I' };
-neurapp_cmdname_t cmd_echo  = { 'E', 'C', 'H' };
+// These live in program memory; use CommandMatch_P() to test them.
+const char cmd_help[NEURAPP_CMD_CHARS]  PROGMEM = { 'H', 'L', 'P' };
+const char cmd_ident[NEURAPP_CMD_CHARS] PROGMEM = { 'I', 'D', 'Q' };
+const char cmd_reset[NEURAPP_CMD_CHARS] PROGMEM = { 'I', 'N', 'I' };
+const char cmd_echo[NEURAPP_CMD_CHARS]  PROGMEM = { 'E', 'C', 'H' };
+const char cmd_ping[NEURAPP_CMD_CHARS]  PROGMEM = { 'P', 'N', 'G' };
 #if NEURAPP_DEBUG_AVAILABLE
-neurapp_cmdname_t cmd_debug_mem     = { 'Z', 'Z', 'M' };
-neurapp_cmdname_t cmd_debug_evticks = { 'Z', 'Z', 'E' };
+const char cmd_debug_mem[NEURAPP_CMD_CHARS]     PROGMEM = { 'Z', 'Z', 'M' };
+const char cmd_debug_evticks[NEURAPP_CMD_CHARS] PROGMEM = { 'Z', 'Z', 'E' };
+const char cmd_debug_latency[NEURAPP_CMD_CHARS] PROGMEM = { 'Z', 'Z', 'L' };
+const char cmd_debug_flight[NEURAPP_CMD_CHARS]  PROGMEM = { 'Z', 'Z', 'F' };
 #endif
 
 // Help screen for built-in commands.
@@ -43,17 +47,33 @@ const char neurapp_builtin_help[] PROGMEM =
   "  ECH 1/0:  Start/stop echoing typed characters back to the host.\r\n"
   "  IDQ    :  Device identification string query.\r\n"
   "  INI    :  Reinitialize (reset clock and idle events).\r\n"
+  "  PNG n  :  Clock sync ping. Replies \"PNG n rx tx\" (hex RTC ticks).\r\n"
 #if NEURAPP_DEBUG_AVAILABLE
   "\r\n"
   "Built-in debugging commands:\r\n"
   "\r\n"
-  "  ZZM    :  Report the amount of free memory.\r\n"
+  "  ZZM    :  Report the amount of free memory (now and lowest seen).\r\n"
   "  ZZE    :  Report accumulated timeslice overruns for event handlers.\r\n"
+  "  ZZL    :  Report command wait and run times (RTC ticks).\r\n"
+  "  ZZF    :  Dump the flight recorder (recent framework events).\r\n"
 #endif
   ;
 
 
 
+//
+//
+// Private Macros
+
+// Reads one byte of a flash-resident table.
+#if USE_FAR_FLASH_POINTERS
+#define NEURAPP_READ_FLASH_BYTE(X) pgm_read_byte_far(X)
+#else
+#define NEURAPP_READ_FLASH_BYTE(X) pgm_read_byte_near(X)
+#endif
+
+
+
 //
 //
 // Private Enums
@@ -73,6 +93,34 @@ enum parse_state_t
 
 
 
+//
+//
+// Private Global Variables
+
+#if NEURAPP_INCREMENTAL_PARSE
+// Application that receives characters from the UART receive hook.
+// There's normally only one.
+NeurApp_Base *neurapp_recv_target = NULL;
+#endif
+
+
+
+//
+//
+// Private Functions
+
+#if NEURAPP_INCREMENTAL_PARSE
+// UART receive hook. This forwards characters to the application.
+
+void NeurApp_RecvHook_ISR(char recvchar)
+{
+  if (NULL != neurapp_recv_target)
+    neurapp_recv_target->HandleRecvChar_ISR(recvchar);
+}
+#endif
+
+
+
 //
 //
 // Classes
@@ -199,6 +247,10 @@ void NeurApp_Parser::ResetState(void)
   this_arg1 = 0;
   this_arg2 = 0;
   argsfound = 0;
+
+  parse_state = PSTATE_PREAMBLE;
+  opidx = 0;
+  saw_question = false;
 }
 
 
@@ -207,150 +259,164 @@ void NeurApp_Parser::ResetState(void)
 
 bool NeurApp_Parser::ParseInputLine(char *rawline)
 {
-  bool was_ok;
-  parse_state_t state;
-  int rawidx, opidx;
+  int rawidx;
   char thischar;
-  bool saw_question;
-  bool is_letter, is_digit, is_white;
-  uint16_t scratch;
 
   // Force state to known-clean values.
   ResetState();
 
-  // Initialize parsing.
-  was_ok = true;
-  state = PSTATE_PREAMBLE;
-  opidx = 0;
-  saw_question = false;
+  // Scan the input string.
+  for (rawidx = 0; 0 != (thischar = rawline[rawidx]); rawidx++)
+    ParseChar(thischar);
+
+  return FinishLine();
+}
 
 
-  // Scan the input string.
+// Processes one character of input.
+// This doesn't handle end-of-line characters; call FinishLine() for those.
 
-  for (rawidx = 0; 0 != (thischar = rawline[rawidx]); rawidx++)
-  {
-    // Figure out what type of character this is.
-    // Convert to upper case while we're at it.
+void NeurApp_Parser::ParseChar(char thischar)
+{
+  parse_state_t state;
+  bool is_letter, is_digit, is_white;
+  uint16_t scratch;
 
-    is_letter = false;
-    is_digit = false;
-    is_white = false;
+  state = (parse_state_t) parse_state;
 
-    if ( ('a' <= thischar) && ('z' >= thischar) )
-    {
-      is_letter = true;
-      thischar -= 'a';
-      thischar += 'A';
-    }
-    else if ( ('A' <= thischar) && ('Z' >= thischar) )
-      is_letter = true;
-    else if ( ('0' <= thischar) && ('9' >= thischar) )
-      is_digit = true;
-    else if (' ' >= thischar)
-      is_white = true;
-    else if ('?' == thischar)
-      saw_question = true;
 
+  // Figure out what type of character this is.
+  // Convert to upper case while we're at it.
 
-    // Update parsing state.
-    // Don't worry about character counts in this step.
+  is_letter = false;
+  is_digit = false;
+  is_white = false;
 
-    switch (state)
-    {
-      case PSTATE_PREAMBLE:
-        if (is_letter)
-          state = PSTATE_OPCODE;
-        else if (!is_white)
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_OPCODE:
-        if (is_white)
-          state = PSTATE_FIRSTGAP;
-        else if (!is_letter)
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_FIRSTGAP:
-        if (is_digit)
-          state = PSTATE_FIRSTARG;
-        else if (!is_white)
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_FIRSTARG:
-        if (is_white)
-          state = PSTATE_SECONDGAP;
-        else if (!is_digit)
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_SECONDGAP:
-        if (is_digit)
-          state = PSTATE_SECONDARG;
-        else if (!is_white)
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_SECONDARG:
-        if (is_white)
-          state = PSTATE_TAIL;
-        else if (!is_digit)
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_TAIL:
-        if (!is_white)
-          state = PSTATE_ERROR;
-        break;
-
-      default:
-        // Already in error state.
-        // Nothing to do.
-        break;
-    }
+  if ( ('a' <= thischar) && ('z' >= thischar) )
+  {
+    is_letter = true;
+    thischar -= 'a';
+    thischar += 'A';
+  }
+  else if ( ('A' <= thischar) && ('Z' >= thischar) )
+    is_letter = true;
+  else if ( ('0' <= thischar) && ('9' >= thischar) )
+    is_digit = true;
+  else if (' ' >= thischar)
+    is_white = true;
+  else if ('?' == thischar)
+    saw_question = true;
 
 
-    // Now that we know what state we're in, update data.
+  // Update parsing state.
+  // Don't worry about character counts in this step.
 
-    switch (state)
-    {
-      case PSTATE_OPCODE:
-        have_command = true;
-        if (opidx < NEURAPP_CMD_CHARS)
-        {
-          this_cmdname[opidx] = thischar;
-          opidx++;
-        }
-        else
-          state = PSTATE_ERROR;
-        break;
-
-      case PSTATE_FIRSTARG:
-        argsfound = 1;
-        this_arg1 *= 10;
-        scratch = thischar;
-        scratch -= '0';
-        this_arg1 += scratch;
-        break;
-
-      case PSTATE_SECONDARG:
-        argsfound = 2;
-        this_arg2 *= 10;
-        scratch = thischar;
-        scratch -= '0';
-        this_arg2 += scratch;
-        break;
-
-      default:
-        // Whatever this is, there's nothing more to do with it.
-        break;
-    }
+  switch (state)
+  {
+    case PSTATE_PREAMBLE:
+      if (is_letter)
+        state = PSTATE_OPCODE;
+      else if (!is_white)
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_OPCODE:
+      if (is_white)
+        state = PSTATE_FIRSTGAP;
+      else if (!is_letter)
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_FIRSTGAP:
+      if (is_digit)
+        state = PSTATE_FIRSTARG;
+      else if (!is_white)
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_FIRSTARG:
+      if (is_white)
+        state = PSTATE_SECONDGAP;
+      else if (!is_digit)
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_SECONDGAP:
+      if (is_digit)
+        state = PSTATE_SECONDARG;
+      else if (!is_white)
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_SECONDARG:
+      if (is_white)
+        state = PSTATE_TAIL;
+      else if (!is_digit)
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_TAIL:
+      if (!is_white)
+        state = PSTATE_ERROR;
+      break;
+
+    default:
+      // Already in error state.
+      // Nothing to do.
+      break;
   }
 
+
+  // Now that we know what state we're in, update data.
+
+  switch (state)
+  {
+    case PSTATE_OPCODE:
+      have_command = true;
+      if (opidx < NEURAPP_CMD_CHARS)
+      {
+        this_cmdname[opidx] = thischar;
+        opidx++;
+      }
+      else
+        state = PSTATE_ERROR;
+      break;
+
+    case PSTATE_FIRSTARG:
+      argsfound = 1;
+      this_arg1 *= 10;
+      scratch = thischar;
+      scratch -= '0';
+      this_arg1 += scratch;
+      break;
+
+    case PSTATE_SECONDARG:
+      argsfound = 2;
+      this_arg2 *= 10;
+      scratch = thischar;
+      scratch -= '0';
+      this_arg2 += scratch;
+      break;
+
+    default:
+      // Whatever this is, there's nothing more to do with it.
+      break;
+  }
+
+  parse_state = state;
+}
+
+
+// Finishes parsing the current line.
+// Returns true if ok or empty, and false if parsing failed.
+
+bool NeurApp_Parser::FinishLine(void)
+{
+  bool was_ok;
+  int cidx;
+
   // If we wound up in the error state, report it as an error.
-  if (PSTATE_ERROR == state)
-    was_ok = false;
+  was_ok = (PSTATE_ERROR != parse_state);
 
 
   // Special-case "?".
@@ -365,8 +431,8 @@ bool NeurApp_Parser::ParseInputLine(char *rawline)
     have_command = true;
     was_ok = true;
 
-    for (opidx = 0; opidx < NEURAPP_CMD_CHARS; opidx++)
-      this_cmdname[opidx] = cmd_help[opidx];
+    for (cidx = 0; cidx < NEURAPP_CMD_CHARS; cidx++)
+      this_cmdname[cidx] = NEURAPP_READ_FLASH_BYTE(cmd_help + cidx);
   }
 
 
@@ -435,6 +501,25 @@ bool NeurApp_Base::CommandMatch(neurapp_cmdname_t &first,
 }
 
 
+// This is a version of CommandMatch() where the second name is stored
+// in program memory.
+
+bool NeurApp_Base::CommandMatch_P(neurapp_cmdname_t &first,
+  const char *second)
+{
+  bool result;
+  int cidx;
+
+  result = true;
+
+  for (cidx = 0; cidx < NEURAPP_CMD_CHARS; cidx++)
+    if (first[cidx] != (char) NEURAPP_READ_FLASH_BYTE(second + cidx))
+      result = false;
+
+  return result;
+}
+
+
 // This writes a short "bad command, type HLP for help" message to the UART.
 
 void NeurApp_Base::PrintShortHelp(char *rawline)
@@ -467,6 +552,277 @@ void NeurApp_Base::PrintShortHelp(char *rawline)
 }
 
 
+// This answers a clock synchronization ping.
+// The receive timestamp is when the ping's end-of-line arrived; the
+// transmit timestamp is taken just before the reply starts sending.
+
+void NeurApp_Base::SendPingReply(uint16_t sequence, uint32_t received_time)
+{
+  uint32_t transmit_time;
+
+  // Drain anything already queued (including the previous reply), so
+  // that the reply's first character goes out right after we stamp it.
+  UART_WaitForSendDone();
+
+  transmit_time = Timer_Query();
+
+  // "PNG ssss rrrrrrrr tttttttt\r\n"
+  ping_reply[0] = 'P';
+  ping_reply[1] = 'N';
+  ping_reply[2] = 'G';
+  ping_reply[3] = ' ';
+  UTIL_WriteHex(ping_reply + 4, sequence, 4);
+  ping_reply[8] = ' ';
+  UTIL_WriteHex(ping_reply + 9, received_time, 8);
+  ping_reply[17] = ' ';
+  UTIL_WriteHex(ping_reply + 18, transmit_time, 8);
+  ping_reply[26] = '\r';
+  ping_reply[27] = '\n';
+  ping_reply[28] = 0;
+
+  UART_QueueSend(ping_reply);
+}
+
+
+#if NEURAPP_DEBUG_AVAILABLE
+
+// This adds one command's wait and run times to its statistics.
+// Intervals that went backwards (the clock was reset) count as zero.
+
+void NeurApp_Base::RecordCommandStats(neurapp_cmdname_t &cmd,
+  uint32_t wait_ticks, uint32_t run_ticks)
+{
+  int sidx, cidx;
+  neurapp_cmd_stats_t *thisslot;
+
+  if (0 > (int32_t) wait_ticks)
+    wait_ticks = 0;
+  if (0 > (int32_t) run_ticks)
+    run_ticks = 0;
+
+  // Find this command's slot, or the first free one.
+  thisslot = NULL;
+  for (sidx = 0; (NULL == thisslot) && (sidx < NEURAPP_DEBUG_CMD_SLOTS);
+    sidx++)
+  {
+    if (0 == cmd_stats[sidx].count)
+    {
+      thisslot = &(cmd_stats[sidx]);
+      for (cidx = 0; cidx < NEURAPP_CMD_CHARS; cidx++)
+        thisslot->name[cidx] = cmd[cidx];
+    }
+    else if (CommandMatch(cmd, cmd_stats[sidx].name))
+      thisslot = &(cmd_stats[sidx]);
+  }
+
+  if (NULL == thisslot)
+  {
+    if (0xffff > cmd_stats_untracked)
+      cmd_stats_untracked++;
+  }
+  else if (0xffff > thisslot->count)
+  {
+    thisslot->count++;
+
+    thisslot->wait_total += wait_ticks;
+    if (0xffff < wait_ticks)
+      wait_ticks = 0xffff;
+    if (thisslot->wait_max < wait_ticks)
+      thisslot->wait_max = wait_ticks;
+
+    thisslot->run_total += run_ticks;
+    if (0xffff < run_ticks)
+      run_ticks = 0xffff;
+    if (thisslot->run_max < run_ticks)
+      thisslot->run_max = run_ticks;
+  }
+}
+
+
+// This writes the flight recorder's contents to the UART, oldest first.
+// Records that get overwritten while this is running are noted as lost.
+
+void NeurApp_Base::DumpFlightRecorder(neurapp_report_buf_t &scratch)
+{
+  uint16_t sequence, first, end;
+  flight_record_t thisrecord;
+  unsigned long timestamp;
+  char reason[10];
+
+  FLIGHT_GetRange(first, end);
+
+  snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+    PSTR("Flight recorder:  %u events, %u resets, reset flags %02x\r\n"),
+    (unsigned) (end - first), (unsigned) FLIGHT_GetResetCount(),
+    (unsigned) FLIGHT_GetResetFlags() );
+  UART_QueueSend(scratch);
+  UART_WaitForSendDone();
+
+  for (sequence = first; sequence != end; sequence++)
+  {
+    if (!FLIGHT_GetRecord(sequence, thisrecord))
+      snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+        PSTR("%5u  (overwritten)\r\n"), (unsigned) sequence );
+    else
+    {
+      timestamp = thisrecord.timestamp;
+
+      switch (thisrecord.event)
+      {
+        case FLIGHT_EV_RESET:
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  reset      flags %02x  count %u\r\n"),
+            (unsigned) sequence, timestamp,
+            (unsigned) thisrecord.detail, (unsigned) thisrecord.data );
+          break;
+
+        case FLIGHT_EV_COMMAND:
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  command    %c%c%c\r\n"),
+            (unsigned) sequence, timestamp,
+            (char) thisrecord.detail, (char) (thisrecord.data >> 8),
+            (char) (thisrecord.data & 0xff) );
+          break;
+
+        case FLIGHT_EV_REPORT_DROP:
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  drop       %c  total %u\r\n"),
+            (unsigned) sequence, timestamp,
+            (char) thisrecord.detail, (unsigned) thisrecord.data );
+          break;
+
+        case FLIGHT_EV_TICK_OVERRUN:
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  overrun    total %u\r\n"),
+            (unsigned) sequence, timestamp, (unsigned) thisrecord.data );
+          break;
+
+        case FLIGHT_EV_UART_DROP:
+          if (FLIGHT_UART_LINE_LOST == thisrecord.detail)
+            strncpy_P(reason, PSTR("line"), sizeof(reason));
+          else if (FLIGHT_UART_LINE_TRUNCATED == thisrecord.detail)
+            strncpy_P(reason, PSTR("truncated"), sizeof(reason));
+          else
+            strncpy_P(reason, PSTR("command"), sizeof(reason));
+
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  uart drop  %s\r\n"),
+            (unsigned) sequence, timestamp, reason );
+          break;
+
+        case FLIGHT_EV_ADC_OVERRUN:
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  adc late   %c  total %u\r\n"),
+            (unsigned) sequence, timestamp,
+            (char) thisrecord.detail, (unsigned) thisrecord.data );
+          break;
+
+        default:
+          snprintf_P( scratch, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("%5u %10lu  event %3u  %3u  %5u\r\n"),
+            (unsigned) sequence, timestamp, (unsigned) thisrecord.event,
+            (unsigned) thisrecord.detail, (unsigned) thisrecord.data );
+          break;
+      }
+    }
+
+    UART_QueueSend(scratch);
+    UART_WaitForSendDone();
+  }
+
+  strncpy_P( scratch, PSTR("End of flight recorder.\r\n"),
+    NEURAPP_REPORT_BUFFER_CHARS );
+  UART_QueueSend(scratch);
+  UART_WaitForSendDone();
+}
+
+#endif
+
+
+#if NEURAPP_INCREMENTAL_PARSE
+
+// This removes the oldest queued command record, if any.
+// Returns false if the queue was empty.
+
+bool NeurApp_Base::GetNextCommand(neurapp_cmd_record_t &record)
+{
+  bool result;
+
+  // The receive interrupt only writes a record before publishing it, so
+  // no lock is needed.
+  result = cmdqueue.Pop(record);
+
+  return result;
+}
+
+
+// The UART receive hook calls this with each received character.
+// Completed lines are parsed by the time the end-of-line arrives, and are
+// queued as command records. If the queue is full, the command is dropped.
+
+void NeurApp_Base::HandleRecvChar_ISR(char recvchar)
+{
+  neurapp_cmd_record_t *thisrecord;
+  int argcount;
+  bool parse_ok;
+  uint8_t tidx;
+
+  if (recv_saw_cr && ('\n' == recvchar))
+  {
+    // Ignore the "LF" in "CRLF".
+  }
+  else if (('\n' == recvchar) || ('\r' == recvchar))
+  {
+    parse_ok = recv_parser.FinishLine();
+    thisrecord = cmdqueue.GetWriteSlot();
+
+    // Empty lines only matter if they're being echoed.
+    if (NULL != thisrecord)
+    {
+      thisrecord->timestamp = Timer_Query_ISR();
+
+      for (tidx = 0; tidx < recv_text_count; tidx++)
+        thisrecord->text[tidx] = recv_text[tidx];
+      thisrecord->text[tidx] = 0;
+
+      if (recv_parser.WasNewCommand(thisrecord->name,
+        thisrecord->arg1, thisrecord->arg2, argcount))
+      {
+        thisrecord->argcount = argcount;
+        thisrecord->parse_ok = true;
+        cmdqueue.Publish();
+      }
+      else if ( (!parse_ok) || echo_state )
+      {
+        thisrecord->argcount = -1;
+        thisrecord->parse_ok = parse_ok;
+        cmdqueue.Publish();
+      }
+    }
+    else
+      FLIGHT_Record_ISR(FLIGHT_EV_UART_DROP, FLIGHT_UART_COMMAND_LOST, 0);
+
+    recv_parser.ResetState();
+    recv_text_count = 0;
+  }
+  else
+  {
+    recv_parser.ParseChar(recvchar);
+
+    // Keep as much of the raw text as fits, for echoing.
+    if (recv_text_count < (NEURAPP_CMD_TEXT_CHARS - 1))
+    {
+      recv_text[recv_text_count] = recvchar;
+      recv_text_count++;
+    }
+  }
+
+  recv_saw_cr = ('\r' == recvchar);
+}
+
+#endif
+
+
 // User-defined only-on-reset initialization.
 
 void NeurApp_Base::UserInitHardware(void)
@@ -519,6 +875,12 @@ NeurApp_Base::NeurApp_Base(void)
   parser.ResetState();
   echo_state = NEURAPP_DEFAULT_ECHO;
 
+#if NEURAPP_INCREMENTAL_PARSE
+  recv_parser.ResetState();
+  recv_saw_cr = false;
+  recv_text_count = 0;
+#endif
+
   event_lut = NULL;
 }
 
@@ -544,6 +906,7 @@ void NeurApp_Base::DoInitialSetup(neurapp_messagedefs_t messagedefs,
   // Initialize ISR reentrant detection.
   in_isr = false;
   long_tasks_running = false;
+  overrun_recorded = false;
 
   // Perform user-specified hardware initialization.
   UserInitHardware();
@@ -563,6 +926,12 @@ void NeurApp_Base::DoInitialSetup(neurapp_messagedefs_t messagedefs,
 
   // Do a soft-reset of state.
   ReInitState();
+
+#if NEURAPP_INCREMENTAL_PARSE
+  // Start parsing input as it arrives.
+  neurapp_recv_target = this;
+  UART_RegisterRecvHook(&NeurApp_RecvHook_ISR);
+#endif
 }
 
 
@@ -578,16 +947,22 @@ void NeurApp_Base::ReInitState(void)
   // This shouldn't be needed, but do it anyways.
   parser.ResetState();
 
+#if NEURAPP_INCREMENTAL_PARSE
+  // Discard partial input and queued commands.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    recv_parser.ResetState();
+    recv_saw_cr = false;
+    recv_text_count = 0;
+    cmdqueue.Reset();
+  }
+#endif
+
 
   // Reset the report queue.
 
-  report_read_ptr = 0;
-  report_write_ptr = 0;
-  report_count = 0;
+  reportqueue.Reset();
   transmit_running = false;
-  // Terminate strings just in case.
-  for (hidx = 0; hidx < NEURAPP_REPORT_QUEUE_LENGTH; hidx++)
-    reportqueue[hidx][0] = 0;
 
   // Force consistency by waiting for any in-progress transmission to finish.
   // FIXME - Is this safe to call here? It blocks.
@@ -603,6 +978,16 @@ void NeurApp_Base::ReInitState(void)
   }
   skipped_ticks_short_total = 0;
   skipped_ticks_long_total = 0;
+
+  for (hidx = 0; hidx < NEURAPP_DEBUG_CMD_SLOTS; hidx++)
+  {
+    cmd_stats[hidx].count = 0;
+    cmd_stats[hidx].wait_total = 0;
+    cmd_stats[hidx].wait_max = 0;
+    cmd_stats[hidx].run_total = 0;
+    cmd_stats[hidx].run_max = 0;
+  }
+  cmd_stats_untracked = 0;
 #endif
 
 
@@ -647,9 +1032,21 @@ void NeurApp_Base::DoUpdate_ISR(void)
     // We expect this to be zero.
     skipped_ticks_short_total++;
 #endif
+
+    if (!overrun_recorded)
+    {
+      overrun_recorded = true;
+#if NEURAPP_DEBUG_AVAILABLE
+      FLIGHT_Record_ISR(FLIGHT_EV_TICK_OVERRUN, 0,
+        (uint16_t) skipped_ticks_short_total);
+#else
+      FLIGHT_Record_ISR(FLIGHT_EV_TICK_OVERRUN, 0, 0);
+#endif
+    }
   }
   else
   {
+    overrun_recorded = false;
     in_isr = true;
 
     NONATOMIC_BLOCK(NONATOMIC_RESTORESTATE)
@@ -668,7 +1065,11 @@ void NeurApp_Base::DoUpdate_ISR(void)
         {
           if ( (1 > hidx)
             || (event_lut[hidx].handler != event_lut[hidx-1].handler) )
+          {
+            SCOPE_RAISE(APP);
             event_lut[hidx].handler->HandleTick_ISR();
+            SCOPE_LOWER(APP);
+          }
 
 #if NEURAPP_DEBUG_AVAILABLE
           // Check for time skew.
@@ -724,7 +1125,11 @@ void NeurApp_Base::DoUpdate_ISR(void)
         {
           if ( (1 > hidx)
             || (event_lut[hidx].handler != event_lut[hidx-1].handler) )
+          {
+            SCOPE_RAISE(POLL);
             event_lut[hidx].handler->HandlePollHighPriority_ISR();
+            SCOPE_LOWER(POLL);
+          }
 
 #if NEURAPP_DEBUG_AVAILABLE
           // Check for time skew.
@@ -760,19 +1165,60 @@ void NeurApp_Base::DoPolling(void)
   neurapp_cmdname_t thiscommand;
   uint16_t arg1, arg2;
   int argcount;
+  bool parse_ok;
+  bool have_command;
   bool bad_command;
   int hidx, cidx;
   bool found;
   neurapp_cmd_list_row_t *cmdlist;
+  const neurapp_cmd_list_row_P_t *cmdlist_P;
+  int8_t thisargcount;
+  uint8_t thisopcode;
+  uint32_t received_time;
+  neurapp_report_buf_t *thisreport;
 #if NEURAPP_DEBUG_AVAILABLE
   neurapp_report_buf_t debug_string;
+  uint32_t dispatch_time;
+  neurapp_cmd_stats_t *thisslot;
+#endif
+#if NEURAPP_INCREMENTAL_PARSE
+  neurapp_cmd_record_t thisrecord;
 #endif
 
 
   //
   // Check for new commands. Process the first one.
 
+#if NEURAPP_INCREMENTAL_PARSE
+  // Commands were already parsed as they arrived. The record keeps the
+  // (possibly truncated) raw text for echoing and error messages.
+  thisline = NULL;
+  parse_ok = false;
+  have_command = false;
+  if (GetNextCommand(thisrecord))
+  {
+    thisline = thisrecord.text;
+
+    parse_ok = thisrecord.parse_ok;
+    have_command = (0 <= thisrecord.argcount);
+    for (cidx = 0; cidx < NEURAPP_CMD_CHARS; cidx++)
+      thiscommand[cidx] = thisrecord.name[cidx];
+    arg1 = thisrecord.arg1;
+    arg2 = thisrecord.arg2;
+    argcount = thisrecord.argcount;
+    received_time = thisrecord.timestamp;
+  }
+#else
   thisline = UART_GetNextLine();
+  if (NULL != thisline)
+  {
+    received_time = UART_GetLineTimestamp();
+    parse_ok = parser.ParseInputLine(thisline);
+    have_command = parse_ok
+      && parser.WasNewCommand(thiscommand, arg1, arg2, argcount);
+  }
+#endif
+
   if (NULL != thisline)
   {
     // Echo the command (if echoing).
@@ -782,17 +1228,23 @@ void NeurApp_Base::DoPolling(void)
       UART_QueueSend_P(PSTR("\r\n"));
     }
 
-    // Try to parse this line.
-    if (parser.ParseInputLine(thisline))
+    if (parse_ok)
     {
       // Parsing input succeeded; we either have a command or an empty line.
-      if (parser.WasNewCommand(thiscommand, arg1, arg2, argcount))
+      if (have_command)
       {
+#if NEURAPP_DEBUG_AVAILABLE
+        dispatch_time = Timer_Query();
+#endif
+
+        FLIGHT_Record( FLIGHT_EV_COMMAND, thiscommand[0],
+          (((uint16_t) thiscommand[1]) << 8) | (uint8_t) thiscommand[2] );
+
         // Check for built-in commands.
 
         bad_command = false;
 
-        if (CommandMatch(thiscommand, cmd_help))
+        if (CommandMatch_P(thiscommand, cmd_help))
         {
           // Display the long-form help screen.
 
@@ -820,31 +1272,44 @@ void NeurApp_Base::DoPolling(void)
           // Done.
           UART_QueueSend_P(PSTR("\r\n"));
         }
-        else if (CommandMatch(thiscommand, cmd_ident))
+        else if (CommandMatch_P(thiscommand, cmd_ident))
         {
           UART_QueueSend_P(message_lut.identity_message);
         }
-        else if (CommandMatch(thiscommand, cmd_reset))
+        else if (CommandMatch_P(thiscommand, cmd_reset))
         {
           ReInitState();
         }
-        else if (CommandMatch(thiscommand, cmd_echo))
+        else if (CommandMatch_P(thiscommand, cmd_echo))
         {
           if (1 == argcount)
             echo_state = (arg1 != 0);
           else
             bad_command = true;
         }
+        else if (CommandMatch_P(thiscommand, cmd_ping))
+        {
+          if (1 == argcount)
+            SendPingReply(arg1, received_time);
+          else
+            bad_command = true;
+        }
 #if NEURAPP_DEBUG_AVAILABLE
-        else if (CommandMatch(thiscommand, cmd_debug_mem))
+        else if (CommandMatch_P(thiscommand, cmd_debug_mem))
         {
           snprintf_P( debug_string, NEURAPP_REPORT_BUFFER_CHARS,
             PSTR("Available memory:  %u bytes\r\n"),
               (unsigned) MCU_GetFreeMemory() );
           UART_QueueSend(debug_string);
           UART_WaitForSendDone();
+
+          snprintf_P( debug_string, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("Lowest free memory:  %u bytes\r\n"),
+              (unsigned) MCU_GetMinFreeMemory() );
+          UART_QueueSend(debug_string);
+          UART_WaitForSendDone();
         }
-        else if (CommandMatch(thiscommand, cmd_debug_evticks))
+        else if (CommandMatch_P(thiscommand, cmd_debug_evticks))
         {
           snprintf_P( debug_string, NEURAPP_REPORT_BUFFER_CHARS,
             PSTR("ISR skipped ticks: %10lu\r\n"),
@@ -883,6 +1348,42 @@ void NeurApp_Base::DoPolling(void)
           UART_QueueSend(debug_string);
           UART_WaitForSendDone();
         }
+        else if (CommandMatch_P(thiscommand, cmd_debug_latency))
+        {
+          for (hidx = 0; hidx < NEURAPP_DEBUG_CMD_SLOTS; hidx++)
+          {
+            thisslot = &(cmd_stats[hidx]);
+            if (0 < thisslot->count)
+            {
+              snprintf_P( debug_string, NEURAPP_REPORT_BUFFER_CHARS,
+                PSTR("%c%c%c x%5u  wait avg %5lu max %5u"
+                  "  run avg %5lu max %5u\r\n"),
+                thisslot->name[0], thisslot->name[1], thisslot->name[2],
+                (unsigned) thisslot->count,
+                (unsigned long) (thisslot->wait_total / thisslot->count),
+                (unsigned) thisslot->wait_max,
+                (unsigned long) (thisslot->run_total / thisslot->count),
+                (unsigned) thisslot->run_max );
+              UART_QueueSend(debug_string);
+              UART_WaitForSendDone();
+            }
+          }
+
+          snprintf_P( debug_string, NEURAPP_REPORT_BUFFER_CHARS,
+            PSTR("Untracked commands: %5u\r\n"),
+            (unsigned) cmd_stats_untracked );
+          UART_QueueSend(debug_string);
+          UART_WaitForSendDone();
+
+          strncpy_P( debug_string, PSTR("End of command latencies.\r\n"),
+            NEURAPP_REPORT_BUFFER_CHARS );
+          UART_QueueSend(debug_string);
+          UART_WaitForSendDone();
+        }
+        else if (CommandMatch_P(thiscommand, cmd_debug_flight))
+        {
+          DumpFlightRecorder(debug_string);
+        }
 #endif
         else
         {
@@ -916,6 +1417,33 @@ void NeurApp_Base::DoPolling(void)
                 }
               }
             }
+
+            // Flash-resident lists need every field fetched with LPM.
+            cmdlist_P = event_lut[hidx].cmdlist_P;
+            if ((!found) && (NULL != cmdlist_P))
+            {
+              for (cidx = 0;
+                (!found) && (0 <= ( thisargcount = (int8_t)
+                  NEURAPP_READ_FLASH_BYTE(&(cmdlist_P[cidx].argcount)) ));
+                cidx++)
+              {
+                if (CommandMatch_P(thiscommand, cmdlist_P[cidx].name))
+                {
+                  found = true;
+                  if (argcount == thisargcount)
+                  {
+                    // This looks like a valid command. Call the handler.
+                    thisopcode =
+                      NEURAPP_READ_FLASH_BYTE(&(cmdlist_P[cidx].opcode));
+                    event_lut[hidx].handler->HandleCommand(
+                      thisopcode, arg1, arg2);
+                  }
+                  else
+                    // Wrong number of arguments.
+                    bad_command = true;
+                }
+              }
+            }
           }
 
           if (!found)
@@ -925,6 +1453,11 @@ void NeurApp_Base::DoPolling(void)
         // Check for unrecognized or malformed commands.
         if (bad_command)
           PrintShortHelp(thisline);
+#if NEURAPP_DEBUG_AVAILABLE
+        else
+          RecordCommandStats(thiscommand, dispatch_time - received_time,
+            Timer_Query() - dispatch_time);
+#endif
       }
     }
     else
@@ -933,8 +1466,10 @@ void NeurApp_Base::DoPolling(void)
       PrintShortHelp(thisline);
     }
 
+#if !NEURAPP_INCREMENTAL_PARSE
     // Whatever happened, we've finished with this line of input.
     UART_DoneWithLine();
+#endif
   }
 
 
@@ -953,7 +1488,7 @@ void NeurApp_Base::DoPolling(void)
 
   // First, send the next pending string if we can.
 
-  if (0 < report_count)
+  if (!reportqueue.IsEmpty())
   {
     if ( ! UART_IsSendInProgress() )
     {
@@ -961,17 +1496,15 @@ void NeurApp_Base::DoPolling(void)
       if (transmit_running)
       {
         transmit_running = false;
-        report_count--;
-        report_read_ptr++;
-        if (report_read_ptr >= NEURAPP_REPORT_QUEUE_LENGTH)
-          report_read_ptr = 0;
+        reportqueue.Release();
       }
 
       // If we still have a pending string, queue it to be transmitted.
-      if (0 < report_count)
+      thisreport = reportqueue.GetReadSlot();
+      if (NULL != thisreport)
       {
         transmit_running = true;
-        UART_QueueSend(reportqueue[report_read_ptr]);
+        UART_QueueSend(*thisreport);
       }
     }
   }
@@ -988,18 +1521,13 @@ void NeurApp_Base::DoPolling(void)
       || (event_lut[hidx].handler != event_lut[hidx-1].handler) )
     {
       // Only ask for new messages while we have free slots for them.
-      while ( (report_count < NEURAPP_REPORT_QUEUE_LENGTH)
-        && event_lut[hidx].handler ->
-          MakeReportString( reportqueue[report_write_ptr] ) )
+      while ( (NULL != (thisreport = reportqueue.GetWriteSlot()))
+        && event_lut[hidx].handler -> MakeReportString(*thisreport) )
       {
         // Make very sure this is NULL-terminated.
-        reportqueue[report_write_ptr][NEURAPP_REPORT_BUFFER_CHARS-1] = 0;
+        (*thisreport)[NEURAPP_REPORT_BUFFER_CHARS-1] = 0;
 
-        // Update the queue pointers.
-        report_count++;
-        report_write_ptr++;
-        if (report_write_ptr >= NEURAPP_REPORT_QUEUE_LENGTH)
-          report_write_ptr = 0;
+        reportqueue.Publish();
       }
     }
   }
@@ -29,9 +29,38 @@
 
 // Number of outgoing message buffers.
 // We can queue up to this many messages before blocking.
-// This should be small. It does not have to be a power of 2.
+// This should be small, and has to be a power of 2.
 #define NEURAPP_REPORT_QUEUE_LENGTH 4
 
+// Enable/disable incremental command parsing.
+// If enabled, received characters are parsed as they arrive (from the UART
+// receive interrupt), and completed commands are queued as compact records
+// instead of as full-length text lines.
+// This is off by default, because it only saves SRAM if the core library
+// is also rebuilt with a smaller UART line ring. Queued records cost
+// NEURAPP_CMD_TEXT_CHARS + 13 bytes each (33 with the defaults, or 264
+// for the queue), plus NEURAPP_CMD_TEXT_CHARS + 1 for the line being
+// received. The UART's line slots (UART_LINE_SIZE + 4 bytes each) go
+// unused but are still allocated; building the core library with
+// UART_LINE_COUNT=2 frees all but two of them. The framework library and
+// the application both have to be built with the same setting.
+#ifndef NEURAPP_INCREMENTAL_PARSE
+#define NEURAPP_INCREMENTAL_PARSE 0
+#endif
+
+// Number of parsed commands that can be queued.
+// This should be a power of 2, so we can do modulo math by masking.
+#define NEURAPP_CMD_QUEUE_LENGTH 8
+
+// Number of raw input characters kept with each queued command, including
+// the terminator. These are used for echoing and error messages; longer
+// lines are truncated. "ABC 65535 65535" fits.
+#define NEURAPP_CMD_TEXT_CHARS 20
+
+// Clock synchronization reply length.
+// "PNG ssss rrrrrrrr tttttttt" plus CRLF and a terminator.
+#define NEURAPP_PING_REPLY_CHARS 29
+
 // Enable/disable debugging commands (profiling etc).
 #define NEURAPP_DEBUG_AVAILABLE 1
 
@@ -39,6 +68,10 @@
 // This is the maximum number of handlers that we record statistics for.
 #define NEURAPP_DEBUG_EV_HANDLER_SLOTS 16
 
+// Number of commands to record latency statistics for.
+// Commands get slots in the order they're first seen.
+#define NEURAPP_DEBUG_CMD_SLOTS 8
+
 
 
 //
@@ -66,6 +99,53 @@ typedef struct
 } neurapp_cmd_list_row_t;
 
 
+// Parsed command record.
+// Incremental parsing queues these instead of raw input lines.
+// Empty lines have an argument count of -1.
+
+typedef struct
+{
+  neurapp_cmdname_t name;
+  uint16_t arg1, arg2;
+  int8_t argcount;
+  bool parse_ok;
+  // RTC timestamp of the end-of-line character.
+  uint32_t timestamp;
+  // The line as received, possibly truncated. This is null-terminated.
+  char text[NEURAPP_CMD_TEXT_CHARS];
+} neurapp_cmd_record_t;
+
+
+// Per-command latency statistics, in RTC ticks.
+// "Wait" is from the end-of-line character arriving to dispatch; "run" is
+// dispatch to the command finishing. Maxima saturate at 65535.
+
+typedef struct
+{
+  neurapp_cmdname_t name;
+  uint16_t count;
+  uint32_t wait_total;
+  uint16_t wait_max;
+  uint32_t run_total;
+  uint16_t run_max;
+} neurapp_cmd_stats_t;
+
+
+// Flash-resident command lookup table row type.
+// Terminated by a negative argument count.
+// This stores the mnemonic by value, so the whole table can live in
+// program memory instead of SRAM. Define tables in global scope with:
+// const neurapp_cmd_list_row_P_t tablename[] PROGMEM =
+//   { { { 'A', 'B', 'C' }, opcode, argcount }, ... };
+
+typedef struct
+{
+  char name[NEURAPP_CMD_CHARS];
+  uint8_t opcode;
+  int8_t argcount;
+} neurapp_cmd_list_row_P_t;
+
+
 // Event handler lookup table row type.
 // Terminated by NULL event handler.
 // NOTE - The same handler may be listed multiple times with different
@@ -73,6 +153,9 @@ typedef struct
 // Those handlers must be in adjacent entries to be recognized as duplicates.
 // If they aren't, InitHardware() and HandleTick_ISR() will be called too
 // often.
+// NOTE - Either command list may be NULL. If both are present, the SRAM
+// list is searched first. Rows written as { handler, cmdlist } still work;
+// the flash list pointer defaults to NULL.
 
 typedef struct
 {
@@ -80,6 +163,8 @@ typedef struct
   class NeurAppEvent_Base *handler;
   // Command list, terminated by a negative argument count.
   neurapp_cmd_list_row_t *cmdlist;
+  // Flash-resident command list, terminated by a negative argument count.
+  const neurapp_cmd_list_row_P_t *cmdlist_P;
 } neurapp_event_handler_row_t;
 
 
@@ -158,6 +243,7 @@ public:
 
 // Low-level command parser.
 // This turns input strings into command/arg1/arg2 tuples.
+// Input can be given a line at a time, or a character at a time.
 
 class NeurApp_Parser
 {
@@ -167,6 +253,11 @@ protected:
   uint16_t this_arg1, this_arg2;
   int argsfound;
 
+  // Partial-line state.
+  uint8_t parse_state;
+  uint8_t opidx;
+  bool saw_question;
+
 public:
   NeurApp_Parser(void);
   // Default destructor is fine.
@@ -177,6 +268,14 @@ public:
   // Returns true if ok or empty, and false if parsing failed.
   bool ParseInputLine(char *rawline);
 
+  // Processes one character of input. This doesn't handle end-of-line
+  // characters; call FinishLine() for those.
+  void ParseChar(char thischar);
+  // Finishes parsing the current line.
+  // Returns true if ok or empty, and false if parsing failed.
+  // Call ResetState() before feeding the next line's characters.
+  bool FinishLine(void);
+
   // Queries the most recent parsed command.
   // Returns true if a command was parsed, false otherwise.
   // Data is only copied if a new command was present.
@@ -202,10 +301,26 @@ protected:
   NeurApp_Parser parser;
   bool echo_state;
 
-  // Outgoing message buffers.
-  int report_read_ptr, report_write_ptr, report_count;
+#if NEURAPP_INCREMENTAL_PARSE
+  // Incremental parsing state. The receive interrupt owns the parser and
+  // produces command records; the polling loop consumes them.
+  NeurApp_Parser recv_parser;
+  bool recv_saw_cr;
+  // Raw text of the line being received.
+  char recv_text[NEURAPP_CMD_TEXT_CHARS];
+  uint8_t recv_text_count;
+  NeurAVR_Ring<neurapp_cmd_record_t, NEURAPP_CMD_QUEUE_LENGTH> cmdqueue;
+#endif
+
+  // Outgoing message buffers. The oldest one is released when the UART
+  // has finished sending it.
   bool transmit_running;
-  neurapp_report_buf_t reportqueue[NEURAPP_REPORT_QUEUE_LENGTH];
+  NeurAVR_Ring<neurapp_report_buf_t, NEURAPP_REPORT_QUEUE_LENGTH>
+    reportqueue;
+
+  // Clock synchronization reply. This has to outlive the call that
+  // queued it, since the UART sends from it directly.
+  char ping_reply[NEURAPP_PING_REPLY_CHARS];
 
   // Debugging/profiling buffers.
 #if NEURAPP_DEBUG_AVAILABLE
@@ -213,12 +328,16 @@ protected:
   uint32_t skipped_ticks_short_total;
   uint32_t ev_handler_long_skipped_ticks[NEURAPP_DEBUG_EV_HANDLER_SLOTS];
   uint32_t skipped_ticks_long_total;
+  neurapp_cmd_stats_t cmd_stats[NEURAPP_DEBUG_CMD_SLOTS];
+  uint16_t cmd_stats_untracked;
 #endif
 
   // Timer interrupt management.
   // This is for handling nested/reentrant interrupts properly.
   volatile bool in_isr;
   volatile bool long_tasks_running;
+  // Only the first tick of each overrun goes to the flight recorder.
+  bool overrun_recorded;
 
 
   //
@@ -226,10 +345,32 @@ protected:
 
   // This returns true if two command names match and false otherwise.
   bool CommandMatch(neurapp_cmdname_t &first, neurapp_cmdname_t &second);
+  // This is a version of CommandMatch() where the second name is stored
+  // in program memory.
+  bool CommandMatch_P(neurapp_cmdname_t &first, const char *second);
 
   // This writes a short "bad command, type HLP for help" message to the UART.
   void PrintShortHelp(char *rawline);
 
+  // This answers a clock synchronization ping.
+  // The receive timestamp is when the ping's end-of-line arrived; the
+  // transmit timestamp is taken just before the reply starts sending.
+  void SendPingReply(uint16_t sequence, uint32_t received_time);
+
+#if NEURAPP_DEBUG_AVAILABLE
+  // This adds one command's wait and run times to its statistics.
+  void RecordCommandStats(neurapp_cmdname_t &cmd,
+    uint32_t wait_ticks, uint32_t run_ticks);
+  // This writes the flight recorder's contents to the UART.
+  void DumpFlightRecorder(neurapp_report_buf_t &scratch);
+#endif
+
+#if NEURAPP_INCREMENTAL_PARSE
+  // This removes the oldest queued command record, if any.
+  // Returns false if the queue was empty.
+  bool GetNextCommand(neurapp_cmd_record_t &record);
+#endif
+
 
   //
   // User-defined initialization functions.
@@ -291,6 +432,12 @@ public:
   // allowed to take longer than one tick, but preempt non-interrupt tasks.
   void DoUpdate_ISR(void);
 
+#if NEURAPP_INCREMENTAL_PARSE
+  // The UART receive hook calls this with each received character.
+  // DoInitialSetup() registers the hook.
+  void HandleRecvChar_ISR(char recvchar);
+#endif
+
   // The main application's polling loop should call this repeatedly.
   // This checks for new commands, passes them to event handlers, checks
   // for reports, and emits any generated reports.
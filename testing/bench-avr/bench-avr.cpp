@@ -0,0 +1,622 @@
+// Attention Circuits Control Laboratory - Library Tests
+// Cycle-count benchmark firmware.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+#include "neurapp-oo.h"
+#include "neurapp-adcstream.h"
+#include "neurapp-gpiolog.h"
+
+#include <avr/sleep.h>
+
+
+
+//
+// Notes
+
+// This measures library entry points and ISRs in CPU cycles, using Timer 1
+// as a free-running /1 counter. It's intended to be run under a simulator
+// (see "run-bench.sh"), but also works on hardware.
+//
+// Each result is printed as:  "CYC (name) (min) (max)"
+// Min and max are over BENCH_PASSES passes; most entries are deterministic.
+//
+// Function results exclude the indirect call/return used to reach the
+// benchmark wrapper, but include the wrapper's argument setup.
+// ISR results call the vector directly, so they include register
+// save/restore and RETI, but not the 4-5 cycles the hardware takes to
+// vector into the ISR (or the JMP in the vector table).
+// Anything longer than 65535 cycles wraps.
+//
+// NOTE - The RTC is left off. Timer 1 is also the 328p's RTC timer.
+
+
+
+//
+// Macros
+
+#define CPU_SPEED 16000000ul
+#define LINK_BAUD 115200ul
+
+// Number of times each benchmark is run.
+#define BENCH_PASSES 8
+
+// Helper for turning a vector name into a string after expansion.
+#define BENCH_STRINGIFY_INNER(X) #X
+#define BENCH_STRINGIFY(X) BENCH_STRINGIFY_INNER(X)
+
+// RTC and UART vectors.
+#ifdef __AVR_ATmega2560__
+#define BENCH_RTC_VECT TIMER5_COMPA_vect
+#define BENCH_RX_VECT USART0_RX_vect
+#define BENCH_UDRE_VECT USART0_UDRE_vect
+#else
+#define BENCH_RTC_VECT TIMER1_COMPA_vect
+#define BENCH_RX_VECT USART_RX_vect
+#define BENCH_UDRE_VECT USART_UDRE_vect
+#endif
+
+// This calls an ISR directly. RETI sets the I flag, but the instruction
+// after it always executes before any pending interrupt is taken, so the
+// CLI keeps us locked.
+#define BENCH_CALL_VECTOR(X) \
+  __asm volatile ( "call " BENCH_STRINGIFY(X) "\n\tcli\n" ::: "memory" )
+
+
+
+//
+// Constants
+
+const char versionstr[] PROGMEM =
+  "devicetype: Benchmark  subtype: v1  revision: 20201018\r\n";
+
+const char helpscreenstr[] PROGMEM =
+  "Benchmark application.\r\n";
+
+neurapp_messagedefs_t messages =
+{
+  versionstr,
+  helpscreenstr
+};
+
+
+
+//
+// Class Declarations
+
+// Application that starts with echo turned off.
+
+class BenchApp : public NeurApp_Base
+{
+public:
+  BenchApp(void);
+};
+
+
+// One benchmark.
+
+typedef struct
+{
+  PGM_P name;
+  void (*setup)(void);
+  void (*body)(void);
+} bench_row_t;
+
+
+
+//
+// Class Implementations
+
+
+BenchApp::BenchApp(void)
+{
+  echo_state = false;
+}
+
+
+
+//
+// Global Variables
+
+NeurAppEvent_ADCStream adc_handler;
+NeurAppEvent_GPIOLog gpio_handler;
+
+neurapp_event_handler_row_t event_lut[] =
+{
+  { &adc_handler, NULL, neurapp_adcstream_cmds },
+  { &gpio_handler, NULL, neurapp_gpiolog_cmds },
+  { NULL, NULL, NULL }
+};
+
+BenchApp bench_application;
+NeurApp_Parser bench_parser;
+
+// Results go here so that the compiler can't optimize work away.
+volatile uint32_t bench_sink = 0;
+
+char hexbuf[16];
+char sendbuf[] = "A 0001 00001234 8000 8000\r\n";
+char commandbuf[] = "ASR 1234 5678";
+
+// Fixed-point operands. These are variables so that nothing gets folded.
+int16_t fixed_a16 = 0x5a5a;
+int16_t fixed_b16 = -0x3c3c;
+int32_t fixed_a32 = 0x7a5a5a5al;
+int32_t fixed_b32 = -0x1234567l;
+uint32_t fixed_u32 = 0xfedcba98ul;
+uint16_t fixed_divisor = 1000;
+fixed_recip16_t fixed_recip;
+
+
+
+//
+// Functions
+
+
+// Helper functions.
+
+// This empties the transmit buffer the way the UDRE ISR would.
+
+void DrainUART(void)
+{
+  char thischar;
+
+  while (UART_GetNextSendChar_ISR(thischar))
+    bench_sink += thischar;
+}
+
+
+// This feeds a string to the receive buffer.
+
+void FeedUART(const char *text)
+{
+  uint8_t cidx;
+
+  for (cidx = 0; 0 != text[cidx]; cidx++)
+    UART_HandleRecvChar_ISR(text[cidx]);
+}
+
+
+// This resets buffers and the application to a known idle state.
+// Called with interrupts off.
+
+void ResetApp(void)
+{
+  DrainUART();
+  UART_InitBuffers_ISR();
+  while (ADC_IsADCBusy())
+    ;
+  ADC_ReInitBuffer();
+  bench_application.ReInitState();
+  Timer_RegisterCallback(NULL);
+}
+
+
+// This starts ADC streaming and GPIO logging at full rate.
+
+void StartHandlers(void)
+{
+  ResetApp();
+  FeedUART("ASM 63\rASR 1\rASS 1\rGLS 1\r");
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  DrainUART();
+}
+
+
+// This queues a string for transmission, for timing the UDRE ISR.
+
+void StartSend(void)
+{
+  ResetApp();
+  UART_QueueSend(sendbuf);
+}
+
+
+// This is the RTC callback used for the "full tick" ISR benchmark.
+
+void BenchTickCallback(void)
+{
+  bench_application.DoUpdate_ISR();
+}
+
+
+// This hooks the application into the RTC callback.
+
+void StartTickCallback(void)
+{
+  StartHandlers();
+  Timer_RegisterCallback(&BenchTickCallback);
+}
+
+
+
+// Benchmark bodies.
+
+void BenchEmpty(void)
+{
+}
+
+
+void BenchTimerQuery(void)
+{
+  bench_sink += Timer_Query_ISR();
+}
+
+
+void BenchWriteHex(void)
+{
+  UTIL_WriteHex(hexbuf, 0x12345678ul, 8);
+}
+
+
+void BenchRecvChar(void)
+{
+  UART_HandleRecvChar_ISR('X');
+}
+
+
+void BenchRecvEOL(void)
+{
+  UART_HandleRecvChar_ISR('\r');
+}
+
+
+void BenchSendChar(void)
+{
+  char thischar;
+
+  UART_GetNextSendChar_ISR(thischar);
+}
+
+
+void BenchIO8Write(void)
+{
+  IO8_WriteData(0x5a);
+}
+
+
+void BenchIO8Read(void)
+{
+  bench_sink += IO8_ReadData();
+}
+
+
+void BenchADCIdlePoll(void)
+{
+  ADC_HousekeepingPoll();
+}
+
+
+// This stores one finished sample and starts the next conversion.
+// The setup function waits for the first conversion to finish.
+
+void BenchADCSamplePoll(void)
+{
+  ADC_HousekeepingPoll();
+}
+
+
+void StartADCSample(void)
+{
+  ResetApp();
+  ADC_StartConversion(0x03);
+  while (ADC_IsADCBusy())
+    ;
+}
+
+
+void BenchAddSat16(void)
+{
+  bench_sink += FIXED_AddSat16(fixed_a16, fixed_a16);
+}
+
+
+void BenchAddSat32(void)
+{
+  bench_sink += FIXED_AddSat32(fixed_a32, fixed_a32);
+}
+
+
+void BenchMulQ15(void)
+{
+  bench_sink += FIXED_MulQ15(fixed_a16, fixed_b16);
+}
+
+
+void BenchMulQ16(void)
+{
+  bench_sink += FIXED_MulQ16(fixed_a32, fixed_b32);
+}
+
+
+void BenchDivRecip16(void)
+{
+  bench_sink += FIXED_DivRecip16(fixed_a16, fixed_recip);
+}
+
+
+// For comparison with the reciprocal.
+void BenchDivU16(void)
+{
+  bench_sink += ((uint16_t) fixed_a16) / fixed_divisor;
+}
+
+
+void BenchSqrtU32(void)
+{
+  bench_sink += FIXED_SqrtU32(fixed_u32);
+}
+
+
+void BenchLog2U32(void)
+{
+  bench_sink += FIXED_Log2U32(fixed_u32);
+}
+
+
+void StartFixed(void)
+{
+  ResetApp();
+  FIXED_MakeRecip16(fixed_recip, fixed_divisor);
+}
+
+
+void BenchParse(void)
+{
+  bench_parser.ParseInputLine(commandbuf);
+}
+
+
+void BenchUpdate(void)
+{
+  bench_application.DoUpdate_ISR();
+}
+
+
+void BenchPolling(void)
+{
+  bench_application.DoPolling();
+}
+
+
+void BenchFreeMemory(void)
+{
+  bench_sink += MCU_GetFreeMemory();
+}
+
+
+void BenchRTCVector(void)
+{
+  BENCH_CALL_VECTOR(BENCH_RTC_VECT);
+}
+
+
+void BenchRXVector(void)
+{
+  BENCH_CALL_VECTOR(BENCH_RX_VECT);
+}
+
+
+void BenchUDREVector(void)
+{
+  BENCH_CALL_VECTOR(BENCH_UDRE_VECT);
+}
+
+
+
+// Benchmark names.
+// FIXME - PSTR() only works inside a function. This is equivalent.
+// NOTE - Names must not contain spaces or periods.
+
+const char name_empty[] PROGMEM = "empty_call";
+const char name_timerquery[] PROGMEM = "Timer_Query_ISR";
+const char name_writehex[] PROGMEM = "UTIL_WriteHex_8";
+const char name_recvchar[] PROGMEM = "UART_HandleRecvChar_ISR_char";
+const char name_recveol[] PROGMEM = "UART_HandleRecvChar_ISR_eol";
+const char name_sendchar[] PROGMEM = "UART_GetNextSendChar_ISR";
+const char name_io8write[] PROGMEM = "IO8_WriteData";
+const char name_io8read[] PROGMEM = "IO8_ReadData";
+const char name_adcidle[] PROGMEM = "ADC_HousekeepingPoll_idle";
+const char name_adcsample[] PROGMEM = "ADC_HousekeepingPoll_sample";
+const char name_addsat16[] PROGMEM = "FIXED_AddSat16";
+const char name_addsat32[] PROGMEM = "FIXED_AddSat32";
+const char name_mulq15[] PROGMEM = "FIXED_MulQ15";
+const char name_mulq16[] PROGMEM = "FIXED_MulQ16";
+const char name_divrecip[] PROGMEM = "FIXED_DivRecip16";
+const char name_divu16[] PROGMEM = "divide_u16_reference";
+const char name_sqrt[] PROGMEM = "FIXED_SqrtU32";
+const char name_log2[] PROGMEM = "FIXED_Log2U32";
+const char name_parse[] PROGMEM = "ParseInputLine_2args";
+const char name_updateidle[] PROGMEM = "DoUpdate_ISR_idle";
+const char name_updatestream[] PROGMEM = "DoUpdate_ISR_streaming";
+const char name_pollidle[] PROGMEM = "DoPolling_idle";
+const char name_pollstream[] PROGMEM = "DoPolling_streaming";
+const char name_freemem[] PROGMEM = "MCU_GetFreeMemory";
+const char name_rtcbare[] PROGMEM = "ISR_RTC_nocallback";
+const char name_rtcapp[] PROGMEM = "ISR_RTC_app_streaming";
+const char name_rxvect[] PROGMEM = "ISR_UART_RX";
+const char name_udreidle[] PROGMEM = "ISR_UART_UDRE_idle";
+const char name_udresend[] PROGMEM = "ISR_UART_UDRE_send";
+
+
+// Benchmark table.
+// The empty call must be first; it's the overhead that gets subtracted.
+
+bench_row_t bench_list[] =
+{
+  { name_empty, ResetApp, BenchEmpty },
+  { name_timerquery, ResetApp, BenchTimerQuery },
+  { name_writehex, ResetApp, BenchWriteHex },
+  { name_recvchar, ResetApp, BenchRecvChar },
+  { name_recveol, ResetApp, BenchRecvEOL },
+  { name_sendchar, StartSend, BenchSendChar },
+  { name_io8write, ResetApp, BenchIO8Write },
+  { name_io8read, ResetApp, BenchIO8Read },
+  { name_adcidle, ResetApp, BenchADCIdlePoll },
+  { name_adcsample, StartADCSample, BenchADCSamplePoll },
+  { name_addsat16, ResetApp, BenchAddSat16 },
+  { name_addsat32, ResetApp, BenchAddSat32 },
+  { name_mulq15, ResetApp, BenchMulQ15 },
+  { name_mulq16, ResetApp, BenchMulQ16 },
+  { name_divrecip, StartFixed, BenchDivRecip16 },
+  { name_divu16, StartFixed, BenchDivU16 },
+  { name_sqrt, ResetApp, BenchSqrtU32 },
+  { name_log2, ResetApp, BenchLog2U32 },
+  { name_parse, ResetApp, BenchParse },
+  { name_updateidle, ResetApp, BenchUpdate },
+  { name_updatestream, StartHandlers, BenchUpdate },
+  { name_pollidle, ResetApp, BenchPolling },
+  { name_pollstream, StartHandlers, BenchPolling },
+  { name_freemem, ResetApp, BenchFreeMemory },
+  { name_rtcbare, ResetApp, BenchRTCVector },
+  { name_rtcapp, StartTickCallback, BenchRTCVector },
+  { name_rxvect, ResetApp, BenchRXVector },
+  { name_udreidle, ResetApp, BenchUDREVector },
+  { name_udresend, StartSend, BenchUDREVector },
+  { NULL, NULL, NULL }
+};
+
+
+
+// Timing.
+
+// This sets up Timer 1 as a free-running /1 counter with no interrupts.
+
+void StartCycleCounter(void)
+{
+  TIMSK1 = 0;
+  TCCR1A = 0;
+  TCCR1B = 0x01;
+}
+
+
+// This runs one benchmark body with interrupts off and returns the number
+// of cycles it took, including call overhead.
+
+uint16_t TimeCall(void (*body)(void))
+{
+  uint16_t starttime, endtime;
+
+  cli();
+  starttime = TCNT1;
+  (*body)();
+  endtime = TCNT1;
+  cli();
+
+  return endtime - starttime;
+}
+
+
+// This prints one result line.
+
+void PrintResult(PGM_P name, uint16_t mincycles, uint16_t maxcycles)
+{
+  UART_QueueSend_P(PSTR("CYC "));
+  UART_QueueSend_P(name);
+  UART_PrintChar(' ');
+  UART_PrintUInt(mincycles);
+  UART_PrintChar(' ');
+  UART_PrintUInt(maxcycles);
+  UART_QueueSend_P(PSTR("\r\n"));
+  UART_WaitForSendDone();
+}
+
+
+// This runs all benchmarks and prints the results.
+
+void RunBenchmarks(void)
+{
+  uint8_t bidx, pidx;
+  uint16_t overhead;
+  uint16_t thistime, mincycles, maxcycles;
+  bench_row_t *thisbench;
+
+  overhead = 0;
+
+  for (bidx = 0; NULL != bench_list[bidx].name; bidx++)
+  {
+    thisbench = &(bench_list[bidx]);
+    mincycles = 0xffff;
+    maxcycles = 0;
+
+    for (pidx = 0; pidx < BENCH_PASSES; pidx++)
+    {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        (*(thisbench->setup))();
+      }
+
+      // This leaves interrupts off; turn them back on afterwards.
+      thistime = TimeCall(thisbench->body);
+      sei();
+
+      if (0 < bidx)
+        thistime -= overhead;
+
+      if (thistime < mincycles)
+        mincycles = thistime;
+      if (thistime > maxcycles)
+        maxcycles = thistime;
+    }
+
+    if (0 == bidx)
+      overhead = mincycles;
+
+    // Put the UART back the way it was before the output.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      ResetApp();
+    }
+
+    PrintResult(thisbench->name, mincycles, maxcycles);
+  }
+}
+
+
+
+//
+// Main Program
+
+int main(void)
+{
+  MCU_Init();
+
+  UART_Init(CPU_SPEED, LINK_BAUD);
+
+  bench_application.DoInitialSetup(messages, event_lut);
+
+  StartCycleCounter();
+
+  UART_QueueSend_P(PSTR("BEGIN\r\n"));
+  UART_WaitForSendDone();
+
+  RunBenchmarks();
+
+  UART_QueueSend_P(PSTR("END\r\n"));
+  UART_WaitForSendDone();
+
+  // Give the last character time to leave the shift register.
+  _delay_loop_2(0xffff);
+
+  // Sleeping with interrupts off tells the simulator we're done.
+  cli();
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_enable();
+  sleep_cpu();
+
+  // We should never reach here.
+  return 0;
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,71 @@
+#!/bin/bash
+# Attention Circuits Control Laboratory - Library Tests
+# Cycle-count benchmark comparison.
+# Written by Christopher Thomas.
+# Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+# the Creative Commons Attribution 4.0 International License.
+
+
+#
+# NOTE - This prints a table comparing two benchmark runs from
+# "run-bench.sh". Max cycle counts are compared.
+#
+# Usage:  ./compare-bench.sh (old tag) (new tag) [mcu]
+# The MCU defaults to "atmega328p".
+
+
+OLDTAG=$1
+NEWTAG=$2
+MCU=$3
+
+if [ -z "$NEWTAG" ]
+then
+  echo "Usage:  $0 (old tag) (new tag) [mcu]"
+  exit 1
+fi
+
+if [ -z "$MCU" ]
+then
+  MCU=atmega328p
+fi
+
+OLDFILE="results/${OLDTAG}-${MCU}.txt"
+NEWFILE="results/${NEWTAG}-${MCU}.txt"
+
+for FILE in $OLDFILE $NEWFILE
+do
+  if [ ! -f $FILE ]
+  then
+    echo "Can't find \"$FILE\"."
+    exit 1
+  fi
+done
+
+
+# Entries only present in one run show "-" for the other.
+
+awk -v oldtag="$OLDTAG" -v newtag="$NEWTAG" '
+  FNR == NR { oldval[$1] = $3; if (!($1 in seen)) { order[n++] = $1; seen[$1] = 1 }; next }
+  { newval[$1] = $3; if (!($1 in seen)) { order[n++] = $1; seen[$1] = 1 } }
+  END {
+    printf("%-32s %10s %10s %8s %8s\n", "Benchmark (cycles)", oldtag, newtag, "delta", "change");
+    for (i = 0; i < n; i++) {
+      name = order[i];
+      if ((name in oldval) && (name in newval)) {
+        delta = newval[name] - oldval[name];
+        if (oldval[name] > 0)
+          change = sprintf("%+.1f%%", 100.0 * delta / oldval[name]);
+        else
+          change = "-";
+        printf("%-32s %10d %10d %+8d %8s\n", name, oldval[name], newval[name], delta, change);
+      }
+      else
+        printf("%-32s %10s %10s %8s %8s\n", name,
+          (name in oldval) ? oldval[name] : "-",
+          (name in newval) ? newval[name] : "-", "-", "-");
+    }
+  }' $OLDFILE $NEWFILE
+
+
+#
+# This is the end of the file.
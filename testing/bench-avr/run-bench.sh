@@ -0,0 +1,68 @@
+#!/bin/bash
+# Attention Circuits Control Laboratory - Library Tests
+# Cycle-count benchmark runner.
+# Written by Christopher Thomas.
+# Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+# the Creative Commons Attribution 4.0 International License.
+
+
+#
+# NOTE - This runs the benchmark firmware under simavr ("run_avr") and
+# saves the results as "results/(commit)-(arch).txt", one
+# "(name) (min) (max)" line per benchmark.
+#
+# The commit tag is the short hash of HEAD, with "-dirty" appended if the
+# working tree has uncommitted changes. Rebuild the libraries first.
+#
+# Usage:  ./run-bench.sh [tag]
+
+
+# Configuration.
+
+SIMAVR=run_avr
+MCUHZ=16000000
+TIMEOUT=120
+
+# Architectures: "(binary suffix) (simavr mcu name)".
+read -d '' ARCHLIST <<-"Endofblock"
+	328 atmega328p
+	2560 atmega2560
+Endofblock
+
+
+# Figure out what to call this run.
+
+TAG=$1
+if [ -z "$TAG" ]
+then
+  TAG=`git rev-parse --short HEAD`
+  if ! git diff --quiet HEAD -- ../.. 2>/dev/null
+  then
+    TAG="${TAG}-dirty"
+  fi
+fi
+
+
+# Build and run.
+
+make elf || exit 1
+mkdir -p results
+
+echo "$ARCHLIST" | while read SUFFIX MCU
+do
+  OUTFILE="results/${TAG}-${MCU}.txt"
+
+  # simavr echoes UART output a line at a time, with control characters
+  # turned into periods and (sometimes) colour codes added.
+  timeout $TIMEOUT $SIMAVR -m $MCU -f $MCUHZ bench-avr${SUFFIX}.elf 2>&1 \
+    | sed -e 's/\x1b\[[0-9;]*m//g' \
+    | grep -o 'CYC [^.]*' \
+    | sed -e 's/^CYC //' \
+    > $OUTFILE
+
+  echo "-- ${MCU}: `wc -l < $OUTFILE` results in ${OUTFILE}"
+done
+
+
+#
+# This is the end of the file.
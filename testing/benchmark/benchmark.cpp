@@ -0,0 +1,428 @@
+// Attention Circuits Control Laboratory - Library Tests
+// Host-side microbenchmarks for the emulation libraries.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+//
+// Includes
+
+#include "neuravr.h"
+#include "neuravr-private.h"
+#include "neurapp-oo.h"
+#include "neurapp-adcstream.h"
+#include "neurapp-gpiolog.h"
+
+// This is emulation-only, so we can use the standard library freely.
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+
+
+//
+// Notes
+
+// This times hot library routines in isolation, on the workstation, using
+// the emulation libraries. Numbers are only useful relative to each other
+// and to previous runs on the same machine; they say nothing about AVR
+// cycle counts.
+//
+// The timer and UART threads are never started. The benchmark drives the
+// UART buffers and the application's tick/poll entry points directly.
+//
+// Usage:  benchmark328-emu [repetitions]
+
+
+
+//
+// Macros
+
+// Default number of timed repetitions per benchmark.
+#define DEFAULT_REPS 50
+
+// Each repetition runs enough operations to take at least this long.
+#define MIN_REP_NANOSECONDS 2000000
+
+// Test input.
+#define TEST_COMMAND_LINE "ASR 1234 5678"
+#define TEST_RECV_LINE "XYZ 1234 5678\r"
+#define TEST_SEND_STRING \
+  "A 0001 00001234 8000 8000 8000 8000 8000 8000\r\n"
+
+
+//
+// Constants
+
+const char versionstr[] PROGMEM =
+  "devicetype: Benchmark  subtype: v1  revision: 20201018\r\n";
+
+const char helpscreenstr[] PROGMEM =
+  "Benchmark application.\r\n";
+
+neurapp_messagedefs_t messages =
+{
+  versionstr,
+  helpscreenstr
+};
+
+
+
+//
+// Class Declarations
+
+// Application that exposes internals that we want to time, and that
+// starts with echo turned off.
+
+class BenchApp : public NeurApp_Base
+{
+public:
+  BenchApp(void);
+
+  bool TestCommandMatch(neurapp_cmdname_t &first, neurapp_cmdname_t &second);
+#if NEURAPP_INCREMENTAL_PARSE
+  void DiscardCommands(void);
+#endif
+};
+
+
+// One benchmark. "body" performs "ops" operations per call.
+
+typedef struct
+{
+  const char *name;
+  void (*setup)(void);
+  void (*body)(void);
+  unsigned ops;
+} bench_row_t;
+
+
+
+//
+// Class Implementations
+
+
+BenchApp::BenchApp(void)
+{
+  echo_state = false;
+}
+
+
+bool BenchApp::TestCommandMatch(neurapp_cmdname_t &first,
+  neurapp_cmdname_t &second)
+{
+  return CommandMatch(first, second);
+}
+
+
+#if NEURAPP_INCREMENTAL_PARSE
+void BenchApp::DiscardCommands(void)
+{
+  neurapp_cmd_record_t thisrecord;
+
+  while (GetNextCommand(thisrecord))
+  {
+    // Just discard it.
+  }
+}
+#endif
+
+
+
+//
+// Global Variables
+
+NeurAppEvent_ADCStream adc_handler;
+NeurAppEvent_GPIOLog gpio_handler;
+
+neurapp_event_handler_row_t event_lut[] =
+{
+  { &adc_handler, NULL, neurapp_adcstream_cmds },
+  { &gpio_handler, NULL, neurapp_gpiolog_cmds },
+  { NULL, NULL, NULL }
+};
+
+BenchApp bench_application;
+NeurApp_Parser bench_parser;
+
+// Results go here so that the compiler can't optimize work away.
+volatile uint32_t bench_sink = 0;
+
+char hexbuf[16];
+char sendbuf[] = TEST_SEND_STRING;
+neurapp_cmdname_t match_first = { 'A', 'S', 'Q' };
+neurapp_cmdname_t match_second = { 'A', 'S', 'Q' };
+
+
+
+//
+// Functions
+
+
+// Helper functions.
+
+// This empties the transmit buffer the way the UDRE ISR would.
+
+void DrainUART(void)
+{
+  char thischar;
+
+  while (UART_GetNextSendChar_ISR(thischar))
+    bench_sink += thischar;
+}
+
+
+// This feeds a string to the receive ISR.
+
+void FeedUART(const char *text)
+{
+  int cidx;
+
+  for (cidx = 0; 0 != text[cidx]; cidx++)
+    UART_HandleRecvChar_ISR(text[cidx]);
+}
+
+
+// This resets the application to a known idle state.
+
+void ResetApp(void)
+{
+  DrainUART();
+  UART_InitBuffers_ISR();
+  bench_application.ReInitState();
+}
+
+
+// This starts ADC streaming and GPIO logging at full rate.
+
+void StartHandlers(void)
+{
+  ResetApp();
+  FeedUART("ASM 255\rASR 1\rASS 1\rGLS 1\r");
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  DrainUART();
+}
+
+
+
+// Benchmark bodies.
+
+void BenchParse(void)
+{
+  uint16_t arg1, arg2;
+  int argcount;
+  neurapp_cmdname_t cmd;
+
+  bench_parser.ParseInputLine((char *) TEST_COMMAND_LINE);
+  bench_parser.WasNewCommand(cmd, arg1, arg2, argcount);
+  bench_sink += arg1 + arg2;
+}
+
+
+void BenchRecvLine(void)
+{
+  FeedUART(TEST_RECV_LINE);
+
+  // Consume the result, so that the queue never fills up and we don't
+  // end up timing the dropped-line path.
+#if NEURAPP_INCREMENTAL_PARSE
+  bench_application.DiscardCommands();
+#else
+  UART_DoneWithLine();
+#endif
+}
+
+
+void BenchSendString(void)
+{
+  UART_QueueSend(sendbuf);
+  DrainUART();
+}
+
+
+void BenchADCIdlePoll(void)
+{
+  ADC_HousekeepingPoll();
+}
+
+
+void BenchADCScan(void)
+{
+  uint16_t data;
+  uint8_t channel;
+
+  ADC_StartConversion((1 << ADC_CHANNEL_COUNT) - 1);
+  while (!ADC_IsDataReady())
+    ADC_HousekeepingPoll();
+  while (ADC_ReadPendingSample(data, channel))
+    bench_sink += data;
+}
+
+
+void BenchWriteHex(void)
+{
+  UTIL_WriteHex(hexbuf, bench_sink, 8);
+  bench_sink += hexbuf[7];
+}
+
+
+void BenchCommandMatch(void)
+{
+  bench_sink += bench_application.TestCommandMatch(match_first, match_second);
+}
+
+
+void BenchUpdateIdle(void)
+{
+  bench_application.DoUpdate_ISR();
+}
+
+
+void BenchPollIdle(void)
+{
+  bench_application.DoPolling();
+}
+
+
+void BenchPollCommand(void)
+{
+  FeedUART("ASQ\r");
+  bench_application.DoPolling();
+  bench_application.DoPolling();
+  DrainUART();
+  bench_application.DoPolling();
+  DrainUART();
+}
+
+
+void BenchUpdateStreaming(void)
+{
+  rtc_timestamp++;
+  bench_application.DoUpdate_ISR();
+}
+
+
+void BenchFullPass(void)
+{
+  rtc_timestamp++;
+  bench_application.DoUpdate_ISR();
+  bench_application.DoPolling();
+  DrainUART();
+}
+
+
+
+// Benchmark table.
+
+bench_row_t bench_list[] =
+{
+  { "ParseInputLine (2 args)", ResetApp, BenchParse, 1 },
+  { "HandleRecvChar_ISR (per char)", ResetApp, BenchRecvLine,
+    sizeof(TEST_RECV_LINE) - 1 },
+  { "GetNextSendChar_ISR (per char)", ResetApp, BenchSendString,
+    sizeof(TEST_SEND_STRING) - 1 },
+  { "ADC_HousekeepingPoll (idle)", ResetApp, BenchADCIdlePoll, 1 },
+  { "ADC full scan", ResetApp, BenchADCScan, 1 },
+  { "UTIL_WriteHex (8 digits)", ResetApp, BenchWriteHex, 1 },
+  { "CommandMatch", ResetApp, BenchCommandMatch, 1 },
+  { "DoUpdate_ISR (idle)", ResetApp, BenchUpdateIdle, 1 },
+  { "DoPolling (idle)", ResetApp, BenchPollIdle, 1 },
+  { "DoPolling (command + report)", ResetApp, BenchPollCommand, 1 },
+  { "DoUpdate_ISR (streaming)", StartHandlers, BenchUpdateStreaming, 1 },
+  { "Tick + poll pass (streaming)", StartHandlers, BenchFullPass, 1 },
+  { NULL, NULL, NULL, 0 }
+};
+
+
+
+// Timing.
+
+// This returns the time taken to call a benchmark body "count" times.
+
+double TimeCalls(void (*body)(void), unsigned long count)
+{
+  std::chrono::steady_clock::time_point starttime, endtime;
+  unsigned long cidx;
+
+  starttime = std::chrono::steady_clock::now();
+  for (cidx = 0; cidx < count; cidx++)
+    (*body)();
+  endtime = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::nano>(endtime - starttime).count();
+}
+
+
+// This runs one benchmark and prints statistics in ns/op.
+
+void RunBenchmark(bench_row_t &thisbench, int reps)
+{
+  unsigned long count;
+  double elapsed;
+  std::vector<double> samples;
+  double total;
+  int ridx;
+
+  // Warm up and figure out how many calls make up one repetition.
+  (*thisbench.setup)();
+  count = 1;
+  while (MIN_REP_NANOSECONDS > TimeCalls(thisbench.body, count))
+    count <<= 1;
+
+  // Time the repetitions.
+  for (ridx = 0; ridx < reps; ridx++)
+  {
+    (*thisbench.setup)();
+    elapsed = TimeCalls(thisbench.body, count);
+    samples.push_back(elapsed / (count * thisbench.ops));
+  }
+
+  std::sort(samples.begin(), samples.end());
+  total = 0;
+  for (ridx = 0; ridx < reps; ridx++)
+    total += samples[ridx];
+
+  printf("%-32s %10.2f %10.2f %10.2f %10.2f\n", thisbench.name,
+    samples[0], samples[reps / 2], total / reps, samples[reps - 1]);
+}
+
+
+
+//
+// Main Program
+
+int main(int argc, char **argv)
+{
+  int reps;
+  int bidx;
+
+  reps = DEFAULT_REPS;
+  if (1 < argc)
+    reps = atoi(argv[1]);
+  if (1 > reps)
+    reps = 1;
+
+  MCU_Init();
+  UART_InitBuffers_ISR();
+  bench_application.DoInitialSetup(messages, event_lut);
+
+  printf("%-32s %10s %10s %10s %10s\n", "Benchmark (ns/op)",
+    "min", "median", "mean", "max");
+
+  for (bidx = 0; NULL != bench_list[bidx].name; bidx++)
+    RunBenchmark(bench_list[bidx], reps);
+
+  printf("(%d repetitions each, sink %08x)\n",
+    reps, (unsigned) bench_sink);
+
+  return 0;
+}
+
+
+//
+// This is the end of the file.
@@ -39,6 +39,16 @@
 
 #endif
 
+#ifdef __AVR_ATmega32U4__
+
+// D13 is C7 on the Leonardo.
+#define LED_ON 0b10000000
+#define LED_OFF 0
+#define LED_PORT PORTC
+#define LED_DIR DDRC
+
+#endif
+
 
 
 //
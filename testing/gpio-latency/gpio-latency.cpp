@@ -0,0 +1,718 @@
+// Attention Circuits Control Laboratory - Library Tests
+// GPIO edge-to-output latency benchmark.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+//
+// Includes
+
+#include "neuravr.h"
+
+#ifdef NEUREMU
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#endif
+
+
+
+//
+// Notes
+
+// This measures how long it takes to notice an input edge and assert an
+// output in response, using IO8_ReadData() and IO8_WriteData(), for three
+// ways of noticing the edge:
+//
+//   "p" - Polling IO8_ReadData() from the main loop.
+//   "t" - Checking IO8_ReadData() from the RTC tick callback.
+//   "i" - Checking IO8_ReadData() from a pin-change interrupt.
+//
+// Wiring: jumper GP0 (stimulus output) to GP4 (sense input). GP1 is the
+// response output. GP4 is used for sensing because it's on port B on both
+// chips, which has pin-change interrupts (PB1/PCINT1 on the 328p, PB4/PCINT4
+// on the 2560). Emulated builds loop GP0 back to GP4 in software.
+//
+// Each trial arms Timer 2 with a pseudo-random delay (about 1 ms to 16 ms).
+// Its compare-match ISR asserts the stimulus and timestamps it. Whichever
+// path sees the edge asserts the response and timestamps that. Latency is
+// the difference, in CPU cycles (16 per microsecond). Timestamps come from
+// the RTC tick count plus the RTC timer's counter, so they're accurate to
+// one cycle plus read overhead. Emulated builds use the workstation clock,
+// scaled to 16 MHz cycles.
+//
+// NOTE - The stimulus is generated on-chip, so every path also waits for
+// the stimulus ISR to return. To measure pin-to-pin latency including
+// that, put a scope on GP0 and GP1.
+//
+// Background load can be added while measuring:
+//   "a" - Toggles continuous ADC scans of all channels.
+//   "u" - Toggles continuous UART transmission.
+//
+// Other commands (one or more per line):
+//   (number) - Sets the number of trials per run.
+//   "r" - Performs a run and reports latency statistics and a histogram.
+//   "?" - Shows help and the current settings.
+
+
+
+//
+// Macros
+
+#define CPU_SPEED 16000000ul
+#define RTC_TICKS_PER_SECOND 10000ul
+#define LINK_BAUD 115200ul
+
+#define CLOCKS_PER_TICK (CPU_SPEED / RTC_TICKS_PER_SECOND)
+
+// GPIO bits.
+#define STIM_BIT 0x01
+#define RESP_BIT 0x02
+#define SENSE_BIT 0x10
+
+// Test modes.
+#define MODE_POLL 'p'
+#define MODE_TICK 't'
+#define MODE_INTERRUPT 'i'
+
+#define DEFAULT_TRIALS 1000
+
+// Give up on a trial this many cycles after arming the stimulus (40 ms).
+// The longest stimulus delay is 255 * 1024 cycles, or about 16 ms.
+#define TRIAL_TIMEOUT_CYCLES 640000ul
+
+// Let the sense line settle for this many cycles between trials (200 us).
+#define SETTLE_CYCLES 3200ul
+
+// Histogram buckets are powers of two: bucket 0 is 0..15 cycles, bucket 1
+// is 16..31, bucket 2 is 32..63, and so forth. The last bucket also holds
+// everything larger.
+#define HIST_BUCKETS 16
+#define HIST_FIRST_BITS 4
+
+
+// Hardware-specific registers.
+
+#ifndef NEUREMU
+
+// Fine timestamp source: the RTC timer.
+#ifdef __AVR_ATmega2560__
+#define FINE_TCNT TCNT5
+#define FINE_TIFR TIFR5
+#define FINE_OCF OCF5A
+#else
+#define FINE_TCNT TCNT1
+#define FINE_TIFR TIFR1
+#define FINE_OCF OCF1A
+#endif
+
+// Pin-change interrupt bit for GP4.
+#ifdef __AVR_ATmega2560__
+#define SENSE_PCINT_BIT PCINT4
+#else
+#define SENSE_PCINT_BIT PCINT1
+#endif
+
+#endif
+
+
+
+//
+// Global Variables
+
+
+// Settings.
+char test_mode = MODE_POLL;
+bool adc_load = false;
+bool uart_load = false;
+uint16_t trial_count = DEFAULT_TRIALS;
+
+
+// Trial state. These are shared with ISRs.
+volatile bool trial_armed = false;
+volatile bool trial_done = false;
+volatile uint32_t stim_time = 0;
+volatile uint32_t resp_time = 0;
+
+
+// Statistics for the current run.
+uint16_t hist_counts[HIST_BUCKETS];
+uint16_t trials_missed;
+uint32_t lat_min, lat_max;
+uint32_t lat_total;
+uint16_t lat_samples;
+
+
+// Pseudo-random state for stimulus delays.
+uint16_t lfsr_state = 0xace1;
+
+
+// Background UART traffic.
+const char uart_load_str[] PROGMEM =
+  "# Background load 0123456789 abcdefghijklmnopqrstuvwxyz ABCDEFGHIJ\r\n";
+
+
+#ifdef NEUREMU
+// Software stimulus timer.
+volatile bool emu_stim_pending = false;
+volatile uint32_t emu_stim_delay_usecs = 0;
+#endif
+
+
+
+//
+// Functions
+
+
+// This returns a timestamp in CPU cycles.
+// This must be called with interrupts disabled.
+
+uint32_t GetFineTime_ISR(void)
+{
+#ifdef NEUREMU
+  return (uint32_t)
+    ( std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch() ).count()
+      / (1000000000ull / CPU_SPEED) );
+#else
+  uint32_t ticks;
+  uint16_t count;
+
+  ticks = Timer_Query_ISR();
+  count = FINE_TCNT;
+
+  // If the counter wrapped and the RTC ISR hasn't run yet, account for
+  // the tick and re-read the counter (the first read may be pre-wrap).
+  if (FINE_TIFR & (1 << FINE_OCF))
+  {
+    ticks++;
+    count = FINE_TCNT;
+  }
+
+  return (ticks * CLOCKS_PER_TICK) + count;
+#endif
+}
+
+
+// This returns a timestamp in CPU cycles, from outside of ISRs.
+
+uint32_t GetFineTime(void)
+{
+  uint32_t result;
+
+  result = 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    result = GetFineTime_ISR();
+  }
+
+  return result;
+}
+
+
+// This reads the sense input.
+// Emulated builds loop the stimulus output back in software.
+
+uint8_t ReadSense_ISR(void)
+{
+#ifdef NEUREMU
+  return (IO8_GetOutputValue() & STIM_BIT) ? SENSE_BIT : 0;
+#else
+  return IO8_ReadData() & SENSE_BIT;
+#endif
+}
+
+
+// This asserts the response, if a trial is waiting for one.
+// This must be called with interrupts disabled.
+
+void RespondToEdge_ISR(void)
+{
+  if (trial_armed)
+  {
+    IO8_WriteData(STIM_BIT | RESP_BIT);
+    resp_time = GetFineTime_ISR();
+
+    trial_armed = false;
+    trial_done = true;
+  }
+}
+
+
+// This asserts the stimulus. It's called from the stimulus timer ISR.
+
+void AssertStimulus_ISR(void)
+{
+  IO8_WriteData(STIM_BIT);
+  stim_time = GetFineTime_ISR();
+  trial_armed = true;
+
+#ifdef NEUREMU
+  // Emulate the pin-change interrupt firing.
+  if (MODE_INTERRUPT == test_mode)
+    if (ReadSense_ISR())
+      RespondToEdge_ISR();
+#endif
+}
+
+
+// RTC tick callback. This does ADC housekeeping and, in tick mode, checks
+// for the edge.
+
+void TickCallback(void)
+{
+  if (adc_load)
+    ADC_HousekeepingPoll();
+
+  if (MODE_TICK == test_mode)
+    if (ReadSense_ISR())
+      RespondToEdge_ISR();
+}
+
+
+#ifndef NEUREMU
+
+// Stimulus timer ISR. This is one-shot.
+
+ISR(TIMER2_COMPA_vect, ISR_BLOCK)
+{
+  TIMSK2 = 0;
+  TCCR2B = 0;
+
+  AssertStimulus_ISR();
+}
+
+
+// Pin-change ISR for the sense input.
+
+ISR(PCINT0_vect, ISR_BLOCK)
+{
+  if (ReadSense_ISR())
+    RespondToEdge_ISR();
+}
+
+#else
+
+// Software stimulus timer thread.
+
+void EmuStimulusThread(void)
+{
+  while (1)
+  {
+    if (emu_stim_pending)
+    {
+      usleep(emu_stim_delay_usecs);
+
+      // Check again; the trial may have been cancelled while we slept.
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        if (emu_stim_pending)
+        {
+          emu_stim_pending = false;
+          AssertStimulus_ISR();
+        }
+      }
+    }
+    else
+      usleep(100);
+  }
+}
+
+#endif
+
+
+// This returns the next pseudo-random number (16-bit Galois LFSR).
+
+uint16_t NextRandom(void)
+{
+  lfsr_state = (lfsr_state >> 1) ^ ((lfsr_state & 1) ? 0xb400 : 0);
+  return lfsr_state;
+}
+
+
+// This starts the stimulus timer with a pseudo-random delay.
+// Delays are quantized to 64 us, but the timer runs independently of the
+// RTC, so the stimulus lands at an arbitrary phase relative to ticks.
+
+void ArmStimulus(void)
+{
+  uint8_t delay;
+
+  delay = 16 + (NextRandom() % 240);
+
+#ifdef NEUREMU
+  emu_stim_delay_usecs = 64ul * delay;
+  emu_stim_pending = true;
+#else
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    // CTC mode, /1024 prescaler.
+    TCCR2B = 0;
+    TCCR2A = (1 << WGM21);
+    TCNT2 = 0;
+    OCR2A = delay;
+    TIFR2 = (1 << OCF2A);
+    TIMSK2 = (1 << OCIE2A);
+    TCCR2B = (1 << CS22) | (1 << CS21) | (1 << CS20);
+  }
+#endif
+}
+
+
+// This stops the stimulus timer and cancels any trial in progress.
+
+void DisarmStimulus(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+#ifdef NEUREMU
+    emu_stim_pending = false;
+#else
+    TIMSK2 = 0;
+    TCCR2B = 0;
+#endif
+    trial_armed = false;
+    trial_done = false;
+    IO8_WriteData(0);
+  }
+}
+
+
+// This sets up the pin-change interrupt if we're using it.
+
+void ConfigurePinChange(bool enabled)
+{
+#ifndef NEUREMU
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (enabled)
+    {
+      PCMSK0 |= (1 << SENSE_PCINT_BIT);
+      PCIFR = (1 << PCIF0);
+      PCICR |= (1 << PCIE0);
+    }
+    else
+    {
+      PCICR &= ~(1 << PCIE0);
+      PCMSK0 &= ~(1 << SENSE_PCINT_BIT);
+    }
+  }
+#endif
+}
+
+
+// This does one pass of background work from the main loop.
+
+void DoBackgroundLoad(void)
+{
+  uint16_t data;
+  uint8_t channel;
+
+  if (adc_load)
+  {
+    // This is ignored if a scan is still in progress.
+    while (ADC_ReadPendingSample(data, channel))
+      ;
+    ADC_StartConversion((1 << ADC_CHANNEL_COUNT) - 1);
+  }
+
+  if (uart_load && !UART_IsSendInProgress())
+    UART_QueueSend_P(uart_load_str);
+}
+
+
+// This records one latency sample.
+
+void RecordLatency(uint32_t latency)
+{
+  uint8_t bucket;
+  uint32_t scratch;
+
+  bucket = 0;
+  scratch = latency >> HIST_FIRST_BITS;
+  while ((0 < scratch) && ((HIST_BUCKETS - 1) > bucket))
+  {
+    bucket++;
+    scratch >>= 1;
+  }
+
+  hist_counts[bucket]++;
+
+  if ( (0 == lat_samples) || (latency < lat_min) )
+    lat_min = latency;
+  if ( (0 == lat_samples) || (latency > lat_max) )
+    lat_max = latency;
+
+  lat_total += latency;
+  lat_samples++;
+}
+
+
+// This returns the upper bound of the histogram bucket containing the
+// requested fraction of samples (expressed in percent).
+
+uint32_t HistPercentile(uint8_t percent)
+{
+  uint32_t result;
+  uint32_t wanted, seen;
+  uint8_t bucket;
+
+  wanted = ((uint32_t) lat_samples * percent + 99) / 100;
+  seen = 0;
+  result = 0;
+
+  for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
+  {
+    seen += hist_counts[bucket];
+    result = (1ul << (bucket + HIST_FIRST_BITS)) - 1;
+    if (seen >= wanted)
+      break;
+  }
+
+  return result;
+}
+
+
+// This performs one run of trials.
+
+void PerformRun(void)
+{
+  uint16_t tidx;
+  uint8_t bucket;
+  uint32_t starttime;
+  bool timed_out;
+
+  for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
+    hist_counts[bucket] = 0;
+  trials_missed = 0;
+  lat_min = 0;
+  lat_max = 0;
+  lat_total = 0;
+  lat_samples = 0;
+
+  ConfigurePinChange(MODE_INTERRUPT == test_mode);
+
+  for (tidx = 0; tidx < trial_count; tidx++)
+  {
+    DisarmStimulus();
+
+    // Let the sense line settle.
+    starttime = GetFineTime();
+    while (SETTLE_CYCLES > (GetFineTime() - starttime))
+      DoBackgroundLoad();
+
+    ArmStimulus();
+    starttime = GetFineTime();
+    timed_out = false;
+
+    while ( (!trial_done) && (!timed_out) )
+    {
+      if (MODE_POLL == test_mode)
+      {
+        // Keep the polling loop tight; only do background work when
+        // there's no edge.
+        if (ReadSense_ISR())
+        {
+          ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+          {
+            RespondToEdge_ISR();
+          }
+        }
+        else
+          DoBackgroundLoad();
+      }
+      else
+        DoBackgroundLoad();
+
+      if (TRIAL_TIMEOUT_CYCLES < (GetFineTime() - starttime))
+        timed_out = true;
+    }
+
+    if (trial_done)
+      RecordLatency(resp_time - stim_time);
+    else
+      trials_missed++;
+  }
+
+  DisarmStimulus();
+  ConfigurePinChange(false);
+}
+
+
+// This reports the current settings.
+
+void ReportSettings(void)
+{
+  UART_QueueSend_P(PSTR("Mode: "));
+  if (MODE_TICK == test_mode)
+    UART_QueueSend_P(PSTR("tick ISR"));
+  else if (MODE_INTERRUPT == test_mode)
+    UART_QueueSend_P(PSTR("pin-change ISR"));
+  else
+    UART_QueueSend_P(PSTR("polling"));
+
+  UART_QueueSend_P(PSTR("  ADC load: "));
+  UART_QueueSend_P(adc_load ? PSTR("on") : PSTR("off"));
+  UART_QueueSend_P(PSTR("  UART load: "));
+  UART_QueueSend_P(uart_load ? PSTR("on") : PSTR("off"));
+  UART_QueueSend_P(PSTR("  Trials: "));
+  UART_PrintUInt(trial_count);
+  UART_QueueSend_P(PSTR("\r\n"));
+}
+
+
+// This reports the results of the last run.
+
+void ReportResults(void)
+{
+  uint8_t bucket;
+
+  ReportSettings();
+
+  UART_QueueSend_P(PSTR("Samples: "));
+  UART_PrintUInt(lat_samples);
+  UART_QueueSend_P(PSTR("  Missed: "));
+  UART_PrintUInt(trials_missed);
+  UART_QueueSend_P(PSTR("\r\n"));
+
+  if (0 < lat_samples)
+  {
+    UART_QueueSend_P(PSTR("Latency (cycles):  min "));
+    UART_PrintUInt(lat_min);
+    UART_QueueSend_P(PSTR("  mean "));
+    UART_PrintUInt(lat_total / lat_samples);
+    UART_QueueSend_P(PSTR("  max "));
+    UART_PrintUInt(lat_max);
+    UART_QueueSend_P(PSTR("  jitter "));
+    UART_PrintUInt(lat_max - lat_min);
+    UART_QueueSend_P(PSTR("\r\n"));
+
+    UART_QueueSend_P(PSTR("Percentiles (bucket bound):  p50 <= "));
+    UART_PrintUInt(HistPercentile(50));
+    UART_QueueSend_P(PSTR("  p99 <= "));
+    UART_PrintUInt(HistPercentile(99));
+    UART_QueueSend_P(PSTR("\r\n"));
+
+    for (bucket = 0; bucket < HIST_BUCKETS; bucket++)
+      if (0 < hist_counts[bucket])
+      {
+        UART_QueueSend_P(PSTR("  "));
+        UART_PrintUInt( (0 == bucket) ? 0 :
+          (1ul << (bucket + HIST_FIRST_BITS - 1)) );
+        UART_QueueSend_P(PSTR(".."));
+        if ((HIST_BUCKETS - 1) > bucket)
+          UART_PrintUInt((1ul << (bucket + HIST_FIRST_BITS)) - 1);
+        else
+          UART_QueueSend_P(PSTR("up"));
+        UART_QueueSend_P(PSTR(": "));
+        UART_PrintUInt(hist_counts[bucket]);
+        UART_QueueSend_P(PSTR("\r\n"));
+      }
+  }
+
+  UART_QueueSend_P(PSTR("Done.\r\n"));
+}
+
+
+// This shows the help screen.
+
+void ShowHelp(void)
+{
+  UART_QueueSend_P(PSTR(
+    "GPIO edge-to-output latency test. Jumper GP0 to GP4.\r\n"
+    "p/t/i = polling/tick/pin-change mode, a/u = toggle ADC/UART load,\r\n"
+    "(number) = trials per run, r = run, ? = help.\r\n"));
+  ReportSettings();
+}
+
+
+
+//
+// Main Program
+
+int main(void)
+{
+  char *thisline;
+  char thischar;
+  uint8_t cidx;
+  uint32_t newcount;
+  bool have_count;
+  bool want_run;
+
+  MCU_Init();
+
+  UART_Init(CPU_SPEED, LINK_BAUD);
+  UART_SetLineFiltering(true);
+
+  ADC_Init();
+
+  Timer_Init(CPU_SPEED, RTC_TICKS_PER_SECOND);
+  Timer_RegisterCallback(&TickCallback);
+
+  IO8_SelectOutputs(STIM_BIT | RESP_BIT);
+  IO8_SetPullups(0);
+  IO8_WriteData(0);
+
+#ifdef NEUREMU
+  std::thread(EmuStimulusThread).detach();
+#endif
+
+  ShowHelp();
+
+  while (1)
+  {
+    thisline = UART_GetNextLine();
+
+    if (NULL != thisline)
+    {
+      newcount = 0;
+      have_count = false;
+      want_run = false;
+
+      for (cidx = 0; 0 != (thischar = thisline[cidx]); cidx++)
+      {
+        if (('0' <= thischar) && ('9' >= thischar))
+        {
+          newcount = (newcount * 10) + (thischar - '0');
+          if (0xffff < newcount)
+            newcount = 0xffff;
+          have_count = true;
+        }
+        else if ( (MODE_POLL == thischar) || (MODE_TICK == thischar)
+          || (MODE_INTERRUPT == thischar) )
+          test_mode = thischar;
+        else if ('a' == thischar)
+          adc_load = !adc_load;
+        else if ('u' == thischar)
+          uart_load = !uart_load;
+        else if ('r' == thischar)
+          want_run = true;
+        else if ('?' == thischar)
+          ShowHelp();
+      }
+
+      UART_DoneWithLine();
+
+      if (have_count && (0 < newcount))
+        trial_count = newcount;
+
+      if (want_run)
+      {
+        UART_WaitForSendDone();
+        PerformRun();
+        UART_WaitForSendDone();
+        ReportResults();
+      }
+      else if (!have_count)
+        ReportSettings();
+    }
+  }
+
+  // We should never reach here.
+  return 0;
+}
+
+
+//
+// This is the end of the file.
@@ -0,0 +1,576 @@
+// Attention Circuits Control Laboratory - Library Tests
+// UART throughput and latency stress test - host-side driver.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+//
+// Includes
+
+// This is a workstation program (POSIX), not firmware.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+
+
+//
+// Notes
+
+// This talks to the "uart-stress" firmware, either through a serial port
+// or by running the emulated build as a child process. It sends numbered
+// test lines, keeping up to "window" of them unanswered at a time, and
+// matches replies to compute throughput and round-trip latency.
+//
+// Usage:
+//   stress-host -p /dev/ttyACM0 [-b 115200] [options]
+//   stress-host -e ./uart-stress328-emu [options]
+//
+// Options:
+//   -n (count)    Number of test lines (default 1000).
+//   -l (length)   Characters per line, not counting CRLF (default 32,
+//                 min 10).
+//   -w (window)   Maximum unanswered lines (default 1; large = flood).
+//   -t (ms)       Give up this long after the last reply (default 2000).
+//   -s (ms)       Wait this long for "READY" after opening (default 2500
+//                 for serial ports, since opening one resets an Arduino).
+//
+// The last line of output is a one-line summary starting with "RESULT",
+// for collecting sweeps with scripts.
+
+
+
+//
+// Macros
+
+#define DEFAULT_COUNT 1000
+#define DEFAULT_LENGTH 32
+#define MIN_LENGTH 10
+#define DEFAULT_WINDOW 1
+#define DEFAULT_TIMEOUT_MS 2000
+#define DEFAULT_SERIAL_SETTLE_MS 2500
+#define DEFAULT_SPAWN_SETTLE_MS 500
+
+
+
+//
+// Typedefs
+
+typedef std::chrono::steady_clock::time_point timestamp_t;
+
+
+// Connection to the device under test.
+
+typedef struct
+{
+  int read_fd;
+  int write_fd;
+  pid_t child;
+} link_t;
+
+
+
+//
+// Global Variables
+
+// Process group of the emulator child, or -1 if there isn't one.
+// The exit signal handler needs this.
+volatile pid_t emulator_group = -1;
+
+
+
+//
+// Functions
+
+
+// This returns the number of milliseconds between two times.
+
+double MillisBetween(timestamp_t starttime, timestamp_t endtime)
+{
+  return
+    std::chrono::duration<double, std::milli>(endtime - starttime).count();
+}
+
+
+// This translates a baud rate into a termios speed constant.
+// Returns B0 if the rate isn't supported.
+
+speed_t LookUpBaud(long baud)
+{
+  speed_t result;
+
+  result = B0;
+
+  switch (baud)
+  {
+    case 9600: result = B9600; break;
+    case 19200: result = B19200; break;
+    case 38400: result = B38400; break;
+    case 57600: result = B57600; break;
+    case 115200: result = B115200; break;
+    case 230400: result = B230400; break;
+#ifdef B500000
+    case 500000: result = B500000; break;
+#endif
+#ifdef B1000000
+    case 1000000: result = B1000000; break;
+#endif
+#ifdef B2000000
+    case 2000000: result = B2000000; break;
+#endif
+    default: break;
+  }
+
+  return result;
+}
+
+
+// This opens a serial port in raw mode. Returns true on success.
+
+bool OpenSerial(link_t &link, const char *port, long baud)
+{
+  int fd;
+  struct termios config;
+  speed_t speed;
+
+  speed = LookUpBaud(baud);
+  if (B0 == speed)
+  {
+    fprintf(stderr, "Unsupported baud rate %ld.\n", baud);
+    return false;
+  }
+
+  fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (0 > fd)
+  {
+    perror(port);
+    return false;
+  }
+
+  tcgetattr(fd, &config);
+  cfmakeraw(&config);
+  cfsetispeed(&config, speed);
+  cfsetospeed(&config, speed);
+  config.c_cflag |= CLOCAL | CREAD;
+  tcsetattr(fd, TCSANOW, &config);
+  tcflush(fd, TCIOFLUSH);
+
+  link.read_fd = fd;
+  link.write_fd = fd;
+  link.child = -1;
+
+  return true;
+}
+
+
+// This kills the emulator (and anything the shell started for it) if
+// we're interrupted, so that it doesn't keep running on its own.
+
+void HandleExitSignal(int signum)
+{
+  if (0 < emulator_group)
+    kill(-emulator_group, SIGTERM);
+
+  _exit(128 + signum);
+}
+
+
+// This runs a command with pipes for stdin and stdout. Returns true on
+// success.
+// The child gets its own process group, so that the shell and the
+// emulator can be killed together.
+
+bool SpawnEmulator(link_t &link, const char *command)
+{
+  int topipe[2], frompipe[2];
+  pid_t child;
+
+  if ( (0 != pipe(topipe)) || (0 != pipe(frompipe)) )
+  {
+    perror("pipe");
+    return false;
+  }
+
+  child = fork();
+  if (0 > child)
+  {
+    perror("fork");
+    return false;
+  }
+
+  if (0 == child)
+  {
+    setpgid(0, 0);
+#ifdef __linux__
+    // If we die without cleaning up (e.g. SIGKILL), take the child too.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+    dup2(topipe[0], 0);
+    dup2(frompipe[1], 1);
+    close(topipe[0]);
+    close(topipe[1]);
+    close(frompipe[0]);
+    close(frompipe[1]);
+    execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+    _exit(127);
+  }
+
+  // Set the group from this side too, so it's in place before we could
+  // possibly need to signal it.
+  setpgid(child, child);
+  emulator_group = child;
+
+  close(topipe[0]);
+  close(frompipe[1]);
+
+  fcntl(topipe[1], F_SETFL, O_NONBLOCK);
+  fcntl(frompipe[0], F_SETFL, O_NONBLOCK);
+
+  link.read_fd = frompipe[0];
+  link.write_fd = topipe[1];
+  link.child = child;
+
+  return true;
+}
+
+
+// This shuts down the link.
+
+void CloseLink(link_t &link)
+{
+  if (0 <= link.child)
+  {
+    close(link.write_fd);
+    close(link.read_fd);
+    kill(-link.child, SIGTERM);
+    waitpid(link.child, NULL, 0);
+    emulator_group = -1;
+  }
+  else
+    close(link.read_fd);
+}
+
+
+// This reads whatever is available and splits it into lines.
+// Carriage returns are discarded.
+
+void ReadLines(link_t &link, std::string &partial,
+  std::vector<std::string> &lines, uint64_t &bytes_read)
+{
+  char buffer[4096];
+  ssize_t count;
+  ssize_t cidx;
+
+  while (0 < (count = read(link.read_fd, buffer, sizeof(buffer))))
+  {
+    bytes_read += count;
+    for (cidx = 0; cidx < count; cidx++)
+    {
+      if ('\n' == buffer[cidx])
+      {
+        lines.push_back(partial);
+        partial.clear();
+      }
+      else if ('\r' != buffer[cidx])
+        partial.push_back(buffer[cidx]);
+    }
+  }
+}
+
+
+// This returns the requested percentile of a sorted list.
+
+double Percentile(std::vector<double> &sorted, double fraction)
+{
+  size_t index;
+
+  if (sorted.empty())
+    return 0;
+
+  index = (size_t) (fraction * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+
+
+//
+// Main Program
+
+int main(int argc, char **argv)
+{
+  const char *port;
+  const char *command;
+  long baud;
+  long count, length, window, timeout_ms, settle_ms;
+  int opt;
+  link_t link;
+
+  std::string partial, outbuf;
+  std::vector<std::string> lines;
+  std::vector<timestamp_t> sendtimes;
+  std::vector<bool> answered;
+  std::vector<double> latencies;
+  long sent, replies, given_up, duplicates, truncated, unexpected;
+  uint64_t bytes_written, bytes_read;
+  timestamp_t now, starttime, lastreply, lastsend;
+  bool ready, done;
+  struct pollfd pollfds[2];
+  char linebuf[64];
+  std::string padding;
+  ssize_t written;
+  unsigned long seq, replylength;
+  size_t lidx;
+  double elapsed_ms;
+
+
+  // Parse arguments.
+
+  port = NULL;
+  command = NULL;
+  baud = 115200;
+  count = DEFAULT_COUNT;
+  length = DEFAULT_LENGTH;
+  window = DEFAULT_WINDOW;
+  timeout_ms = DEFAULT_TIMEOUT_MS;
+  settle_ms = -1;
+
+  while (-1 != (opt = getopt(argc, argv, "p:b:e:n:l:w:t:s:")))
+  {
+    switch (opt)
+    {
+      case 'p': port = optarg; break;
+      case 'b': baud = atol(optarg); break;
+      case 'e': command = optarg; break;
+      case 'n': count = atol(optarg); break;
+      case 'l': length = atol(optarg); break;
+      case 'w': window = atol(optarg); break;
+      case 't': timeout_ms = atol(optarg); break;
+      case 's': settle_ms = atol(optarg); break;
+      default:
+        fprintf(stderr, "Usage:  %s (-p port [-b baud] | -e command)"
+          " [-n count] [-l length] [-w window] [-t ms] [-s ms]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if ( (NULL == port) == (NULL == command) )
+  {
+    fprintf(stderr, "Specify exactly one of -p (port) or -e (command).\n");
+    return 1;
+  }
+
+  if (MIN_LENGTH > length)
+    length = MIN_LENGTH;
+  if (1 > window)
+    window = 1;
+  if (1 > count)
+    count = 1;
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, HandleExitSignal);
+  signal(SIGTERM, HandleExitSignal);
+
+  if (NULL != port)
+  {
+    if (!OpenSerial(link, port, baud))
+      return 1;
+    if (0 > settle_ms)
+      settle_ms = DEFAULT_SERIAL_SETTLE_MS;
+  }
+  else
+  {
+    if (!SpawnEmulator(link, command))
+      return 1;
+    if (0 > settle_ms)
+      settle_ms = DEFAULT_SPAWN_SETTLE_MS;
+  }
+
+
+  // Wait for the firmware to start.
+
+  ready = false;
+  bytes_read = 0;
+  starttime = std::chrono::steady_clock::now();
+
+  while ( (!ready)
+    && (MillisBetween(starttime, std::chrono::steady_clock::now())
+      < settle_ms) )
+  {
+    pollfds[0].fd = link.read_fd;
+    pollfds[0].events = POLLIN;
+    poll(pollfds, 1, 10);
+
+    ReadLines(link, partial, lines, bytes_read);
+    for (lidx = 0; lidx < lines.size(); lidx++)
+      if (std::string::npos != lines[lidx].find("READY"))
+        ready = true;
+    lines.clear();
+  }
+
+  if (!ready)
+    fprintf(stderr, "(No \"READY\" seen; starting anyways.)\n");
+
+
+  // Run the test.
+
+  padding.assign(length - MIN_LENGTH, 'x');
+
+  sendtimes.resize(count);
+  answered.assign(count, false);
+
+  sent = 0;
+  replies = 0;
+  given_up = 0;
+  duplicates = 0;
+  truncated = 0;
+  unexpected = 0;
+  bytes_written = 0;
+  bytes_read = 0;
+
+  starttime = std::chrono::steady_clock::now();
+  lastreply = starttime;
+  lastsend = starttime;
+  done = false;
+
+  while (!done)
+  {
+    now = std::chrono::steady_clock::now();
+
+    // Queue new lines while we have room in the window.
+    // Lines are timestamped when they're queued; with a large window,
+    // latency includes time spent waiting in our own buffer.
+    while ( (sent < count) && ((sent - replies - given_up) < window) )
+    {
+      snprintf(linebuf, sizeof(linebuf), "S %08lx", (unsigned long) sent);
+      outbuf += linebuf;
+      outbuf += padding;
+      outbuf += "\r\n";
+      sendtimes[sent] = now;
+      sent++;
+      lastsend = now;
+    }
+
+    pollfds[0].fd = link.read_fd;
+    pollfds[0].events = POLLIN;
+    pollfds[1].fd = link.write_fd;
+    pollfds[1].events = outbuf.empty() ? 0 : POLLOUT;
+    if (link.read_fd == link.write_fd)
+    {
+      pollfds[0].events |= pollfds[1].events;
+      poll(pollfds, 1, 5);
+    }
+    else
+      poll(pollfds, 2, 5);
+
+    // Send what we can.
+    if (!outbuf.empty())
+    {
+      written = write(link.write_fd, outbuf.data(), outbuf.size());
+      if (0 < written)
+      {
+        bytes_written += written;
+        outbuf.erase(0, written);
+      }
+    }
+
+    // Match replies.
+    ReadLines(link, partial, lines, bytes_read);
+    now = std::chrono::steady_clock::now();
+
+    for (lidx = 0; lidx < lines.size(); lidx++)
+    {
+      if ( (2 == sscanf(lines[lidx].c_str(), "K %lx %lx",
+        &seq, &replylength)) && (seq < (unsigned long) sent) )
+      {
+        if (answered[seq])
+          duplicates++;
+        else
+        {
+          answered[seq] = true;
+          replies++;
+          if (0 < given_up)
+            given_up--;
+          latencies.push_back(MillisBetween(sendtimes[seq], now));
+          if (replylength != (unsigned long) length)
+            truncated++;
+        }
+        lastreply = now;
+      }
+      else if (!lines[lidx].empty())
+        unexpected++;
+    }
+    lines.clear();
+
+    // Stop when everything's answered, or when replies stop coming.
+    if (replies >= count)
+      done = true;
+    else if (timeout_ms < MillisBetween(
+      (lastreply > lastsend) ? lastreply : lastsend, now))
+    {
+      // Give up on the unanswered lines so that they stop taking up
+      // window space, and keep going if there are more to send.
+      if (sent < count)
+      {
+        given_up = sent - replies;
+        lastsend = now;
+      }
+      else
+        done = true;
+    }
+  }
+
+  CloseLink(link);
+
+
+  // Report.
+
+  elapsed_ms = MillisBetween(starttime, lastreply);
+  if (0 >= elapsed_ms)
+    elapsed_ms = 1;
+
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("Lines sent:      %ld (%ld chars each plus CRLF)\n", sent, length);
+  printf("Replies:         %ld\n", replies);
+  printf("Dropped:         %ld\n", count - replies);
+  printf("Truncated:       %ld\n", truncated);
+  printf("Duplicates:      %ld\n", duplicates);
+  printf("Other lines:     %ld\n", unexpected);
+  printf("Window:          %ld\n", window);
+  printf("Elapsed:         %.1f ms\n", elapsed_ms);
+  printf("Lines/sec:       %.1f\n", 1000.0 * replies / elapsed_ms);
+  printf("Bytes/sec out:   %.1f\n", 1000.0 * bytes_written / elapsed_ms);
+  printf("Bytes/sec in:    %.1f\n", 1000.0 * bytes_read / elapsed_ms);
+  printf("Latency (ms):    min %.3f  p50 %.3f  p99 %.3f  max %.3f\n",
+    Percentile(latencies, 0.0), Percentile(latencies, 0.5),
+    Percentile(latencies, 0.99), Percentile(latencies, 1.0));
+
+  printf("RESULT length %ld window %ld sent %ld replies %ld drops %ld"
+    " truncated %ld lps %.1f bps %.1f p50 %.3f p99 %.3f max %.3f\n",
+    length, window, sent, replies, count - replies, truncated,
+    1000.0 * replies / elapsed_ms, 1000.0 * bytes_written / elapsed_ms,
+    Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+    Percentile(latencies, 1.0));
+
+  return 0;
+}
+
+
+//
+// This is the end of the file.
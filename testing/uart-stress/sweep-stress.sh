@@ -0,0 +1,37 @@
+#!/bin/bash
+# Attention Circuits Control Laboratory - Library Tests
+# UART stress test sweep script.
+# Written by Christopher Thomas.
+# Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+# the Creative Commons Attribution 4.0 International License.
+
+
+#
+# NOTE - This runs "stress-host" once per combination of line length and
+# window size, and prints one summary line per run. Arguments are passed
+# through to stress-host (use "-p port -b baud" or "-e command").
+#
+# Usage:  ./sweep-stress.sh (stress-host arguments)
+
+
+# Configuration.
+
+HOST=./stress-host
+
+LENGTHS="10 16 32 64 80"
+WINDOWS="1 2 4 8 64"
+
+
+# Run the sweep.
+
+for LENGTH in $LENGTHS
+do
+  for WINDOW in $WINDOWS
+  do
+    $HOST "$@" -l $LENGTH -w $WINDOW | grep '^RESULT' | sed -e 's/^RESULT //'
+  done
+done
+
+
+#
+# This is the end of the file.
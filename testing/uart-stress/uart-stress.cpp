@@ -0,0 +1,171 @@
+// Attention Circuits Control Laboratory - Library Tests
+// UART throughput and latency stress test - firmware.
+// Written by Christopher Thomas.
+// Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+// the Creative Commons Attribution 4.0 International License.
+
+//
+// Includes
+
+#include "neuravr.h"
+
+
+
+//
+// Notes
+
+// This answers every line of the form "S (8 hex digits) (padding)" with
+// "K (same 8 digits) (line length, 4 hex digits)". Anything else gets
+// "Q (lines seen) (lines answered)", so the host can check what made it.
+// Replies are built with UTIL_WriteHex(), to keep the firmware's own
+// overhead small compared to the UART's.
+//
+// The host side is "stress-host". See the Makefile for building with
+// other baud rates.
+
+
+
+//
+// Macros
+
+#define CPU_SPEED 16000000ul
+
+// This can be overridden from the command line (see the Makefile).
+#ifndef LINK_BAUD
+#define LINK_BAUD 115200ul
+#endif
+
+// "K ssssssss llll\r\n" plus terminator, or
+// "Q cccccccc aaaaaaaa\r\n" plus terminator.
+#define REPLY_CHARS 24
+
+
+
+//
+// Global Variables
+
+// Reply buffer. This has to stay valid until it's been sent.
+char replybuf[REPLY_CHARS];
+
+uint32_t lines_seen = 0;
+uint32_t lines_answered = 0;
+
+
+
+//
+// Functions
+
+
+// This converts a hex digit to its value, or returns 0xff if it isn't one.
+
+uint8_t HexDigitValue(char thischar)
+{
+  uint8_t result;
+
+  result = 0xff;
+
+  if (('0' <= thischar) && ('9' >= thischar))
+    result = thischar - '0';
+  else if (('a' <= thischar) && ('f' >= thischar))
+    result = 10 + thischar - 'a';
+  else if (('A' <= thischar) && ('F' >= thischar))
+    result = 10 + thischar - 'A';
+
+  return result;
+}
+
+
+// This builds a reply for one line. Returns true if it was a test line.
+
+bool MakeReply(char *thisline)
+{
+  bool result;
+  uint8_t cidx;
+  uint16_t length;
+
+  result = false;
+
+  // Check for "S xxxxxxxx".
+  if ( ('S' == thisline[0]) && (' ' == thisline[1]) )
+  {
+    result = true;
+    for (cidx = 2; result && (cidx < 10); cidx++)
+      if (0xff == HexDigitValue(thisline[cidx]))
+        result = false;
+  }
+
+  if (result)
+  {
+    for (length = 10; 0 != thisline[length]; length++)
+      ;
+
+    replybuf[0] = 'K';
+    replybuf[1] = ' ';
+    for (cidx = 2; cidx < 10; cidx++)
+      replybuf[cidx] = thisline[cidx];
+    replybuf[10] = ' ';
+    UTIL_WriteHex(replybuf + 11, length, 4);
+    replybuf[15] = '\r';
+    replybuf[16] = '\n';
+    replybuf[17] = 0;
+  }
+  else
+  {
+    replybuf[0] = 'Q';
+    replybuf[1] = ' ';
+    UTIL_WriteHex(replybuf + 2, lines_seen, 8);
+    replybuf[10] = ' ';
+    UTIL_WriteHex(replybuf + 11, lines_answered, 8);
+    replybuf[19] = '\r';
+    replybuf[20] = '\n';
+    replybuf[21] = 0;
+  }
+
+  return result;
+}
+
+
+
+//
+// Main Program
+
+int main(void)
+{
+  char *thisline;
+
+  MCU_Init();
+
+  UART_Init(CPU_SPEED, LINK_BAUD);
+
+  // Don't let stray blank lines take up buffer space.
+  UART_SetLineFiltering(true);
+
+  UART_QueueSend_P(PSTR("READY\r\n"));
+
+  while (1)
+  {
+    thisline = UART_GetNextLine();
+
+    if (NULL != thisline)
+    {
+      lines_seen++;
+
+      // Wait for the previous reply before overwriting its buffer.
+      UART_WaitForSendDone();
+
+      if (MakeReply(thisline))
+        lines_answered++;
+
+      UART_DoneWithLine();
+
+      UART_QueueSend(replybuf);
+    }
+  }
+
+  // We should never reach here.
+  return 0;
+}
+
+
+//
+// This is the end of the file.
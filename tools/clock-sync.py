@@ -0,0 +1,408 @@
+#!/usr/bin/env python3
+# Attention Circuits Control Laboratory - Atmel AVR firmware
+# Host-side clock synchronization estimator.
+# Written by Christopher Thomas.
+# Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+# the Creative Commons Attribution 4.0 International License.
+
+
+#
+# Notes
+#
+# This pings a device running the NeurApp framework with the built-in
+# "PNG" command and estimates the mapping from device RTC ticks to host
+# wall-clock time, including crystal drift.
+#
+# Protocol:
+#   Host sends:      "PNG n"  (n is a sequence number, 0..65535)
+#   Device replies:  "PNG ssss rrrrrrrr tttttttt"  (hexadecimal)
+#   "s" echoes the sequence number, "r" is the RTC timestamp of when the
+# ping's end-of-line arrived, and "t" is the RTC timestamp taken just
+# before the reply started sending.
+#
+# Each exchange gives four times: host send (t0), device receive (t1),
+# device transmit (t2), and host receive (t3). Assuming the link delay is
+# the same in both directions, device time (t1 + t2) / 2 corresponds to
+# host time (t0 + t3) / 2, with an uncertainty of half the round trip
+# (t3 - t0) - (t2 - t1). Serial links add a lot of jitter (USB polling,
+# FTDI latency timers), so only the fastest round trips in the recent
+# window are used. A line fit through those gives the offset and the
+# rate (ticks per host second); the rate's deviation from nominal is the
+# crystal's drift.
+#
+# For serial ports, host times are corrected for the time it takes to
+# shift out the ping and to shift in the reply (10 bits per character).
+#
+# If the device's clock goes backwards (reset, or "INI"), the estimate
+# starts over. 32-bit timestamp wraparound is handled.
+#
+# Usage:
+#   clock-sync.py -p /dev/ttyACM0 [-b 115200] [options]
+#   clock-sync.py -e ./skel-oo328-emu [options]
+#
+# One line is printed per ping. The last line of output is a summary
+# starting with "RESULT", giving the wall-clock time of device tick 0 and
+# the fitted rate; wall time = (epoch) + (ticks) / (rate).
+#
+# The "ClockEstimator" class can also be imported and fed timestamps
+# directly.
+
+
+#
+# Imports
+
+import argparse
+import collections
+import os
+import re
+import select
+import shlex
+import signal
+import subprocess
+import sys
+import termios
+import time
+
+
+#
+# Constants
+
+# Reply format.
+PONG_PATTERN = re.compile(
+  r'^PNG ([0-9A-Fa-f]{4}) ([0-9A-Fa-f]{8}) ([0-9A-Fa-f]{8})\s*$')
+
+# Characters in a reply, including CRLF, for serialization correction.
+PONG_CHARS = 28
+
+# Timestamp wraparound.
+TICK_MODULUS = 1 << 32
+
+# Baud rate lookup for termios.
+BAUD_RATES = {
+  9600: termios.B9600,
+  19200: termios.B19200,
+  38400: termios.B38400,
+  57600: termios.B57600,
+  115200: termios.B115200,
+  230400: termios.B230400,
+  460800: getattr(termios, 'B460800', None),
+  500000: getattr(termios, 'B500000', None),
+  1000000: getattr(termios, 'B1000000', None),
+}
+
+
+#
+# Classes
+
+
+# One ping/pong exchange, with device times unwrapped.
+
+class Sample:
+  def __init__(self, host_mid, device_mid, rtt):
+    self.host_mid = host_mid
+    self.device_mid = device_mid
+    self.rtt = rtt
+
+
+# Device-to-host clock mapping estimator.
+# Host times are in seconds (any epoch); device times are raw RTC ticks.
+
+class ClockEstimator:
+  def __init__(self, nominal_hz, window = 64, keep_fraction = 0.5):
+    self.nominal_hz = float(nominal_hz)
+    self.window = window
+    self.keep_fraction = keep_fraction
+    self.Reset()
+
+  def Reset(self):
+    self.samples = collections.deque(maxlen = self.window)
+    self.last_raw = None
+    self.wraps = 0
+    self.resets = 0
+    # Fit: device ticks = offset + rate * (host time - host_ref).
+    self.host_ref = None
+    self.offset = None
+    self.rate = self.nominal_hz
+
+  # This turns a raw 32-bit timestamp into a monotonic tick count.
+  # Returns None if the device's clock went backwards.
+  def Unwrap(self, raw):
+    result = None
+    if self.last_raw is None:
+      result = raw
+    else:
+      delta = (raw - self.last_raw) % TICK_MODULUS
+      if delta < (TICK_MODULUS // 2):
+        if raw < self.last_raw:
+          self.wraps += 1
+        result = raw + self.wraps * TICK_MODULUS
+    if result is not None:
+      self.last_raw = raw
+    return result
+
+  # Adds one exchange. Host times are in seconds, device times are raw
+  # ticks. Returns the sample's residual against the updated fit, in ticks.
+  def AddExchange(self, host_send, device_rx, device_tx, host_recv):
+    rx = self.Unwrap(device_rx)
+    tx = None
+    if rx is not None:
+      tx = self.Unwrap(device_tx)
+    if (rx is None) or (tx is None):
+      # The device was reset. Start over from this exchange.
+      resets = self.resets + 1
+      self.Reset()
+      self.resets = resets
+      rx = self.Unwrap(device_rx)
+      tx = self.Unwrap(device_tx)
+
+    # Time spent on the device doesn't count toward link delay.
+    turnaround = (tx - rx) / self.rate
+    rtt = max(0.0, (host_recv - host_send) - turnaround)
+    sample = Sample(0.5 * (host_send + host_recv), 0.5 * (rx + tx), rtt)
+    self.samples.append(sample)
+
+    self.Fit()
+
+    return sample.device_mid - self.HostToTicks(sample.host_mid)
+
+  # This refits using the fastest round trips in the window.
+  def Fit(self):
+    ranked = sorted(self.samples, key = lambda sample: sample.rtt)
+    count = max(2, int(len(ranked) * self.keep_fraction + 0.5))
+    chosen = ranked[:count]
+
+    self.host_ref = self.samples[0].host_mid
+
+    xvals = [sample.host_mid - self.host_ref for sample in chosen]
+    yvals = [sample.device_mid for sample in chosen]
+    xmean = sum(xvals) / len(xvals)
+    ymean = sum(yvals) / len(yvals)
+    sxx = sum((x - xmean) * (x - xmean) for x in xvals)
+    sxy = sum((x - xmean) * (y - ymean) for x, y in zip(xvals, yvals))
+
+    # With one sample, or samples too close together, assume nominal rate.
+    if (2 > len(chosen)) or (sxx < 1e-6):
+      self.rate = self.nominal_hz
+    else:
+      self.rate = sxy / sxx
+    self.offset = ymean - self.rate * xmean
+
+  # Conversion between host seconds and unwrapped device ticks.
+  def HostToTicks(self, host_time):
+    return self.offset + self.rate * (host_time - self.host_ref)
+
+  def TicksToHost(self, ticks):
+    return self.host_ref + (ticks - self.offset) / self.rate
+
+  # Drift relative to the nominal rate, in parts per million.
+  def DriftPPM(self):
+    return 1e6 * (self.rate - self.nominal_hz) / self.nominal_hz
+
+  # Best round trip in the window, in seconds.
+  def MinRTT(self):
+    return min(sample.rtt for sample in self.samples)
+
+
+# Connection to the device.
+
+class Link:
+  def __init__(self):
+    self.read_fd = None
+    self.write_fd = None
+    self.child = None
+    self.partial = b''
+
+  def OpenSerial(self, port, baud):
+    speed = BAUD_RATES.get(baud)
+    if speed is None:
+      raise ValueError('unsupported baud rate %d' % baud)
+
+    fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+
+    # Raw mode, 8N1, no flow control.
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0
+    attrs[1] = 0
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0
+    attrs[4] = speed
+    attrs[5] = speed
+    attrs[6][termios.VMIN] = 0
+    attrs[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+
+    self.read_fd = fd
+    self.write_fd = fd
+
+  # This runs the command directly rather than through a shell, so that
+  # Close() kills the emulator itself and not just a shell wrapper.
+  def SpawnEmulator(self, command):
+    self.child = subprocess.Popen(shlex.split(command),
+      stdin = subprocess.PIPE, stdout = subprocess.PIPE)
+    self.read_fd = self.child.stdout.fileno()
+    self.write_fd = self.child.stdin.fileno()
+
+  def Close(self):
+    if self.child is not None:
+      self.child.kill()
+      self.child.wait()
+    elif self.read_fd is not None:
+      os.close(self.read_fd)
+    self.read_fd = None
+    self.write_fd = None
+    self.child = None
+
+  def Send(self, text):
+    os.write(self.write_fd, text.encode('ascii'))
+
+  # This returns (line, arrival time), or (None, None) on timeout.
+  def ReadLine(self, timeout):
+    deadline = time.monotonic() + timeout
+    while b'\n' not in self.partial:
+      remaining = deadline - time.monotonic()
+      if 0 >= remaining:
+        return (None, None)
+      ready, _, _ = select.select([self.read_fd], [], [], remaining)
+      if ready:
+        chunk = os.read(self.read_fd, 256)
+        if 0 == len(chunk):
+          return (None, None)
+        self.partial += chunk
+    arrival = time.monotonic()
+    line, self.partial = self.partial.split(b'\n', 1)
+    return (line.decode('ascii', 'replace').strip(), arrival)
+
+  # This discards input until the link is quiet.
+  def Drain(self, quiet):
+    while True:
+      line, _ = self.ReadLine(quiet)
+      if line is None:
+        break
+    self.partial = b''
+
+
+#
+# Functions
+
+
+def main():
+  parser = argparse.ArgumentParser(
+    description = 'Estimate device RTC offset and drift against the host.')
+  parser.add_argument('-p', '--port', help = 'serial port')
+  parser.add_argument('-b', '--baud', type = int, default = 115200,
+    help = 'serial baud rate (default 115200)')
+  parser.add_argument('-e', '--emulator',
+    help = 'run this emulated build instead of opening a port')
+  parser.add_argument('-n', '--count', type = int, default = 60,
+    help = 'number of pings; 0 runs until interrupted (default 60)')
+  parser.add_argument('-i', '--interval', type = float, default = 1.0,
+    help = 'seconds between pings (default 1.0)')
+  parser.add_argument('-r', '--rate', type = float, default = 10000.0,
+    help = 'nominal RTC ticks per second (default 10000)')
+  parser.add_argument('-w', '--window', type = int, default = 64,
+    help = 'pings to fit over (default 64)')
+  parser.add_argument('-t', '--timeout', type = float, default = 1.0,
+    help = 'seconds to wait for each reply (default 1.0)')
+  parser.add_argument('-s', '--settle', type = float, default = None,
+    help = 'seconds to wait after opening (default 2.5 for serial '
+      'ports, since opening one resets an Arduino; 0.5 otherwise)')
+  args = parser.parse_args()
+
+  if (args.port is None) == (args.emulator is None):
+    parser.error('specify exactly one of -p or -e')
+
+  # Turn SIGTERM into an exception, so that cleanup still happens.
+  signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(1))
+
+  link = Link()
+  chartime = 0.0
+  if args.port is not None:
+    link.OpenSerial(args.port, args.baud)
+    chartime = 10.0 / args.baud
+    settle = 2.5 if args.settle is None else args.settle
+  else:
+    link.SpawnEmulator(args.emulator)
+    settle = 0.5 if args.settle is None else args.settle
+
+  # Make sure the emulator doesn't outlive us, whatever happens.
+  try:
+    # Skip the banner and anything else the device had to say.
+    time.sleep(settle)
+    link.Drain(0.2)
+
+    # Host times are monotonic; this maps them to wall-clock time.
+    wall_offset = time.time() - time.monotonic()
+
+    estimator = ClockEstimator(args.rate, args.window)
+    sent = 0
+    answered = 0
+    sequence = 0
+
+    print('%10s %5s %9s %14s %9s %12s %9s' % ('Host(s)', 'Seq',
+      'RTT(ms)', 'Ticks', 'Resid', 'Rate(Hz)', 'Drift'))
+
+    try:
+      while (0 == args.count) or (sent < args.count):
+        command = 'PNG %d\r\n' % sequence
+        host_send = time.monotonic()
+        link.Send(command)
+        sent += 1
+
+        # Wait for the matching reply, ignoring anything else.
+        deadline = host_send + args.timeout
+        reply = None
+        while (reply is None) and (time.monotonic() < deadline):
+          line, arrival = link.ReadLine(deadline - time.monotonic())
+          if line is not None:
+            match = PONG_PATTERN.match(line)
+            if match and (int(match.group(1), 16) == sequence):
+              reply = (int(match.group(2), 16), int(match.group(3), 16),
+                arrival)
+
+        if reply is not None:
+          answered += 1
+          device_rx, device_tx, host_recv = reply
+
+          # The device stamps the ping's last character and the reply's
+          # first one.
+          host_send += (len(command) - 1) * chartime
+          host_recv -= (PONG_CHARS - 1) * chartime
+
+          residual = estimator.AddExchange(host_send, device_rx, device_tx,
+            host_recv)
+          print('%10.3f %5d %9.3f %14d %9.2f %12.4f %+8.1f' % (
+            host_send - estimator.host_ref, sequence,
+            1000.0 * estimator.samples[-1].rtt,
+            estimator.samples[-1].device_mid, residual,
+            estimator.rate, estimator.DriftPPM()))
+        else:
+          print('%10s %5d  (no reply)' % ('', sequence))
+        sys.stdout.flush()
+
+        sequence = (sequence + 1) & 0xffff
+        time.sleep(max(0.0, host_send + args.interval - time.monotonic()))
+    except KeyboardInterrupt:
+      pass
+  finally:
+    link.Close()
+
+  if 0 == answered:
+    print('RESULT no replies (sent %d)' % sent)
+    return 1
+
+  epoch = wall_offset + estimator.TicksToHost(0.0)
+  print('RESULT sent %d answered %d resets %d rtt_min_ms %.3f '
+    'rate_hz %.4f drift_ppm %+.1f epoch %.6f' % (sent, answered,
+    estimator.resets, 1000.0 * estimator.MinRTT(), estimator.rate,
+    estimator.DriftPPM(), epoch))
+
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
+
+
+#
+# This is the end of the file.
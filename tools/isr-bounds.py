@@ -0,0 +1,705 @@
+#!/usr/bin/env python3
+# Attention Circuits Control Laboratory - Atmel AVR firmware
+# Static worst-case ISR cycle and stack-depth analyzer.
+# Written by Christopher Thomas.
+# Copyright (c) 2020 by Vanderbilt University. This work is licensed under
+# the Creative Commons Attribution 4.0 International License.
+
+
+#
+# Notes
+#
+# This reads "avr-objdump -d -C" output for a firmware ELF, builds the
+# control flow graph of each function and the call graph from each ISR
+# vector, and reports upper bounds on cycle count and stack depth.
+#
+# Bounds are conservative:
+# - Conditional branches are charged as taken; skips are charged as
+# skipping the following instruction.
+# - Every loop needs an iteration bound from the annotation file. A loop's
+# cost is (bound) x (longest path through one iteration).
+# - Indirect calls (ICALL/EICALL) need target lists from the annotation
+# file. This covers "rtc_usercallback" and virtual event handler calls.
+# - Stack depth counts every PUSH in a function, plus its frame, plus the
+# deepest call it makes.
+# - Switch tables dispatched through __tablejump2__ are assumed to reach
+# any otherwise-unreachable instruction in the calling function.
+#
+# Anything that can't be bounded is reported as an issue, and the affected
+# result is marked with "?". The exit status is nonzero if there are issues
+# or if a "--budget" is exceeded.
+#
+# Annotation file format (one directive per line, "#" starts a comment):
+#
+#   icall (function) (target) [(target)...]
+#     Every indirect call in (function) may call any listed target.
+#   loop (function) (bound)
+#     Every loop in (function) runs its header at most (bound) times
+#     per entry.
+#   loop (function)@(hex address) (bound)
+#     As above, for the single loop whose header is at that address.
+#   cost (function) (cycles) (stack bytes)
+#     Don't analyze (function); use these numbers instead.
+#
+# Function names are demangled and have their argument lists removed,
+# e.g. "NeurApp_Base::DoUpdate_ISR". ISRs are "__vector_(n)".
+
+
+#
+# Imports
+
+import argparse
+import re
+import subprocess
+import sys
+
+
+#
+# Constants
+
+# Per-MCU timing. PC size is in bytes.
+MCU_INFO = {
+  'atmega328p': { 'pcbytes': 2, 'call': 4, 'rcall': 3, 'icall': 3,
+    'ret': 4, 'irq': 4, 'vecjmp': 3 },
+  'atmega2560': { 'pcbytes': 3, 'call': 5, 'rcall': 4, 'icall': 4,
+    'ret': 5, 'irq': 5, 'vecjmp': 3 },
+}
+
+# Vector names we know about, for labelling output.
+VECTOR_NAMES = {
+  'atmega328p': { 11: 'TIMER1_COMPA (RTC)', 18: 'USART_RX',
+    19: 'USART_UDRE', 21: 'ADC', 24: 'TWI', 17: 'SPI_STC',
+    22: 'EE_READY' },
+  'atmega2560': { 46: 'TIMER5_COMPA (RTC)', 25: 'USART0_RX',
+    26: 'USART0_UDRE', 36: 'USART1_RX', 37: 'USART1_UDRE', 29: 'ADC',
+    39: 'TWI', 24: 'SPI_STC', 30: 'EE_READY' },
+}
+
+# Single-cycle instructions are the default; these are the exceptions.
+# Calls, returns, and skips are handled separately.
+MULTI_CYCLE = {
+  'adiw': 2, 'sbiw': 2, 'mul': 2, 'muls': 2, 'mulsu': 2,
+  'fmul': 2, 'fmuls': 2, 'fmulsu': 2,
+  'rjmp': 2, 'jmp': 3, 'ijmp': 2, 'eijmp': 2,
+  'lds': 2, 'sts': 2, 'ld': 2, 'ldd': 2, 'st': 2, 'std': 2,
+  'push': 2, 'pop': 2, 'sbi': 2, 'cbi': 2,
+  'lpm': 3, 'elpm': 3,
+}
+
+BRANCHES = set([ 'brbs', 'brbc', 'breq', 'brne', 'brcs', 'brcc', 'brsh',
+  'brlo', 'brmi', 'brpl', 'brge', 'brlt', 'brhs', 'brhc', 'brts', 'brtc',
+  'brvs', 'brvc', 'brie', 'brid' ])
+
+SKIPS = set([ 'cpse', 'sbrc', 'sbrs', 'sbic', 'sbis' ])
+
+# Cost of libgcc's __tablejump2__ (jump, table fetch, indirect jump).
+TABLEJUMP_CYCLES = 16
+
+# Frame allocation is only looked for this far into a function.
+PROLOGUE_LENGTH = 24
+
+
+
+#
+# Classes
+
+
+# One disassembled instruction.
+
+class Insn:
+  def __init__(self, addr, size, mnem, ops, target):
+    self.addr = addr
+    self.size = size
+    self.mnem = mnem
+    self.ops = ops
+    self.target = target
+
+
+# One function (the instructions between one symbol and the next).
+
+class Function:
+  def __init__(self, name, start):
+    self.name = name
+    self.start = start
+    self.insns = []
+    self.byaddr = {}
+
+  def end(self):
+    if 0 == len(self.insns):
+      return self.start
+    return self.insns[-1].addr + self.insns[-1].size
+
+
+# Analysis result for one function.
+
+class Result:
+  def __init__(self, cycles, stack, exact, callees):
+    self.cycles = cycles
+    self.stack = stack
+    self.exact = exact
+    self.callees = callees
+
+
+
+#
+# Functions
+
+
+# This strips the argument list from a demangled name.
+
+def NormalizeName(name):
+  name = name.strip()
+  paren = name.find('(')
+  if 0 < paren:
+    name = name[:paren]
+  return name
+
+
+# This parses "avr-objdump -d" output into a list of functions.
+
+def ParseDisassembly(text):
+  functions = []
+  thisfunc = None
+
+  symline = re.compile(r'^([0-9a-f]+) <(.*)>:\s*$')
+  insnline = re.compile(r'^\s*([0-9a-f]+):\t((?:[0-9a-f]{2} )+)\s*\t?(.*)$')
+  targetref = re.compile(r';\s*0x([0-9a-f]+)\s*<')
+
+  for line in text.splitlines():
+    match = symline.match(line)
+    if match:
+      thisfunc = Function(NormalizeName(match.group(2)),
+        int(match.group(1), 16))
+      functions.append(thisfunc)
+      continue
+
+    match = insnline.match(line)
+    if match and (thisfunc is not None):
+      addr = int(match.group(1), 16)
+      size = len(match.group(2).split())
+      rest = match.group(3).split('\t')
+      mnem = rest[0].strip().lower()
+      ops = ''
+      if 1 < len(rest):
+        ops = rest[1].strip()
+      target = None
+      tmatch = targetref.search(match.group(3))
+      if tmatch:
+        target = int(tmatch.group(1), 16)
+      elif mnem in ('jmp', 'call'):
+        # Absolute targets without a symbol comment.
+        try:
+          target = int(ops.split()[0], 16)
+        except (ValueError, IndexError):
+          target = None
+
+      # Skip ".word" and friends; they're data.
+      if (0 < len(mnem)) and ('.' != mnem[0]):
+        insn = Insn(addr, size, mnem, ops, target)
+        thisfunc.insns.append(insn)
+        thisfunc.byaddr[addr] = insn
+
+  return [ func for func in functions if 0 < len(func.insns) ]
+
+
+# This reads the annotation file.
+
+def ParseAnnotations(filename):
+  icalls = {}
+  loops = {}
+  costs = {}
+
+  if filename is None:
+    return icalls, loops, costs
+
+  with open(filename) as infile:
+    for lineno, line in enumerate(infile, 1):
+      line = line.split('#')[0].strip()
+      if 0 == len(line):
+        continue
+      words = line.split()
+
+      try:
+        if ('icall' == words[0]) and (3 <= len(words)):
+          icalls.setdefault(words[1], []).extend(words[2:])
+        elif ('loop' == words[0]) and (3 == len(words)):
+          if '@' in words[1]:
+            fname, addr = words[1].split('@')
+            loops[(fname, int(addr, 16))] = int(words[2], 0)
+          else:
+            loops[(words[1], None)] = int(words[2], 0)
+        elif ('cost' == words[0]) and (4 == len(words)):
+          costs[words[1]] = (int(words[2], 0), int(words[3], 0))
+        else:
+          raise ValueError
+      except ValueError:
+        sys.stderr.write('%s:%d: can\'t parse "%s"\n'
+          % (filename, lineno, line))
+        sys.exit(2)
+
+  return icalls, loops, costs
+
+
+
+# Analyzer state and per-function analysis.
+
+class Analyzer:
+  def __init__(self, functions, mcu, icalls, loops, costs):
+    self.mcu = MCU_INFO[mcu]
+    self.icalls = icalls
+    self.loops = loops
+    self.costs = costs
+    self.issues = []
+    self.results = {}
+    self.inprogress = set()
+
+    self.byname = {}
+    self.bystart = {}
+    for func in functions:
+      self.bystart[func.start] = func
+      if func.name not in self.byname:
+        self.byname[func.name] = func
+
+    # Sorted starts, for mapping addresses to functions.
+    self.starts = sorted(self.bystart.keys())
+
+
+  def Issue(self, text):
+    if text not in self.issues:
+      self.issues.append(text)
+
+
+  def FunctionAt(self, addr):
+    # Only exact entry points count as call targets.
+    return self.bystart.get(addr)
+
+
+  # This returns the cost of one instruction, ignoring any callee.
+
+  def InsnCycles(self, func, insn):
+    mnem = insn.mnem
+    if mnem in BRANCHES:
+      return 2
+    if mnem in SKIPS:
+      nextinsn = func.byaddr.get(insn.addr + insn.size)
+      if (nextinsn is not None) and (4 == nextinsn.size):
+        return 3
+      return 2
+    if mnem in ('call', 'rcall', 'icall', 'eicall', 'ret', 'reti'):
+      if 'eicall' == mnem:
+        return self.mcu['icall']
+      if 'reti' == mnem:
+        return self.mcu['ret']
+      return self.mcu[mnem]
+    if mnem in ('ld', 'ldd') and ('-' in insn.ops):
+      # Pre-decrement loads take an extra cycle.
+      return 3
+    return MULTI_CYCLE.get(mnem, 1)
+
+
+  # This builds the successor lists and call sites for one function.
+  # Returns (succ, calls, exits), where "calls" maps an instruction address
+  # to a list of (callee name, is tail call) and "exits" is the set of
+  # instructions that leave the function.
+
+  def BuildGraph(self, func):
+    succ = {}
+    calls = {}
+    tablejumps = []
+
+    for insn in func.insns:
+      nextaddr = insn.addr + insn.size
+      here = []
+      mnem = insn.mnem
+
+      if mnem in ('ret', 'reti'):
+        pass
+
+      elif mnem in ('jmp', 'rjmp'):
+        if insn.target is None:
+          self.Issue('%s: unresolved jump at 0x%x' % (func.name, insn.addr))
+        elif insn.target in func.byaddr:
+          here.append(insn.target)
+        else:
+          callee = self.FunctionAt(insn.target)
+          if callee is None:
+            self.Issue('%s: jump out of function at 0x%x'
+              % (func.name, insn.addr))
+          elif callee.name.startswith('__tablejump'):
+            tablejumps.append(insn.addr)
+          else:
+            calls[insn.addr] = [ (callee.name, True) ]
+
+      elif mnem in ('ijmp', 'eijmp'):
+        self.Issue('%s: indirect jump at 0x%x' % (func.name, insn.addr))
+
+      elif mnem in BRANCHES:
+        here.append(nextaddr)
+        if insn.target is not None:
+          here.append(insn.target)
+
+      elif mnem in SKIPS:
+        here.append(nextaddr)
+        nextinsn = func.byaddr.get(nextaddr)
+        if nextinsn is not None:
+          here.append(nextaddr + nextinsn.size)
+
+      elif mnem in ('call', 'rcall'):
+        here.append(nextaddr)
+        if insn.target == nextaddr:
+          # "rcall .+0" is a stack allocation, not a call.
+          pass
+        elif insn.target is None:
+          self.Issue('%s: unresolved call at 0x%x' % (func.name, insn.addr))
+        else:
+          callee = self.FunctionAt(insn.target)
+          if callee is None:
+            self.Issue('%s: call into the middle of something at 0x%x'
+              % (func.name, insn.addr))
+          elif callee.name.startswith('__tablejump'):
+            tablejumps.append(insn.addr)
+          else:
+            calls[insn.addr] = [ (callee.name, False) ]
+
+      elif mnem in ('icall', 'eicall'):
+        here.append(nextaddr)
+        if func.name in self.icalls:
+          calls[insn.addr] = \
+            [ (name, False) for name in self.icalls[func.name] ]
+        else:
+          self.Issue('%s: unannotated indirect call at 0x%x'
+            % (func.name, insn.addr))
+
+      else:
+        here.append(nextaddr)
+
+      # Falling off the end of the function ends the path.
+      succ[insn.addr] = [ addr for addr in here if addr in func.byaddr ]
+
+    # Switch tables: assume any instruction nothing else reaches is a case.
+    if 0 < len(tablejumps):
+      reached = set([ func.start ])
+      for addr in succ:
+        reached.update(succ[addr])
+      orphans = [ insn.addr for insn in func.insns
+        if insn.addr not in reached ]
+      for addr in tablejumps:
+        succ[addr] = orphans
+
+    return succ, calls, tablejumps
+
+
+  # This returns the stack used by a function's own frame.
+
+  def OwnStack(self, func):
+    total = 0
+    sawframe = False
+
+    for idx, insn in enumerate(func.insns):
+      if 'push' == insn.mnem:
+        total += 1
+      elif ('rcall' == insn.mnem) and (insn.target == insn.addr + insn.size):
+        total += self.mcu['pcbytes']
+      elif (not sawframe) and (PROLOGUE_LENGTH > idx) \
+        and (insn.mnem in ('sbiw', 'subi')) and insn.ops.startswith('r28,'):
+        # Frame allocation: "sbiw r28, N", or "subi r28, lo8(N)" followed
+        # by "sbci r29, hi8(N)".
+        sawframe = True
+        try:
+          total += int(insn.ops.split(',')[1].strip(), 0)
+          if (idx + 1 < len(func.insns)) \
+            and ('sbci' == func.insns[idx + 1].mnem) \
+            and func.insns[idx + 1].ops.startswith('r29,'):
+            total += \
+              int(func.insns[idx + 1].ops.split(',')[1].strip(), 0) << 8
+        except ValueError:
+          self.Issue('%s: can\'t parse frame size at 0x%x'
+            % (func.name, insn.addr))
+
+    return total
+
+
+  # This returns a loop bound, or None if there isn't one.
+
+  def LoopBound(self, func, header):
+    bound = self.loops.get((func.name, header))
+    if bound is None:
+      bound = self.loops.get((func.name, None))
+    return bound
+
+
+  # This analyzes one function (and, recursively, everything it calls).
+
+  def Analyze(self, name):
+    if name in self.results:
+      return self.results[name]
+
+    if name in self.costs:
+      cycles, stack = self.costs[name]
+      result = Result(cycles, stack, True, [])
+      self.results[name] = result
+      return result
+
+    func = self.byname.get(name)
+    if func is None:
+      self.Issue('%s: no such function' % name)
+      result = Result(0, 0, False, [])
+      self.results[name] = result
+      return result
+
+    if name in self.inprogress:
+      self.Issue('%s: recursion (add a "cost" annotation)' % name)
+      return Result(0, 0, False, [])
+
+    self.inprogress.add(name)
+    issuecount = len(self.issues)
+
+    succ, calls, tablejumps = self.BuildGraph(func)
+
+    # Per-instruction cost, including callees.
+    cost = {}
+    callstack = 0
+    callees = []
+    exact = True
+
+    for insn in func.insns:
+      thiscost = self.InsnCycles(func, insn)
+      if insn.addr in tablejumps:
+        thiscost = TABLEJUMP_CYCLES
+
+      if insn.addr in calls:
+        worst = 0
+        for calleename, istail in calls[insn.addr]:
+          calleeresult = self.Analyze(calleename)
+          exact = exact and calleeresult.exact
+          worst = max(worst, calleeresult.cycles)
+          if istail:
+            callstack = max(callstack, calleeresult.stack)
+          else:
+            callstack = max(callstack,
+              self.mcu['pcbytes'] + calleeresult.stack)
+          if calleename not in callees:
+            callees.append(calleename)
+        thiscost += worst
+
+      cost[insn.addr] = thiscost
+
+    cycles, ok = self.LongestPath(func, succ, cost)
+    exact = exact and ok and (len(self.issues) == issuecount)
+
+    result = Result(cycles, self.OwnStack(func) + callstack, exact, callees)
+
+    self.inprogress.discard(name)
+    self.results[name] = result
+    return result
+
+
+  # This computes the longest path through a function, collapsing loops
+  # innermost-first. Returns (cycles, True if fully bounded).
+
+  def LongestPath(self, func, succ, cost):
+    ok = True
+
+    # Find loops from back edges. A loop is the address range from its
+    # header to its last back edge.
+    loopends = {}
+    for addr in succ:
+      for dest in succ[addr]:
+        if dest <= addr:
+          loopends[dest] = max(loopends.get(dest, dest), addr)
+
+    ranges = sorted(loopends.items(), key = lambda item: item[1] - item[0])
+
+    # Representative node for each instruction, and node graph.
+    rep = dict([ (addr, addr) for addr in succ ])
+    nodecost = dict(cost)
+    nodesucc = dict([ (addr, set(succ[addr])) for addr in succ ])
+
+    def Find(addr):
+      while rep[addr] != addr:
+        addr = rep[addr]
+      return addr
+
+    for header, lastaddr in ranges:
+      header = Find(header)
+      members = set([ Find(addr) for addr in succ
+        if (header <= addr) and (addr <= lastaddr) ])
+      members.add(header)
+
+      # Longest single iteration, starting from the header.
+      memo = {}
+      def IterPath(node):
+        if node in memo:
+          return memo[node]
+        memo[node] = 0
+        best = 0
+        for dest in nodesucc[node]:
+          dest = Find(dest)
+          if (dest in members) and (dest != header) and (dest > node):
+            best = max(best, IterPath(dest))
+        memo[node] = nodecost[node] + best
+        return memo[node]
+
+      sys.setrecursionlimit(max(sys.getrecursionlimit(),
+        10 * len(succ) + 1000))
+      itercost = IterPath(header)
+
+      bound = self.LoopBound(func, header)
+      if bound is None:
+        self.Issue('%s: no bound for loop at 0x%x' % (func.name, header))
+        ok = False
+        bound = 1
+
+      # Collapse the loop into its header.
+      exits = set()
+      for node in members:
+        for dest in nodesucc[node]:
+          dest = Find(dest)
+          if dest not in members:
+            exits.add(dest)
+      for node in members:
+        if node != header:
+          rep[node] = header
+          del nodecost[node]
+          del nodesucc[node]
+      nodecost[header] = itercost * bound
+      nodesucc[header] = exits
+
+    # Longest path over what's left, which should be acyclic.
+    memo = {}
+    active = set()
+    def PathFrom(node):
+      if node in memo:
+        return memo[node]
+      if node in active:
+        self.Issue('%s: irreducible control flow near 0x%x'
+          % (func.name, node))
+        return 0
+      active.add(node)
+      best = 0
+      for dest in nodesucc[node]:
+        best = max(best, PathFrom(Find(dest)))
+      active.discard(node)
+      memo[node] = nodecost[node] + best
+      return memo[node]
+
+    sys.setrecursionlimit(max(sys.getrecursionlimit(), 10 * len(succ) + 1000))
+    return PathFrom(Find(func.start)), ok
+
+
+  # This prints a call tree with per-function bounds.
+
+  def PrintTree(self, name, depth, seen):
+    result = self.results.get(name)
+    if result is None:
+      return
+    flag = '' if result.exact else '?'
+    print('%s%-*s %8d%-1s %6d' % ('  ' * depth, 50 - 2 * depth, name,
+      result.cycles, flag, result.stack))
+    if name in seen:
+      return
+    seen = seen | set([ name ])
+    for callee in result.callees:
+      self.PrintTree(callee, depth + 1, seen)
+
+
+
+#
+# Main Program
+
+def main():
+  parser = argparse.ArgumentParser(
+    description = 'Worst-case ISR cycle and stack bounds from disassembly.')
+  parser.add_argument('input',
+    help = 'firmware ELF (or disassembly text with --asm)')
+  parser.add_argument('--asm', action = 'store_true',
+    help = 'input is "avr-objdump -d -C" output, not an ELF')
+  parser.add_argument('--mcu', default = 'atmega328p',
+    choices = sorted(MCU_INFO.keys()))
+  parser.add_argument('--objdump', default = 'avr-objdump')
+  parser.add_argument('--annotations', '-a',
+    help = 'annotation file (indirect call targets, loop bounds, costs)')
+  parser.add_argument('--root', action = 'append', default = [],
+    help = 'extra function to analyze (may be repeated)')
+  parser.add_argument('--budget', action = 'append', default = [],
+    help = 'fail if (function)=(cycles) is exceeded (may be repeated)')
+  parser.add_argument('--tree', action = 'store_true',
+    help = 'print the call tree under each root')
+  args = parser.parse_args()
+
+  if args.asm:
+    with open(args.input) as infile:
+      text = infile.read()
+  else:
+    text = subprocess.run([ args.objdump, '-d', '-C', args.input ],
+      stdout = subprocess.PIPE, check = True,
+      universal_newlines = True).stdout
+
+  functions = ParseDisassembly(text)
+  icalls, loops, costs = ParseAnnotations(args.annotations)
+  analyzer = Analyzer(functions, args.mcu, icalls, loops, costs)
+  mcu = MCU_INFO[args.mcu]
+
+  # Roots are every defined ISR plus anything requested.
+  vecpattern = re.compile(r'^__vector_(\d+)$')
+  roots = []
+  for func in functions:
+    match = vecpattern.match(func.name)
+    if match:
+      roots.append((func.name, int(match.group(1))))
+  roots.sort(key = lambda item: item[1])
+  for name in args.root:
+    roots.append((name, None))
+
+  budgets = {}
+  for item in args.budget:
+    name, cycles = item.rsplit('=', 1)
+    budgets[name] = int(cycles, 0)
+
+  print('%-40s %10s %8s' % ('Root', 'Cycles', 'Stack'))
+
+  failed = False
+  isrstack = 0
+  for name, vector in roots:
+    result = analyzer.Analyze(name)
+    cycles = result.cycles
+    stack = result.stack
+    label = name
+    if vector is not None:
+      # Include interrupt response and the vector table jump.
+      cycles += mcu['irq'] + mcu['vecjmp']
+      stack += mcu['pcbytes']
+      isrstack += stack
+      label = ('%s %s' % (name,
+        VECTOR_NAMES[args.mcu].get(vector, ''))).strip()
+    flag = '' if result.exact else '?'
+    print('%-40s %9d%-1s %8d' % (label, cycles, flag, stack))
+
+    if (name in budgets) and (cycles > budgets[name]):
+      print('  ** over budget (%d cycles)' % budgets[name])
+      failed = True
+
+  print('%-40s %10s %8d' % ('(all ISRs nested, once each)', '', isrstack))
+
+  if args.tree:
+    for name, vector in roots:
+      print('')
+      print('%-50s %9s %6s' % ('Call tree', 'Cycles', 'Stack'))
+      analyzer.PrintTree(name, 0, set())
+
+  if 0 < len(analyzer.issues):
+    print('')
+    print('Issues (results marked "?" are not upper bounds):')
+    for issue in analyzer.issues:
+      print('  ' + issue)
+    failed = True
+
+  return 1 if failed else 0
+
+
+if __name__ == '__main__':
+  sys.exit(main())
+
+
+#
+# This is the end of the file.